@@ -0,0 +1,399 @@
+/* Allocation accounting.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --enable-alloc-stats, the allocation macros of alloc-stats.h
+   route every xmalloc, xcalloc, xrealloc, xstrdup and xfree through
+   the functions below, which keep the live bytes, live blocks, peak
+   and number of allocations of each category.  The category of a
+   block is the file it was allocated from, or the name of the scope
+   it was allocated in; hash tables pass theirs on to their storage.
+   The report is printed at exit and whenever SIGUSR1 is received.
+
+   The blocks stay in malloc's own format, so that memory allocated
+   by the C library or by gnulib may still be passed to xfree, and the
+   other way around.  The size and category of each block are kept in
+   a table keyed by its address instead, as the DEBUG_MALLOC code of
+   older Wget releases did; blocks missing from it are simply freed
+   unaccounted.  */
+
+#include "wget.h"
+
+#ifdef ENABLE_ALLOC_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "hash.h"
+
+/* Call the real allocators of gnulib's xalloc module.  */
+#undef xmalloc
+#undef xcalloc
+#undef xrealloc
+#undef xstrdup
+#undef xfree
+
+struct category {
+  const char *name;
+  wgint live_bytes;             /* bytes currently allocated */
+  wgint live_blocks;            /* blocks currently allocated */
+  wgint peak_bytes;             /* the high-water mark of live_bytes */
+  wgint allocations;            /* blocks allocated over the run */
+};
+
+/* Categories past the last one are accounted to the first,
+   "other".  */
+#define MAX_CATEGORIES 128
+
+static struct category categories[MAX_CATEGORIES] = { { "other" } };
+static int category_count = 1;
+static struct category total = { "total" };
+
+/* The block table, an open-addressed hash table with linear probing
+   whose size is a power of two.  An empty cell has a NULL PTR.  */
+
+struct block {
+  const void *ptr;
+  size_t size;
+  int category;
+};
+
+static struct block *blocks;
+static size_t block_table_size;
+static size_t block_count;
+
+/* The scope entered with alloc_stats_enter, if any.  */
+static const char *current_scope;
+
+volatile sig_atomic_t alloc_stats_report_requested;
+
+/* Return the index of the category called NAME, adding it if it is
+   new.  File names are stripped of their directory.  */
+
+static int
+category_index (const char *name)
+{
+  static const char *last_name;
+  static int last_index;
+  const char *base;
+  int i;
+
+  if (name == last_name)
+    return last_index;
+
+  base = strrchr (name, '/');
+  base = base ? base + 1 : name;
+  for (i = 0; i < category_count; i++)
+    if (categories[i].name == base || 0 == strcmp (categories[i].name, base))
+      break;
+  if (i == category_count)
+    {
+      if (category_count == MAX_CATEGORIES)
+        i = 0;
+      else
+        categories[category_count++].name = base;
+    }
+  last_name = name;
+  last_index = i;
+  return i;
+}
+
+static void
+category_add (int i, size_t size)
+{
+  struct category *c = &categories[i];
+  c->live_bytes += size;
+  c->live_blocks++;
+  c->allocations++;
+  if (c->live_bytes > c->peak_bytes)
+    c->peak_bytes = c->live_bytes;
+  total.live_bytes += size;
+  total.live_blocks++;
+  total.allocations++;
+  if (total.live_bytes > total.peak_bytes)
+    total.peak_bytes = total.live_bytes;
+}
+
+static void
+category_remove (int i, size_t size)
+{
+  struct category *c = &categories[i];
+  c->live_bytes -= size;
+  c->live_blocks--;
+  total.live_bytes -= size;
+  total.live_blocks--;
+}
+
+#define BLOCK_POSITION(ptr, size) (hash_pointer (ptr) & ((size) - 1))
+
+/* Return the cell of PTR, or the empty cell where it belongs.  */
+
+static struct block *
+find_block (const void *ptr)
+{
+  size_t i = BLOCK_POSITION (ptr, block_table_size);
+  while (blocks[i].ptr && blocks[i].ptr != ptr)
+    i = (i + 1) & (block_table_size - 1);
+  return &blocks[i];
+}
+
+/* Double the block table, or create it.  The table is allocated with
+   calloc directly, and is not accounted itself.  */
+
+static void
+grow_block_table (void)
+{
+  struct block *old_blocks = blocks;
+  size_t old_size = block_table_size, i;
+
+  block_table_size = old_size ? old_size * 2 : 1024;
+  blocks = calloc (block_table_size, sizeof (struct block));
+  if (!blocks)
+    xalloc_die ();
+  for (i = 0; i < old_size; i++)
+    if (old_blocks[i].ptr)
+      *find_block (old_blocks[i].ptr) = old_blocks[i];
+  free (old_blocks);
+}
+
+/* Record that PTR of SIZE bytes was allocated for category I.  */
+
+static void
+add_block (const void *ptr, size_t size, int i)
+{
+  struct block *b;
+
+  if (!ptr)
+    return;
+  if (block_count + 1 > block_table_size / 4 * 3)
+    grow_block_table ();
+  b = find_block (ptr);
+  if (b->ptr)
+    /* The block was freed behind our back, by free or by a library,
+       and malloc handed out the same address again.  */
+    category_remove (b->category, b->size);
+  else
+    ++block_count;
+  b->ptr = ptr;
+  b->size = size;
+  b->category = i;
+  category_add (i, size);
+}
+
+/* Forget PTR.  Returns the category it was accounted to, or -1 if it
+   was unknown.  */
+
+static int
+remove_block (const void *ptr)
+{
+  struct block *b;
+  size_t i, j, mask;
+  int category;
+
+  if (!ptr || !blocks)
+    return -1;
+  b = find_block (ptr);
+  if (!b->ptr)
+    return -1;
+  category = b->category;
+  category_remove (category, b->size);
+  --block_count;
+
+  /* Empty the cell and move back the blocks that follow it in the
+     same run, so that none of them is separated from the position it
+     hashes to by an empty cell.  */
+  mask = block_table_size - 1;
+  i = b - blocks;
+  blocks[i].ptr = NULL;
+  for (j = (i + 1) & mask; blocks[j].ptr; j = (j + 1) & mask)
+    {
+      size_t k = BLOCK_POSITION (blocks[j].ptr, block_table_size);
+      if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+      blocks[i] = blocks[j];
+      blocks[j].ptr = NULL;
+      i = j;
+    }
+  return category;
+}
+
+/* Return the category of an allocation made from FILE: the current
+   scope if there is one, otherwise FILE itself.  */
+
+const char *
+alloc_stats_category (const char *file)
+{
+  return current_scope ? current_scope : file;
+}
+
+void *
+alloc_stats_malloc (size_t size, const char *file)
+{
+  void *ptr = xmalloc (size);
+  add_block (ptr, size, category_index (alloc_stats_category (file)));
+  return ptr;
+}
+
+void *
+alloc_stats_calloc (size_t n, size_t size, const char *file)
+{
+  void *ptr = xcalloc (n, size);
+  add_block (ptr, n * size, category_index (alloc_stats_category (file)));
+  return ptr;
+}
+
+/* A block keeps its category when it is reallocated.  */
+
+void *
+alloc_stats_realloc (void *ptr, size_t size, const char *file)
+{
+  int category = remove_block (ptr);
+  void *newptr = xrealloc (ptr, size);
+  if (category < 0)
+    category = category_index (alloc_stats_category (file));
+  add_block (newptr, size, category);
+  return newptr;
+}
+
+char *
+alloc_stats_strdup (const char *s, const char *file)
+{
+  char *copy = xstrdup (s);
+  add_block (copy, strlen (copy) + 1,
+             category_index (alloc_stats_category (file)));
+  return copy;
+}
+
+void
+alloc_stats_free (void *ptr)
+{
+  remove_block (ptr);
+  free (ptr);
+}
+
+/* Account the block PTR, if known, to CATEGORY from now on.  */
+
+void
+alloc_stats_retag (const void *ptr, const char *category)
+{
+  struct block *b;
+  int i;
+
+  if (!ptr || !blocks)
+    return;
+  b = find_block (ptr);
+  if (!b->ptr)
+    return;
+  i = category_index (category);
+  if (i == b->category)
+    return;
+  category_remove (b->category, b->size);
+  categories[b->category].allocations--;
+  total.allocations--;
+  b->category = i;
+  category_add (i, b->size);
+}
+
+/* Account the allocations made until the matching alloc_stats_leave
+   to CATEGORY, whichever file they are made from.  Returns the scope
+   to be passed to alloc_stats_leave.  */
+
+const char *
+alloc_stats_enter (const char *category)
+{
+  const char *previous = current_scope;
+  current_scope = category;
+  return previous;
+}
+
+void
+alloc_stats_leave (const char *previous)
+{
+  current_scope = previous;
+}
+
+/* Ask for the report to be printed at a convenient time.  This may be
+   called from a signal handler.  */
+
+void
+alloc_stats_request_report (void)
+{
+  alloc_stats_report_requested = 1;
+}
+
+static int
+cmp_live_bytes (const void *p1, const void *p2)
+{
+  const struct category *c1 = p1, *c2 = p2;
+  if (c1->live_bytes != c2->live_bytes)
+    return c1->live_bytes > c2->live_bytes ? -1 : 1;
+  if (c1->peak_bytes != c2->peak_bytes)
+    return c1->peak_bytes > c2->peak_bytes ? -1 : 1;
+  return 0;
+}
+
+static void
+print_category (const struct category *c)
+{
+  char live[24], nblocks[24], peak[24], count[24];
+  number_to_string (live, c->live_bytes);
+  number_to_string (nblocks, c->live_blocks);
+  number_to_string (peak, c->peak_bytes);
+  number_to_string (count, c->allocations);
+  logprintf (LOG_ALWAYS, "  %-20s %14s %10s %14s %12s\n",
+             c->name, live, nblocks, peak, count);
+}
+
+/* Print the accounting of each category, largest first.  */
+
+void
+alloc_stats_report (void)
+{
+  /* Logging allocates, so work on a copy.  */
+  struct category snapshot[MAX_CATEGORIES], snapshot_total;
+  int count = 0, i;
+
+  alloc_stats_report_requested = 0;
+  for (i = 0; i < category_count; i++)
+    if (categories[i].allocations)
+      snapshot[count++] = categories[i];
+  snapshot_total = total;
+  qsort (snapshot, count, sizeof (snapshot[0]), cmp_live_bytes);
+
+  logputs (LOG_ALWAYS, _("Memory allocated by category:\n"));
+  logprintf (LOG_ALWAYS, "  %-20s %14s %10s %14s %12s\n",
+             _("category"), _("live bytes"), _("blocks"),
+             _("peak bytes"), _("allocations"));
+  for (i = 0; i < count; i++)
+    print_category (&snapshot[i]);
+  print_category (&snapshot_total);
+}
+
+#endif /* ENABLE_ALLOC_STATS */
@@ -0,0 +1,82 @@
+/* Declarations for alloc-stats.c.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+/* When Wget is configured with --enable-alloc-stats, the allocation
+   functions are redirected to the wrappers below, which account every
+   block to a category: the source file that allocated it, unless the
+   allocation happens within a named scope.  Otherwise all of this
+   compiles to nothing.  */
+
+#ifdef ENABLE_ALLOC_STATS
+
+# include <signal.h>
+
+void *alloc_stats_malloc (size_t, const char *);
+void *alloc_stats_calloc (size_t, size_t, const char *);
+void *alloc_stats_realloc (void *, size_t, const char *);
+char *alloc_stats_strdup (const char *, const char *);
+void alloc_stats_free (void *);
+
+const char *alloc_stats_category (const char *);
+void alloc_stats_retag (const void *, const char *);
+const char *alloc_stats_enter (const char *);
+void alloc_stats_leave (const char *);
+
+void alloc_stats_request_report (void);
+void alloc_stats_report (void);
+
+extern volatile sig_atomic_t alloc_stats_report_requested;
+
+# define xmalloc(size) alloc_stats_malloc (size, __FILE__)
+# define xcalloc(n, size) alloc_stats_calloc (n, size, __FILE__)
+# define xrealloc(ptr, size) alloc_stats_realloc (ptr, size, __FILE__)
+# define xstrdup(s) alloc_stats_strdup (s, __FILE__)
+# define xfree(ptr) alloc_stats_free (ptr)
+
+/* Print the report if a signal handler asked for it.  */
+# define alloc_stats_check_report() do {        \
+  if (alloc_stats_report_requested)             \
+    alloc_stats_report ();                      \
+} while (0)
+
+#else  /* not ENABLE_ALLOC_STATS */
+
+# define alloc_stats_retag(ptr, category) ((void) 0)
+# define alloc_stats_enter(category) NULL
+# define alloc_stats_leave(previous) ((void) (previous))
+# define alloc_stats_request_report() ((void) 0)
+# define alloc_stats_report() ((void) 0)
+# define alloc_stats_check_report() ((void) 0)
+
+#endif /* not ENABLE_ALLOC_STATS */
+
+#endif /* ALLOC_STATS_H */
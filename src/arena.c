@@ -0,0 +1,185 @@
+/* Memory arenas.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* An arena hands out memory from large blocks and releases all of it
+   at once.  The links found in a document, along with their parsed
+   URLs, are allocated in an arena owned by the list of links, which
+   spares a malloc and a free for each of the many small strings of
+   each link.  Nothing allocated in an arena may be freed on its own
+   or outlive the arena; whatever has to be kept is copied out.  */
+
+#include "wget.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "arena.h"
+
+/* The size of the first block, and the size the blocks grow to.
+   Larger allocations get a block of their own.  */
+#define FIRST_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE (64 * 1024)
+
+/* Every allocation is aligned for the most demanding of these.  */
+union arena_align {
+  void *p;
+  double d;
+  wgint w;
+  long l;
+};
+
+#define ALIGN_UP(n) \
+  (((n) + sizeof (union arena_align) - 1) & ~(sizeof (union arena_align) - 1))
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;                  /* usable size of the block */
+  size_t used;                  /* how much of it is handed out */
+  union arena_align data[1];    /* the memory, SIZE bytes long */
+};
+
+struct arena {
+  struct arena_block *blocks;   /* the block being allocated from
+                                   first, then the older ones */
+  size_t next_size;             /* the size of the next block */
+};
+
+struct arena *
+arena_new (void)
+{
+  struct arena *arena = xnew0 (struct arena);
+  arena->next_size = FIRST_BLOCK_SIZE;
+  return arena;
+}
+
+static struct arena_block *
+new_block (size_t size)
+{
+  struct arena_block *block =
+    xmalloc (offsetof (struct arena_block, data) + size);
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/* Return SIZE bytes of uninitialized memory from ARENA.  */
+
+void *
+arena_alloc (struct arena *arena, size_t size)
+{
+  struct arena_block *block = arena->blocks;
+  void *result;
+
+  size = ALIGN_UP (size ? size : 1);
+  if (!block || block->size - block->used < size)
+    {
+      if (size > arena->next_size / 4)
+        {
+          /* Give a large allocation a block of its own, behind the
+             current one, which may still have room for more.  */
+          block = new_block (size);
+          if (arena->blocks)
+            {
+              block->next = arena->blocks->next;
+              arena->blocks->next = block;
+            }
+          else
+            {
+              block->next = NULL;
+              arena->blocks = block;
+            }
+          block->used = size;
+          return block->data;
+        }
+      block = new_block (arena->next_size);
+      block->next = arena->blocks;
+      arena->blocks = block;
+      if (arena->next_size < MAX_BLOCK_SIZE)
+        arena->next_size *= 2;
+    }
+  result = (char *) block->data + block->used;
+  block->used += size;
+  return result;
+}
+
+/* Like arena_alloc, but clear the memory.  */
+
+void *
+arena_alloc0 (struct arena *arena, size_t size)
+{
+  void *result = arena_alloc (arena, size);
+  memset (result, 0, size);
+  return result;
+}
+
+char *
+arena_strdup (struct arena *arena, const char *s)
+{
+  return arena_strdupdelim (arena, s, s + strlen (s));
+}
+
+/* Copy the string in [BEG, END) to ARENA and zero-terminate it, like
+   strdupdelim does.  */
+
+char *
+arena_strdupdelim (struct arena *arena, const char *beg, const char *end)
+{
+  char *result = arena_alloc (arena, end - beg + 1);
+  memcpy (result, beg, end - beg);
+  result[end - beg] = '\0';
+  return result;
+}
+
+/* Move the malloc'ed string S to ARENA, freeing S.  This is for the
+   strings that come from functions unaware of arenas.  */
+
+char *
+arena_adopt (struct arena *arena, char *s)
+{
+  char *result = arena_strdup (arena, s);
+  xfree (s);
+  return result;
+}
+
+/* Release ARENA along with everything allocated in it.  */
+
+void
+arena_free (struct arena *arena)
+{
+  struct arena_block *block = arena->blocks;
+  while (block)
+    {
+      struct arena_block *next = block->next;
+      xfree (block);
+      block = next;
+    }
+  xfree (arena);
+}
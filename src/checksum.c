@@ -0,0 +1,382 @@
+/* Verification of downloaded files against published checksums.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "url.h"
+#include "checksum.h"
+
+#ifndef MIN
+# define MIN(x, y) ((x) > (y) ? (y) : (x))
+#endif
+
+/* Checksums read with --checksum-file, keyed by the URL or file name
+   they were listed under.  */
+static struct hash_table *checksum_table;
+
+/* The checksum given with --checksum.  */
+static struct checksum checksum_option;
+
+static const struct {
+  const char *name;
+  enum checksum_type type;
+  int size;
+} checksum_types[] = {
+  { "md5", checksum_md5, MD5_DIGEST_SIZE },
+  { "sha1", checksum_sha1, SHA1_DIGEST_SIZE },
+  { "sha256", checksum_sha256, SHA256_DIGEST_SIZE },
+};
+
+/* Parse SIZE bytes of hex digits at HEX into CS->expected.  The type
+   of CS is deduced from the number of digits, unless NAME is non-NULL,
+   in which case it must name a type with the matching digest size.  */
+
+static bool
+parse_digest (struct checksum *cs, const char *name, size_t namelen,
+              const char *hex, size_t size)
+{
+  int i;
+
+  for (i = 0; i < countof (checksum_types); i++)
+    if (size == 2 * checksum_types[i].size
+        && (!name || (namelen == strlen (checksum_types[i].name)
+                      && !strncasecmp (name, checksum_types[i].name,
+                                       namelen))))
+      break;
+  if (i == countof (checksum_types))
+    return false;
+  cs->type = checksum_types[i].type;
+  for (i = 0; i < size; i += 2)
+    {
+      if (!c_isxdigit (hex[i]) || !c_isxdigit (hex[i + 1]))
+        return false;
+      cs->expected[i / 2] = X2DIGITS_TO_NUM (hex[i], hex[i + 1]);
+    }
+  cs->length = -1;
+  return true;
+}
+
+/* Parse SPEC, in the form "ALGO:HEX", into CS.  */
+
+static bool
+parse_spec (const char *spec, struct checksum *cs)
+{
+  const char *colon = strchr (spec, ':');
+  if (!colon)
+    return false;
+  return parse_digest (cs, spec, colon - spec, colon + 1, strlen (colon + 1));
+}
+
+/* Parse the hex digest HEX of type NAME into CS, which is left ready
+   to be passed to checksum_prepare.  NAME is "md5", "sha1" or
+   "sha256"; the dashed spellings used by Metalink ("sha-1", "sha-256")
+   are accepted as well.  Returns false if the type is unknown or the
+   digest is malformed.  */
+
+bool
+checksum_parse (struct checksum *cs, const char *name, const char *hex)
+{
+  char *plain = xstrdup (name);
+  char *p, *q;
+  bool ok;
+
+  for (p = q = plain; *p; p++)
+    if (*p != '-')
+      *q++ = *p;
+  *q = '\0';
+  ok = parse_digest (cs, plain, strlen (plain), hex, strlen (hex));
+  xfree (plain);
+  return ok;
+}
+
+/* Return true if SPEC is a valid argument to --checksum.  */
+
+bool
+checksum_spec_valid_p (const char *spec)
+{
+  struct checksum cs;
+  return parse_spec (spec, &cs);
+}
+
+/* Parse one line of a checksum file, in the format written by the
+   md5sum/sha1sum/sha256sum utilities ("HEX  NAME" or "HEX *NAME"), or
+   in the BSD format ("ALGO (NAME) = HEX").  The line, starting at B
+   and ending before E, must not contain the line terminator.  */
+
+static bool
+parse_checksum_line (const char *b, const char *e, char **name,
+                     struct checksum *cs)
+{
+  const char *p;
+
+  /* BSD format.  */
+  p = memchr (b, '(', e - b);
+  if (p && p > b && p[-1] == ' ')
+    {
+      const char *algo_end = p - 1;
+      const char *name_b = p + 1;
+      const char *hex;
+      for (hex = e; hex > name_b && c_isxdigit (hex[-1]); hex--)
+        ;
+      if (hex - name_b >= 4 && !memcmp (hex - 4, ") = ", 4)
+          && parse_digest (cs, b, algo_end - b, hex, e - hex))
+        {
+          *name = strdupdelim (name_b, hex - 4);
+          return true;
+        }
+    }
+  /* GNU format.  */
+  for (p = b; p < e && c_isxdigit (*p); p++)
+    ;
+  if (e - p < 3 || p[0] != ' ' || (p[1] != ' ' && p[1] != '*'))
+    return false;
+  if (!parse_digest (cs, NULL, 0, b, p - b))
+    return false;
+  *name = strdupdelim (p + 2, e);
+  return true;
+}
+
+/* Read the checksums listed in FILE, to be used for verifying the
+   files downloaded.  Returns false if the file cannot be read or is
+   not a valid checksum file.  */
+
+bool
+checksum_read_file (const char *file)
+{
+  struct file_memory *fm = wget_read_file (file);
+  const char *p, *end;
+  int line = 0;
+  bool ok = true;
+
+  if (!fm)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return false;
+    }
+  if (!checksum_table)
+    checksum_table = make_string_hash_table (0);
+
+  for (p = fm->content, end = fm->content + fm->length; p < end; )
+    {
+      const char *b = p, *e;
+      char *name;
+      struct checksum cs;
+
+      e = memchr (p, '\n', end - p);
+      if (!e)
+        e = end;
+      p = e < end ? e + 1 : end;
+      ++line;
+      if (e > b && e[-1] == '\r')
+        --e;
+      if (e == b || *b == '#')
+        continue;
+
+      if (!parse_checksum_line (b, e, &name, &cs))
+        {
+          logprintf (LOG_NOTQUIET, _("%s:%d: Invalid checksum line.\n"),
+                     file, line);
+          ok = false;
+          break;
+        }
+      if (hash_table_contains (checksum_table, name))
+        xfree (name);
+      else
+        {
+          struct checksum *entry = xnew (struct checksum);
+          *entry = cs;
+          hash_table_put (checksum_table, name, entry);
+        }
+    }
+  wget_read_file_free (fm);
+  return ok;
+}
+
+/* Return the expected checksum of the file retrieved from U and
+   saved to LOCAL_FILE, or NULL if there is none.  A checksum given
+   with --checksum applies to every file; otherwise the checksum file
+   is searched for the URL, the local file name, and the last
+   component of either.
+
+   The returned object is owned by this module; it is reset by each
+   call.  */
+
+struct checksum *
+checksum_lookup (const struct url *u, const char *local_file)
+{
+  struct checksum *cs = NULL;
+
+  if (opt.checksum)
+    {
+      if (!parse_spec (opt.checksum, &checksum_option))
+        return NULL;
+      cs = &checksum_option;
+    }
+  else if (checksum_table)
+    {
+      cs = hash_table_get (checksum_table, u->url);
+      if (!cs && local_file)
+        {
+          const char *base = strrchr (local_file, '/');
+          cs = hash_table_get (checksum_table, local_file);
+          if (!cs && base)
+            cs = hash_table_get (checksum_table, base + 1);
+        }
+      if (!cs && *u->file)
+        cs = hash_table_get (checksum_table, u->file);
+    }
+  if (cs)
+    cs->length = -1;
+  return cs;
+}
+
+static void
+checksum_start (struct checksum *cs)
+{
+  switch (cs->type)
+    {
+    case checksum_md5:
+      md5_init_ctx (&cs->ctx.md5);
+      break;
+    case checksum_sha1:
+      sha1_init_ctx (&cs->ctx.sha1);
+      break;
+    case checksum_sha256:
+      sha256_init_ctx (&cs->ctx.sha256);
+      break;
+    }
+  cs->length = 0;
+}
+
+/* Add SIZE bytes at BUF to the digest of CS.  */
+
+void
+checksum_update (struct checksum *cs, const char *buf, size_t size)
+{
+  switch (cs->type)
+    {
+    case checksum_md5:
+      md5_process_bytes (buf, size, &cs->ctx.md5);
+      break;
+    case checksum_sha1:
+      sha1_process_bytes (buf, size, &cs->ctx.sha1);
+      break;
+    case checksum_sha256:
+      sha256_process_bytes (buf, size, &cs->ctx.sha256);
+      break;
+    }
+  cs->length += size;
+}
+
+/* Prepare CS for digesting the data that follows the first RESTVAL
+   bytes of FILE as it arrives.  If CS already covers exactly that
+   much data, as is the case when a download is retried, the digest
+   simply continues; otherwise the first RESTVAL bytes are read back
+   from FILE.  Returns false if that is not possible.  */
+
+bool
+checksum_prepare (struct checksum *cs, const char *file, wgint restval)
+{
+  FILE *fp;
+  char buf[8192];
+  wgint left = restval;
+
+  if (cs->length == restval)
+    return true;
+  checksum_start (cs);
+  if (!restval)
+    return true;
+
+  fp = fopen (file, "rb");
+  if (!fp)
+    return false;
+  while (left > 0)
+    {
+      size_t n = fread (buf, 1, MIN (left, (wgint) sizeof buf), fp);
+      if (n == 0)
+        break;
+      checksum_update (cs, buf, n);
+      left -= n;
+    }
+  fclose (fp);
+  if (left > 0)
+    {
+      cs->length = -1;
+      return false;
+    }
+  return true;
+}
+
+/* Finish the digest of CS and compare it to the expected one.  */
+
+bool
+checksum_verify (struct checksum *cs)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  int size = 0;
+
+  switch (cs->type)
+    {
+    case checksum_md5:
+      md5_finish_ctx (&cs->ctx.md5, digest);
+      size = MD5_DIGEST_SIZE;
+      break;
+    case checksum_sha1:
+      sha1_finish_ctx (&cs->ctx.sha1, digest);
+      size = SHA1_DIGEST_SIZE;
+      break;
+    case checksum_sha256:
+      sha256_finish_ctx (&cs->ctx.sha256, digest);
+      size = SHA256_DIGEST_SIZE;
+      break;
+    }
+  cs->length = -1;
+  return !memcmp (digest, cs->expected, size);
+}
+
+/* Cleanup the data structures associated with this file.  */
+
+void
+checksum_cleanup (void)
+{
+  if (checksum_table)
+    {
+      free_keys_and_values (checksum_table);
+      hash_table_destroy (checksum_table);
+      checksum_table = NULL;
+    }
+}
@@ -0,0 +1,69 @@
+/* Declarations for checksum.c.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+
+struct url;
+
+enum checksum_type {
+  checksum_md5,
+  checksum_sha1,
+  checksum_sha256
+};
+
+/* The expected digest of a file being downloaded, along with the
+   state of the digest of the data received so far.  */
+struct checksum {
+  enum checksum_type type;
+  unsigned char expected[SHA256_DIGEST_SIZE];
+  wgint length;                 /* bytes digested so far, or -1 if
+                                   the digest has not been started */
+  union {
+    struct md5_ctx md5;
+    struct sha1_ctx sha1;
+    struct sha256_ctx sha256;
+  } ctx;
+};
+
+bool checksum_spec_valid_p (const char *);
+bool checksum_parse (struct checksum *, const char *, const char *);
+bool checksum_read_file (const char *);
+struct checksum *checksum_lookup (const struct url *, const char *);
+bool checksum_prepare (struct checksum *, const char *, wgint);
+void checksum_update (struct checksum *, const char *, size_t);
+bool checksum_verify (struct checksum *);
+void checksum_cleanup (void);
+
+#endif /* CHECKSUM_H */
@@ -46,6 +46,8 @@ as that of the covered work.  */
 #  include <netdb.h>
 # endif /* def __VMS [else] */
 # include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <fcntl.h>
 # ifndef __BEOS__
 #  include <arpa/inet.h>
 # endif
@@ -58,6 +60,11 @@ as that of the covered work.  */
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "ptimer.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
 
 /* Apparently needed for Interix: */
 #ifdef HAVE_STDINT_H
@@ -172,88 +179,482 @@ sockaddr_size (const struct sockaddr *sa)
     }
 }
 
-/* Resolve the bind address specified via --bind-address and store it
-   to SA.  The resolved value is stored in a static variable and
-   reused after the first invocation of this function.
+/* The local addresses given with --bind-address, resolved on first
+   use, and the traffic that went through each of them.  */
+
+struct bind_source {
+  ip_address ip;
+  int open;                     /* connections currently open */
+  int connections;              /* connections made in total */
+  wgint received;               /* bytes received */
+};
 
-   Returns true on success, false on failure.  */
+static struct bind_source *bind_sources;
+static int bind_source_count;
+static bool bind_sources_resolved;
 
-static bool
-resolve_bind_address (struct sockaddr *sa)
+/* The index in bind_sources of the source each file descriptor is
+   bound to, or -1.  */
+static int *fd_sources;
+static int fd_sources_size;
+
+/* For each destination address, the number of the next source to use
+   under the round-robin policy.  */
+static struct hash_table *next_sources;
+
+/* Resolve the addresses given with --bind-address.  Addresses that
+   don't resolve are skipped with a warning.  opt.bind_addresses
+   doesn't change during a Wget run, so this is done only once.  */
+
+static void
+resolve_bind_sources (void)
 {
-  struct address_list *al;
+  char **name;
 
-  /* Make sure this is called only once.  opt.bind_address doesn't
-     change during a Wget run.  */
-  static bool called, should_bind;
-  static ip_address ip;
-  if (called)
+  if (bind_sources_resolved)
+    return;
+  bind_sources_resolved = true;
+
+  for (name = opt.bind_addresses; name && *name; name++)
     {
-      if (should_bind)
-        sockaddr_set_data (sa, &ip, 0);
-      return should_bind;
+      struct address_list *al = lookup_host (*name, LH_BIND | LH_SILENT);
+      struct bind_source *src;
+      if (!al)
+        {
+          /* #### We should be able to print the error message here. */
+          logprintf (LOG_NOTQUIET,
+                     _("%s: unable to resolve bind address %s; not using it.\n"),
+                     exec_name, quote (*name));
+          continue;
+        }
+      bind_sources = xrealloc (bind_sources, (bind_source_count + 1)
+                               * sizeof (struct bind_source));
+      src = &bind_sources[bind_source_count++];
+      xzero (*src);
+      /* Use the first address of each name.  */
+      src->ip = *address_list_address_at (al, 0);
+      address_list_release (al);
     }
-  called = true;
+}
 
-  al = lookup_host (opt.bind_address, LH_BIND | LH_SILENT);
-  if (!al)
+/* Return a hash of the address IP.  */
+
+static unsigned long
+hash_address (const ip_address *ip)
+{
+  const unsigned char *p = IP_INADDR_DATA (ip);
+  int len = ip->family == AF_INET ? 4 : 16;
+  unsigned long h = 2166136261UL;       /* FNV-1a */
+  while (len--)
+    h = (h ^ *p++) * 16777619UL;
+  return h;
+}
+
+/* Choose the source to bind to for a connection to DEST, according to
+   opt.bind_policy, among the sources of the same address family.
+   Returns the index of the source in bind_sources, or -1 if there is
+   none.  */
+
+static int
+choose_bind_source (const ip_address *dest)
+{
+  int *cands = alloca (bind_source_count * sizeof (int));
+  int count = 0, i, chosen = -1;
+
+  for (i = 0; i < bind_source_count; i++)
+    if (bind_sources[i].ip.family == dest->family)
+      cands[count++] = i;
+  /* With no source of the right family, bind to one anyway and let
+     the connection fail as it would with a single --bind-address.  */
+  if (!count)
+    for (i = 0; i < bind_source_count; i++)
+      cands[count++] = i;
+  if (!count)
+    return -1;
+
+  switch (opt.bind_policy)
     {
-      /* #### We should be able to print the error message here. */
-      logprintf (LOG_NOTQUIET,
-                 _("%s: unable to resolve bind address %s; disabling bind.\n"),
-                 exec_name, quote (opt.bind_address));
-      should_bind = false;
-      return false;
+    case bind_hash:
+      chosen = cands[hash_address (dest) % count];
+      break;
+    case bind_round_robin:
+      {
+        char key[ADDRESS_STRING_SIZE];
+        char *orig_key;
+        void *value;
+        unsigned long next;
+        address_to_string (key, dest);
+        if (!next_sources)
+          next_sources = make_string_hash_table (0);
+        if (hash_table_get_pair (next_sources, key, &orig_key, &value))
+          next = (uintptr_t) value;
+        else
+          {
+            /* Start each destination at a different source, and
+               concurrent jobs at different sources from each other.  */
+            next = hash_address (dest) + getpid ();
+            orig_key = xstrdup (key);
+          }
+        chosen = cands[next % count];
+        hash_table_put (next_sources, orig_key, (void *) (uintptr_t) (next + 1));
+      }
+      break;
+    case bind_least_loaded:
+      chosen = cands[0];
+      for (i = 1; i < count; i++)
+        {
+          struct bind_source *a = &bind_sources[cands[i]];
+          struct bind_source *b = &bind_sources[chosen];
+          if (a->open < b->open
+              || (a->open == b->open && a->received < b->received))
+            chosen = cands[i];
+        }
+      break;
     }
+  return chosen;
+}
 
-  /* Pick the first address in the list and use it as bind address.
-     Perhaps we should try multiple addresses in succession, but I
-     don't think that's necessary in practice.  */
-  ip = *address_list_address_at (al, 0);
-  address_list_release (al);
+/* Remember that SOCK is bound to the source with index SRC.  */
 
-  sockaddr_set_data (sa, &ip, 0);
-  should_bind = true;
-  return true;
+static void
+track_bind_source (int sock, int src)
+{
+  if (sock >= fd_sources_size)
+    {
+      int old = fd_sources_size, i;
+      fd_sources_size = 2 * fd_sources_size > sock ? 2 * fd_sources_size
+        : sock + 16;
+      fd_sources = xrealloc (fd_sources, fd_sources_size * sizeof (int));
+      for (i = old; i < fd_sources_size; i++)
+        fd_sources[i] = -1;
+    }
+  fd_sources[sock] = src;
+  ++bind_sources[src].open;
+  ++bind_sources[src].connections;
 }
-
-struct cwt_context {
-  int fd;
-  const struct sockaddr *addr;
-  socklen_t addrlen;
-  int result;
-};
 
-static void
-connect_with_timeout_callback (void *arg)
+/* Return the index of the source SOCK is bound to, or -1.  */
+
+static inline int
+bind_source_of (int sock)
 {
-  struct cwt_context *ctx = (struct cwt_context *)arg;
-  ctx->result = connect (ctx->fd, ctx->addr, ctx->addrlen);
+  return sock < fd_sources_size ? fd_sources[sock] : -1;
+}
+
+/* Return true if the connection on SOCK, opened earlier, may be reused
+   under opt.bind_policy.  A connection is kept to the source chosen
+   for its destination under the hash policy, and under the
+   least-loaded policy isn't reused while another source carries fewer
+   connections than its own would without it.  */
+
+bool
+bind_source_reusable_p (int sock)
+{
+  int src = bind_source_of (sock), i;
+  ip_address peer;
+
+  if (src < 0)
+    return true;
+  switch (opt.bind_policy)
+    {
+    case bind_hash:
+      if (!socket_ip_address (sock, &peer, ENDPOINT_PEER))
+        return false;
+      return choose_bind_source (&peer) == src;
+    case bind_least_loaded:
+      for (i = 0; i < bind_source_count; i++)
+        if (bind_sources[i].ip.family == bind_sources[src].ip.family
+            && bind_sources[i].open < bind_sources[src].open - 1)
+          return false;
+      return true;
+    default:
+      return true;
+    }
+}
+
+/* Log how many connections were made and how much data was received
+   through each of the bind addresses, when there is more than one.  */
+
+void
+bind_sources_report (void)
+{
+  int i;
+
+  if (bind_source_count < 2)
+    return;
+  for (i = 0; i < bind_source_count; i++)
+    logprintf (LOG_VERBOSE,
+               ngettext ("Bind address %s: %d connection, %s received.\n",
+                         "Bind address %s: %d connections, %s received.\n",
+                         bind_sources[i].connections),
+               print_address (&bind_sources[i].ip),
+               bind_sources[i].connections,
+               human_readable (bind_sources[i].received));
+}
+
+void
+bind_sources_cleanup (void)
+{
+  xfree_null (bind_sources);
+  xfree_null (fd_sources);
+  bind_sources = NULL;
+  fd_sources = NULL;
+  bind_source_count = fd_sources_size = 0;
+  bind_sources_resolved = false;
+  if (next_sources)
+    {
+      string_set_free (next_sources);
+      next_sources = NULL;
+    }
+}
+
+/* Switch SOCK to non-blocking mode if NONBLOCK is true, and back to
+   blocking mode otherwise.  */
+
+static bool
+set_socket_nonblocking (int sock, bool nonblock)
+{
+#ifdef F_GETFL
+  int flags = fcntl (sock, F_GETFL, 0);
+  if (flags < 0)
+    return false;
+  flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  return fcntl (sock, F_SETFL, flags) == 0;
+#else
+  int arg = nonblock;
+  return ioctl (sock, FIONBIO, &arg) == 0;
+#endif
+}
+
+/* Wait for the connection in progress on the non-blocking SOCK to be
+   established, for at most TIMEOUT seconds, 0 meaning no limit.
+   Returns 0 on success, leaving SOCK in non-blocking mode.  Otherwise
+   returns -1 and leaves the reason in errno.  */
+
+static int
+connect_wait (int sock, double timeout)
+{
+  int ready, err = 0;
+  socklen_t errlen = sizeof (err);
+
+  ready = select_fd (sock, timeout ? timeout : -1, WAIT_FOR_WRITE);
+
+  if (ready == 0)
+    {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  if (ready < 0)
+    return -1;
+  if (getsockopt (sock, SOL_SOCKET, SO_ERROR, (void *) &err, &errlen) < 0)
+    return -1;
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return 0;
 }
 
 /* Like connect, but specifies a timeout.  If connecting takes longer
-   than TIMEOUT seconds, -1 is returned and errno is set to
-   ETIMEDOUT.  */
+   than TIMEOUT seconds, -1 is returned and errno is set to ETIMEDOUT.
+   The connection is started in non-blocking mode and waited for with
+   connect_wait, so that no signal is needed to interrupt it.  The
+   socket is left in non-blocking mode, as fd_read and fd_write
+   expect.  */
 
 static int
 connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
                       double timeout)
 {
-  struct cwt_context ctx;
-  ctx.fd = fd;
-  ctx.addr = addr;
-  ctx.addrlen = addrlen;
+  if (!set_socket_nonblocking (fd, true))
+    return -1;
+  if (connect (fd, addr, addrlen) < 0
+      && (errno != EINPROGRESS || connect_wait (fd, timeout) < 0))
+    return -1;
+  return 0;
+}
+
+/* Assumed round-trip time, for systems that don't report one.  */
+#define DEFAULT_RTT 0.1
+
+/* Limits of the receive buffer chosen by --socket-buffer=auto.  */
+#define MIN_RCVBUF (64 * 1024)
+#define MAX_RCVBUF (16 * 1024 * 1024)
+
+/* These systems grow the receive buffer of a connection as its
+   transfer speeds up, and stop doing so once SO_RCVBUF is set.  There
+   --socket-buffer=auto leaves the buffer alone.  */
+#if defined __linux__ || defined __FreeBSD__ || defined __APPLE__ \
+  || defined WINDOWS
+# define RCVBUF_AUTOTUNING
+#endif
+
+/* The receive buffer to set before the next connection to each
+   server address under --socket-buffer=auto, as measured on the
+   previous one.  The buffer cannot usefully be grown once the
+   connection is established: the window scale is agreed upon in the
+   handshake.  */
+static struct hash_table *receive_buffers;
+
+/* Return the receive buffer size for a connection that carries RATE
+   bytes per second over a path with a round-trip time of RTT
+   seconds, 0 meaning unknown: twice the bandwidth-delay product,
+   within MIN_RCVBUF and MAX_RCVBUF.  */
+
+#if !defined RCVBUF_AUTOTUNING || defined TESTING
+static int
+receive_buffer_size (double rate, double rtt)
+{
+  double want = 2 * rate * (rtt > 0 ? rtt : DEFAULT_RTT);
+  return (want < MIN_RCVBUF ? MIN_RCVBUF
+          : want > MAX_RCVBUF ? MAX_RCVBUF : (int) want);
+}
+#endif
+
+/* Note that BYTES were received on SOCK in SECONDS, so that the next
+   connection to the same server address gets a receive buffer that
+   suits that throughput.  Transfers too short to have left TCP slow
+   start say nothing about the path, and are ignored.  */
+
+void
+socket_note_throughput (int sock, wgint bytes, double seconds)
+{
+#if defined SO_RCVBUF && !defined RCVBUF_AUTOTUNING
+  ip_address peer;
+  char key[ADDRESS_STRING_SIZE];
+  char *orig_key;
+  void *value;
+  int size;
+
+  if (opt.socket_buffer >= 0 || bytes < MIN_RCVBUF || seconds <= 0)
+    return;
+  if (!socket_ip_address (sock, &peer, ENDPOINT_PEER))
+    return;
+  size = receive_buffer_size (bytes / seconds, socket_rtt (sock));
+  address_to_string (key, &peer);
+  if (!receive_buffers)
+    receive_buffers = make_string_hash_table (0);
+  if (!hash_table_get_pair (receive_buffers, key, &orig_key, &value))
+    orig_key = xstrdup (key);
+  hash_table_put (receive_buffers, orig_key, (void *) (intptr_t) size);
+  DEBUGP (("Next receive buffer for %s: %d bytes.\n", key, size));
+#endif
+}
 
-  if (run_with_timeout (timeout, connect_with_timeout_callback, &ctx))
+/* Return the receive buffer to set before connecting to SA, or 0 to
+   leave it to the system.  */
+
+static int
+receive_buffer_for (const struct sockaddr *sa)
+{
+  if (opt.socket_buffer > 0)
+    return opt.socket_buffer < INT_MAX ? opt.socket_buffer : INT_MAX;
+#ifndef RCVBUF_AUTOTUNING
+  if (opt.socket_buffer < 0 && receive_buffers)
     {
-      errno = ETIMEDOUT;
-      return -1;
+      char key[ADDRESS_STRING_SIZE];
+      ip_address ip;
+      sockaddr_get_data (sa, &ip, NULL);
+      address_to_string (key, &ip);
+      return (intptr_t) hash_table_get (receive_buffers, key);
     }
-  if (ctx.result == -1 && errno == EINTR)
-    errno = ETIMEDOUT;
-  return ctx.result;
+#endif
+  return 0;
 }
-
+
+void
+receive_buffers_cleanup (void)
+{
+  if (receive_buffers)
+    {
+      string_set_free (receive_buffers);
+      receive_buffers = NULL;
+    }
+}
+
+/* Create a TCP socket for connecting to SA, set up according to the
+   options and bound to --bind-address if one was given.  Returns -1
+   on error, leaving the reason in errno.  */
+
+static int
+open_socket (const struct sockaddr *sa)
+{
+  /* Create the socket of the family appropriate for the address.  */
+  int sock = socket (sa->sa_family, SOCK_STREAM, 0);
+  if (sock < 0)
+    return -1;
+
+#if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
+  if (opt.ipv6_only) {
+    int on = 1;
+    /* In case of error, we will go on anyway... */
+    int err = setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
+    IF_DEBUG
+      if (err < 0)
+        DEBUGP (("Failed setting IPV6_V6ONLY: %s", strerror (errno)));
+  }
+#endif
+
+  /* For very small rate limits, set the buffer size (and hence,
+     hopefully, the kernel's TCP window size) to the per-second limit.
+     That way we should never have to sleep for more than 1s between
+     network reads.  */
+  if (opt.limit_rate && opt.limit_rate < 8192)
+    {
+      int bufsize = opt.limit_rate;
+      if (bufsize < 512)
+        bufsize = 512;          /* avoid pathologically small values */
+#ifdef SO_RCVBUF
+      setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
+                  (void *)&bufsize, (socklen_t)sizeof (bufsize));
+#endif
+      /* When we add limit_rate support for writing, which is useful
+         for POST, we should also set SO_SNDBUF here.  */
+    }
+  else
+    {
+      /* The buffer must be sized before connecting, as the window
+         scale is agreed upon in the handshake.  */
+      int bufsize = receive_buffer_for (sa);
+#ifdef SO_RCVBUF
+      if (bufsize > 0)
+        setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
+                    (void *)&bufsize, (socklen_t)sizeof (bufsize));
+#endif
+    }
+
+  if (opt.bind_addresses)
+    {
+      /* Bind the client side of the socket to one of the requested
+         addresses.  */
+      struct sockaddr_storage bind_ss;
+      struct sockaddr *bind_sa = (struct sockaddr *)&bind_ss;
+      ip_address dest;
+      int src;
+
+      resolve_bind_sources ();
+      sockaddr_get_data (sa, &dest, NULL);
+      src = choose_bind_source (&dest);
+      if (src >= 0)
+        {
+          sockaddr_set_data (bind_sa, &bind_sources[src].ip, 0);
+          if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
+            {
+              int save_errno = errno;
+              fd_close (sock);
+              errno = save_errno;
+              return -1;
+            }
+          track_bind_source (sock, src);
+          DEBUGP (("Bound socket %d to %s.\n", sock,
+                   print_address (&bind_sources[src].ip)));
+        }
+    }
+
+  return sock;
+}
+
 /* Connect via TCP to the specified address and port.
 
    If PRINT is non-NULL, it is the host name to print that we're
@@ -304,52 +705,10 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   /* Store the sockaddr info to SA.  */
   sockaddr_set_data (sa, ip, port);
 
-  /* Create the socket of the family appropriate for the address.  */
-  sock = socket (sa->sa_family, SOCK_STREAM, 0);
+  sock = open_socket (sa);
   if (sock < 0)
     goto err;
 
-#if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
-  if (opt.ipv6_only) {
-    int on = 1;
-    /* In case of error, we will go on anyway... */
-    int err = setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
-    IF_DEBUG
-      if (err < 0)
-        DEBUGP (("Failed setting IPV6_V6ONLY: %s", strerror (errno)));
-  }
-#endif
-
-  /* For very small rate limits, set the buffer size (and hence,
-     hopefully, the kernel's TCP window size) to the per-second limit.
-     That way we should never have to sleep for more than 1s between
-     network reads.  */
-  if (opt.limit_rate && opt.limit_rate < 8192)
-    {
-      int bufsize = opt.limit_rate;
-      if (bufsize < 512)
-        bufsize = 512;          /* avoid pathologically small values */
-#ifdef SO_RCVBUF
-      setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
-                  (void *)&bufsize, (socklen_t)sizeof (bufsize));
-#endif
-      /* When we add limit_rate support for writing, which is useful
-         for POST, we should also set SO_SNDBUF here.  */
-    }
-
-  if (opt.bind_address)
-    {
-      /* Bind the client side of the socket to the requested
-         address.  */
-      struct sockaddr_storage bind_ss;
-      struct sockaddr *bind_sa = (struct sockaddr *)&bind_ss;
-      if (resolve_bind_address (bind_sa))
-        {
-          if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
-            goto err;
-        }
-    }
-
   /* Connect the socket to the remote endpoint.  */
   if (connect_with_timeout (sock, sa, sockaddr_size (sa),
                             opt.connect_timeout) < 0)
@@ -376,6 +735,50 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+/* Start connecting via TCP to IP and PORT, without waiting for the
+   connection to be established, so that the kernel completes the
+   handshake while Wget is busy with something else.  Returns the
+   socket, which must be passed to connect_finish before use, or -1 on
+   error.  */
+
+int
+connect_start (const ip_address *ip, int port)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock;
+
+  sockaddr_set_data (sa, ip, port);
+  sock = open_socket (sa);
+  if (sock < 0)
+    return -1;
+
+  if (!set_socket_nonblocking (sock, true)
+      || (connect (sock, sa, sockaddr_size (sa)) < 0
+          && errno != EINPROGRESS))
+    {
+      int save_errno = errno;
+      fd_close (sock);
+      errno = save_errno;
+      return -1;
+    }
+
+  DEBUGP (("Started connecting socket %d.\n", sock));
+  return sock;
+}
+
+/* Wait for the connection started by connect_start on SOCK to be
+   established, for at most TIMEOUT seconds, 0 meaning no limit.
+   Returns 0 on success, with SOCK still in non-blocking mode.  Otherwise
+   returns -1 and leaves the reason in errno; SOCK still has to be
+   closed.  */
+
+int
+connect_finish (int sock, double timeout)
+{
+  return connect_wait (sock, timeout);
+}
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
@@ -387,6 +790,7 @@ connect_to_host (const char *host, int port)
 {
   int i, start, end;
   int sock;
+  struct ptimer *timer = ptimer_new ();
 
   struct address_list *al = lookup_host (host, 0);
 
@@ -396,6 +800,7 @@ connect_to_host (const char *host, int port)
       logprintf (LOG_NOTQUIET,
                  _("%s: unable to resolve host address %s\n"),
                  exec_name, quote (host));
+      ptimer_destroy (timer);
       return E_HOST;
     }
 
@@ -403,12 +808,14 @@ connect_to_host (const char *host, int port)
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
+      ptimer_reset (timer);
       sock = connect_to_ip (ip, port, host);
       if (sock >= 0)
         {
           /* Success. */
-          address_list_set_connected (al);
+          address_list_set_connected (al, i, ptimer_measure (timer));
           address_list_release (al);
+          ptimer_destroy (timer);
           return sock;
         }
 
@@ -429,6 +836,7 @@ connect_to_host (const char *host, int port)
       goto retry;
     }
   address_list_release (al);
+  ptimer_destroy (timer);
 
   return -1;
 }
@@ -530,6 +938,13 @@ accept_connection (int local_sock)
         return -1;
     }
   sock = accept (local_sock, sa, &addrlen);
+  if (sock >= 0 && !set_socket_nonblocking (sock, true))
+    {
+      int save_errno = errno;
+      fd_close (sock);
+      errno = save_errno;
+      return -1;
+    }
   DEBUGP (("Accepted client at socket %d.\n", sock));
   return sock;
 }
@@ -616,6 +1031,22 @@ socket_family (int sock, int endpoint)
   return sockaddr->sa_family;
 }
 
+/* Return the smoothed round-trip time of the TCP connection on SOCK
+   in seconds, or 0 if the system does not report it.  */
+
+double
+socket_rtt (int sock)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+  struct tcp_info info;
+  socklen_t len = sizeof (info);
+  if (getsockopt (sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0
+      && info.tcpi_rtt > 0)
+    return info.tcpi_rtt / 1000000.0;
+#endif
+  return 0;
+}
+
 /* Return true if the error from the connect code can be considered
    retryable.  Wget normally retries after errors, but the exception
    are the "unsupported protocol" type errors (possible on IPv4/IPv6
@@ -666,7 +1097,8 @@ retryable_socket_connect_error (int err)
 /* Wait for a single descriptor to become available, timing out after
    MAXTIME seconds.  Returns 1 if FD is available, 0 for timeout and
    -1 for error.  The argument WAIT_FOR can be a combination of
-   WAIT_FOR_READ and WAIT_FOR_WRITE.
+   WAIT_FOR_READ and WAIT_FOR_WRITE.  A negative MAXTIME waits for as
+   long as it takes.
 
    This is a mere convenience wrapper around the select call, and
    should be taken as such (for example, it doesn't implement Wget's
@@ -691,14 +1123,7 @@ select_fd (int fd, double maxtime, int wait_for)
   tmout.tv_usec = 1000000 * (maxtime - (long) maxtime);
 
   do
-  {
-    result = select (fd + 1, rd, wr, NULL, &tmout);
-#ifdef WINDOWS
-    /* gnulib select() converts blocking sockets to nonblocking in windows.
-       wget uses blocking sockets so we must convert them back to blocking.  */
-    set_windows_fd_as_blocking_socket (fd);
-#endif
-  }
+    result = select (fd + 1, rd, wr, NULL, maxtime < 0 ? NULL : &tmout);
   while (result < 0 && errno == EINTR);
 
   return result;
@@ -733,12 +1158,6 @@ test_socket_open (int sock)
   to.tv_usec = 1;
 
   ret = select (sock + 1, &check_set, NULL, NULL, &to);
-#ifdef WINDOWS
-/* gnulib select() converts blocking sockets to nonblocking in windows.
-wget uses blocking sockets so we must convert them back to blocking
-*/
-  set_windows_fd_as_blocking_socket ( sock );
-#endif
 
   if ( !ret )
     /* We got a timeout, it means we're still connected. */
@@ -749,7 +1168,9 @@ wget uses blocking sockets so we must convert them back to blocking
     return false;
 }
 
-/* Basic socket operations, mostly EINTR wrappers.  */
+/* Basic socket operations, mostly EINTR wrappers.  The sockets are
+   in non-blocking mode, so these fail with EAGAIN instead of
+   waiting.  */
 
 static int
 sock_read (int fd, char *buf, int bufsize)
@@ -806,7 +1227,6 @@ sock_close (int fd)
    or SSL_read or whatever is necessary.  */
 
 static struct hash_table *transport_map;
-static unsigned int transport_map_modified_tick;
 
 struct transport_info {
   struct transport_implementation *imp;
@@ -836,7 +1256,6 @@ fd_register_transport (int fd, struct transport_implementation *imp, void *ctx)
   if (!transport_map)
     transport_map = hash_table_new (0, NULL, NULL);
   hash_table_put (transport_map, (void *)(intptr_t) fd, info);
-  ++transport_map_modified_tick;
 }
 
 /* Return context of the transport registered with
@@ -850,68 +1269,103 @@ fd_transport_context (int fd)
   return info->ctx;
 }
 
-/* When fd_read/fd_write are called multiple times in a loop, they should
-   remember the INFO pointer instead of fetching it every time.  It is
-   not enough to compare FD to LAST_FD because FD might have been
-   closed and reopened.  modified_tick ensures that changes to
-   transport_map will not be unnoticed.
-
-   This is a macro because we want the static storage variables to be
-   per-function.  */
-
-#define LAZY_RETRIEVE_INFO(info) do {                                   \
-  static struct transport_info *last_info;                              \
-  static int last_fd = -1;                                              \
-  static unsigned int last_tick;                                        \
-  if (!transport_map)                                                   \
-    info = NULL;                                                        \
-  else if (last_fd == fd && last_tick == transport_map_modified_tick)   \
-    info = last_info;                                                   \
-  else                                                                  \
-    {                                                                   \
-      info = hash_table_get (transport_map, (void *)(intptr_t) fd);     \
-      last_fd = fd;                                                     \
-      last_info = info;                                                 \
-      last_tick = transport_map_modified_tick;                          \
-    }                                                                   \
-} while (0)
+/* Return the transport registered for FD with fd_register_transport,
+   or NULL if FD is a plain socket.  The result is deliberately not
+   cached in static variables, so that fd_read and friends may be
+   called for several connections in turn; a hash lookup is cheap
+   next to the system call that follows.  */
+
+static struct transport_info *
+retrieve_info (int fd)
+{
+  if (!transport_map)
+    return NULL;
+  return hash_table_get (transport_map, (void *)(intptr_t) fd);
+}
+
+/* Whether an operation failed only because it would have had to wait
+   for the network.  */
+#ifdef EWOULDBLOCK
+# define WOULD_BLOCK(err) ((err) == EAGAIN || (err) == EWOULDBLOCK)
+#else
+# define WOULD_BLOCK(err) ((err) == EAGAIN)
+#endif
+
+/* Wait for FD to become ready for WF after an operation on it would
+   have blocked, for no longer than TIMEOUT seconds since the first
+   wait, which starts *TIMER.  A TIMEOUT of 0 means no limit, and -1
+   means opt.read_timeout.  */
 
 static bool
-poll_internal (int fd, struct transport_info *info, int wf, double timeout)
+poll_internal (int fd, struct transport_info *info, int wf, double timeout,
+               struct ptimer **timer)
 {
+  double left = -1;
+  int test;
+
   if (timeout == -1)
     timeout = opt.read_timeout;
   if (timeout)
     {
-      int test;
-      if (info && info->imp->poller)
-        test = info->imp->poller (fd, timeout, wf, info->ctx);
-      else
-        test = sock_poll (fd, timeout, wf);
-      if (test == 0)
-        errno = ETIMEDOUT;
-      if (test <= 0)
-        return false;
+      if (!*timer)
+        *timer = ptimer_new ();
+      left = timeout - ptimer_measure (*timer);
+      if (left <= 0)
+        {
+          errno = ETIMEDOUT;
+          return false;
+        }
+    }
+  if (info && info->imp->poller)
+    test = info->imp->poller (fd, left, wf, info->ctx);
+  else
+    test = sock_poll (fd, left, wf);
+  if (test == 0)
+    errno = ETIMEDOUT;
+  return test > 0;
+}
+
+static void
+destroy_timer (struct ptimer *timer)
+{
+  if (timer)
+    {
+      int save_errno = errno;
+      ptimer_destroy (timer);
+      errno = save_errno;
     }
-  return true;
 }
 
 /* Read no more than BUFSIZE bytes of data from FD, storing them to
    BUF.  If TIMEOUT is non-zero, the operation aborts if no data is
    received after that many seconds.  If TIMEOUT is -1, the value of
-   opt.timeout is used for TIMEOUT.  */
+   opt.timeout is used for TIMEOUT.
+
+   The read is attempted first, and FD is only polled when no data is
+   available yet, which saves a system call per read on a busy
+   connection.  */
 
 int
 fd_read (int fd, char *buf, int bufsize, double timeout)
 {
-  struct transport_info *info;
-  LAZY_RETRIEVE_INFO (info);
-  if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
-    return -1;
-  if (info && info->imp->reader)
-    return info->imp->reader (fd, buf, bufsize, info->ctx);
-  else
-    return sock_read (fd, buf, bufsize);
+  struct transport_info *info = retrieve_info (fd);
+  struct ptimer *timer = NULL;
+  int res, src;
+
+  for (;;)
+    {
+      if (info && info->imp->reader)
+        res = info->imp->reader (fd, buf, bufsize, info->ctx);
+      else
+        res = sock_read (fd, buf, bufsize);
+      if (res >= 0 || !WOULD_BLOCK (errno)
+          || !poll_internal (fd, info, WAIT_FOR_READ, timeout, &timer))
+        break;
+    }
+  destroy_timer (timer);
+  if (res > 0 && (src = bind_source_of (fd)) >= 0)
+    bind_sources[src].received += res;
+  return res;
 }
 
 /* Like fd_read, except it provides a "preview" of the data that will
@@ -929,14 +1383,22 @@ fd_read (int fd, char *buf, int bufsize, double timeout)
 int
 fd_peek (int fd, char *buf, int bufsize, double timeout)
 {
-  struct transport_info *info;
-  LAZY_RETRIEVE_INFO (info);
-  if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
-    return -1;
-  if (info && info->imp->peeker)
-    return info->imp->peeker (fd, buf, bufsize, info->ctx);
-  else
-    return sock_peek (fd, buf, bufsize);
+  struct transport_info *info = retrieve_info (fd);
+  struct ptimer *timer = NULL;
+  int res;
+
+  for (;;)
+    {
+      if (info && info->imp->peeker)
+        res = info->imp->peeker (fd, buf, bufsize, info->ctx);
+      else
+        res = sock_peek (fd, buf, bufsize);
+      if (res >= 0 || !WOULD_BLOCK (errno)
+          || !poll_internal (fd, info, WAIT_FOR_READ, timeout, &timer))
+        break;
+    }
+  destroy_timer (timer);
+  return res;
 }
 
 /* Write the entire contents of BUF to FD.  If TIMEOUT is non-zero,
@@ -948,25 +1410,33 @@ int
 fd_write (int fd, char *buf, int bufsize, double timeout)
 {
   int res;
-  struct transport_info *info;
-  LAZY_RETRIEVE_INFO (info);
+  struct transport_info *info = retrieve_info (fd);
+  struct ptimer *timer = NULL;
 
   /* `write' may write less than LEN bytes, thus the loop keeps trying
-     it until all was written, or an error occurred.  */
+     it until all was written, or an error occurred.  The timeout
+     applies to each wait for the socket to drain.  */
   res = 0;
   while (bufsize > 0)
     {
-      if (!poll_internal (fd, info, WAIT_FOR_WRITE, timeout))
-        return -1;
       if (info && info->imp->writer)
         res = info->imp->writer (fd, buf, bufsize, info->ctx);
       else
         res = sock_write (fd, buf, bufsize);
+      if (res < 0 && WOULD_BLOCK (errno))
+        {
+          if (!poll_internal (fd, info, WAIT_FOR_WRITE, timeout, &timer))
+            break;
+          continue;
+        }
       if (res <= 0)
         break;
       buf += res;
       bufsize -= res;
+      destroy_timer (timer);
+      timer = NULL;
     }
+  destroy_timer (timer);
   return res;
 }
 
@@ -983,11 +1453,7 @@ fd_write (int fd, char *buf, int bufsize, double timeout)
 const char *
 fd_errstr (int fd)
 {
-  /* Don't bother with LAZY_RETRIEVE_INFO, as this will only be called
-     in case of error, never in a tight loop.  */
-  struct transport_info *info = NULL;
-  if (transport_map)
-    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  struct transport_info *info = retrieve_info (fd);
 
   if (info && info->imp->errstr)
     {
@@ -1005,14 +1471,18 @@ void
 fd_close (int fd)
 {
   struct transport_info *info;
+  int src;
   if (fd < 0)
     return;
 
-  /* Don't use LAZY_RETRIEVE_INFO because fd_close() is only called once
-     per socket, so that particular optimization wouldn't work.  */
-  info = NULL;
-  if (transport_map)
-    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  src = bind_source_of (fd);
+  if (src >= 0)
+    {
+      --bind_sources[src].open;
+      fd_sources[fd] = -1;
+    }
+
+  info = retrieve_info (fd);
 
   if (info && info->imp->closer)
     info->imp->closer (fd, info->ctx);
@@ -1023,6 +1493,128 @@ fd_close (int fd)
     {
       hash_table_remove (transport_map, (void *)(intptr_t) fd);
       xfree (info);
-      ++transport_map_modified_tick;
     }
 }
+
+#ifdef TESTING
+
+/* Set IP to the IPv4 address whose last byte is N in 10.0.0.0/24.  */
+
+static void
+test_ipv4 (ip_address *ip, int n)
+{
+  xzero (*ip);
+  ip->family = AF_INET;
+  ip->data.d4.s_addr = htonl (0x0a000000 | n);
+}
+
+const char *
+test_choose_bind_source()
+{
+  struct bind_source sources[3];
+  ip_address dest, other;
+  int first, second, i;
+
+  xzero (sources);
+  test_ipv4 (&sources[0].ip, 1);
+  test_ipv4 (&sources[1].ip, 2);
+  test_ipv4 (&sources[2].ip, 3);
+  test_ipv4 (&dest, 100);
+  test_ipv4 (&other, 101);
+  bind_sources = sources;
+  bind_source_count = 3;
+
+  /* Round-robin goes through the sources in turn for each
+     destination.  */
+  opt.bind_policy = bind_round_robin;
+  first = choose_bind_source (&dest);
+  second = choose_bind_source (&dest);
+  mu_assert ("test_choose_bind_source: round-robin",
+             first >= 0 && second == (first + 1) % 3
+             && choose_bind_source (&dest) == (first + 2) % 3
+             && choose_bind_source (&dest) == first);
+
+  /* Hash always picks the same source for a destination.  */
+  opt.bind_policy = bind_hash;
+  first = choose_bind_source (&dest);
+  for (i = 0; i < 5; i++)
+    mu_assert ("test_choose_bind_source: hash",
+               choose_bind_source (&dest) == first);
+  mu_assert ("test_choose_bind_source: hash of another destination",
+             choose_bind_source (&other) >= 0);
+
+  /* Least-loaded picks the fewest open connections, then the least
+     data received.  */
+  opt.bind_policy = bind_least_loaded;
+  sources[0].open = 2;
+  sources[1].open = 1;
+  sources[2].open = 1;
+  sources[1].received = 5000;
+  sources[2].received = 100;
+  mu_assert ("test_choose_bind_source: least-loaded",
+             choose_bind_source (&dest) == 2);
+  sources[2].open = 3;
+  mu_assert ("test_choose_bind_source: least-loaded, open connections",
+             choose_bind_source (&dest) == 1);
+
+#ifdef ENABLE_IPV6
+  /* Only a source of the destination's family is used when there is
+     one.  */
+  sources[0].ip.family = AF_INET6;
+  memset (&sources[0].ip.data, 0, sizeof (sources[0].ip.data));
+  sources[0].open = sources[1].open = sources[2].open = 0;
+  opt.bind_policy = bind_round_robin;
+  for (i = 0; i < 4; i++)
+    mu_assert ("test_choose_bind_source: address family",
+               choose_bind_source (&dest) != 0);
+#endif
+
+  bind_sources = NULL;
+  bind_source_count = 0;
+  if (next_sources)
+    {
+      string_set_free (next_sources);
+      next_sources = NULL;
+    }
+  return NULL;
+}
+
+const char *
+test_receive_buffer()
+{
+  wgint saved = opt.socket_buffer;
+
+  mu_assert ("test_receive_buffer: slow link",
+             receive_buffer_size (10000, 0.05) == MIN_RCVBUF);
+  mu_assert ("test_receive_buffer: bandwidth-delay product",
+             receive_buffer_size (10 * 1024 * 1024, 0.05)
+             == 2 * 10 * 1024 * 1024 / 20);
+  mu_assert ("test_receive_buffer: unknown round-trip time",
+             receive_buffer_size (10 * 1024 * 1024, 0)
+             == (int) (2 * 10 * 1024 * 1024 * DEFAULT_RTT));
+  mu_assert ("test_receive_buffer: fast link",
+             receive_buffer_size (1e9, 0.2) == MAX_RCVBUF);
+
+  /* A size that was given is set before every connection; with
+     "auto", nothing is set before anything was measured.  */
+  {
+    struct sockaddr_in sin;
+    xzero (sin);
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl (0x0a000001);
+    opt.socket_buffer = 300000;
+    mu_assert ("test_receive_buffer: fixed size",
+               receive_buffer_for ((struct sockaddr *) &sin) == 300000);
+    opt.socket_buffer = -1;
+    mu_assert ("test_receive_buffer: auto, unmeasured",
+               receive_buffer_for ((struct sockaddr *) &sin) == 0);
+    opt.socket_buffer = 0;
+    mu_assert ("test_receive_buffer: default",
+               receive_buffer_for ((struct sockaddr *) &sin) == 0);
+  }
+
+  opt.socket_buffer = saved;
+  return NULL;
+}
+
+#endif /* TESTING */
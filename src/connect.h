@@ -42,6 +42,11 @@ enum {
 };
 int connect_to_host (const char *, int);
 int connect_to_ip (const ip_address *, int, const char *);
+int connect_start (const ip_address *, int);
+int connect_finish (int, double);
+bool bind_source_reusable_p (int);
+void bind_sources_report (void);
+void bind_sources_cleanup (void);
 
 int bind_local (const ip_address *, int *);
 int accept_connection (int);
@@ -52,6 +57,9 @@ enum {
 };
 bool socket_ip_address (int, ip_address *, int);
 int  socket_family (int sock, int endpoint);
+double socket_rtt (int);
+void socket_note_throughput (int, wgint, double);
+void receive_buffers_cleanup (void);
 
 bool retryable_socket_connect_error (int);
 
@@ -36,11 +36,21 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
 #include "convert.h"
 #include "url.h"
 #include "recur.h"
 #include "utils.h"
 #include "hash.h"
+#include "arena.h"
 #include "ptimer.h"
 #include "res.h"
 #include "html-url.h"
@@ -123,11 +133,23 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
           pi = iri_new ();
           set_uri_encoding (pi, opt.locale, true);
 
-          u = url_parse (cur_url->url->url, NULL, pi, true);
+          u = url_parse_arena (cur_url->url->url, NULL, pi, true,
+                               cur_url->arena);
           if (!u)
 	    continue;
 
           local_name = hash_table_get (dl_url_file_map, u->url);
+          if (!local_name)
+            {
+              /* With --canonicalize, the link may have been retrieved
+                 under its canonical URL.  */
+              char *canonical = url_canonicalize (u);
+              if (canonical)
+                {
+                  local_name = hash_table_get (dl_url_file_map, canonical);
+                  xfree (canonical);
+                }
+            }
 
           /* Decide on the conversion type.  */
           if (local_name)
@@ -138,7 +160,10 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
                  not be identical to that on the server (think `-nd',
                  `--cut-dirs', etc.)  */
               cur_url->convert = CO_CONVERT_TO_RELATIVE;
-              cur_url->local_name = xstrdup (local_name);
+              cur_url->local_name = (cur_url->arena
+                                     ? arena_strdup (cur_url->arena,
+                                                     local_name)
+                                     : xstrdup (local_name));
               DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
             }
           else
@@ -153,7 +178,8 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
               DEBUGP (("will convert url %s to complete\n", u->url));
             }
 
-          url_free (u);
+          if (!cur_url->arena)
+            url_free (u);
           iri_free (pi);
         }
 
@@ -199,22 +225,179 @@ convert_all_links (void)
   ptimer_destroy (timer);
 }
 
-static void write_backup_file (const char *, downloaded_file_t);
-static const char *replace_plain (const char*, int, FILE*, const char *);
-static const char *replace_attr (const char *, int, FILE *, const char *);
-static const char *replace_attr_refresh_hack (const char *, int, FILE *,
+/* The converted document is written as a list of spans, each either
+   an unchanged run of the original, which stays where it is mapped, or
+   the text replacing a link.  The spans are gathered in OUT->iov and
+   written with a single writev() whenever CONV_IOV_MAX of them have
+   piled up.  */
+
+#if defined IOV_MAX && IOV_MAX < 1024
+# define CONV_IOV_MAX IOV_MAX
+#else
+# define CONV_IOV_MAX 1024
+#endif
+
+#ifndef HAVE_WRITEV
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+
+/* Write only the first span; conv_flush calls us again for the
+   rest.  */
+
+static ssize_t
+writev (int fd, const struct iovec *iov, int count)
+{
+  return write (fd, iov[0].iov_base, iov[0].iov_len);
+}
+#endif
+
+struct conv_output {
+  int fd;
+  struct iovec iov[CONV_IOV_MAX];
+  char *owned[CONV_IOV_MAX];    /* replacement text to free once
+                                   written, or NULL */
+  int count;
+  int error;                    /* errno of the failed write, or 0 */
+};
+
+/* Write out the spans gathered in OUT and free their text.  */
+
+static void
+conv_flush (struct conv_output *out)
+{
+  struct iovec *iov = out->iov;
+  int left = out->count, i;
+
+  while (left > 0 && !out->error)
+    {
+      ssize_t res = writev (out->fd, iov, left);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        {
+          out->error = res < 0 ? errno : EIO;
+          break;
+        }
+      while (left > 0 && (size_t) res >= iov->iov_len)
+        {
+          res -= iov->iov_len;
+          ++iov;
+          --left;
+        }
+      if (left > 0)
+        {
+          iov->iov_base = (char *) iov->iov_base + res;
+          iov->iov_len -= res;
+        }
+    }
+  for (i = 0; i < out->count; i++)
+    xfree_null (out->owned[i]);
+  out->count = 0;
+}
+
+/* Add the LEN bytes at P to OUT.  If OWNED is non-NULL, it is the
+   allocated block P points into, freed after it is written.  */
+
+static void
+conv_add (struct conv_output *out, const char *p, size_t len, char *owned)
+{
+  if (!len)
+    {
+      xfree_null (owned);
+      return;
+    }
+  if (out->count == CONV_IOV_MAX)
+    conv_flush (out);
+  out->iov[out->count].iov_base = (char *) p;
+  out->iov[out->count].iov_len = len;
+  out->owned[out->count] = owned;
+  ++out->count;
+}
+
+/* Add a span of the original document, which must stay mapped until
+   the output is flushed.  */
+
+static void
+conv_span (struct conv_output *out, const char *p, size_t len)
+{
+  conv_add (out, p, len, NULL);
+}
+
+/* Add a copy of TEXT.  */
+
+static void
+conv_text (struct conv_output *out, const char *text)
+{
+  char *copy = xstrdup (text);
+  conv_add (out, copy, strlen (copy), copy);
+}
+
+static void write_backup_file (const char *, downloaded_file_t,
+                               const struct file_memory *);
+static const char *replace_plain (const char*, int, struct conv_output *,
+                                  const char *);
+static const char *replace_srcset (const char *, int, struct conv_output *,
+                                   const char *);
+static const char *replace_attr (const char *, int, struct conv_output *,
+                                 const char *);
+static const char *replace_attr_refresh_hack (const char *, int,
+                                              struct conv_output *,
                                               const char *, int);
 static char *local_quote_string (const char *, bool);
 static char *construct_relative (const char *, const char *);
 
+/* Make sure the data written to FD, or the entries of the directory
+   FD refers to, reach the disk, as far as the system allows.  */
+
+static void
+sync_fd (int fd)
+{
+#ifdef HAVE_FSYNC
+  while (fsync (fd) < 0 && errno == EINTR)
+    ;
+#endif
+}
+
+/* Sync the directory holding FILE, so that a rename into it survives
+   a crash of the system.  */
+
+static void
+sync_parent_dir (const char *file)
+{
+#if defined HAVE_FSYNC && !defined WINDOWS
+  const char *slash = strrchr (file, '/');
+  char *dir;
+  int fd;
+
+  if (slash)
+    BOUNDED_TO_ALLOCA (file, slash == file ? slash + 1 : slash, dir);
+  else
+    dir = ".";
+  fd = open (dir, O_RDONLY);
+  if (fd >= 0)
+    {
+      sync_fd (fd);
+      close (fd);
+    }
+#endif
+}
+
 /* Change the links in one file.  LINKS is a list of links in the
    document, along with their positions and the desired direction of
-   the conversion.  */
+   the conversion.
+
+   The converted document is written to a temporary file next to FILE,
+   which is then renamed over it, so that FILE holds either the old or
+   the new contents however the process ends.  */
 static void
 convert_links (const char *file, struct urlpos *links)
 {
   struct file_memory *fm;
-  FILE *fp;
+  struct conv_output out;
+  struct_stat st;
+  char *temp;
   const char *p;
   downloaded_file_t downloaded_file_return;
 
@@ -240,37 +423,29 @@ convert_links (const char *file, struct urlpos *links)
   }
 
   fm = wget_read_file (file);
-  if (!fm)
+  if (!fm || stat (file, &st) < 0)
     {
       logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
                  file, strerror (errno));
+      if (fm)
+        wget_read_file_free (fm);
       return;
     }
 
-  downloaded_file_return = downloaded_file (CHECK_FOR_FILE, file);
-  if (opt.backup_converted && downloaded_file_return)
-    write_backup_file (file, downloaded_file_return);
-
-  /* Before opening the file for writing, unlink the file.  This is
-     important if the data in FM is mmaped.  In such case, nulling the
-     file, which is what fopen() below does, would make us read all
-     zeroes from the mmaped region.  */
-  if (unlink (file) < 0 && errno != ENOENT)
-    {
-      logprintf (LOG_NOTQUIET, _("Unable to delete %s: %s\n"),
-                 quote (file), strerror (errno));
-      wget_read_file_free (fm);
-      return;
-    }
-  /* Now open the file for writing.  */
-  fp = fopen (file, "wb");
-  if (!fp)
+  /* The original is never written to, so the data in FM stays valid
+     even when it is mmaped.  */
+  temp = aprintf ("%s.XXXXXX", file);
+  out.fd = mkstemp (temp);
+  if (out.fd < 0)
     {
       logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
                  file, strerror (errno));
+      xfree (temp);
       wget_read_file_free (fm);
       return;
     }
+  out.count = 0;
+  out.error = 0;
 
   /* Here we loop through all the URLs in file, replacing those of
      them that are downloaded with relative references.  */
@@ -293,7 +468,7 @@ convert_links (const char *file, struct urlpos *links)
 
       /* Echo the file contents, up to the offending URL's opening
          quote, to the outfile.  */
-      fwrite (p, 1, url_start - p, fp);
+      conv_span (&out, p, url_start - p);
       p = url_start;
 
       switch (link->convert)
@@ -303,14 +478,17 @@ convert_links (const char *file, struct urlpos *links)
           {
             char *newname = construct_relative (file, link->local_name);
             char *quoted_newname = local_quote_string (newname,
-                                                       link->link_css_p);
+                                                       link->link_css_p
+                                                       || link->link_srcset_p);
 
             if (link->link_css_p)
-              p = replace_plain (p, link->size, fp, quoted_newname);
+              p = replace_plain (p, link->size, &out, quoted_newname);
+            else if (link->link_srcset_p)
+              p = replace_srcset (p, link->size, &out, quoted_newname);
             else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newname);
+              p = replace_attr (p, link->size, &out, quoted_newname);
             else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newname,
+              p = replace_attr_refresh_hack (p, link->size, &out, quoted_newname,
                                              link->refresh_timeout);
 
             DEBUGP (("TO_RELATIVE: %s to %s at position %d in %s.\n",
@@ -327,11 +505,13 @@ convert_links (const char *file, struct urlpos *links)
             char *quoted_newlink = html_quote_string (newlink);
 
             if (link->link_css_p)
-              p = replace_plain (p, link->size, fp, newlink);
+              p = replace_plain (p, link->size, &out, newlink);
+            else if (link->link_srcset_p)
+              p = replace_srcset (p, link->size, &out, newlink);
             else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newlink);
+              p = replace_attr (p, link->size, &out, quoted_newlink);
             else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newlink,
+              p = replace_attr_refresh_hack (p, link->size, &out, quoted_newlink,
                                              link->refresh_timeout);
 
             DEBUGP (("TO_COMPLETE: <something> to %s at position %d in %s.\n",
@@ -342,7 +522,7 @@ convert_links (const char *file, struct urlpos *links)
           }
         case CO_NULLIFY_BASE:
           /* Change the base href to "". */
-          p = replace_attr (p, link->size, fp, "");
+          p = replace_attr (p, link->size, &out, "");
           break;
         case CO_NOCONVERT:
           abort ();
@@ -352,11 +532,46 @@ convert_links (const char *file, struct urlpos *links)
 
   /* Output the rest of the file. */
   if (p - fm->content < fm->length)
-    fwrite (p, 1, fm->length - (p - fm->content), fp);
-  fclose (fp);
-  wget_read_file_free (fm);
+    conv_span (&out, p, fm->length - (p - fm->content));
+  conv_flush (&out);
+  if (!out.error && opt.convert_sync != convert_sync_none)
+    sync_fd (out.fd);
+  if (close (out.fd) < 0 && !out.error)
+    out.error = errno;
+  if (out.error)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
+                 file, strerror (out.error));
+      unlink (temp);
+      goto out;
+    }
+
+  /* Back up the original while it is still in place.  */
+  downloaded_file_return = downloaded_file (CHECK_FOR_FILE, file);
+  if (opt.backup_converted && downloaded_file_return)
+    write_backup_file (file, downloaded_file_return, fm);
+
+  /* mkstemp creates the file readable only by its owner; give it the
+     permissions of the original.  */
+  chmod (temp, st.st_mode & 07777);
+#ifdef WINDOWS
+  /* rename() does not replace an existing file here.  */
+  unlink (file);
+#endif
+  if (rename (temp, file) < 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
+                 file, strerror (errno));
+      unlink (temp);
+      goto out;
+    }
+  if (opt.convert_sync == convert_sync_dir)
+    sync_parent_dir (file);
 
   logprintf (LOG_VERBOSE, "%d-%d\n", to_file_count, to_url_count);
+ out:
+  xfree (temp);
+  wget_read_file_free (fm);
 }
 
 /* Construct and return a link that points from BASEFILE to LINKFILE.
@@ -426,8 +641,56 @@ construct_relative (const char *basefile, const char *linkfile)
    written. */
 static struct hash_table *converted_files;
 
+/* Make BACKUP hold the contents of FILE, which are also in FM.  The
+   converted document is renamed over FILE rather than written into
+   it, so a hard link to the original needs no copying at all.  Where
+   hard links are not supported, the data is cloned if the file system
+   can share it, and copied otherwise; the backup then gets the time
+   stamp of the original, which -N compares against.  */
+
+static bool
+make_backup (const char *file, const char *backup,
+             const struct file_memory *fm)
+{
+  struct_stat st;
+  FILE *fp;
+  bool cloned = false, ok;
+
+  if (unlink (backup) < 0 && errno != ENOENT)
+    return false;
+#ifdef HAVE_LINK
+  if (link (file, backup) == 0)
+    return true;
+#endif
+
+  if (stat (file, &st) < 0)
+    return false;
+  fp = fopen (backup, "wb");
+  if (!fp)
+    return false;
+#if defined HAVE_LINUX_FS_H && defined FICLONE
+  {
+    int fd = open (file, O_RDONLY);
+    if (fd >= 0)
+      {
+        cloned = ioctl (fileno (fp), FICLONE, fd) == 0;
+        close (fd);
+      }
+  }
+#endif
+  if (!cloned)
+    fwrite (fm->content, 1, fm->length, fp);
+  ok = !ferror (fp);
+  if (fclose (fp) == EOF)
+    ok = false;
+  if (ok)
+    touch (backup, st.st_mtime);
+  return ok;
+}
+
 static void
-write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
+write_backup_file (const char *file, downloaded_file_t downloaded_file_return,
+                   const struct file_memory *fm)
 {
   /* Rather than just writing over the original .html file with the
      converted version, save the former to *.orig.  Note we only do
@@ -471,8 +734,9 @@ write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
      called on this file. */
   if (!string_set_contains (converted_files, file))
     {
-      /* Rename <file> to <file>.orig before former gets written over. */
-      if (rename (file, filename_plus_orig_suffix) != 0)
+      /* Keep <file> as <file>.orig before the converted version
+         replaces it. */
+      if (!make_backup (file, filename_plus_orig_suffix, fm))
         logprintf (LOG_NOTQUIET, _("Cannot back up %s as %s: %s\n"),
                    file, filename_plus_orig_suffix, strerror (errno));
 
@@ -501,9 +765,33 @@ static bool find_fragment (const char *, int, const char **, const char **);
 
 /* Replace a string with NEW_TEXT.  Ignore quoting. */
 static const char *
-replace_plain (const char *p, int size, FILE *fp, const char *new_text)
+replace_plain (const char *p, int size, struct conv_output *out,
+               const char *new_text)
+{
+  conv_text (out, new_text);
+  p += size;
+  return p;
+}
+
+/* Replace one candidate of a srcset attribute with NEW_TEXT.  Spaces
+   and commas would end the URL there, so they are escaped before the
+   text is quoted for HTML.  */
+static const char *
+replace_srcset (const char *p, int size, struct conv_output *out,
+                const char *new_text)
 {
-  fputs (new_text, fp);
+  char *escaped = xmalloc (3 * strlen (new_text) + 1), *q = escaped;
+  char *quoted;
+
+  for (; *new_text; new_text++)
+    if (*new_text == ' ' || *new_text == ',')
+      q += sprintf (q, "%%%02X", *new_text);
+    else
+      *q++ = *new_text;
+  *q = '\0';
+  quoted = html_quote_string (escaped);
+  conv_add (out, quoted, strlen (quoted), quoted);
+  xfree (escaped);
   p += size;
   return p;
 }
@@ -511,7 +799,8 @@ replace_plain (const char *p, int size, FILE *fp, const char *new_text)
 /* Replace an attribute's original text with NEW_TEXT. */
 
 static const char *
-replace_attr (const char *p, int size, FILE *fp, const char *new_text)
+replace_attr (const char *p, int size, struct conv_output *out,
+              const char *new_text)
 {
   bool quote_flag = false;
   char quote_char = '\"';       /* use "..." for quoting, unless the
@@ -533,16 +822,16 @@ replace_attr (const char *p, int size, FILE *fp, const char *new_text)
       ++p;
       size -= 2;                /* disregard opening and closing quote */
     }
-  putc (quote_char, fp);
-  fputs (new_text, fp);
+  conv_span (out, quote_char == '\'' ? "'" : "\"", 1);
+  conv_text (out, new_text);
 
   /* Look for fragment identifier, if any. */
   if (find_fragment (p, size, &frag_beg, &frag_end))
-    fwrite (frag_beg, 1, frag_end - frag_beg, fp);
+    conv_span (out, frag_beg, frag_end - frag_beg);
   p += size;
   if (quote_flag)
     ++p;
-  putc (quote_char, fp);
+  conv_span (out, quote_char == '\'' ? "'" : "\"", 1);
 
   return p;
 }
@@ -552,7 +841,7 @@ replace_attr (const char *p, int size, FILE *fp, const char *new_text)
    append "timeout_value; URL=" before the next_text.  */
 
 static const char *
-replace_attr_refresh_hack (const char *p, int size, FILE *fp,
+replace_attr_refresh_hack (const char *p, int size, struct conv_output *out,
                            const char *new_text, int timeout)
 {
   /* "0; URL=..." */
@@ -562,7 +851,7 @@ replace_attr_refresh_hack (const char *p, int size, FILE *fp,
                                            + 1);
   sprintf (new_with_timeout, "%d; URL=%s", timeout, new_text);
 
-  return replace_attr (p, size, fp, new_with_timeout);
+  return replace_attr (p, size, out, new_with_timeout);
 }
 
 /* Find the first occurrence of '#' in [BEG, BEG+SIZE) that is not
@@ -46,6 +46,7 @@ enum convert_options {
 };
 
 struct url;
+struct arena;
 
 /* A structure that defines the whereabouts of a URL, i.e. its
    position in an HTML document, etc.  */
@@ -69,6 +70,8 @@ struct urlpos {
   unsigned int link_css_p	:1; /* the url came from CSS */
   unsigned int link_expect_html	:1; /* expected to contain HTML */
   unsigned int link_expect_css	:1; /* expected to contain CSS */
+  unsigned int link_srcset_p	:1; /* one of the candidates of a srcset
+				       attribute */
 
   unsigned int link_refresh_p	:1; /* link was received from
 				       <meta http-equiv=refresh content=...> */
@@ -81,6 +84,10 @@ struct urlpos {
   int pos, size;
 
   struct urlpos *next;		/* next list element */
+
+  struct arena *arena;		/* the arena the whole list, with the
+				   URLs and local names, was allocated
+				   in, or NULL if it is on the heap */
 };
 
 /* downloaded_file() takes a parameter of this type and returns this type. */
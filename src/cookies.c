@@ -77,10 +77,6 @@ struct cookie_jar {
   int cookie_count;             /* number of cookies in the jar. */
 };
 
-/* Value set by entry point functions, so that the low-level
-   routines don't need to call time() all the time.  */
-static time_t cookies_now;
-
 struct cookie_jar *
 cookie_jar_new (void)
 {
@@ -134,13 +130,14 @@ cookie_new (void)
   return cookie;
 }
 
-/* Non-zero if the cookie has expired.  Assumes cookies_now has been
-   set by one of the entry point functions.  */
+/* Non-zero if the cookie has expired at time NOW.  The entry point
+   functions call time() once and pass the result down, so that the
+   low-level routines don't need to call it all the time.  */
 
 static bool
-cookie_expired_p (const struct cookie *c)
+cookie_expired_p (const struct cookie *c, time_t now)
 {
-  return c->expiry_time != 0 && c->expiry_time < cookies_now;
+  return c->expiry_time != 0 && c->expiry_time < now;
 }
 
 /* Deallocate COOKIE and its components. */
@@ -337,10 +334,11 @@ discard_matching_cookie (struct cookie_jar *jar, struct cookie *cookie)
    attribute name and value.  Subsequent parameters will be checked
    against field names such as `domain', `path', etc.  Recognized
    fields will be parsed and the corresponding members of COOKIE
-   filled.  */
+   filled.  Expiry times given as a number of seconds are counted from
+   NOW.  */
 
 static struct cookie *
-parse_set_cookie (const char *set_cookie, bool silent)
+parse_set_cookie (const char *set_cookie, bool silent, time_t now)
 {
   const char *ptr = set_cookie;
   struct cookie *cookie = cookie_new ();
@@ -402,7 +400,7 @@ parse_set_cookie (const char *set_cookie, bool silent)
               /* According to netscape's specification, expiry time in
                  the past means that discarding of a matching cookie
                  is requested.  */
-              if (cookie->expiry_time < cookies_now)
+              if (cookie->expiry_time < now)
                 cookie->discard_requested = 1;
             }
         }
@@ -420,7 +418,7 @@ parse_set_cookie (const char *set_cookie, bool silent)
             /* something went wrong. */
             goto error;
           cookie->permanent = 1;
-          cookie->expiry_time = cookies_now + maxage;
+          cookie->expiry_time = now + maxage;
 
           /* According to rfc2109, a cookie with max-age of 0 means that
              discarding of a matching cookie is requested.  */
@@ -658,14 +656,14 @@ cookie_handle_set_cookie (struct cookie_jar *jar,
                           const char *path, const char *set_cookie)
 {
   struct cookie *cookie;
-  cookies_now = time (NULL);
+  time_t now = time (NULL);
 
   /* Wget's paths don't begin with '/' (blame rfc1808), but cookie
      usage assumes /-prefixed paths.  Until the rest of Wget is fixed,
      simply prepend slash to PATH.  */
   PREPEND_SLASH (path);
 
-  cookie = parse_set_cookie (set_cookie, false);
+  cookie = parse_set_cookie (set_cookie, false, now);
   if (!cookie)
     goto out;
 
@@ -828,11 +826,11 @@ path_matches (const char *full_path, const char *prefix)
 static bool
 cookie_matches_url (const struct cookie *cookie,
                     const char *host, int port, const char *path,
-                    bool secflag, int *path_goodness)
+                    bool secflag, int *path_goodness, time_t now)
 {
   int pg;
 
-  if (cookie_expired_p (cookie))
+  if (cookie_expired_p (cookie, now))
     /* Ignore stale cookies.  Don't bother unchaining the cookie at
        this point -- Wget is a relatively short-lived application, and
        stale cookies will not be saved by `save_cookies'.  On the
@@ -971,6 +969,7 @@ cookie_header (struct cookie_jar *jar, const char *host,
   int count, i, ocnt;
   char *result;
   int result_size, pos;
+  time_t now;
   PREPEND_SLASH (path);         /* see cookie_handle_set_cookie */
 
   /* First, find the cookie chains whose domains match HOST. */
@@ -985,7 +984,7 @@ cookie_header (struct cookie_jar *jar, const char *host,
   if (!chain_count)
     return NULL;
 
-  cookies_now = time (NULL);
+  now = time (NULL);
 
   /* Now extract from the chains those cookies that match our host
      (for domain_exact cookies), port (for cookies with port other
@@ -995,7 +994,7 @@ cookie_header (struct cookie_jar *jar, const char *host,
   count = 0;
   for (i = 0; i < chain_count; i++)
     for (cookie = chains[i]; cookie; cookie = cookie->next)
-      if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
+      if (cookie_matches_url (cookie, host, port, path, secflag, NULL, now))
         ++count;
   if (!count)
     return NULL;                /* no cookies matched */
@@ -1010,7 +1009,8 @@ cookie_header (struct cookie_jar *jar, const char *host,
     for (cookie = chains[i]; cookie; cookie = cookie->next)
       {
         int pg;
-        if (!cookie_matches_url (cookie, host, port, path, secflag, &pg))
+        if (!cookie_matches_url (cookie, host, port, path, secflag, &pg,
+                                 now))
           continue;
         outgoing[ocnt].cookie = cookie;
         outgoing[ocnt].domain_goodness = strlen (cookie->domain);
@@ -1132,6 +1132,7 @@ void
 cookie_jar_load (struct cookie_jar *jar, const char *file)
 {
   char *line;
+  time_t now;
   FILE *fp = fopen (file, "r");
   if (!fp)
     {
@@ -1139,7 +1140,7 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
                  quote (file), strerror (errno));
       return;
     }
-  cookies_now = time (NULL);
+  now = time (NULL);
 
   for (; ((line = read_whole_line (fp)) != NULL); xfree (line))
     {
@@ -1205,7 +1206,7 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
       cookie->domain  = strdupdelim (domain_b, domain_e);
 
       /* safe default in case EXPIRES field is garbled. */
-      expiry = (double)cookies_now - 1;
+      expiry = (double)now - 1;
 
       /* I don't like changing the line, but it's safe here.  (line is
          malloced.)  */
@@ -1221,7 +1222,7 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
         }
       else
         {
-          if (expiry < cookies_now)
+          if (expiry < now)
             goto abort_cookie;  /* ignore stale cookie. */
           cookie->expiry_time = expiry;
           cookie->permanent = 1;
@@ -1245,10 +1246,11 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
 {
   FILE *fp;
   hash_table_iterator iter;
+  time_t now;
 
   DEBUGP (("Saving cookies to %s.\n", file));
 
-  cookies_now = time (NULL);
+  now = time (NULL);
 
   fp = fopen (file, "w");
   if (!fp)
@@ -1259,7 +1261,7 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
     }
 
   fputs ("# HTTP cookie file.\n", fp);
-  fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (cookies_now));
+  fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (now));
   fputs ("# Edit at your own risk.\n\n", fp);
 
   for (hash_table_iterate (jar->chains, &iter);
@@ -1272,7 +1274,7 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
         {
           if (!cookie->permanent && !opt.keep_session_cookies)
             continue;
-          if (cookie_expired_p (cookie))
+          if (cookie_expired_p (cookie, now))
             continue;
           if (!cookie->domain_exact)
             fputc ('.', fp);
@@ -1362,7 +1364,7 @@ test_cookies (void)
       const char **expected = tests_succ[i].results;
       struct cookie *c;
 
-      c = parse_set_cookie (data, true);
+      c = parse_set_cookie (data, true, time (NULL));
       if (!c)
         {
           printf ("NULL cookie returned for valid data: %s\n", data);
@@ -1402,7 +1404,7 @@ test_cookies (void)
     {
       struct cookie *c;
       char *data = tests_fail[i];
-      c = parse_set_cookie (data, true);
+      c = parse_set_cookie (data, true, time (NULL));
       if (c)
         printf ("Failed to report error on invalid data: %s\n", data);
     }
@@ -52,6 +52,7 @@ as that of the covered work.  */
 
 #include "wget.h"
 #include "utils.h"
+#include "arena.h"
 #include "convert.h"
 #include "html-url.h"
 #include "css-tokens.h"
@@ -265,6 +266,7 @@ get_urls_css_file (const char *file, const char *url)
 
   ctx.text = fm->content;
   ctx.head = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
@@ -272,5 +274,7 @@ get_urls_css_file (const char *file, const char *url)
 
   get_urls_css (&ctx, 0, fm->length);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
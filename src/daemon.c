@@ -0,0 +1,719 @@
+/* Serving downloads submitted over a local socket.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --daemon=SOCKET, Wget reads its configuration and loads the
+   TLS context and CA certificates once, then listens on the Unix
+   socket SOCKET for jobs.  A job is a Wget command line, run in the
+   client's working directory: for each job the daemon forks a process
+   that parses the job's arguments on top of the daemon's options and
+   then proceeds like an ordinary Wget invocation.  At most
+   opt.daemon_jobs jobs run at once; further clients wait in the
+   listen queue.
+
+   With --submit=SOCKET, Wget hands its command line to the daemon
+   listening on SOCKET along with its standard input, output and error
+   descriptors, so that the job writes to them directly, waits for the
+   job to finish and exits with its exit status.  If no daemon is
+   listening, Wget runs the command itself.
+
+   The request is a sequence of NUL-terminated strings: the number of
+   arguments in decimal, the working directory and the arguments,
+   starting with the program name.  The descriptors, if any, accompany
+   the first byte as SCM_RIGHTS ancillary data.  A client that sends
+   no descriptors receives the job's output on the connection.  When
+   the job is over, the daemon sends the line "exit N", N being the
+   job's exit status, and closes the connection.
+
+   As a job runs with the daemon's privileges and files, only the
+   daemon's own user may submit one.  The socket is created with mode
+   0600 in a directory nobody else can write to, and the credentials of
+   each client are checked where the system reports them.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if !defined(WINDOWS) && !defined(MSDOS) && !defined(__VMS)
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/un.h>
+# include <sys/wait.h>
+# define USE_DAEMON
+#endif
+
+#ifdef HAVE_SSL
+# include "ssl.h"
+#endif
+#include "utils.h"
+#include "daemon.h"
+
+#ifdef USE_DAEMON
+
+/* Exit status reported for a job that did not exit normally.  */
+#define JOB_CRASHED 1
+
+/* The number of descriptors passed along with a job: the client's
+   standard input, output and error.  */
+#define JOB_FDS 3
+
+/* Limits on a request: its size in bytes, the number of arguments and
+   the seconds to wait for it to arrive.  */
+#define MAX_REQUEST_SIZE (4 * 1024 * 1024)
+#define MAX_JOB_ARGS 65536
+#define REQUEST_TIMEOUT 30
+
+/* A job being run by the daemon.  */
+struct job {
+  pid_t pid;                    /* process running the job */
+  int fd;                       /* connection to report the status to */
+};
+
+static struct job *jobs;
+static int job_count;
+
+/* Written to by the SIGCHLD handler to wake up the main loop.  */
+static int child_pipe[2];
+
+static void
+child_handler (int sig)
+{
+  int saved_errno = errno;
+  if (write (child_pipe[1], "", 1) < 0)
+    ;                           /* the loop is awake anyway */
+  errno = saved_errno;
+}
+
+/* Fill ADDR with the address of the socket named FILE.  Returns false
+   if the name is too long.  */
+
+static bool
+socket_address (const char *file, struct sockaddr_un *addr)
+{
+  xzero (*addr);
+  addr->sun_family = AF_UNIX;
+  if (strlen (file) >= sizeof (addr->sun_path))
+    {
+      fprintf (stderr, _("%s: Socket name too long.\n"), file);
+      return false;
+    }
+  strcpy (addr->sun_path, file);
+  return true;
+}
+
+/* Make sure that the directory the socket FILE goes in cannot be
+   written to by other users, who could otherwise replace the socket
+   with one of their own.  The directory is created, with mode 0700, if
+   it does not exist.  */
+
+static bool
+private_directory (const char *file)
+{
+  const char *slash = strrchr (file, '/');
+  char *dir;
+  struct_stat st;
+  bool ok = true;
+
+  if (!slash)
+    dir = xstrdup (".");
+  else if (slash == file)
+    dir = xstrdup ("/");
+  else
+    dir = strdupdelim (file, slash);
+
+  if (stat (dir, &st) < 0)
+    {
+      if (errno != ENOENT || mkdir (dir, 0700) < 0)
+        {
+          fprintf (stderr, "%s: %s\n", dir, strerror (errno));
+          ok = false;
+        }
+    }
+  else if (!S_ISDIR (st.st_mode) || st.st_uid != geteuid ()
+           || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+      fprintf (stderr, _("\
+%s: The socket must be in a directory only you can write to.\n"), dir);
+      ok = false;
+    }
+  xfree (dir);
+  return ok;
+}
+
+/* Return true if the client connected on FD runs as the same user as
+   the daemon.  Where the system cannot tell, the permissions of the
+   socket are relied upon.  */
+
+static bool
+client_allowed (int fd)
+{
+#if defined SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof (cred);
+  if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return false;
+  return cred.uid == geteuid ();
+#elif defined HAVE_GETPEEREID
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid (fd, &uid, &gid) < 0)
+    return false;
+  return uid == geteuid ();
+#else
+  return true;
+#endif
+}
+
+/* Create the socket FILE and listen on it.  A socket left behind by a
+   daemon that is no longer running is replaced.  */
+
+static int
+listen_on (const char *file)
+{
+  struct sockaddr_un addr;
+  struct_stat st;
+  mode_t old_umask;
+  int fd;
+
+  if (!socket_address (file, &addr) || !private_directory (file))
+    return -1;
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      fprintf (stderr, "socket: %s\n", strerror (errno));
+      return -1;
+    }
+  if (stat (file, &st) == 0 && S_ISSOCK (st.st_mode))
+    {
+      if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0)
+        {
+          fprintf (stderr, _("%s: A daemon is already listening.\n"), file);
+          close (fd);
+          return -1;
+        }
+      unlink (file);
+      close (fd);
+      fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0)
+        {
+          fprintf (stderr, "socket: %s\n", strerror (errno));
+          return -1;
+        }
+    }
+  /* Create the socket with mode 0600 from the start, so that there is
+     no moment when other users can connect.  */
+  old_umask = umask (077);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+      || chmod (file, 0600) < 0
+      || listen (fd, SOMAXCONN) < 0)
+    {
+      fprintf (stderr, "%s: %s\n", file, strerror (errno));
+      umask (old_umask);
+      close (fd);
+      return -1;
+    }
+  umask (old_umask);
+  return fd;
+}
+
+/* Report the exit status of the jobs that have finished to their
+   clients.  */
+
+static void
+reap_jobs (void)
+{
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    {
+      int i;
+      for (i = 0; i < job_count; i++)
+        if (jobs[i].pid == pid)
+          {
+            char buf[32];
+            int code = WIFEXITED (status) ? WEXITSTATUS (status) : JOB_CRASHED;
+            snprintf (buf, sizeof (buf), "exit %d\n", code);
+            if (write (jobs[i].fd, buf, strlen (buf)) < 0)
+              ;                 /* the client is gone */
+            close (jobs[i].fd);
+            jobs[i] = jobs[--job_count];
+            break;
+          }
+    }
+}
+
+/* Read the request of the job on the connection FD into *ARGC and
+   *ARGV, change to its working directory and set up its standard
+   descriptors.  Exits if the request is malformed, too large, or not
+   received within REQUEST_TIMEOUT seconds.  */
+
+static void
+read_job (int fd, int *argc, char ***argv)
+{
+  char *buf = NULL;
+  size_t size = 0, len = 0;
+  int received[JOB_FDS];
+  int nfds = 0, nstrings = 0, i;
+  const char *p, *end;
+  long count = -1;
+  struct timeval tv;
+
+  /* A client that stalls would otherwise hold a job slot forever.  */
+  tv.tv_sec = REQUEST_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+  while (count < 0 || nstrings < count + 2)
+    {
+      struct msghdr msg;
+      struct iovec iov;
+      union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE (sizeof (int) * JOB_FDS)];
+      } control;
+      ssize_t n;
+
+      if (len >= MAX_REQUEST_SIZE)
+        exit (2);
+      if (size - len < 4096)
+        {
+          size = size ? size * 2 : 4096;
+          buf = xrealloc (buf, size);
+        }
+      iov.iov_base = buf + len;
+      iov.iov_len = size - len;
+      xzero (msg);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof (control.buf);
+
+      n = recvmsg (fd, &msg, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        exit (2);
+
+      if (msg.msg_controllen)
+        {
+          struct cmsghdr *cmsg;
+          for (cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+               cmsg = CMSG_NXTHDR (&msg, cmsg))
+            if (cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_RIGHTS && !nfds)
+              {
+                nfds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+                memcpy (received, CMSG_DATA (cmsg), nfds * sizeof (int));
+              }
+        }
+
+      /* Count the strings received so far.  The first is the number
+         of arguments, which has to be sensible.  */
+      for (p = buf + len, end = buf + len + n; p < end; p++)
+        if (!*p && ++nstrings == 1)
+          {
+            char *rest;
+            errno = 0;
+            count = strtol (buf, &rest, 10);
+            if (rest == buf || *rest || errno
+                || count < 1 || count > MAX_JOB_ARGS)
+              exit (2);
+          }
+      len += n;
+    }
+
+  tv.tv_sec = 0;
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+  /* Set up the descriptors before anything is written.  */
+  if (nfds == JOB_FDS)
+    {
+      for (i = 0; i < JOB_FDS; i++)
+        if (received[i] != i)
+          {
+            dup2 (received[i], i);
+            close (received[i]);
+          }
+      close (fd);
+    }
+  else
+    {
+      int null = open ("/dev/null", O_RDONLY);
+      for (i = 0; i < nfds; i++)
+        close (received[i]);
+      if (null >= 0 && null != 0)
+        {
+          dup2 (null, 0);
+          close (null);
+        }
+      dup2 (fd, 1);
+      dup2 (fd, 2);
+      if (fd > 2)
+        close (fd);
+    }
+
+  p = buf + strlen (buf) + 1;
+  if (chdir (p) < 0)
+    {
+      fprintf (stderr, "%s: %s\n", p, strerror (errno));
+      exit (1);
+    }
+  p += strlen (p) + 1;
+
+  *argc = count;
+  *argv = xnew_array (char *, count + 1);
+  for (i = 0; i < count; i++)
+    {
+      (*argv)[i] = (char *) p;
+      p += strlen (p) + 1;
+    }
+  (*argv)[count] = NULL;
+}
+
+#ifdef HAVE_SSL
+/* The TLS settings the context was created with, which jobs cannot
+   change.  */
+static struct {
+  int secure_protocol;
+  char *cert_file, *private_key, *ca_directory, *ca_cert;
+  char *random_file, *egd_file;
+  int cert_type, private_key_type;
+} tls_settings;
+
+static bool
+same_string (const char *s1, const char *s2)
+{
+  return s1 == s2 || (s1 && s2 && !strcmp (s1, s2));
+}
+#endif
+
+/* Serve jobs submitted on the socket FILE, never returning except in
+   the processes forked to run the jobs, with *ARGC and *ARGV set to
+   the arguments of the job.  */
+
+void
+daemon_serve (const char *file, int *argc, char ***argv)
+{
+  int sock;
+
+  sock = listen_on (file);
+  if (sock < 0)
+    exit (1);
+
+#ifdef HAVE_SSL
+  /* Load the certificates now instead of in every job.  */
+  ssl_init ();
+  tls_settings.secure_protocol = opt.secure_protocol;
+  tls_settings.cert_file = opt.cert_file;
+  tls_settings.private_key = opt.private_key;
+  tls_settings.ca_directory = opt.ca_directory;
+  tls_settings.ca_cert = opt.ca_cert;
+  tls_settings.random_file = opt.random_file;
+  tls_settings.egd_file = opt.egd_file;
+  tls_settings.cert_type = opt.cert_type;
+  tls_settings.private_key_type = opt.private_key_type;
+#endif
+
+  if (pipe (child_pipe) < 0)
+    {
+      fprintf (stderr, "pipe: %s\n", strerror (errno));
+      exit (1);
+    }
+  fcntl (child_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (child_pipe[1], F_SETFL, O_NONBLOCK);
+  signal (SIGCHLD, child_handler);
+  signal (SIGPIPE, SIG_IGN);
+
+  if (opt.daemon_jobs < 1)
+    opt.daemon_jobs = 1;
+  jobs = xnew_array (struct job, opt.daemon_jobs);
+
+  if (!opt.quiet)
+    fprintf (stderr, _("Accepting jobs on %s.\n"), file);
+
+  while (true)
+    {
+      fd_set fds;
+      int conn;
+      pid_t pid;
+
+      FD_ZERO (&fds);
+      FD_SET (child_pipe[0], &fds);
+      if (job_count < opt.daemon_jobs)
+        FD_SET (sock, &fds);
+      if (select ((sock > child_pipe[0] ? sock : child_pipe[0]) + 1,
+                  &fds, NULL, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          fprintf (stderr, "select: %s\n", strerror (errno));
+          exit (1);
+        }
+
+      if (FD_ISSET (child_pipe[0], &fds))
+        {
+          char drain[64];
+          while (read (child_pipe[0], drain, sizeof (drain)) > 0)
+            ;
+          reap_jobs ();
+        }
+
+      if (job_count >= opt.daemon_jobs || !FD_ISSET (sock, &fds))
+        continue;
+      conn = accept (sock, NULL, NULL);
+      if (conn < 0)
+        continue;
+      if (!client_allowed (conn))
+        {
+          fprintf (stderr, _("Rejected a job submitted by another user.\n"));
+          close (conn);
+          continue;
+        }
+
+      pid = fork ();
+      if (pid == 0)
+        {
+          /* Run the job.  */
+          signal (SIGCHLD, SIG_DFL);
+          close (child_pipe[0]);
+          close (child_pipe[1]);
+          close (sock);
+          xfree (jobs);
+          read_job (conn, argc, argv);
+          return;
+        }
+      if (pid < 0)
+        {
+          char buf[32];
+          snprintf (buf, sizeof (buf), "exit %d\n", JOB_CRASHED);
+          if (write (conn, buf, strlen (buf)) < 0)
+            ;
+          close (conn);
+          continue;
+        }
+      jobs[job_count].pid = pid;
+      jobs[job_count].fd = conn;
+      ++job_count;
+    }
+}
+
+/* Check the options of a job once its arguments have been parsed.
+   Returns false if they cannot be honored by the daemon.  */
+
+bool
+daemon_check_job (void)
+{
+  /* The job is not submitted any further.  */
+  xfree_null (opt.submit_socket);
+  opt.submit_socket = NULL;
+
+  if (opt.daemon_socket)
+    {
+      fprintf (stderr, _("A job cannot start a daemon.\n"));
+      return false;
+    }
+#ifdef HAVE_SSL
+  if (opt.secure_protocol != tls_settings.secure_protocol
+      || !same_string (opt.cert_file, tls_settings.cert_file)
+      || !same_string (opt.private_key, tls_settings.private_key)
+      || !same_string (opt.ca_directory, tls_settings.ca_directory)
+      || !same_string (opt.ca_cert, tls_settings.ca_cert)
+      || !same_string (opt.random_file, tls_settings.random_file)
+      || !same_string (opt.egd_file, tls_settings.egd_file)
+      || opt.cert_type != tls_settings.cert_type
+      || opt.private_key_type != tls_settings.private_key_type)
+    {
+      fprintf (stderr, _("\
+Certificate and TLS protocol options must be given to the daemon.\n"));
+      return false;
+    }
+#endif
+  return true;
+}
+
+/* Send the arguments ARGV to the daemon listening on the socket FILE,
+   and wait for it to run them.  Returns the exit status of the job,
+   or -1 if the daemon cannot be reached.  */
+
+int
+daemon_submit (const char *file, int argc, char **argv)
+{
+  struct sockaddr_un addr;
+  char *request, *p, *cwd;
+  size_t len;
+  int fd, i, fds[JOB_FDS];
+  char reply[64];
+  size_t got = 0;
+
+  if (!socket_address (file, &addr))
+    return -1;
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      int saved_errno = errno;
+      close (fd);
+      errno = saved_errno;
+      return -1;
+    }
+
+  cwd = getcwd (NULL, 0);
+  if (!cwd)
+    {
+      fprintf (stderr, "getcwd: %s\n", strerror (errno));
+      close (fd);
+      return 1;
+    }
+
+  /* Build the request.  */
+  len = numdigit (argc) + 1 + strlen (cwd) + 1;
+  for (i = 0; i < argc; i++)
+    len += strlen (argv[i]) + 1;
+  p = request = xmalloc (len);
+  p += sprintf (p, "%d", argc) + 1;
+  strcpy (p, cwd);
+  p += strlen (cwd) + 1;
+  for (i = 0; i < argc; i++)
+    {
+      strcpy (p, argv[i]);
+      p += strlen (argv[i]) + 1;
+    }
+  free (cwd);
+
+  /* Pass our standard descriptors along with the first chunk; a
+     closed one is replaced by /dev/null.  */
+  for (i = 0; i < JOB_FDS; i++)
+    {
+      fds[i] = i;
+      if (fcntl (i, F_GETFD) < 0)
+        fds[i] = open ("/dev/null", i ? O_WRONLY : O_RDONLY);
+    }
+
+  {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (sizeof (fds))];
+    } control;
+    ssize_t n;
+
+    iov.iov_base = request;
+    iov.iov_len = len;
+    xzero (msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    n = sendmsg (fd, &msg, 0);
+    if (n > 0)
+      {
+        size_t sent = n;
+        while (sent < len)
+          {
+            n = write (fd, request + sent, len - sent);
+            if (n < 0 && errno == EINTR)
+              continue;
+            if (n <= 0)
+              break;
+            sent += n;
+          }
+        n = sent == len ? (ssize_t) len : -1;
+      }
+    xfree (request);
+    for (i = 0; i < JOB_FDS; i++)
+      if (fds[i] != i && fds[i] >= 0)
+        close (fds[i]);
+    if (n < 0)
+      {
+        fprintf (stderr, "%s: %s\n", file, strerror (errno));
+        close (fd);
+        return 1;
+      }
+  }
+
+  /* Wait for the exit status.  */
+  while (got < sizeof (reply) - 1)
+    {
+      ssize_t n = read (fd, reply + got, sizeof (reply) - 1 - got);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      got += n;
+      if (reply[got - 1] == '\n')
+        break;
+    }
+  close (fd);
+  reply[got] = '\0';
+  if (strncmp (reply, "exit ", 5) != 0)
+    {
+      fprintf (stderr, _("%s: The daemon did not report the job's status.\n"),
+               file);
+      return 1;
+    }
+  return atoi (reply + 5);
+}
+
+#else /* not USE_DAEMON */
+
+void
+daemon_serve (const char *file, int *argc, char ***argv)
+{
+  fprintf (stderr, _("This version does not support --daemon.\n"));
+  exit (1);
+}
+
+bool
+daemon_check_job (void)
+{
+  return true;
+}
+
+int
+daemon_submit (const char *file, int argc, char **argv)
+{
+  return -1;
+}
+
+#endif /* not USE_DAEMON */
@@ -412,6 +412,7 @@ static void
 ip_address_to_eprt_repr (const ip_address *addr, int port, char *buf,
                          size_t buflen)
 {
+  char addrbuf[ADDRESS_STRING_SIZE];
   int afnum;
 
   /* buf must contain the argument of EPRT (of the form |af|addr|port|).
@@ -421,7 +422,8 @@ ip_address_to_eprt_repr (const ip_address *addr, int port, char *buf,
 
   /* Construct the argument of EPRT (of the form |af|addr|port|). */
   afnum = (addr->family == AF_INET ? 1 : 2);
-  snprintf (buf, buflen, "|%d|%s|%d|", afnum, print_address (addr), port);
+  snprintf (buf, buflen, "|%d|%s|%d|", afnum,
+            address_to_string (addrbuf, addr), port);
   buf[buflen - 1] = '\0';
 }
 
@@ -895,11 +897,13 @@ ftp_cwd (int csock, const char *dir)
 uerr_t
 ftp_rest (int csock, wgint offset)
 {
+  char offsetbuf[24];
   char *request, *respline;
   int nwritten;
   uerr_t err;
 
-  request = ftp_request ("REST", number_to_static_string (offset));
+  number_to_string (offsetbuf, offset);
+  request = ftp_request ("REST", offsetbuf);
   nwritten = fd_write (csock, request, strlen (request), -1);
   if (nwritten < 0)
     {
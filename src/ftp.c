@@ -50,6 +50,7 @@ as that of the covered work.  */
 #include "convert.h"            /* for downloaded_file */
 #include "recur.h"              /* for INFINITE_RECURSION */
 #include "warc.h"
+#include "checksum.h"
 
 #ifdef __VMS
 # include "vms.h"
@@ -73,6 +74,8 @@ typedef struct
   char *id;                     /* initial directory */
   char *target;                 /* target file name */
   struct url *proxy;            /* FTWK-style proxy */
+  struct checksum *checksum;    /* expected checksum of the target */
+  struct transfer_context *ctx; /* the transfer this connection is for */
 } ccon;
 
 extern int numurls;
@@ -1256,6 +1259,17 @@ Error in server response, closing control connection.\n"));
   else if (expected_bytes)
     print_length (expected_bytes, restval, false);
 
+  /* Digest the file as it arrives if a checksum was published for
+     it.  */
+  if (con->checksum && !(cmd & DO_LIST)
+      && !checksum_prepare (con->checksum, con->target, restval))
+    {
+      logprintf (LOG_NOTQUIET, _("\
+Cannot read %s back; its checksum will not be verified.\n"),
+                 quote (con->target));
+      con->checksum = NULL;
+    }
+
   /* Get the contents of the document.  */
   flags = 0;
   if (restval && rest_failed)
@@ -1263,7 +1277,9 @@ Error in server response, closing control connection.\n"));
   rd_size = 0;
   res = fd_read_body (dtsock, fp,
                       expected_bytes ? expected_bytes - restval : 0,
-                      restval, &rd_size, qtyread, &con->dltime, flags, warc_tmp);
+                      restval, &rd_size, qtyread, &con->dltime, flags, warc_tmp,
+                      (cmd & DO_LIST) ? NULL : con->checksum, NULL,
+                      con->ctx);
 
   tms = datetime_str (time (NULL));
   tmrate = retr_rate (rd_size, con->dltime);
@@ -1398,7 +1414,7 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
   wgint restval, len = 0, qtyread = 0;
   char *tms, *locf;
   const char *tmrate = NULL;
-  uerr_t err;
+  uerr_t err, ret = TRYLIMEXC;
   struct_stat st;
 
   /* Declare WARC variables. */
@@ -1422,6 +1438,11 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
         locf = opt.output_document;
     }
 
+  /* Look up the published checksum of the file, if any.  */
+  con->checksum = NULL;
+  if (!(con->cmd & DO_LIST) && !opt.spider)
+    con->checksum = checksum_lookup (u, locf);
+
   /* If the output_document was given, then this check was already done and
      the file didn't exist. Hence the !opt.output_document */
 
@@ -1579,6 +1600,30 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
       if (!opt.spider)
         tmrate = retr_rate (qtyread - restval, con->dltime);
 
+      /* Compare the digest of the file to the published one.  On a
+         mismatch, remove the file and retrieve it again.  */
+      if (con->checksum && !(con->cmd & DO_LIST))
+        {
+          if (!checksum_verify (con->checksum))
+            {
+              logprintf (LOG_NOTQUIET, _("%s (%s) - Checksum mismatch for %s. "),
+                         tms, tmrate, quote (locf));
+              ret = CHECKSUMERR;
+              if (output_stream)
+                {
+                  logputs (LOG_NOTQUIET, "\n");
+                  break;
+                }
+              if (unlink (locf) < 0)
+                logprintf (LOG_NOTQUIET, "%s: %s\n", locf, strerror (errno));
+              qtyread = 0;
+              printwhat (count, opt.ntry);
+              continue;
+            }
+          logprintf (LOG_VERBOSE, _("Checksum of %s verified.\n"),
+                     quote (locf));
+        }
+
       /* If we get out of the switch above without continue'ing, we've
          successfully downloaded a file.  Remember this fact. */
       downloaded_file (FILE_DOWNLOADED_NORMALLY, locf);
@@ -1676,7 +1721,7 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
       fd_close (con->csock);
       con->csock = -1;
     }
-  return TRYLIMEXC;
+  return ret;
 }
 
 /* Return the directory listing in a reusable format.  The directory
@@ -2213,7 +2258,7 @@ ftp_retrieve_glob (struct url *u, ccon *con, int action)
    encoded into a URL.  */
 uerr_t
 ftp_loop (struct url *u, char **local_file, int *dt, struct url *proxy,
-          bool recursive, bool glob)
+          bool recursive, bool glob, struct transfer_context *ctx)
 {
   ccon con;                     /* FTP connection */
   uerr_t res;
@@ -2227,6 +2272,7 @@ ftp_loop (struct url *u, char **local_file, int *dt, struct url *proxy,
   con.rs = ST_UNIX;
   con.id = NULL;
   con.proxy = proxy;
+  con.ctx = ctx;
 
   /* If the file name is empty, the user probably wants a directory
      index.  We'll provide one, properly HTML-ized.  Unless
@@ -129,7 +129,9 @@ enum wget_ftp_fstatus
 };
 
 struct fileinfo *ftp_parse_ls (const char *, const enum stype);
-uerr_t ftp_loop (struct url *, char **, int *, struct url *, bool, bool);
+struct transfer_context;
+uerr_t ftp_loop (struct url *, char **, int *, struct url *, bool, bool,
+                 struct transfer_context *);
 
 uerr_t ftp_index (const char *, struct url *, struct fileinfo *);
 
@@ -40,16 +40,12 @@ as that of the covered work.  */
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
-#include <sys/ioctl.h>
 
 #include "utils.h"
 #include "connect.h"
 #include "url.h"
-#include "ptimer.h"
 #include "ssl.h"
 
-#include <sys/fcntl.h>
-
 #ifdef WIN32
 # include "w32sock.h"
 #endif
@@ -88,6 +84,7 @@ ssl_init (void)
 
   const char *ca_directory;
   DIR *dir;
+  double stats_start = startup_stats_clock ();
 
   gnutls_global_init ();
   gnutls_certificate_allocate_credentials (&credentials);
@@ -159,6 +156,7 @@ cert to be of the same type.\n"));
                                             GNUTLS_X509_FMT_PEM);
 
   ssl_initialized = true;
+  startup_stats_add ("TLS and CA certificates", stats_start, true);
 
   return true;
 }
@@ -174,6 +172,10 @@ struct wgnutls_transport_context
      actually reading.  */
   char peekbuf[512];
   int peeklen;
+
+  /* What the session waits for after an operation returned
+     GNUTLS_E_AGAIN: WAIT_FOR_READ or WAIT_FOR_WRITE.  */
+  int want;
 };
 
 #ifndef MIN
@@ -181,74 +183,29 @@ struct wgnutls_transport_context
 #endif
 
 
+/* Translate the result RET of a GnuTLS record operation to the
+   conventions of fd_read and fd_write: GNUTLS_E_AGAIN becomes -1 with
+   errno set to EAGAIN, and the direction the session waits for is
+   remembered for wgnutls_poll.  */
+
 static int
-wgnutls_read_timeout (int fd, char *buf, int bufsize, void *arg, double timeout)
+wgnutls_result (struct wgnutls_transport_context *ctx, int ret)
 {
-#ifdef F_GETFL
-  int flags = 0;
-#endif
-  int ret = 0;
-  struct ptimer *timer = NULL;
-  struct wgnutls_transport_context *ctx = arg;
-  int timed_out = 0;
-
-  if (timeout)
+  if (ret == GNUTLS_E_AGAIN)
     {
-#ifdef F_GETFL
-      flags = fcntl (fd, F_GETFL, 0);
-      if (flags < 0)
-        return flags;
-      if (fcntl (fd, F_SETFL, flags | O_NONBLOCK))
-        return -1;
-#else
-      /* XXX: Assume it was blocking before.  */
-      const int one = 1;
-      if (ioctl (fd, FIONBIO, &one) < 0)
-        return -1;
-#endif
-
-      timer = ptimer_new ();
-      if (timer == NULL)
-        return -1;
+      ctx->want = gnutls_record_get_direction (ctx->session)
+        ? WAIT_FOR_WRITE : WAIT_FOR_READ;
+      ctx->last_error = 0;
+      errno = EAGAIN;
+      return -1;
     }
-
-  do
+  ctx->want = 0;
+  if (ret < 0)
     {
-      double next_timeout = 0;
-      if (timeout)
-        {
-          next_timeout = timeout - ptimer_measure (timer);
-          if (next_timeout < 0)
-            break;
-        }
-
-      ret = GNUTLS_E_AGAIN;
-      if (timeout == 0 || gnutls_record_check_pending (ctx->session)
-          || select_fd (fd, next_timeout, WAIT_FOR_READ))
-        {
-          ret = gnutls_record_recv (ctx->session, buf, bufsize);
-          timed_out = timeout && ptimer_measure (timer) >= timeout;
-        }
+      ctx->last_error = ret;
+      /* Don't let a stale errno pass for EAGAIN.  */
+      errno = 0;
     }
-  while (ret == GNUTLS_E_INTERRUPTED || (ret == GNUTLS_E_AGAIN && !timed_out));
-
-  if (timeout)
-    {
-      ptimer_destroy (timer);
-
-#ifdef F_GETFL
-      if (fcntl (fd, F_SETFL, flags) < 0)
-        return -1;
-#else
-      const int zero = 0;
-      if (ioctl (fd, FIONBIO, &zero) < 0)
-        return -1;
-#endif
-
-      if (timed_out && ret == GNUTLS_E_AGAIN)
-        errno = ETIMEDOUT;
-    }
-
   return ret;
 }
 
@@ -270,11 +227,11 @@ wgnutls_read (int fd, char *buf, int bufsize, void *arg)
       return copysize;
     }
 
-  ret = wgnutls_read_timeout (fd, buf, bufsize, arg, opt.read_timeout);
-  if (ret < 0)
-    ctx->last_error = ret;
+  do
+    ret = gnutls_record_recv (ctx->session, buf, bufsize);
+  while (ret == GNUTLS_E_INTERRUPTED);
 
-  return ret;
+  return wgnutls_result (ctx, ret);
 }
 
 static int
@@ -284,10 +241,8 @@ wgnutls_write (int fd, char *buf, int bufsize, void *arg)
   struct wgnutls_transport_context *ctx = arg;
   do
     ret = gnutls_record_send (ctx->session, buf, bufsize);
-  while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
-  if (ret < 0)
-    ctx->last_error = ret;
-  return ret;
+  while (ret == GNUTLS_E_INTERRUPTED);
+  return wgnutls_result (ctx, ret);
 }
 
 static int
@@ -295,6 +250,10 @@ wgnutls_poll (int fd, double timeout, int wait_for, void *arg)
 {
   struct wgnutls_transport_context *ctx = arg;
 
+  /* A renegotiation may have to write while reading, or vice
+     versa.  */
+  if (ctx->want)
+    wait_for = ctx->want;
   if (timeout)
     return ctx->peeklen || gnutls_record_check_pending (ctx->session)
       || select_fd (fd, timeout, wait_for);
@@ -305,51 +264,38 @@ wgnutls_poll (int fd, double timeout, int wait_for, void *arg)
 static int
 wgnutls_peek (int fd, char *buf, int bufsize, void *arg)
 {
-  int read = 0;
+  int ret;
   struct wgnutls_transport_context *ctx = arg;
-  int offset = MIN (bufsize, ctx->peeklen);
 
   if (ctx->peeklen)
     {
-      memcpy (buf, ctx->peekbuf, offset);
-      return offset;
+      int copysize = MIN (bufsize, ctx->peeklen);
+      memcpy (buf, ctx->peekbuf, copysize);
+      return copysize;
     }
 
   if (bufsize > sizeof ctx->peekbuf)
     bufsize = sizeof ctx->peekbuf;
 
-  if (bufsize > offset)
-    {
-      if (opt.read_timeout && gnutls_record_check_pending (ctx->session) == 0
-          && select_fd (fd, 0.0, WAIT_FOR_READ) <= 0)
-        read = 0;
-      else
-        read = wgnutls_read_timeout (fd, buf + offset, bufsize - offset,
-                                     ctx, opt.read_timeout);
-      if (read < 0)
-        {
-          if (offset)
-            read = 0;
-          else
-            return read;
-        }
+  do
+    ret = gnutls_record_recv (ctx->session, buf, bufsize);
+  while (ret == GNUTLS_E_INTERRUPTED);
 
-      if (read > 0)
-        {
-          memcpy (ctx->peekbuf + offset, buf + offset,
-                  read);
-          ctx->peeklen += read;
-        }
+  ret = wgnutls_result (ctx, ret);
+  if (ret > 0)
+    {
+      memcpy (ctx->peekbuf, buf, ret);
+      ctx->peeklen = ret;
     }
-
-  return offset + read;
+  return ret;
 }
 
 static const char *
 wgnutls_errstr (int fd, void *arg)
 {
   struct wgnutls_transport_context *ctx = arg;
-  return gnutls_strerror (ctx->last_error);
+  /* A timeout is reported with errno alone.  */
+  return ctx->last_error ? gnutls_strerror (ctx->last_error) : NULL;
 }
 
 static void
@@ -440,7 +386,26 @@ ssl_connect_wget (int fd, const char *hostname)
       return false;
     }
 
-  err = gnutls_handshake (session);
+  /* The socket is in non-blocking mode, so wait for it whenever the
+     handshake has to, for no longer than the read timeout.  */
+  do
+    {
+      err = gnutls_handshake (session);
+      if (err == GNUTLS_E_AGAIN)
+        {
+          int ready = select_fd (fd, opt.read_timeout ? opt.read_timeout : -1,
+                                 gnutls_record_get_direction (session)
+                                 ? WAIT_FOR_WRITE : WAIT_FOR_READ);
+          if (ready <= 0)
+            {
+              logprintf (LOG_NOTQUIET, "GnuTLS: %s\n",
+                         ready ? strerror (errno) : strerror (ETIMEDOUT));
+              gnutls_deinit (session);
+              return false;
+            }
+        }
+    }
+  while (err == GNUTLS_E_AGAIN || err == GNUTLS_E_INTERRUPTED);
   if (err < 0)
     {
       logprintf (LOG_NOTQUIET, "GnuTLS: %s\n", gnutls_strerror (err));
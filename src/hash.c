@@ -50,6 +50,7 @@ as that of the covered work.  */
 # define xnew_array(type, x) xmalloc (sizeof (type) * (x))
 # define xmalloc malloc
 # define xfree free
+# define alloc_stats_retag(ptr, category) ((void) 0)
 # ifndef countof
 #  define countof(x) (sizeof (x) / sizeof ((x)[0]))
 # endif
@@ -64,6 +65,13 @@ as that of the covered work.  */
 
 #include "hash.h"
 
+#ifdef ENABLE_ALLOC_STATS
+/* The constructors are defined under their own names here.  */
+# undef hash_table_new
+# undef make_string_hash_table
+# undef make_nocase_string_hash_table
+#endif
+
 /* INTERFACE:
 
    Hash tables are a technique used to implement mapping between
@@ -165,6 +173,10 @@ struct hash_table {
                                    entries, resize the table.  */
   int prime_offset;             /* the offset of the current prime in
                                    the prime table. */
+#ifdef ENABLE_ALLOC_STATS
+  const char *alloc_category;   /* the category the storage is
+                                   accounted to. */
+#endif
 };
 
 /* We use the all-bits-set constant (INVALID_PTR) marker to mean that
@@ -299,10 +311,36 @@ hash_table_new (int items,
   memset (ht->cells, INVALID_PTR_CHAR, size * sizeof (struct cell));
 
   ht->count = 0;
+#ifdef ENABLE_ALLOC_STATS
+  ht->alloc_category = alloc_stats_category (__FILE__);
+#endif
+
+  return ht;
+}
 
+#ifdef ENABLE_ALLOC_STATS
+/* Account HT, and everything allocated for it from now on, to the
+   category of FILE, which is normally the file that created it.
+   Returns HT.  */
+
+struct hash_table *
+hash_table_account (struct hash_table *ht, const char *file)
+{
+  ht->alloc_category = alloc_stats_category (file);
+  alloc_stats_retag (ht, ht->alloc_category);
+  alloc_stats_retag (ht->cells, ht->alloc_category);
   return ht;
 }
 
+/* Return the category the storage of HT is accounted to.  */
+
+const char *
+hash_table_alloc_category (const struct hash_table *ht)
+{
+  return ht->alloc_category;
+}
+#endif /* ENABLE_ALLOC_STATS */
+
 /* Free the data associated with hash table HT. */
 
 void
@@ -402,6 +440,7 @@ grow_hash_table (struct hash_table *ht)
   cells = xnew_array (struct cell, newsize);
   memset (cells, INVALID_PTR_CHAR, newsize * sizeof (struct cell));
   ht->cells = cells;
+  alloc_stats_retag (cells, ht->alloc_category);
 
   for (c = old_cells; c < old_end; c++)
     if (CELL_OCCUPIED (c))
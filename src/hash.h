@@ -63,4 +63,17 @@ struct hash_table *make_nocase_string_hash_table (int);
 
 unsigned long hash_pointer (const void *);
 
+#ifdef ENABLE_ALLOC_STATS
+/* Account the storage of a table to the file that created it rather
+   than to hash.c.  The keys of string sets follow the table.  */
+struct hash_table *hash_table_account (struct hash_table *, const char *);
+const char *hash_table_alloc_category (const struct hash_table *);
+# define hash_table_new(items, hash, test) \
+  hash_table_account (hash_table_new (items, hash, test), __FILE__)
+# define make_string_hash_table(items) \
+  hash_table_account (make_string_hash_table (items), __FILE__)
+# define make_nocase_string_hash_table(items) \
+  hash_table_account (make_nocase_string_hash_table (items), __FILE__)
+#endif
+
 #endif /* HASH_H */
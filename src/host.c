@@ -35,6 +35,7 @@ as that of the covered work.  */
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #ifndef WINDOWS
 # include <sys/types.h>
@@ -56,12 +57,24 @@ as that of the covered work.  */
 #endif /* WINDOWS */
 
 #include <errno.h>
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <unistd.h>
+# include <signal.h>
+# include <sys/wait.h>
+# define USE_FORK
+#endif
 
 #include "utils.h"
 #include "host.h"
+#include "connect.h"
+#include "ptimer.h"
 #include "url.h"
 #include "hash.h"
 
+#ifdef TESTING
+#include "test.h"
+#endif
+
 #ifndef NO_ADDRESS
 # define NO_ADDRESS NO_DATA
 #endif
@@ -141,17 +154,256 @@ address_list_contains (const struct address_list *al, const ip_address *ip)
     }
 }
 
+/* What Wget has learned about connecting to each address: kept apart
+   from the address lists, so that it survives refreshing the DNS
+   cache and applies to all the host names of an address, and with
+   --address-stats, saved across runs.  */
+
+struct address_stats {
+  double rtt;                   /* moving average of the connect time,
+                                   in seconds; 0 if never connected */
+  int failures;                 /* failed attempts since the last
+                                   successful one */
+  time_t failed_at;             /* time of the last failed attempt */
+};
+
+/* Mapping between addresses, as printed by print_address, and their
+   stats.  */
+static struct hash_table *address_stats_map;
+static bool address_stats_loaded;
+
+/* The weight of the latest connect time in the moving average.  */
+#define RTT_WEIGHT 0.3
+
+/* An address is avoided for this many seconds after a failed attempt,
+   doubled for each further failure, up to MAX_FAILURE_BACKOFF.  */
+#define FAILURE_BACKOFF 60
+#define MAX_FAILURE_BACKOFF 3600
+
+/* Load the stats saved with --address-stats, the first time they are
+   needed.  A file that doesn't exist yet is not an error.  */
+
+static void
+address_stats_load (void)
+{
+  FILE *fp;
+  char *line;
+
+  if (address_stats_loaded || !opt.address_stats)
+    return;
+  address_stats_loaded = true;
+
+  fp = fopen (opt.address_stats, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open address stats file %s: %s\n"),
+                   quote (opt.address_stats), strerror (errno));
+      return;
+    }
+  if (!address_stats_map)
+    address_stats_map = make_string_hash_table (0);
+  for (; (line = read_whole_line (fp)) != NULL; xfree (line))
+    {
+      char addr[64];
+      double rtt;
+      int failures;
+      long failed_at;
+      struct address_stats *st;
+
+      if (*line == '#'
+          || sscanf (line, "%63s %lf %d %ld", addr, &rtt, &failures,
+                     &failed_at) != 4
+          || !is_valid_ip_address (addr)
+          || hash_table_contains (address_stats_map, addr))
+        continue;
+      st = xnew0 (struct address_stats);
+      st->rtt = rtt / 1000;
+      st->failures = failures;
+      st->failed_at = failed_at;
+      hash_table_put (address_stats_map, xstrdup (addr), st);
+    }
+  fclose (fp);
+}
+
+/* Save the stats to the file given with --address-stats.  */
+
+void
+address_stats_save (void)
+{
+  FILE *fp;
+  hash_table_iterator iter;
+
+  if (!opt.address_stats || !address_stats_map)
+    return;
+
+  DEBUGP (("Saving address stats to %s.\n", opt.address_stats));
+  fp = fopen (opt.address_stats, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open address stats file %s: %s\n"),
+                 quote (opt.address_stats), strerror (errno));
+      return;
+    }
+  fputs ("# Wget address stats: address, average connect time in ms,\n"
+         "# failures since the last connection, time of the last failure.\n",
+         fp);
+  for (hash_table_iterate (address_stats_map, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      struct address_stats *st = iter.value;
+      fprintf (fp, "%s %.1f %d %ld\n", (char *) iter.key, st->rtt * 1000,
+               st->failures, (long) st->failed_at);
+    }
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (opt.address_stats), strerror (errno));
+}
+
+/* Return the stats of IP, creating them if CREATE is true.  Otherwise
+   returns NULL for an address nothing is known about.  */
+
+static struct address_stats *
+address_stats_get (const ip_address *ip, bool create)
+{
+  char key[ADDRESS_STRING_SIZE];
+  struct address_stats *st;
+
+  address_to_string (key, ip);
+
+  address_stats_load ();
+  if (!address_stats_map)
+    {
+      if (!create)
+        return NULL;
+      address_stats_map = make_string_hash_table (0);
+    }
+  st = hash_table_get (address_stats_map, key);
+  if (!st && create)
+    {
+      st = xnew0 (struct address_stats);
+      hash_table_put (address_stats_map, xstrdup (key), st);
+    }
+  return st;
+}
+
+/* Return true if the address with stats ST failed recently enough to
+   be avoided at time NOW.  */
+
+static bool
+address_failing_p (const struct address_stats *st, time_t now)
+{
+  long backoff = FAILURE_BACKOFF;
+  int i;
+
+  if (!st || !st->failures)
+    return false;
+  for (i = 1; i < st->failures && backoff < MAX_FAILURE_BACKOFF; i++)
+    backoff *= 2;
+  if (backoff > MAX_FAILURE_BACKOFF)
+    backoff = MAX_FAILURE_BACKOFF;
+  return now - st->failed_at < backoff;
+}
+
+/* An address with its stats, for address_list_order.  */
+
+struct ranked_address {
+  ip_address ip;
+  bool failing;
+  int family_rank;
+  double rtt;
+};
+
+static int
+cmp_ranked_address (const void *a1, const void *a2)
+{
+  const struct ranked_address *r1 = a1, *r2 = a2;
+
+  /* The failing addresses come first, below al->faulty.  */
+  if (r1->failing != r2->failing)
+    return r1->failing ? -1 : 1;
+  if (r1->family_rank != r2->family_rank)
+    return r1->family_rank - r2->family_rank;
+  /* Then the fastest, and the ones never connected to last, in the
+     order DNS gave them.  */
+  if (!r1->rtt || !r2->rtt)
+    return !r1->rtt - !r2->rtt;
+  return r1->rtt < r2->rtt ? -1 : r1->rtt > r2->rtt;
+}
+
+/* Order the addresses of AL so that the ones that connected the
+   fastest are tried first, within the order of families requested by
+   --prefer-family, and mark the ones that failed recently as faulty,
+   unless all of them did.  */
+
+static void
+address_list_order (struct address_list *al)
+{
+  struct ranked_address *ranked;
+  time_t now;
+  int i, failing = 0;
+  bool known = false;
+
+  if (al->count < 2)
+    return;
+  for (i = 0; i < al->count && !known; i++)
+    known = address_stats_get (al->addresses + i, false) != NULL;
+  if (!known)
+    return;
+
+  now = time (NULL);
+  ranked = xnew_array (struct ranked_address, al->count);
+  for (i = 0; i < al->count; i++)
+    {
+      struct address_stats *st = address_stats_get (al->addresses + i, false);
+      ranked[i].ip = al->addresses[i];
+      ranked[i].failing = address_failing_p (st, now);
+      ranked[i].family_rank = 0;
+#ifdef ENABLE_IPV6
+      if (opt.prefer_family != prefer_none)
+        ranked[i].family_rank = (al->addresses[i].family == AF_INET)
+          != (opt.prefer_family == prefer_ipv4);
+#endif
+      ranked[i].rtt = st ? st->rtt : 0;
+      if (ranked[i].failing)
+        ++failing;
+    }
+  stable_sort (ranked, al->count, sizeof (struct ranked_address),
+               cmp_ranked_address);
+  for (i = 0; i < al->count; i++)
+    al->addresses[i] = ranked[i].ip;
+  xfree (ranked);
+
+  al->faulty = failing < al->count ? failing : 0;
+  IF_DEBUG
+    {
+      debug_logprintf ("Address order:");
+      for (i = 0; i < al->count; i++)
+        debug_logprintf (" %s%s", print_address (al->addresses + i),
+                         i < al->faulty ? " (failing)" : "");
+      debug_logprintf ("\n");
+    }
+}
+
 /* Mark the INDEXth element of AL as faulty, so that the next time
-   this address list is used, the faulty element will be skipped.  */
+   this address list is used, the faulty element will be skipped.
+   The failure is remembered for the address.  */
 
 void
 address_list_set_faulty (struct address_list *al, int index)
 {
+  struct address_stats *st;
+
   /* We assume that the address list is traversed in order, so that a
      "faulty" attempt is always preceded with all-faulty addresses,
      and this is how Wget uses it.  */
   assert (index == al->faulty);
 
+  st = address_stats_get (al->addresses + index, true);
+  ++st->failures;
+  st->failed_at = time (NULL);
+
   ++al->faulty;
   if (al->faulty >= al->count)
     /* All addresses have been proven faulty.  Since there's not much
@@ -162,11 +414,21 @@ address_list_set_faulty (struct address_list *al, int index)
 }
 
 /* Set the "connected" flag to true.  This flag used by connect.c to
-   see if the host perhaps needs to be resolved again.  */
+   see if the host perhaps needs to be resolved again.  Connecting to
+   the INDEXth element of AL took ELAPSED seconds, which goes into the
+   average connect time of the address.  */
 
 void
-address_list_set_connected (struct address_list *al)
+address_list_set_connected (struct address_list *al, int index,
+                            double elapsed)
 {
+  struct address_stats *st = address_stats_get (al->addresses + index, true);
+
+  /* Don't let a zero reading pass for "never connected".  */
+  if (elapsed <= 0)
+    elapsed = 1e-6;
+  st->rtt = st->rtt ? st->rtt + RTT_WEIGHT * (elapsed - st->rtt) : elapsed;
+  st->failures = 0;
   al->connected = true;
 }
 
@@ -310,43 +572,8 @@ address_list_release (struct address_list *al)
     }
 }
 
-/* Versions of gethostbyname and getaddrinfo that support timeout. */
-
 #ifndef ENABLE_IPV6
 
-struct ghbnwt_context {
-  const char *host_name;
-  struct hostent *hptr;
-};
-
-static void
-gethostbyname_with_timeout_callback (void *arg)
-{
-  struct ghbnwt_context *ctx = (struct ghbnwt_context *)arg;
-  ctx->hptr = gethostbyname (ctx->host_name);
-}
-
-/* Just like gethostbyname, except it times out after TIMEOUT seconds.
-   In case of timeout, NULL is returned and errno is set to ETIMEDOUT.
-   The function makes sure that when NULL is returned for reasons
-   other than timeout, errno is reset.  */
-
-static struct hostent *
-gethostbyname_with_timeout (const char *host_name, double timeout)
-{
-  struct ghbnwt_context ctx;
-  ctx.host_name = host_name;
-  if (run_with_timeout (timeout, gethostbyname_with_timeout_callback, &ctx))
-    {
-      SET_H_ERRNO (HOST_NOT_FOUND);
-      errno = ETIMEDOUT;
-      return NULL;
-    }
-  if (!ctx.hptr)
-    errno = 0;
-  return ctx.hptr;
-}
-
 /* Print error messages for host errors.  */
 static const char *
 host_errstr (int error)
@@ -367,63 +594,480 @@ host_errstr (int error)
     return _("Unknown error");
 }
 
+/* The error code reported by resolve_with_timeout when the lookup
+   fails for a reason given by errno, such as a timeout.  */
+# define RESOLVE_SYSTEM_ERROR NO_RECOVERY
+
 #else  /* ENABLE_IPV6 */
 
-struct gaiwt_context {
-  const char *node;
-  const char *service;
-  const struct addrinfo *hints;
-  struct addrinfo **res;
-  int exit_code;
+# define RESOLVE_SYSTEM_ERROR EAI_SYSTEM
+
+#endif /* ENABLE_IPV6 */
+
+/* A name lookup to be performed by resolve.  */
+
+struct resolve_args {
+  const char *host;
+#ifdef ENABLE_IPV6
+  struct addrinfo hints;
+#endif
 };
 
+/* Resolve ARGS->host, waiting as long as the resolver takes.  Returns
+   the list of its addresses, or NULL with the error code stored to
+   *ERR: the return value of getaddrinfo (with errno set in case of
+   EAI_SYSTEM), or h_errno where gethostbyname is used.  *ERR is 0 if
+   the lookup succeeded without yielding any usable address.  */
+
+static struct address_list *
+resolve (const struct resolve_args *args, int *err)
+{
+#ifdef ENABLE_IPV6
+  struct addrinfo *res = NULL;
+  struct address_list *al;
+
+  *err = getaddrinfo (args->host, NULL, &args->hints, &res);
+  if (*err != 0 || res == NULL)
+    return NULL;
+  al = address_list_from_addrinfo (res);
+  freeaddrinfo (res);
+  return al;
+#else  /* not ENABLE_IPV6 */
+  struct hostent *hptr = gethostbyname (args->host);
+  if (!hptr)
+    {
+      *err = h_errno;
+      errno = 0;
+      return NULL;
+    }
+  *err = 0;
+  /* Do older systems have h_addr_list?  */
+  return address_list_from_ipv4_addresses (hptr->h_addr_list);
+#endif /* not ENABLE_IPV6 */
+}
+
+/* Versions of resolve that support timeout.  The resolver is never
+   interrupted by a signal, because getaddrinfo and gethostbyname are
+   not safe to jump out of.  Where fork is available, lookups are
+   instead handed to a resolver process, which sends the addresses
+   back through a pipe, and which is killed if they don't arrive in
+   time; each lookup thus has a deadline of its own, and giving up on
+   one leaves nothing behind in Wget.  The process is started by the
+   first lookup that has a timeout and serves the following ones, so
+   a run pays for a single fork, plus one for each lookup that timed
+   out.  Elsewhere the lookup is left to run_with_timeout, which uses
+   a thread under Windows.  */
+
+#ifdef USE_FORK
+
+/* A lookup sent to the resolver process.  It is followed by HOSTLEN
+   bytes of the host name.  */
+
+struct resolve_request {
+  int family;                   /* the hints passed to getaddrinfo */
+  int socktype;
+  int flags;
+  int hostlen;
+};
+
+/* The header of the reply of the resolver process.  It is followed
+   by COUNT addresses.  */
+
+struct resolve_reply {
+  int err;                      /* the error code of resolve */
+  int saved_errno;              /* errno after resolve */
+  int count;                    /* the number of addresses */
+};
+
+/* The resolver process, or 0 if there is none, the process that
+   started it, and the pipes that lead to and from it.  */
+static pid_t resolver_pid;
+static pid_t resolver_owner;
+static int resolver_requests = -1;
+static int resolver_replies = -1;
+
+/* The host whose lookup lookup_host_async sent to the resolver
+   process, if its reply hasn't been read yet.  */
+static char *resolver_pending;
+
+/* Read SIZE bytes from FD to BUF, giving up when TIMER reaches
+   DEADLINE seconds.  Returns false on timeout, with errno set to
+   ETIMEDOUT, and in case of error or premature EOF.  */
+
+static bool
+read_until_deadline (int fd, void *buf, size_t size, struct ptimer *timer,
+                     double deadline)
+{
+  char *p = buf;
+
+  while (size > 0)
+    {
+      double left = deadline - ptimer_measure (timer);
+      ssize_t nread;
+      int ready;
+
+      if (left <= 0)
+        {
+          errno = ETIMEDOUT;
+          return false;
+        }
+      ready = select_fd (fd, left, WAIT_FOR_READ);
+      if (ready == 0)
+        {
+          errno = ETIMEDOUT;
+          return false;
+        }
+      if (ready < 0)
+        return false;
+      nread = read (fd, p, size);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread <= 0)
+        {
+          if (nread == 0)
+            errno = EPIPE;
+          return false;
+        }
+      p += nread;
+      size -= nread;
+    }
+  return true;
+}
+
+/* Read SIZE bytes from FD to BUF, waiting as long as it takes.  */
+
+static bool
+read_fully (int fd, void *buf, size_t size)
+{
+  char *p = buf;
+
+  while (size > 0)
+    {
+      ssize_t nread = read (fd, p, size);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread <= 0)
+        return false;
+      p += nread;
+      size -= nread;
+    }
+  return true;
+}
+
+/* Write SIZE bytes of BUF to FD.  */
+
+static bool
+write_fully (int fd, const void *buf, size_t size)
+{
+  const char *p = buf;
+
+  while (size > 0)
+    {
+      ssize_t nwritten = write (fd, p, size);
+      if (nwritten < 0 && errno == EINTR)
+        continue;
+      if (nwritten <= 0)
+        return false;
+      p += nwritten;
+      size -= nwritten;
+    }
+  return true;
+}
+
+/* The body of the resolver process: serve the lookups arriving on
+   IN, writing the replies to OUT, until Wget goes away.  */
+
 static void
-getaddrinfo_with_timeout_callback (void *arg)
+resolver_serve (int in, int out)
 {
-  struct gaiwt_context *ctx = (struct gaiwt_context *)arg;
-  ctx->exit_code = getaddrinfo (ctx->node, ctx->service, ctx->hints, ctx->res);
+  struct resolve_request req;
+
+  while (read_fully (in, &req, sizeof (req)))
+    {
+      struct resolve_args args;
+      struct resolve_reply reply;
+      struct address_list *al;
+      char *host;
+
+      if (req.hostlen <= 0 || req.hostlen > 65536)
+        break;
+      host = xmalloc (req.hostlen + 1);
+      if (!read_fully (in, host, req.hostlen))
+        break;
+      host[req.hostlen] = '\0';
+
+      xzero (args);
+      args.host = host;
+#ifdef ENABLE_IPV6
+      args.hints.ai_family = req.family;
+      args.hints.ai_socktype = req.socktype;
+      args.hints.ai_flags = req.flags;
+#endif
+      al = resolve (&args, &reply.err);
+      reply.saved_errno = errno;
+      reply.count = al ? al->count : 0;
+      if (!write_fully (out, &reply, sizeof (reply))
+          || (al && !write_fully (out, al->addresses,
+                                  al->count * sizeof (ip_address))))
+        break;
+      if (al)
+        address_list_delete (al);
+      xfree (host);
+    }
 }
 
-/* Just like getaddrinfo, except it times out after TIMEOUT seconds.
-   In case of timeout, the EAI_SYSTEM error code is returned and errno
-   is set to ETIMEDOUT.  */
+/* Start the resolver process.  Returns false if it cannot be
+   started.  */
 
-static int
-getaddrinfo_with_timeout (const char *node, const char *service,
-                          const struct addrinfo *hints, struct addrinfo **res,
-                          double timeout)
+static bool
+resolver_start (void)
 {
-  struct gaiwt_context ctx;
-  ctx.node = node;
-  ctx.service = service;
-  ctx.hints = hints;
-  ctx.res = res;
+  int requests[2], replies[2];
+  pid_t pid;
+
+  if (pipe (requests) < 0)
+    return false;
+  if (pipe (replies) < 0)
+    {
+      close (requests[0]);
+      close (requests[1]);
+      return false;
+    }
 
-  if (run_with_timeout (timeout, getaddrinfo_with_timeout_callback, &ctx))
+  pid = fork ();
+  if (pid < 0)
     {
+      DEBUGP (("fork: %s\n", strerror (errno)));
+      close (requests[0]);
+      close (requests[1]);
+      close (replies[0]);
+      close (replies[1]);
+      return false;
+    }
+  if (pid == 0)
+    {
+      /* The child must not keep Wget's connections and files open
+         after Wget closes them.  They are all below FD_SETSIZE, as
+         select_fd requires.  */
+      int fd;
+      for (fd = 0; fd < FD_SETSIZE; fd++)
+        if (fd != requests[0] && fd != replies[1])
+          close (fd);
+      resolver_serve (requests[0], replies[1]);
+      /* Exit without running any of the parent's cleanup.  */
+      _exit (0);
+    }
+
+  close (requests[0]);
+  close (replies[1]);
+  resolver_pid = pid;
+  resolver_owner = getpid ();
+  resolver_requests = requests[1];
+  resolver_replies = replies[0];
+  return true;
+}
+
+/* Stop using the resolver process, killing it first if KILL_IT is
+   true.  A process that was inherited through fork is left to the
+   process that started it.  */
+
+static void
+resolver_stop (bool kill_it)
+{
+  int status;
+
+  if (!resolver_pid)
+    return;
+  close (resolver_requests);
+  close (resolver_replies);
+  if (resolver_owner == getpid ())
+    {
+      /* Closing the pipe is enough to make an idle resolver exit.  */
+      if (kill_it)
+        kill (resolver_pid, SIGKILL);
+      while (waitpid (resolver_pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    }
+  resolver_pid = 0;
+  resolver_requests = resolver_replies = -1;
+  xfree_null (resolver_pending);
+  resolver_pending = NULL;
+}
+
+/* Send the lookup described by ARGS to the resolver process, starting
+   it if needed.  A lookup started by lookup_host_async whose reply
+   hasn't arrived is given up.  Returns false if there is no resolver
+   process to send it to.  */
+
+static bool
+resolver_send (const struct resolve_args *args)
+{
+  struct resolve_request req;
+
+  if (resolver_pid && (resolver_owner != getpid () || resolver_pending))
+    resolver_stop (resolver_owner == getpid ());
+  if (!resolver_pid && !resolver_start ())
+    return false;
+
+  xzero (req);
+#ifdef ENABLE_IPV6
+  req.family = args->hints.ai_family;
+  req.socktype = args->hints.ai_socktype;
+  req.flags = args->hints.ai_flags;
+#endif
+  req.hostlen = strlen (args->host);
+  if (!write_fully (resolver_requests, &req, sizeof (req))
+      || !write_fully (resolver_requests, args->host, req.hostlen))
+    {
+      /* The resolver process is gone; do without it.  */
+      resolver_stop (true);
+      return false;
+    }
+  return true;
+}
+
+/* Read the reply of the resolver process to the lookup sent last,
+   giving up after TIMEOUT seconds, or waiting as long as it takes if
+   TIMEOUT is 0.  Returns false if no reply came, and otherwise stores
+   the addresses to *ALP, or NULL with the error code of resolve to
+   *ERR and errno set as resolve left it.  */
+
+static bool
+resolver_read_reply (double timeout, struct address_list **alp, int *err)
+{
+  struct address_list *al = NULL;
+  struct resolve_reply reply;
+  struct ptimer *timer = ptimer_new ();
+  bool done;
+
+#define READ_REPLY(buf, size) (timeout > 0                                   \
+  ? read_until_deadline (resolver_replies, buf, size, timer, timeout)       \
+  : read_fully (resolver_replies, buf, size))
+
+  done = READ_REPLY (&reply, sizeof (reply));
+  if (done && reply.count > 0)
+    {
+      al = xnew0 (struct address_list);
+      al->addresses = xnew_array (ip_address, reply.count);
+      al->count = reply.count;
+      al->refcount = 1;
+      done = READ_REPLY (al->addresses, reply.count * sizeof (ip_address));
+      if (!done)
+        {
+          address_list_delete (al);
+          al = NULL;
+        }
+    }
+#undef READ_REPLY
+  ptimer_destroy (timer);
+
+  if (!done)
+    return false;
+  if (!al)
+    {
+      *err = reply.err;
+      errno = reply.saved_errno;
+    }
+  *alp = al;
+  return true;
+}
+
+/* Just like resolve, except it gives up after TIMEOUT seconds.  In
+   case of timeout, NULL is returned, *ERR is set to
+   RESOLVE_SYSTEM_ERROR and errno to ETIMEDOUT.  */
+
+static struct address_list *
+resolve_with_timeout (const struct resolve_args *args, double timeout,
+                      int *err)
+{
+  struct address_list *al;
+  int save_errno;
+
+  if (timeout == 0)
+    return resolve (args, err);
+
+  if (!resolver_send (args))
+    return resolve (args, err);
+  if (!resolver_read_reply (timeout, &al, err))
+    {
+      /* A resolver that hasn't replied in time is still waiting for
+         the lookup; it is of no further use.  */
+      save_errno = errno;
+      resolver_stop (true);
+      *err = RESOLVE_SYSTEM_ERROR;
+      errno = save_errno;
+      return NULL;
+    }
+  return al;
+}
+
+#else  /* not USE_FORK */
+
+struct rwt_context {
+  const struct resolve_args *args;
+  int *err;
+  struct address_list *al;
+};
+
+static void
+resolve_with_timeout_callback (void *arg)
+{
+  struct rwt_context *ctx = (struct rwt_context *)arg;
+  ctx->al = resolve (ctx->args, ctx->err);
+}
+
+/* Just like resolve, except it gives up after TIMEOUT seconds.  In
+   case of timeout, NULL is returned, *ERR is set to
+   RESOLVE_SYSTEM_ERROR and errno to ETIMEDOUT.  */
+
+static struct address_list *
+resolve_with_timeout (const struct resolve_args *args, double timeout,
+                      int *err)
+{
+  struct rwt_context ctx;
+  ctx.args = args;
+  ctx.err = err;
+  ctx.al = NULL;
+
+  if (run_with_timeout (timeout, resolve_with_timeout_callback, &ctx))
+    {
+      *err = RESOLVE_SYSTEM_ERROR;
       errno = ETIMEDOUT;
-      return EAI_SYSTEM;
+      return NULL;
     }
-  return ctx.exit_code;
+  return ctx.al;
 }
 
-#endif /* ENABLE_IPV6 */
+#endif /* not USE_FORK */
 
-/* Return a textual representation of ADDR, i.e. the dotted quad for
-   IPv4 addresses, and the colon-separated list of hex words (with all
-   zeros omitted, etc.) for IPv6 addresses.  */
+/* Store a textual representation of ADDR to BUF, i.e. the dotted
+   quad for IPv4 addresses, and the colon-separated list of hex words
+   (with all zeros omitted, etc.) for IPv6 addresses.  BUF must hold
+   ADDRESS_STRING_SIZE bytes.  Returns BUF.  */
 
-const char *
-print_address (const ip_address *addr)
+char *
+address_to_string (char *buf, const ip_address *addr)
 {
 #ifdef ENABLE_IPV6
-  static char buf[64];
-  if (!inet_ntop (addr->family, IP_INADDR_DATA (addr), buf, sizeof buf))
-    snprintf (buf, sizeof buf, "<error: %s>", strerror (errno));
-  return buf;
+  if (!inet_ntop (addr->family, IP_INADDR_DATA (addr), buf,
+                  ADDRESS_STRING_SIZE))
+    snprintf (buf, ADDRESS_STRING_SIZE, "<error: %s>", strerror (errno));
 #else
-  return inet_ntoa (addr->data.d4);
+  strcpy (buf, inet_ntoa (addr->data.d4));
 #endif
+  return buf;
+}
+
+/* Like address_to_string, but return a static buffer, overwritten by
+   the next call.  Meant for log messages; a string that goes to the
+   network or serves as a key should be built with
+   address_to_string.  */
+
+const char *
+print_address (const ip_address *addr)
+{
+  static char buf[ADDRESS_STRING_SIZE];
+  return address_to_string (buf, addr);
 }
 
 /* The following two functions were adapted from glibc's
@@ -637,6 +1281,109 @@ cache_remove (const char *host)
       hash_table_remove (host_name_addresses_map, host);
     }
 }
+
+/* Set up ARGS to look up HOST the way lookup_host does with FLAGS.  */
+
+static void
+lookup_args_init (struct resolve_args *args, const char *host, int flags)
+{
+  xzero (*args);
+  args->host = host;
+#ifdef ENABLE_IPV6
+  args->hints.ai_socktype = SOCK_STREAM;
+  if (opt.ipv4_only)
+    args->hints.ai_family = AF_INET;
+  else if (opt.ipv6_only)
+    args->hints.ai_family = AF_INET6;
+  else
+    /* We tried using AI_ADDRCONFIG, but removed it because: it
+       misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
+       it's unneeded since we sort the addresses anyway.  */
+      args->hints.ai_family = AF_UNSPEC;
+
+  if (flags & LH_BIND)
+    args->hints.ai_flags |= AI_PASSIVE;
+#endif /* ENABLE_IPV6 */
+}
+
+/* Reorder the addresses of AL so that IPv4 ones (or IPv6 ones, as per
+   --prefer-family) come first.  Sorting is stable so the order of the
+   addresses with the same family is undisturbed.  */
+
+static void
+sort_preferred_family (struct address_list *al)
+{
+#ifdef ENABLE_IPV6
+  if (al->count > 1 && opt.prefer_family != prefer_none)
+    stable_sort (al->addresses, al->count, sizeof (ip_address),
+                 opt.prefer_family == prefer_ipv4
+                 ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+#endif
+}
+
+#ifdef USE_FORK
+
+/* Read the reply to the lookup started by lookup_host_async into the
+   cache.  If WAIT is false, this is only done if the reply has
+   arrived; otherwise it is waited for as long as --dns-timeout
+   allows.  */
+
+static void
+resolver_collect (bool wait)
+{
+  struct address_list *al;
+  int err;
+
+  if (!resolver_pending || resolver_owner != getpid ())
+    return;
+  if (!wait && select_fd (resolver_replies, 0, WAIT_FOR_READ) <= 0)
+    return;
+  if (!resolver_read_reply (opt.dns_timeout, &al, &err))
+    {
+      resolver_stop (true);
+      return;
+    }
+  if (al)
+    {
+      sort_preferred_family (al);
+      address_list_order (al);
+      cache_store (resolver_pending, al);
+      address_list_release (al);
+    }
+  xfree (resolver_pending);
+  resolver_pending = NULL;
+}
+
+#endif /* USE_FORK */
+
+/* Start looking up HOST in the background, so that a later
+   lookup_host finds its addresses in the cache without waiting.
+   Only one such lookup is under way at a time.  Returns false if it
+   cannot be started, because another one is under way, because of
+   --no-dns-cache, or because the lookup cannot be left to another
+   process on this system.  */
+
+bool
+lookup_host_async (const char *host)
+{
+#ifdef USE_FORK
+  struct resolve_args args;
+
+  if (!opt.dns_cache)
+    return false;
+  resolver_collect (false);
+  if (resolver_pending && resolver_owner == getpid ())
+    return 0 == strcasecmp (resolver_pending, host);
+  lookup_args_init (&args, host, 0);
+  if (!resolver_send (&args))
+    return false;
+  resolver_pending = xstrdup (host);
+  DEBUGP (("Resolving %s in the background.\n", host));
+  return true;
+#else
+  return false;
+#endif
+}
 
 /* Look up HOST in DNS and return a list of IP addresses.
 
@@ -658,7 +1405,9 @@ cache_remove (const char *host)
                   IPv6 means to use AI_PASSIVE flag to getaddrinfo.
                   Passive lookups are not cached under IPv6.
      LH_REFRESH - if HOST is cached, remove the entry from the cache
-                  and resolve it anew.  */
+                  and resolve it anew.
+     LH_CACHED  - don't ask the resolver; return NULL unless HOST is
+                  cached or is a numeric address.  */
 
 struct address_list *
 lookup_host (const char *host, int flags)
@@ -710,18 +1459,33 @@ lookup_host (const char *host, int flags)
   /* Try to find the host in the cache so we don't need to talk to the
      resolver.  If LH_REFRESH is requested, remove HOST from the cache
      instead.  */
+#ifdef USE_FORK
+  /* A lookup started by lookup_host_async may have filled the cache
+     in the meantime.  One about HOST is waited for rather than sent
+     again.  */
+  if (resolver_pending)
+    resolver_collect (!(flags & LH_CACHED)
+                      && 0 == strcasecmp (resolver_pending, host));
+#endif
+
   if (use_cache)
     {
       if (!(flags & LH_REFRESH))
         {
           al = cache_query (host);
           if (al)
-            return al;
+            {
+              address_list_order (al);
+              return al;
+            }
         }
       else
         cache_remove (host);
     }
 
+  if ((flags & LH_CACHED) && !numeric_address)
+    return NULL;
+
   /* No luck with the cache; resolve HOST. */
 
   if (!silent && !numeric_address)
@@ -744,82 +1508,51 @@ lookup_host (const char *host, int flags)
         xfree (str);
     }
 
-#ifdef ENABLE_IPV6
   {
+    struct resolve_args args;
     int err;
-    struct addrinfo hints, *res;
-
-    xzero (hints);
-    hints.ai_socktype = SOCK_STREAM;
-    if (opt.ipv4_only)
-      hints.ai_family = AF_INET;
-    else if (opt.ipv6_only)
-      hints.ai_family = AF_INET6;
-    else
-      /* We tried using AI_ADDRCONFIG, but removed it because: it
-         misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
-         it's unneeded since we sort the addresses anyway.  */
-        hints.ai_family = AF_UNSPEC;
-
-    if (flags & LH_BIND)
-      hints.ai_flags |= AI_PASSIVE;
 
+    lookup_args_init (&args, host, flags);
+#ifdef ENABLE_IPV6
 #ifdef AI_NUMERICHOST
     if (numeric_address)
       {
         /* Where available, the AI_NUMERICHOST hint can prevent costly
            access to DNS servers.  */
-        hints.ai_flags |= AI_NUMERICHOST;
+        args.hints.ai_flags |= AI_NUMERICHOST;
         timeout = 0;            /* no timeout needed when "resolving"
-                                   numeric hosts -- avoid setting up
-                                   signal handlers and such. */
+                                   numeric hosts -- avoid starting a
+                                   resolver process and such. */
       }
 #endif
+#endif /* ENABLE_IPV6 */
 
-    err = getaddrinfo_with_timeout (host, NULL, &hints, &res, timeout);
-    if (err != 0 || res == NULL)
-      {
-        if (!silent)
-          logprintf (LOG_VERBOSE, _("failed: %s.\n"),
-                     err != EAI_SYSTEM ? gai_strerror (err) : strerror (errno));
-        return NULL;
-      }
-    al = address_list_from_addrinfo (res);
-    freeaddrinfo (res);
+    al = resolve_with_timeout (&args, timeout, &err);
     if (!al)
-      {
-        logprintf (LOG_VERBOSE,
-                   _("failed: No IPv4/IPv6 addresses for host.\n"));
-        return NULL;
-      }
-
-    /* Reorder addresses so that IPv4 ones (or IPv6 ones, as per
-       --prefer-family) come first.  Sorting is stable so the order of
-       the addresses with the same family is undisturbed.  */
-    if (al->count > 1 && opt.prefer_family != prefer_none)
-      stable_sort (al->addresses, al->count, sizeof (ip_address),
-                   opt.prefer_family == prefer_ipv4
-                   ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
-  }
-#else  /* not ENABLE_IPV6 */
-  {
-    struct hostent *hptr = gethostbyname_with_timeout (host, timeout);
-    if (!hptr)
       {
         if (!silent)
           {
+#ifdef ENABLE_IPV6
+            if (err == 0)
+              logputs (LOG_VERBOSE,
+                       _("failed: No IPv4/IPv6 addresses for host.\n"));
+            else
+              logprintf (LOG_VERBOSE, _("failed: %s.\n"),
+                         err != EAI_SYSTEM
+                         ? gai_strerror (err) : strerror (errno));
+#else  /* not ENABLE_IPV6 */
             if (errno != ETIMEDOUT)
               logprintf (LOG_VERBOSE, _("failed: %s.\n"),
-                         host_errstr (h_errno));
+                         host_errstr (err));
             else
               logputs (LOG_VERBOSE, _("failed: timed out.\n"));
+#endif /* not ENABLE_IPV6 */
           }
         return NULL;
       }
-    /* Do older systems have h_addr_list?  */
-    al = address_list_from_ipv4_addresses (hptr->h_addr_list);
+
+    sort_preferred_family (al);
   }
-#endif /* not ENABLE_IPV6 */
 
   /* Print the addresses determined by DNS lookup, but no more than
      three if show_all_dns_entries is not specified.  */
@@ -842,6 +1575,9 @@ lookup_host (const char *host, int flags)
       logputs (LOG_VERBOSE, "\n");
     }
 
+  if (!(flags & LH_BIND))
+    address_list_order (al);
+
   /* Cache the lookup information. */
   if (use_cache)
     cache_store (host, al);
@@ -913,6 +1649,16 @@ host_cleanup (void)
       hash_table_destroy (host_name_addresses_map);
       host_name_addresses_map = NULL;
     }
+#ifdef USE_FORK
+  resolver_stop (false);
+#endif
+  if (address_stats_map)
+    {
+      free_keys_and_values (address_stats_map);
+      hash_table_destroy (address_stats_map);
+      address_stats_map = NULL;
+    }
+  address_stats_loaded = false;
 }
 
 bool
@@ -929,3 +1675,123 @@ is_valid_ip_address (const char *name)
 #endif
   return false;
 }
+
+#ifdef TESTING
+
+/* Return true if the average connect time of IP is RTT, to within a
+   microsecond.  */
+
+static bool
+test_rtt_is (const ip_address *ip, double rtt)
+{
+  struct address_stats *st = address_stats_get (ip, false);
+  return st && st->rtt - rtt < 1e-6 && rtt - st->rtt < 1e-6;
+}
+
+const char *
+test_address_list_order()
+{
+  ip_address addrs[3], ips[3];
+  struct address_list al;
+  struct address_stats st;
+  char *saved_stats = opt.address_stats;
+  time_t now = time (NULL);
+  int saved_family = opt.prefer_family;
+  int i;
+
+  opt.address_stats = NULL;
+  opt.prefer_family = prefer_none;
+  for (i = 0; i < 3; i++)
+    {
+      xzero (ips[i]);
+      ips[i].family = AF_INET;
+      ips[i].data.d4.s_addr = htonl (0x0a000001 + i);
+      addrs[i] = ips[i];
+    }
+  xzero (al);
+  al.count = 3;
+  al.addresses = addrs;
+  al.refcount = 1;
+
+  /* Nothing known: the order of DNS is kept.  */
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: no stats",
+             address_list_contains (&al, &ips[0])
+             && !memcmp (&addrs[0], &ips[0], sizeof (ip_address))
+             && !memcmp (&addrs[2], &ips[2], sizeof (ip_address)));
+
+  /* The fastest address comes first, the ones never connected to
+     last.  */
+  address_list_set_connected (&al, 0, 0.5);
+  address_list_set_connected (&al, 1, 0.1);
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: fastest first",
+             !memcmp (&addrs[0], &ips[1], sizeof (ip_address))
+             && !memcmp (&addrs[1], &ips[0], sizeof (ip_address))
+             && !memcmp (&addrs[2], &ips[2], sizeof (ip_address))
+             && al.faulty == 0);
+
+  /* A single slow connection moves the average only part of the
+     way; a second one overtakes.  */
+  address_list_set_connected (&al, 0, 1.0);
+  mu_assert ("test_address_list_order: moving average",
+             test_rtt_is (&ips[1], 0.1 + RTT_WEIGHT * 0.9));
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: one slow connection",
+             !memcmp (&addrs[0], &ips[1], sizeof (ip_address)));
+  address_list_set_connected (&al, 0, 1.0);
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: slower on average",
+             !memcmp (&addrs[0], &ips[0], sizeof (ip_address))
+             && !memcmp (&addrs[1], &ips[1], sizeof (ip_address)));
+
+  /* A failed address is marked faulty and skipped until its backoff
+     is over.  */
+  address_list_set_faulty (&al, 0);
+  mu_assert ("test_address_list_order: set faulty", al.faulty == 1);
+  al.faulty = 0;
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: failing address skipped",
+             al.faulty == 1
+             && !memcmp (&addrs[0], &ips[0], sizeof (ip_address))
+             && !memcmp (&addrs[1], &ips[1], sizeof (ip_address)));
+
+  /* The backoff doubles with each failure, up to a limit.  */
+  xzero (st);
+  st.failures = 1;
+  st.failed_at = now - FAILURE_BACKOFF - 1;
+  mu_assert ("test_address_list_order: backoff over",
+             !address_failing_p (&st, now));
+  st.failures = 2;
+  mu_assert ("test_address_list_order: backoff doubled",
+             address_failing_p (&st, now));
+  st.failures = 50;
+  st.failed_at = now - MAX_FAILURE_BACKOFF + 1;
+  mu_assert ("test_address_list_order: longest backoff",
+             address_failing_p (&st, now));
+  st.failed_at = now - MAX_FAILURE_BACKOFF - 1;
+  mu_assert ("test_address_list_order: longest backoff over",
+             !address_failing_p (&st, now));
+
+  /* When all the addresses are failing, none is skipped.  */
+  address_list_set_faulty (&al, 1);
+  address_list_set_faulty (&al, 2);
+  al.faulty = 0;
+  address_list_order (&al);
+  mu_assert ("test_address_list_order: all failing", al.faulty == 0);
+
+  /* Connecting clears the failures.  */
+  address_list_set_connected (&al, 0, 0.1);
+  mu_assert ("test_address_list_order: failures cleared",
+             !address_failing_p (address_stats_get (&addrs[0], false), now));
+
+  free_keys_and_values (address_stats_map);
+  hash_table_destroy (address_stats_map);
+  address_stats_map = NULL;
+  address_stats_loaded = false;
+  opt.prefer_family = saved_family;
+  opt.address_stats = saved_stats;
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -81,18 +81,25 @@ typedef struct {
 enum {
   LH_SILENT  = 1,
   LH_BIND    = 2,
-  LH_REFRESH = 4
+  LH_REFRESH = 4,
+  LH_CACHED  = 8
 };
 struct address_list *lookup_host (const char *, int);
+bool lookup_host_async (const char *);
 
 void address_list_get_bounds (const struct address_list *, int *, int *);
 const ip_address *address_list_address_at (const struct address_list *, int);
 bool address_list_contains (const struct address_list *, const ip_address *);
 void address_list_set_faulty (struct address_list *, int);
-void address_list_set_connected (struct address_list *);
+void address_list_set_connected (struct address_list *, int, double);
 bool address_list_connected_p (const struct address_list *);
 void address_list_release (struct address_list *);
+void address_stats_save (void);
 
+/* The size of the buffer address_to_string needs.  */
+#define ADDRESS_STRING_SIZE 64
+
+char *address_to_string (char *, const ip_address *);
 const char *print_address (const ip_address *);
 #ifdef ENABLE_IPV6
 bool is_valid_ipv6_address (const char *, const char *);
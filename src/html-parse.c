@@ -101,6 +101,7 @@ as that of the covered work.  */
 #include <assert.h>
 
 #include "utils.h"
+#include "arena.h"
 #include "html-parse.h"
 
 #ifdef STANDALONE
@@ -148,7 +149,8 @@ hash_table_get (const struct hash_table *ht, void *ptr)
    attribute, do not point into separately allocated areas, but into
    different parts of the pool, separated only by terminating zeros.
    This ensures minimum amount of allocation and, for most tags, no
-   allocation because the entire pool is kept on the stack.  */
+   allocation because the entire pool is kept on the stack.  If the
+   pool has an arena, the larger storage comes from the arena.  */
 
 struct pool {
   char *contents;               /* pointer to the contents. */
@@ -162,6 +164,9 @@ struct pool {
                                    to restore the pool to the initial
                                    state. */
   int orig_size;
+
+  struct arena *arena;          /* where to grow, or NULL for the
+                                   heap. */
 };
 
 /* Initialize the pool to hold INITIAL_SIZE bytes of storage. */
@@ -174,14 +179,39 @@ struct pool {
   P->resized = false;                                           \
   P->orig_contents = P->contents;                               \
   P->orig_size = P->size;                                       \
+  P->arena = NULL;                                              \
 } while (0)
 
+/* Grow POOL in its arena to hold at least NEEDED bytes.  The old
+   storage is simply left behind.  */
+
+static void
+pool_grow_in_arena (struct pool *pool, int needed)
+{
+  int newsize = pool->size;
+  char *contents;
+
+  while (newsize < needed)
+    newsize <<= 1;
+  if (newsize == pool->size)
+    return;
+  contents = arena_alloc (pool->arena, newsize);
+  memcpy (contents, pool->contents, pool->tail);
+  pool->contents = contents;
+  pool->size = newsize;
+}
+
 /* Grow the pool to accomodate at least SIZE new bytes.  If the pool
    already has room to accomodate SIZE bytes of data, this is a no-op.  */
 
-#define POOL_GROW(p, increase)                                  \
-  GROW_ARRAY ((p)->contents, (p)->size, (p)->tail + (increase), \
-              (p)->resized, char)
+#define POOL_GROW(p, increase) do {                                     \
+  struct pool *PG = (p);                                                \
+  if (PG->arena)                                                        \
+    pool_grow_in_arena (PG, PG->tail + (increase));                     \
+  else                                                                  \
+    GROW_ARRAY (PG->contents, PG->size, PG->tail + (increase),          \
+                PG->resized, char);                                     \
+} while (0)
 
 /* Append text in the range [beg, end) to POOL.  No zero-termination
    is done.  */
@@ -280,10 +310,24 @@ struct tagstack_item {
   struct tagstack_item *next;
 };
 
+/* Push a new item on the stack.  It is taken from SPARE, where the
+   popped items are kept for reuse, or allocated in ARENA, or on the
+   heap if ARENA is NULL.  */
 static struct tagstack_item *
-tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
+tagstack_push (struct tagstack_item **head, struct tagstack_item **tail,
+               struct tagstack_item **spare, struct arena *arena)
 {
-  struct tagstack_item *ts = xmalloc(sizeof(struct tagstack_item));
+  struct tagstack_item *ts;
+
+  if (*spare)
+    {
+      ts = *spare;
+      *spare = ts->next;
+    }
+  else if (arena)
+    ts = arena_alloc (arena, sizeof (struct tagstack_item));
+  else
+    ts = xmalloc (sizeof (struct tagstack_item));
   if (*head == NULL)
     {
       *head = *tail = ts;
@@ -300,10 +344,11 @@ tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
   return ts;
 }
 
-/* remove ts and everything after it from the stack */
+/* remove ts and everything after it from the stack, keeping the
+   items in SPARE */
 static void
 tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
-              struct tagstack_item *ts)
+              struct tagstack_item *ts, struct tagstack_item **spare)
 {
   if (*head == NULL)
     return;
@@ -312,15 +357,15 @@ tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
     {
       if (ts == *head)
         {
-          xfree (ts);
           *head = *tail = NULL;
         }
       else
         {
           ts->prev->next = NULL;
           *tail = ts->prev;
-          xfree (ts);
         }
+      ts->next = *spare;
+      *spare = ts;
     }
   else
     {
@@ -337,7 +382,8 @@ tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
       while (ts)
         {
           struct tagstack_item *p = ts->next;
-          xfree (ts);
+          ts->next = *spare;
+          *spare = ts;
           ts = p;
         }
     }
@@ -518,6 +564,35 @@ convert_and_copy (struct pool *pool, const char *beg, const char *end, int flags
     }
 }
 
+/* Return a newly allocated copy of the text in [BEG, END), with the
+   entities decoded as in attribute values.  This is for callers that
+   split a raw attribute value into parts of their own, such as the
+   candidates of srcset, and must keep the raw positions of the parts
+   for link conversion.  */
+
+char *
+html_decode_entities (const char *beg, const char *end)
+{
+  char *res = xmalloc (end - beg + 1);
+  char *to = res;
+
+  while (beg < end)
+    {
+      if (*beg == '&')
+        {
+          int entity = decode_entity (&beg, end);
+          if (entity != -1)
+            *to++ = entity;
+          else
+            *to++ = *beg++;
+        }
+      else
+        *to++ = *beg++;
+    }
+  *to = '\0';
+  return res;
+}
+
 /* Originally we used to adhere to rfc 1866 here, and allowed only
    letters, digits, periods, and hyphens as names (of tags or
    attributes).  However, this broke too many pages which used
@@ -825,14 +900,18 @@ static int tag_backout_count;
    (Obviously, the caller can filter out unwanted tags and attributes
    just as well, but this is just an optimization designed to avoid
    unnecessary copying of tags/attributes which the caller doesn't
-   care about.)  */
+   care about.)
+
+   If ARENA is not NULL, the memory needed while parsing is allocated
+   in it instead of on the heap.  */
 
 void
 map_html_tags (const char *text, int size,
                void (*mapfun) (struct taginfo *, void *), void *maparg,
                int flags,
                const struct hash_table *allowed_tags,
-               const struct hash_table *allowed_attributes)
+               const struct hash_table *allowed_attributes,
+               struct arena *arena)
 {
   /* storage for strings passed to MAPFUN callback; if 256 bytes is
      too little, POOL_APPEND allocates more with malloc. */
@@ -849,11 +928,13 @@ map_html_tags (const char *text, int size,
 
   struct tagstack_item *head = NULL;
   struct tagstack_item *tail = NULL;
+  struct tagstack_item *spare = NULL;
 
   if (!size)
     return;
 
   POOL_INIT (&pool, pool_initial_storage, countof (pool_initial_storage));
+  pool.arena = arena;
 
   {
     int nattrs, end_tag;
@@ -919,7 +1000,8 @@ map_html_tags (const char *text, int size,
 
     if (!end_tag)
       {
-        struct tagstack_item *ts = tagstack_push (&head, &tail);
+        struct tagstack_item *ts = tagstack_push (&head, &tail, &spare,
+                                                  arena);
         if (ts)
           {
             ts->tagname_begin  = tag_name_begin;
@@ -1136,7 +1218,7 @@ map_html_tags (const char *text, int size,
                   taginfo.contents_begin = ts->contents_begin;
                   taginfo.contents_end   = tag_start_position;
                 }
-              tagstack_pop (&head, &tail, ts);
+              tagstack_pop (&head, &tail, ts, &spare);
             }
         }
 
@@ -1161,7 +1243,14 @@ map_html_tags (const char *text, int size,
   if (attr_pair_resized)
     xfree (pairs);
   /* pop any tag stack that's left */
-  tagstack_pop (&head, &tail, head);
+  tagstack_pop (&head, &tail, head, &spare);
+  if (!arena)
+    while (spare)
+      {
+        struct tagstack_item *next = spare->next;
+        xfree (spare);
+        spare = next;
+      }
 }
 
 #undef ADVANCE
@@ -1196,7 +1285,7 @@ int main ()
       x = xrealloc (x, size);
     }
 
-  map_html_tags (x, length, test_mapper, &tag_counter, 0, NULL, NULL);
+  map_html_tags (x, length, test_mapper, &tag_counter, 0, NULL, NULL, NULL);
   printf ("TAGS: %d\n", tag_counter);
   printf ("Tag backouts:     %d\n", tag_backout_count);
   printf ("Comment backouts: %d\n", comment_backout_count);
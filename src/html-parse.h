@@ -58,14 +58,18 @@ struct taginfo {
 };
 
 struct hash_table;		/* forward declaration */
+struct arena;
 
 /* Flags for map_html_tags: */
 #define MHT_STRICT_COMMENTS  1  /* use strict comment interpretation */
 #define MHT_TRIM_VALUES      2  /* trim attribute values, e.g. interpret
                                    <a href=" foo "> as "foo" */
 
+char *html_decode_entities (const char *, const char *);
+
 void map_html_tags (const char *, int,
 		    void (*) (struct taginfo *, void *), void *, int,
-		    const struct hash_table *, const struct hash_table *);
+		    const struct hash_table *, const struct hash_table *,
+		    struct arena *);
 
 #endif /* HTML_PARSE_H */
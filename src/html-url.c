@@ -41,6 +41,7 @@ as that of the covered work.  */
 #include "url.h"
 #include "utils.h"
 #include "hash.h"
+#include "arena.h"
 #include "convert.h"
 #include "recur.h"
 #include "html-url.h"
@@ -77,6 +78,7 @@ enum {
   TAG_OBJECT,
   TAG_OVERLAY,
   TAG_SCRIPT,
+  TAG_SOURCE,
   TAG_TABLE,
   TAG_TD,
   TAG_TH
@@ -108,6 +110,7 @@ static struct known_tag {
   { TAG_OBJECT,  "object",      tag_find_urls },
   { TAG_OVERLAY, "overlay",     tag_find_urls },
   { TAG_SCRIPT,  "script",      tag_find_urls },
+  { TAG_SOURCE,  "source",      tag_find_urls },
   { TAG_TABLE,   "table",       tag_find_urls },
   { TAG_TD,      "td",          tag_find_urls },
   { TAG_TH,      "th",          tag_find_urls }
@@ -130,6 +133,10 @@ static struct known_tag {
    image.  */
 #define ATTR_HTML       2
 
+/* The attribute is a srcset, a list of alternative URLs of an image,
+   of which only some are retrieved, depending on --srcset.  */
+#define ATTR_SRCSET     4
+
 /* For tags handled by tag_find_urls: attributes that contain URLs to
    download. */
 static struct {
@@ -150,11 +157,13 @@ static struct {
   { TAG_IMG,            "href",         ATTR_INLINE },
   { TAG_IMG,            "lowsrc",       ATTR_INLINE },
   { TAG_IMG,            "src",          ATTR_INLINE },
+  { TAG_IMG,            "srcset",       ATTR_INLINE | ATTR_SRCSET },
   { TAG_INPUT,          "src",          ATTR_INLINE },
   { TAG_LAYER,          "src",          ATTR_INLINE | ATTR_HTML },
   { TAG_OBJECT,         "data",         ATTR_INLINE },
   { TAG_OVERLAY,        "src",          ATTR_INLINE | ATTR_HTML },
   { TAG_SCRIPT,         "src",          ATTR_INLINE },
+  { TAG_SOURCE,         "srcset",       ATTR_INLINE | ATTR_SRCSET },
   { TAG_TABLE,          "background",   ATTR_INLINE },
   { TAG_TD,             "background",   ATTR_INLINE },
   { TAG_TH,             "background",   ATTR_INLINE }
@@ -170,6 +179,7 @@ static const char *additional_attributes[] = {
   "name",                       /* used by tag_handle_meta  */
   "content",                    /* used by tag_handle_meta  */
   "action",                     /* used by tag_handle_form  */
+  "sizes",                      /* used by handle_srcset */
   "style"                       /* used by check_style_attr */
 };
 
@@ -290,7 +300,7 @@ append_url (const char *link_uri, int position, int size,
           return NULL;
         }
 
-      url = url_parse (link_uri, NULL, NULL, false);
+      url = url_parse_arena (link_uri, NULL, NULL, false, ctx->arena);
       if (!url)
         {
           DEBUGP (("%s: link \"%s\" doesn't parse.\n",
@@ -312,7 +322,7 @@ append_url (const char *link_uri, int position, int size,
                quote_n (2, link_uri),
                quotearg_n_style (3, escape_quoting_style, complete_uri)));
 
-      url = url_parse (complete_uri, NULL, NULL, false);
+      url = url_parse_arena (complete_uri, NULL, NULL, false, ctx->arena);
       if (!url)
         {
           DEBUGP (("%s: merged link \"%s\" doesn't parse.\n",
@@ -325,7 +335,11 @@ append_url (const char *link_uri, int position, int size,
 
   DEBUGP (("appending %s to urlpos.\n", quote (url->url)));
 
-  newel = xnew0 (struct urlpos);
+  if (ctx->arena)
+    newel = arena_alloc0 (ctx->arena, sizeof (struct urlpos));
+  else
+    newel = xnew0 (struct urlpos);
+  newel->arena = ctx->arena;
   newel->url = url;
   newel->pos = position;
   newel->size = size;
@@ -389,6 +403,183 @@ check_style_attr (struct taginfo *tag, struct map_context *ctx)
   get_urls_css (ctx, raw_start, raw_len);
 }
 
+/* The width of the display the candidates of a srcset are compared
+   for when --srcset does not give one.  Only their order matters
+   then, so any width will do.  */
+#define SRCSET_DEFAULT_WIDTH 1024
+
+/* Parse the number at *P, which may have a fractional part, and move
+   *P past it.  Returns -1 and leaves *P alone if there is none.  */
+
+static double
+srcset_number (const char **p, const char *end)
+{
+  const char *q = *p;
+  double value = 0, scale = 1;
+
+  if (q == end || !(c_isdigit (*q) || *q == '.'))
+    return -1;
+  for (; q < end && c_isdigit (*q); q++)
+    value = value * 10 + (*q - '0');
+  if (q < end && *q == '.')
+    for (q++; q < end && c_isdigit (*q); q++)
+      value += (*q - '0') * (scale /= 10);
+  *p = q;
+  return value;
+}
+
+/* Return the width, in CSS pixels, of the slot the image of TAG takes
+   up on a display WIDTH pixels wide, according to its sizes attribute.
+   Media conditions cannot be evaluated here, so the last size, which
+   applies when none of them matches, is used.  */
+
+static double
+srcset_slot_width (struct taginfo *tag, int width)
+{
+  const char *sizes = find_attr (tag, "sizes", NULL);
+  const char *p, *end;
+  double value;
+
+  if (!sizes)
+    return width;
+  p = strrchr (sizes, ',');
+  p = p ? p + 1 : sizes;
+  while (c_isspace (*p))
+    ++p;
+  end = p + strlen (p);
+  value = srcset_number (&p, end);
+  if (value <= 0)
+    return width;
+  if (0 == strncasecmp (p, "px", 2))
+    return value;
+  if (0 == strncasecmp (p, "vw", 2))
+    return width * value / 100;
+  return width;
+}
+
+/* Collect the candidate URLs of the srcset attribute at ATTRIND of
+   TAG, as in <img srcset="small.jpg 480w, large.jpg 1080w">.  Unless
+   --srcset=all was given, only one candidate is retrieved; the others
+   are only converted by -k.  */
+
+static void
+handle_srcset (struct taginfo *tag, int attrind, struct map_context *ctx)
+{
+  struct srcset_candidate {
+    struct urlpos *up;
+    double density;             /* image pixels per CSS pixel */
+  } *cands;
+  int raw_start = ATTR_POS (tag, attrind, ctx);
+  int raw_len = ATTR_SIZE (tag, attrind);
+  int width = (opt.srcset_policy == srcset_width
+               ? opt.srcset_width : SRCSET_DEFAULT_WIDTH);
+  double slot = srcset_slot_width (tag, width);
+  const char *p, *end;
+  int count = 0, chosen = -1, i;
+
+  /* Like check_style_attr, work on the raw text, without the quotes,
+     so that each candidate has its own position for -k.  */
+  if (raw_len > 0
+      && (ctx->text[raw_start] == '\'' || ctx->text[raw_start] == '"'))
+    {
+      raw_start += 1;
+      raw_len -= 2;
+    }
+  if (raw_len <= 0)
+    return;
+
+  p = ctx->text + raw_start;
+  end = p + raw_len;
+  cands = xnew_array (struct srcset_candidate, raw_len / 2 + 1);
+  while (p < end)
+    {
+      const char *url_b, *url_e;
+      double density = 1;
+      char *link;
+      struct urlpos *up;
+
+      while (p < end && (c_isspace (*p) || *p == ','))
+        ++p;
+      if (p == end)
+        break;
+
+      /* The URL runs up to white space; commas at its end separate
+         it from the next candidate.  */
+      url_b = p;
+      while (p < end && !c_isspace (*p))
+        ++p;
+      url_e = p;
+      if (url_e[-1] == ',')
+        while (url_e > url_b && url_e[-1] == ',')
+          --url_e;
+      else
+        /* The descriptors run up to the next comma.  */
+        while (p < end && *p != ',')
+          {
+            double value;
+            while (p < end && c_isspace (*p))
+              ++p;
+            value = srcset_number (&p, end);
+            if (value > 0 && p < end && c_tolower (*p) == 'w')
+              density = value / slot;
+            else if (value > 0 && p < end && c_tolower (*p) == 'x')
+              density = value;
+            while (p < end && *p != ',' && !c_isspace (*p))
+              ++p;
+          }
+      if (url_e == url_b)
+        continue;
+
+      /* Unlike the value of the attribute, the raw text still has
+         its entities, as in "a.jpg?w=1&amp;h=1".  */
+      link = html_decode_entities (url_b, url_e);
+      up = append_url (link, url_b - ctx->text, url_e - url_b, ctx);
+      xfree (link);
+      if (!up)
+        continue;
+      up->link_inline_p = 1;
+      up->link_srcset_p = 1;
+      cands[count].up = up;
+      cands[count].density = density;
+      ++count;
+    }
+
+  /* With a display width, take the least dense candidate that is
+     still sharp, as a browser would, or the densest one if none is.  */
+  for (i = 0; i < count; i++)
+    switch (opt.srcset_policy)
+      {
+      case srcset_all:
+        break;
+      case srcset_smallest:
+        if (chosen < 0 || cands[i].density < cands[chosen].density)
+          chosen = i;
+        break;
+      case srcset_largest:
+        if (chosen < 0 || cands[i].density > cands[chosen].density)
+          chosen = i;
+        break;
+      case srcset_width:
+        if (chosen < 0
+            || (cands[i].density >= 1
+                ? (cands[chosen].density < 1
+                   || cands[i].density < cands[chosen].density)
+                : cands[i].density > cands[chosen].density))
+          chosen = i;
+        break;
+      }
+
+  if (chosen >= 0)
+    {
+      DEBUGP (("Chose %s of %d srcset candidates.\n",
+               quote (cands[chosen].up->url->url), count));
+      for (i = 0; i < count; i++)
+        if (i != chosen)
+          cands[i].up->ignore_when_downloading = 1;
+    }
+  xfree (cands);
+}
+
 /* All the tag_* functions are called from collect_tags_mapper, as
    specified by KNOWN_TAGS.  */
 
@@ -437,11 +628,18 @@ tag_find_urls (int tagid, struct taginfo *tag, struct map_context *ctx)
           if (0 == strcasecmp (tag->attrs[attrind].name,
                                tag_url_attributes[i].attr_name))
             {
-              struct urlpos *up = append_url (link, ATTR_POS(tag,attrind,ctx),
-                                              ATTR_SIZE(tag,attrind), ctx);
+              int flags = tag_url_attributes[i].flags;
+              struct urlpos *up;
+
+              if (flags & ATTR_SRCSET)
+                {
+                  handle_srcset (tag, attrind, ctx);
+                  continue;
+                }
+              up = append_url (link, ATTR_POS(tag,attrind,ctx),
+                               ATTR_SIZE(tag,attrind), ctx);
               if (up)
                 {
-                  int flags = tag_url_attributes[i].flags;
                   if (flags & ATTR_INLINE)
                     up->link_inline_p = 1;
                   if (flags & ATTR_HTML)
@@ -708,6 +906,7 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 
   ctx.text = fm->content;
   ctx.head = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
@@ -729,7 +928,7 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 
   /* the NULL here used to be interesting_tags */
   map_html_tags (fm->content, fm->length, collect_tags_mapper, &ctx, flags,
-                 NULL, interesting_attributes);
+                 NULL, interesting_attributes, ctx.arena);
 
   /* If meta charset isn't null, override content encoding */
   if (iri && meta_charset)
@@ -741,45 +940,134 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 
   xfree_null (ctx.base);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
 
-/* This doesn't really have anything to do with HTML, but it's similar
-   to get_urls_html, so we put it here.  */
+/* Reading URLs from a plain input file, one per line.  This doesn't
+   really have anything to do with HTML, but it's similar to
+   get_urls_html, so we put it here.
+
+   The file is read one line at a time as the URLs are consumed, so
+   that huge lists are processed in constant memory, and so that URLs
+   written to a pipe are retrieved as they arrive.  */
+
+struct urls_file {
+  char *name;                   /* name of the file, for messages */
+  FILE *fp;
+  bool follow;                  /* whether to wait for more lines at
+                                   the end of the file */
+  char *line;                   /* the line being read */
+  size_t size;                  /* allocated size of LINE */
+  struct urlpos *current;       /* the entry returned last */
+};
+
+/* How long to wait before looking for more lines at the end of a file
+   being followed.  */
+#define FOLLOW_INTERVAL 1.0
 
-struct urlpos *
-get_urls_file (const char *file)
+/* Open FILE, "-" meaning the standard input, for reading URLs with
+   urls_file_next.  If FOLLOW is true and FILE is a regular file,
+   reaching its end waits for more lines to be appended, the way
+   "tail -f" does.  Returns NULL and prints an error if FILE cannot be
+   opened.  */
+
+struct urls_file *
+urls_file_open (const char *file, bool follow)
 {
-  struct file_memory *fm;
-  struct urlpos *head, *tail;
-  const char *text, *text_end;
+  struct urls_file *uf;
+  struct_stat st;
+  FILE *fp;
 
-  /* Load the file.  */
-  fm = wget_read_file (file);
-  if (!fm)
+  if (HYPHENP (file))
+    fp = stdin;
+  else
+    fp = fopen (file, "rb");
+  if (!fp)
     {
       logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
       return NULL;
     }
-  DEBUGP (("Loaded %s (size %s).\n", file, number_to_static_string (fm->length)));
 
-  head = tail = NULL;
-  text = fm->content;
-  text_end = fm->content + fm->length;
-  while (text < text_end)
+  uf = xnew0 (struct urls_file);
+  uf->name = xstrdup (file);
+  uf->fp = fp;
+  uf->follow = (follow && fstat (fileno (fp), &st) == 0
+                && S_ISREG (st.st_mode));
+  uf->size = 256;
+  uf->line = xmalloc (uf->size);
+  return uf;
+}
+
+/* Read the next line of UF into UF->line, without the line
+   terminator.  Returns false at the end of the file.  */
+
+static bool
+read_url_line (struct urls_file *uf)
+{
+  size_t len = 0;
+
+  while (true)
+    {
+      if (uf->size - len < 2)
+        {
+          uf->size *= 2;
+          uf->line = xrealloc (uf->line, uf->size);
+        }
+      if (fgets (uf->line + len, uf->size - len, uf->fp))
+        {
+          len += strlen (uf->line + len);
+          if (len && uf->line[len - 1] == '\n')
+            {
+              uf->line[len - 1] = '\0';
+              return true;
+            }
+          continue;
+        }
+      if (ferror (uf->fp))
+        {
+          if (errno == EINTR)
+            {
+              clearerr (uf->fp);
+              continue;
+            }
+          logprintf (LOG_NOTQUIET, "%s: %s\n", uf->name, strerror (errno));
+          return false;
+        }
+      /* At the end of the file.  Unless it is being followed, an
+         unterminated last line is still a line.  */
+      if (!uf->follow)
+        {
+          uf->line[len] = '\0';
+          return len > 0;
+        }
+      clearerr (uf->fp);
+      xsleep (FOLLOW_INTERVAL);
+    }
+}
+
+/* Return the next URL read from UF, or NULL at the end of the file.
+   Empty lines are skipped, and invalid URLs are reported and skipped.
+   The entry remains valid until the next call.  */
+
+struct urlpos *
+urls_file_next (struct urls_file *uf)
+{
+  if (uf->current)
+    {
+      free_urlpos (uf->current);
+      uf->current = NULL;
+    }
+
+  while (read_url_line (uf))
     {
       int up_error_code;
       char *url_text;
-      struct urlpos *entry;
       struct url *url;
 
-      const char *line_beg = text;
-      const char *line_end = memchr (text, '\n', text_end - text);
-      if (!line_end)
-        line_end = text_end;
-      else
-        ++line_end;
-      text = line_end;
+      const char *line_beg = uf->line;
+      const char *line_end = line_beg + strlen (line_beg);
 
       /* Strip whitespace from the beginning and end of line. */
       while (line_beg < line_end && c_isspace (*line_beg))
@@ -791,9 +1079,6 @@ get_urls_file (const char *file)
         continue;
 
       /* The URL is in the [line_beg, line_end) region. */
-
-      /* We must copy the URL to a zero-terminated string, and we
-         can't use alloca because we're in a loop.  *sigh*.  */
       url_text = strdupdelim (line_beg, line_end);
 
       if (opt.base_href)
@@ -809,7 +1094,7 @@ get_urls_file (const char *file)
         {
           char *error = url_error (url_text, up_error_code);
           logprintf (LOG_NOTQUIET, _("%s: Invalid URL %s: %s\n"),
-                     file, url_text, error);
+                     uf->name, url_text, error);
           xfree (url_text);
           xfree (error);
           inform_exit_status (URLERROR);
@@ -817,19 +1102,48 @@ get_urls_file (const char *file)
         }
       xfree (url_text);
 
-      entry = xnew0 (struct urlpos);
-      entry->url = url;
+      uf->current = xnew0 (struct urlpos);
+      uf->current->url = url;
+      return uf->current;
+    }
+  return NULL;
+}
+
+/* Read the remaining entries of UF into a list.  The caller owns the
+   list and frees it with free_urlpos.  */
+
+struct urlpos *
+urls_file_read_all (struct urls_file *uf)
+{
+  struct urlpos *head = NULL, *tail = NULL, *cur;
 
-      if (!head)
-        head = entry;
+  while ((cur = urls_file_next (uf)) != NULL)
+    {
+      /* The list owns the entry now.  */
+      uf->current = NULL;
+      if (tail)
+        tail->next = cur;
       else
-        tail->next = entry;
-      tail = entry;
+        head = cur;
+      tail = cur;
     }
-  wget_read_file_free (fm);
   return head;
 }
 
+/* Close UF and free the last entry returned from it.  */
+
+void
+urls_file_close (struct urls_file *uf)
+{
+  if (uf->current)
+    free_urlpos (uf->current);
+  if (uf->fp != stdin)
+    fclose (uf->fp);
+  xfree (uf->line);
+  xfree (uf->name);
+  xfree (uf);
+}
+
 void
 cleanup_html_url (void)
 {
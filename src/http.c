@@ -59,6 +59,9 @@ as that of the covered work.  */
 #include "convert.h"
 #include "spider.h"
 #include "warc.h"
+#include "zsync.h"
+#include "checksum.h"
+#include "preconnect.h"
 
 #ifdef TESTING
 #include "test.h"
@@ -225,8 +228,7 @@ release_header (struct request_header *hdr)
      request_set_header (req, "Referer", opt.referer, rel_none);
 
      // Value freshly allocated, free it when done.
-     request_set_header (req, "Range",
-                         aprintf ("bytes=%s-", number_to_static_string (hs->restval)),
+     request_set_header (req, "Range", aprintf ("bytes=%s-", restbuf),
                          rel_value);
    */
 
@@ -406,6 +408,21 @@ static struct hash_table *basic_authed_hosts;
  * it the username, password. A temporary measure until we can get
  * proper authentication in place. */
 
+/* Find the username and password to use for U, looking them up in
+   the URL, ~/.netrc and the options, in that order.  */
+
+static void
+find_credentials (const struct url *u, char **user, char **passwd)
+{
+  *user = u->user;
+  *passwd = u->passwd;
+  search_netrc (u->host, (const char **)user, (const char **)passwd, 0);
+  if (!*user)
+    *user = opt.http_user ? opt.http_user : opt.user;
+  if (!*passwd)
+    *passwd = opt.http_passwd ? opt.http_passwd : opt.passwd;
+}
+
 static bool
 maybe_send_basic_creds (const char *hostname, const char *user,
                         const char *passwd, struct request *req)
@@ -867,7 +884,7 @@ print_server_response (const struct response *resp, const char *prefix)
 
 /* Parse the `Content-Range' header and extract the information it
    contains.  Returns true if successful, false otherwise.  */
-static bool
+bool
 parse_content_range (const char *hdr, wgint *first_byte_ptr,
                      wgint *last_byte_ptr, wgint *entity_length_ptr)
 {
@@ -1246,6 +1263,11 @@ static struct {
 #endif
 } pconn;
 
+/* How many requests opened a new connection, and how many reused the
+   persistent one.  */
+static int pconn_connects;
+static int pconn_reuses;
+
 /* Mark the persistent connection as invalid and free the resources it
    uses.  This is used by the CLOSE_* macros after they forcefully
    close a registered persistent connection.  */
@@ -1260,6 +1282,29 @@ invalidate_persistent (void)
   xzero (pconn);
 }
 
+/* Close the persistent connection, if any, and the connections
+   opened early.  This is used before forking processes that make
+   requests of their own, so that they don't inherit the connections.  */
+
+void
+http_close_persistent (void)
+{
+  if (pconn_active)
+    invalidate_persistent ();
+  preconnect_cleanup ();
+}
+
+/* Store the number of HTTP requests that opened a new connection in
+   *CONNECTS, and the number that reused the persistent connection in
+   *REUSES.  */
+
+void
+http_connection_stats (int *connects, int *reuses)
+{
+  *connects = pconn_connects;
+  *reuses = pconn_reuses;
+}
+
 /* Register FD, which should be a TCP/IP connection to HOST:PORT, as
    persistent.  This will enable someone to use the same connection
    later.  In the context of HTTP, this must be called only AFTER the
@@ -1371,6 +1416,11 @@ persistent_available_p (const char *host, int port, bool ssl,
          already talking to HOST -- no need to reconnect.  */
     }
 
+  /* The local address of the connection must still suit the policy
+     by which --bind-address addresses are chosen.  */
+  if (!bind_source_reusable_p (pconn.socket))
+    return false;
+
   /* Finally, check whether the connection is still open.  This is
      important because most servers implement liberal (short) timeout
      on persistent connections.  Wget can of course always reconnect
@@ -1459,6 +1509,21 @@ struct http_stat
   wgint orig_file_size;         /* size of file to compare for time-stamping */
   time_t orig_file_tstamp;      /* time-stamp of file to compare for
                                  * time-stamping */
+  char *etag;                   /* ETag of the last response */
+  char *if_range;               /* validator to send in If-Range when
+                                   resuming, or NULL */
+  const char *range;            /* explicit Range header value; see
+                                   http_fetch */
+  bool auxiliary;               /* true if the file is fetched for
+                                   Wget's own use (see http_fetch) */
+  char *content_type;           /* Content-Type of an auxiliary fetch */
+  char *content_range;          /* Content-Range of an auxiliary fetch */
+  struct checksum *checksum;    /* expected checksum of the file, or
+                                   NULL */
+  bool in_memory;               /* true if the body was kept in memory
+                                   instead of being written to
+                                   local_file */
+  struct transfer_context *ctx; /* the transfer this request is part of */
 };
 
 static void
@@ -1471,11 +1536,19 @@ free_hstat (struct http_stat *hs)
   xfree_null (hs->local_file);
   xfree_null (hs->orig_file_name);
   xfree_null (hs->message);
+  xfree_null (hs->etag);
+  xfree_null (hs->if_range);
+  xfree_null (hs->content_type);
+  xfree_null (hs->content_range);
 
   /* Guard against being called twice. */
   hs->newloc = NULL;
   hs->remote_time = NULL;
   hs->error = NULL;
+  hs->etag = NULL;
+  hs->if_range = NULL;
+  hs->content_type = NULL;
+  hs->content_range = NULL;
 }
 
 static void
@@ -1492,6 +1565,131 @@ File %s already there; not retrieving.\n\n"), quote (filename));
     *dt |= TEXTHTML;
 }
 
+/* Resume metadata.  When -c is in effect, the validators of the
+   response being saved (ETag, Last-Modified and the entity length)
+   are stored in a small file next to the download, named by appending
+   RESUME_SFX to the local file name.  A later `wget -c' that finds a
+   partial file reads them back and sends If-Range along with Range,
+   so that a server whose copy has changed replies with the whole new
+   entity instead of a range of it.  The file is removed as soon as
+   the download is complete.  */
+
+#define RESUME_SFX ".wget-resume"
+
+/* Return the validator suitable for If-Range, given the ETag and
+   Last-Modified values of a response.  Weak entity tags must not be
+   used with If-Range (RFC 2616, section 14.27), so Last-Modified is
+   used in that case.  Returns NULL if there is nothing usable.  */
+
+static char *
+if_range_validator (const char *etag, const char *last_modified)
+{
+  if (etag && *etag && strncmp (etag, "W/", 2) != 0)
+    return xstrdup (etag);
+  if (last_modified && *last_modified)
+    return xstrdup (last_modified);
+  return NULL;
+}
+
+/* Store the resume metadata for LOCAL_FILE.  LENGTH is the length of
+   the whole entity, or -1 if unknown.  If the response carried no
+   validators, any stale metadata is removed instead, since resuming
+   would then proceed without If-Range anyway.  */
+
+static void
+resume_info_save (const char *local_file, const char *etag,
+                  const char *last_modified, wgint length)
+{
+  char *name = concat_strings (local_file, RESUME_SFX, (char *) 0);
+  FILE *fp;
+
+  if ((!etag || !*etag) && (!last_modified || !*last_modified))
+    {
+      if (file_exists_p (name))
+        unlink (name);
+      xfree (name);
+      return;
+    }
+
+  fp = fopen (name, "wb");
+  if (!fp)
+    {
+      logprintf (LOG_VERBOSE, _("Cannot write resume information to %s: %s\n"),
+                 quote (name), strerror (errno));
+      xfree (name);
+      return;
+    }
+  if (etag && *etag)
+    fprintf (fp, "ETag: %s\n", etag);
+  if (last_modified && *last_modified)
+    fprintf (fp, "Last-Modified: %s\n", last_modified);
+  if (length >= 0)
+    fprintf (fp, "Length: %s\n", number_to_static_string (length));
+  fclose (fp);
+  DEBUGP (("Saved resume information to %s.\n", name));
+  xfree (name);
+}
+
+/* Read the resume metadata stored for LOCAL_FILE.  Returns the
+   validator to send in If-Range (see if_range_validator), or NULL if
+   no metadata is available.  The entity length is stored to LENGTH,
+   or -1 if it is not known.  */
+
+static char *
+resume_info_load (const char *local_file, wgint *length)
+{
+  char *name = concat_strings (local_file, RESUME_SFX, (char *) 0);
+  char *etag = NULL, *last_modified = NULL, *validator;
+  char *line;
+  FILE *fp;
+
+  *length = -1;
+  fp = fopen (name, "rb");
+  xfree (name);
+  if (!fp)
+    return NULL;
+
+  while ((line = read_whole_line (fp)) != NULL)
+    {
+      char *colon = strchr (line, ':');
+      char *value, *end;
+      if (colon)
+        {
+          *colon = '\0';
+          for (value = colon + 1; c_isspace (*value); value++)
+            ;
+          for (end = value + strlen (value);
+               end > value && c_isspace (end[-1]); end--)
+            ;
+          *end = '\0';
+          if (0 == strcasecmp (line, "ETag") && !etag)
+            etag = xstrdup (value);
+          else if (0 == strcasecmp (line, "Last-Modified") && !last_modified)
+            last_modified = xstrdup (value);
+          else if (0 == strcasecmp (line, "Length"))
+            *length = str_to_wgint (value, NULL, 10);
+        }
+      xfree (line);
+    }
+  fclose (fp);
+
+  validator = if_range_validator (etag, last_modified);
+  xfree_null (etag);
+  xfree_null (last_modified);
+  return validator;
+}
+
+/* Remove the resume metadata of LOCAL_FILE, if any.  */
+
+static void
+resume_info_remove (const char *local_file)
+{
+  char *name = concat_strings (local_file, RESUME_SFX, (char *) 0);
+  if (file_exists_p (name) && unlink (name) == 0)
+    DEBUGP (("Removed resume information %s.\n", name));
+  xfree (name);
+}
+
 /* Download the response body from the socket and writes it to
    an output file.  The headers have already been read from the
    socket.  If WARC is enabled, the response body will also be
@@ -1505,6 +1703,9 @@ File %s already there; not retrieving.\n\n"), quote (filename));
    and statcode will be saved in the headers of the WARC record.
    The head parameter contains the HTTP headers of the response.
  
+   If mem is non-NULL, the body is collected there rather than
+   written to fp, which is NULL.
+
    If fp is NULL and WARC is enabled, the response body will be
    written only to the WARC file.  If WARC is disabled and fp
    is a file pointer, the data will be written to the file.
@@ -1513,7 +1714,8 @@ File %s already there; not retrieving.\n\n"), quote (filename));
    
    Returns the error code.   */
 static int
-read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
+read_response_body (struct http_stat *hs, int sock, FILE *fp,
+                    struct body_memory *mem, wgint contlen,
                     wgint contrange, bool chunked_transfer_encoding,
                     char *url, char *warc_timestamp_str, char *warc_request_uuid,
                     ip_address *warc_ip, char *type, int statcode, char *head)
@@ -1577,7 +1779,8 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
      response body to warc_tmp.  */
   hs->res = fd_read_body (sock, fp, contlen != -1 ? contlen : 0,
                           hs->restval, &hs->rd_size, &hs->len, &hs->dltime,
-                          flags, warc_tmp);
+                          flags, warc_tmp, fp ? hs->checksum : NULL, mem,
+                          hs->ctx);
   if (hs->res >= 0)
     {
       if (warc_tmp != NULL)
@@ -1652,7 +1855,8 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
    Defined here to avoid repetition later.  #### This will require
    rework.  */
 #define ALLOW_CLOBBER (opt.noclobber || opt.always_rest || opt.timestamping \
-                       || opt.dirstruct || opt.output_document)
+                       || opt.dirstruct || opt.output_document \
+                       || opt.delta_update)
 
 /* Retrieve a document through HTTP protocol.  It recognizes status
    code, and correctly handles redirections.  It closes the network
@@ -1678,6 +1882,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
   wgint contlen, contrange;
   struct url *conn;
   FILE *fp;
+  struct body_memory mem;       /* the body, when kept in memory */
   int err;
 
   int sock = -1;
@@ -1752,8 +1957,15 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
   hs->rderrmsg = NULL;
   hs->newloc = NULL;
   hs->remote_time = NULL;
+  hs->in_memory = false;
   hs->error = NULL;
   hs->message = NULL;
+  xfree_null (hs->etag);
+  hs->etag = NULL;
+  xfree_null (hs->content_type);
+  hs->content_type = NULL;
+  xfree_null (hs->content_range);
+  hs->content_range = NULL;
 
   conn = u;
 
@@ -1765,7 +1977,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
     const char *meth = "GET";
     if (head_only)
       meth = "HEAD";
-    else if (opt.post_file_name || opt.post_data)
+    else if (hs->ctx->post_file_name || hs->ctx->post_data)
       meth = "POST";
     /* Use the full path, i.e. one that includes the leading slash and
        the query string.  E.g. if u->path is "foo/bar" and u->query is
@@ -1793,20 +2005,30 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       /* ... but some HTTP/1.0 caches doesn't implement Cache-Control.  */
       request_set_header (req, "Pragma", "no-cache", rel_none);
     }
-  if (hs->restval)
-    request_set_header (req, "Range",
-                        aprintf ("bytes=%s-",
-                                 number_to_static_string (hs->restval)),
-                        rel_value);
+  if (hs->range)
+    request_set_header (req, "Range", hs->range, rel_none);
+  else if (hs->restval)
+    {
+      char restbuf[24];
+      number_to_string (restbuf, hs->restval);
+      request_set_header (req, "Range", aprintf ("bytes=%s-", restbuf),
+                          rel_value);
+    }
+  if (hs->restval && hs->if_range)
+    /* Only resume if the remote entity is still the one we have part
+       of; otherwise the server sends the whole new entity.  */
+    request_set_header (req, "If-Range", hs->if_range, rel_none);
   SET_USER_AGENT (req);
   request_set_header (req, "Accept", "*/*", rel_none);
 
-  /* Find the username and password for authentication. */
-  user = u->user;
-  passwd = u->passwd;
-  search_netrc (u->host, (const char **)&user, (const char **)&passwd, 0);
-  user = user ? user : (opt.http_user ? opt.http_user : opt.user);
-  passwd = passwd ? passwd : (opt.http_passwd ? opt.http_passwd : opt.passwd);
+  /* Find the username and password for authentication.  Unless they
+     may be sent before the server asks for them, this is put off
+     until it does, so that ~/.netrc is only read when needed.  */
+  user = passwd = NULL;
+  if (opt.auth_without_challenge
+      || (basic_authed_hosts
+          && hash_table_contains (basic_authed_hosts, u->host)))
+    find_credentials (u, &user, &passwd);
 
   /* We only do "site-wide" authentication with "global" user/password
    * values unless --auth-no-challange has been requested; URL user/password
@@ -1852,25 +2074,26 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
         }
     }
 
-  if (opt.post_data || opt.post_file_name)
+  if (hs->ctx->post_data || hs->ctx->post_file_name)
     {
+      char lenbuf[24];
+
       request_set_header (req, "Content-Type",
                           "application/x-www-form-urlencoded", rel_none);
-      if (opt.post_data)
-        post_data_size = strlen (opt.post_data);
+      if (hs->ctx->post_data)
+        post_data_size = strlen (hs->ctx->post_data);
       else
         {
-          post_data_size = file_size (opt.post_file_name);
+          post_data_size = file_size (hs->ctx->post_file_name);
           if (post_data_size == -1)
             {
               logprintf (LOG_NOTQUIET, _("POST data file %s missing: %s\n"),
-                         quote (opt.post_file_name), strerror (errno));
+                         quote (hs->ctx->post_file_name), strerror (errno));
               post_data_size = 0;
             }
         }
-      request_set_header (req, "Content-Length",
-                          xstrdup (number_to_static_string (post_data_size)),
-                          rel_value);
+      number_to_string (lenbuf, post_data_size);
+      request_set_header (req, "Content-Length", xstrdup (lenbuf), rel_value);
     }
 
  retry_with_auth:
@@ -1878,7 +2101,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
      without authorization header fails.  (Expected to happen at least
      for the Digest authorization scheme.)  */
 
-  if (opt.cookies)
+  if (opt.cookies && wget_cookie_jar)
     request_set_header (req, "Cookie",
                         cookie_header (wget_cookie_jar,
                                        u->host, u->port, u->path,
@@ -1973,6 +2196,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
                         quotearg_style (escape_quoting_style, pconn.host),
                         pconn.port);
           DEBUGP (("Reusing fd %d.\n", sock));
+          ++pconn_reuses;
           if (pconn.authorized)
             /* If the connection is already authorized, the "Basic"
                authorization added by code above is unnecessary and
@@ -1991,7 +2215,9 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   if (sock < 0)
     {
-      sock = connect_to_host (conn->host, conn->port);
+      sock = preconnect_take (conn->host, conn->port);
+      if (sock < 0)
+        sock = connect_to_host (conn->host, conn->port);
       if (sock == E_HOST)
         {
           request_free (req);
@@ -2003,6 +2229,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
           return (retryable_socket_connect_error (errno)
                   ? CONERROR : CONIMPOSSIBLE);
         }
+      ++pconn_connects;
 
 #ifdef HAVE_SSL
       if (proxy && u->scheme == SCHEME_HTTPS)
@@ -2128,28 +2355,28 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   if (write_error >= 0)
     {
-      if (opt.post_data)
+      if (hs->ctx->post_data)
         {
-          DEBUGP (("[POST data: %s]\n", opt.post_data));
-          write_error = fd_write (sock, opt.post_data, post_data_size, -1);
+          DEBUGP (("[POST data: %s]\n", hs->ctx->post_data));
+          write_error = fd_write (sock, hs->ctx->post_data, post_data_size, -1);
           if (write_error >= 0 && warc_tmp != NULL)
             {
               /* Remember end of headers / start of payload. */
               warc_payload_offset = ftello (warc_tmp);
 
               /* Write a copy of the data to the WARC record. */
-              int warc_tmp_written = fwrite (opt.post_data, 1, post_data_size, warc_tmp);
+              int warc_tmp_written = fwrite (hs->ctx->post_data, 1, post_data_size, warc_tmp);
               if (warc_tmp_written != post_data_size)
                 write_error = -2;
             }
         }
-      else if (opt.post_file_name && post_data_size != 0)
+      else if (hs->ctx->post_file_name && post_data_size != 0)
         {
           if (warc_tmp != NULL)
             /* Remember end of headers / start of payload. */
             warc_payload_offset = ftello (warc_tmp);
 
-          write_error = post_file (sock, opt.post_file_name, post_data_size, warc_tmp);
+          write_error = post_file (sock, hs->ctx->post_file_name, post_data_size, warc_tmp);
         }
     }
 
@@ -2299,14 +2526,15 @@ read_header:
     {
       int scpos;
       const char *scbeg, *scend;
-      /* The jar should have been created by now. */
-      assert (wget_cookie_jar != NULL);
       for (scpos = 0;
            (scpos = resp_header_locate (resp, "Set-Cookie", scpos,
                                         &scbeg, &scend)) != -1;
            ++scpos)
         {
           char *set_cookie; BOUNDED_TO_ALLOCA (scbeg, scend, set_cookie);
+          /* The jar is created when the first cookie arrives.  */
+          if (!wget_cookie_jar)
+            wget_cookie_jar = cookie_jar_new ();
           cookie_handle_set_cookie (wget_cookie_jar, u->host, u->port,
                                     u->path, set_cookie);
         }
@@ -2327,7 +2555,7 @@ read_header:
         {
           int err;
           type = resp_header_strdup (resp, "Content-Type");
-          err = read_response_body (hs, sock, NULL, contlen, 0,
+          err = read_response_body (hs, sock, NULL, NULL, contlen, 0,
                                     chunked_transfer_encoding,
                                     u->url, warc_timestamp_str,
                                     warc_request_uuid, warc_ip, type,
@@ -2357,6 +2585,8 @@ read_header:
         }
 
       pconn.authorized = false;
+      if (!auth_finished && !(user && passwd))
+        find_credentials (u, &user, &passwd);
       if (!auth_finished && (user && passwd))
         {
           /* IIS sends multiple copies of WWW-Authenticate, one with
@@ -2572,8 +2802,16 @@ read_header:
     }
   hs->newloc = resp_header_strdup (resp, "Location");
   hs->remote_time = resp_header_strdup (resp, "Last-Modified");
+  hs->etag = resp_header_strdup (resp, "ETag");
 
-  if (resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval)))
+  if (hs->auxiliary)
+    {
+      /* The caller of http_fetch interprets these itself, e.g. to
+         split a multipart/byteranges body.  */
+      hs->content_type = resp_header_strdup (resp, "Content-Type");
+      hs->content_range = resp_header_strdup (resp, "Content-Range");
+    }
+  else if (resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval)))
     {
       wgint first_byte_pos, last_byte_pos, entity_length;
       if (parse_content_range (hdrval, &first_byte_pos, &last_byte_pos,
@@ -2585,6 +2823,18 @@ read_header:
     }
   resp_free (resp);
 
+  if (hs->restval > 0 && hs->if_range
+      && statcode == HTTP_STATUS_OK && contrange == 0)
+    {
+      /* We asked for a range conditional on If-Range and got the
+         whole entity instead: the remote file has changed since the
+         partial download.  Rewrite the local file from the start
+         rather than skipping what we have.  */
+      logputs (LOG_VERBOSE,
+               _("Remote file has changed, restarting the download.\n"));
+      hs->restval = 0;
+    }
+
   /* 20x responses are counted among successful by default.  */
   if (H_20X (statcode))
     *dt |= RETROKF;
@@ -2615,7 +2865,7 @@ read_header:
              But if we are writing a WARC file we are: we like to keep everyting.  */
           if (warc_enabled)
             {
-              int err = read_response_body (hs, sock, NULL, contlen, 0,
+              int err = read_response_body (hs, sock, NULL, NULL, contlen, 0,
                                             chunked_transfer_encoding,
                                             u->url, warc_timestamp_str,
                                             warc_request_uuid, warc_ip, type,
@@ -2672,7 +2922,7 @@ read_header:
   else
     *dt &= ~TEXTCSS;
 
-  if (opt.adjust_extension)
+  if (opt.adjust_extension && !hs->auxiliary)
     {
       if (*dt & TEXTHTML)
         /* -E / --adjust-extension / adjust_extension = on was specified,
@@ -2688,9 +2938,11 @@ read_header:
         }
     }
 
-  if (statcode == HTTP_STATUS_RANGE_NOT_SATISFIABLE
-      || (!opt.timestamping && hs->restval > 0 && statcode == HTTP_STATUS_OK
-          && contrange == 0 && contlen >= 0 && hs->restval >= contlen))
+  if (!hs->auxiliary
+      && (statcode == HTTP_STATUS_RANGE_NOT_SATISFIABLE
+          || (!opt.timestamping && hs->restval > 0
+              && statcode == HTTP_STATUS_OK && contrange == 0
+              && contlen >= 0 && hs->restval >= contlen)))
     {
       /* If `-c' is in use and the file has been fully downloaded (or
          the remote file has shrunk), Wget effectively requests bytes
@@ -2709,8 +2961,9 @@ read_header:
       xfree (head);
       return RETRUNNEEDED;
     }
-  if ((contrange != 0 && contrange != hs->restval)
-      || (H_PARTIAL (statcode) && !contrange))
+  if (!hs->auxiliary
+      && ((contrange != 0 && contrange != hs->restval)
+          || (H_PARTIAL (statcode) && !contrange)))
     {
       /* The Range request was somehow misunderstood by the server.
          Bail out.  */
@@ -2760,7 +3013,8 @@ read_header:
     }
 
   /* Return if we have no intention of further downloading.  */
-  if ((!(*dt & RETROKF) && !opt.content_on_error) || head_only)
+  if ((!(*dt & RETROKF) && !opt.content_on_error) || head_only
+      || (*dt & HEADERS_ONLY))
     {
       /* In case the caller cares to look...  */
       hs->len = 0;
@@ -2771,7 +3025,7 @@ read_header:
          But if we are writing a WARC file we are: we like to keep everyting.  */
       if (warc_enabled)
         {
-          int err = read_response_body (hs, sock, NULL, contlen, 0,
+          int err = read_response_body (hs, sock, NULL, NULL, contlen, 0,
                                         chunked_transfer_encoding,
                                         u->url, warc_timestamp_str,
                                         warc_request_uuid, warc_ip, type,
@@ -2820,11 +3074,28 @@ read_header:
 # define FOPEN_BIN_FLAG true
 #endif /* def __VMS [else] */
 
+  /* When the body is only wanted for the links in it, as with --spider
+     and --delete-after, collect it in memory for the parser instead of
+     writing a file that is removed right after.  A body that cannot
+     contain links is not kept at all.  */
+  xzero (mem);
+  if (opt.in_memory_limit && (opt.spider || opt.delete_after)
+      && !output_stream && !hs->auxiliary && !hs->restval)
+    {
+      mem.discard = !((opt.recursive || opt.page_requisites)
+                      && (*dt & (TEXTHTML | TEXTCSS)));
+      mem.limit = opt.in_memory_limit;
+      mem.file = hs->local_file;
+      fp = NULL;
+    }
+
   /* Open the local file.  */
-  if (!output_stream)
+  if (mem.file)
+    ;
+  else if (!output_stream || hs->auxiliary)
     {
       mkalldirs (hs->local_file);
-      if (opt.backups)
+      if (opt.backups && !hs->auxiliary)
         rotate_backups (hs->local_file);
       if (hs->restval)
         {
@@ -2837,7 +3108,7 @@ read_header:
           fp = fopen (hs->local_file, "ab");
 #endif /* def __VMS [else] */
         }
-      else if (ALLOW_CLOBBER || count > 0)
+      else if (ALLOW_CLOBBER || count > 0 || hs->auxiliary)
         {
 	  if (opt.unlink && file_exists_p (hs->local_file))
 	    {
@@ -2888,24 +3159,51 @@ read_header:
           xfree_null (type);
           return FOPENERR;
         }
+
+      if (opt.always_rest && !hs->auxiliary)
+        resume_info_save (hs->local_file, hs->etag, hs->remote_time,
+                          contlen == -1 ? -1 : contlen + contrange);
     }
   else
     fp = output_stream;
 
   /* Print fetch message, if opt.verbose.  */
-  if (opt.verbose)
+  if (opt.verbose && !mem.file)
     {
       logprintf (LOG_NOTQUIET, _("Saving to: %s\n"),
                  HYPHENP (hs->local_file) ? quote ("STDOUT") : quote (hs->local_file));
     }
 
 
-  err = read_response_body (hs, sock, fp, contlen, contrange,
+  /* Digest the file as it arrives if a checksum was published for
+     it.  */
+  if (!hs->auxiliary && !hs->checksum && !mem.file)
+    hs->checksum = checksum_lookup (u, hs->local_file);
+  if (hs->checksum
+      && !checksum_prepare (hs->checksum, hs->local_file, hs->restval))
+    {
+      logprintf (LOG_NOTQUIET, _("\
+Cannot read %s back; its checksum will not be verified.\n"),
+                 quote (hs->local_file));
+      hs->checksum = NULL;
+    }
+
+  /* Now that the body is on its way, start looking up the hosts of
+     the URLs to be retrieved next, and connect to those found by the
+     time it is read.  */
+  if (opt.preconnect)
+    preconnect_resolve ();
+
+  err = read_response_body (hs, sock, fp, mem.file ? &mem : NULL,
+                            contlen, contrange,
                             chunked_transfer_encoding,
                             u->url, warc_timestamp_str,
                             warc_request_uuid, warc_ip, type,
                             statcode, head);
 
+  if (opt.preconnect)
+    preconnect_resolve ();
+
   /* Now we no longer need to store the response header. */
   xfree (head);
   xfree_null (type);
@@ -2915,7 +3213,25 @@ read_header:
   else
     CLOSE_INVALIDATE (sock);
 
-  if (!output_stream)
+  if (mem.spill)
+    {
+      /* The body outgrew the memory limit and went to the file.  */
+      if (fclose (mem.spill) == EOF && err == RETRFINISHED)
+        err = FWRITEERR;
+    }
+  else if (mem.file && hs->res >= 0)
+    {
+      memory_file_store (hs->local_file, mem.content,
+                         mem.discard ? 0 : mem.length);
+      mem.content = NULL;
+      hs->in_memory = true;
+    }
+  else if (mem.file)
+    /* Nothing of the body is kept, so a retry must start over.  */
+    hs->len = 0;
+  xfree_null (mem.content);
+
+  if (fp && (!output_stream || hs->auxiliary))
     fclose (fp);
 
   return err;
@@ -2926,7 +3242,7 @@ read_header:
 uerr_t
 http_loop (struct url *u, struct url *original_url, char **newloc,
            char **local_file, const char *referer, int *dt, struct url *proxy,
-           struct iri *iri)
+           struct iri *iri, struct transfer_context *ctx)
 {
   int count;
   bool got_head = false;         /* used for time-stamping and filename detection */
@@ -2970,6 +3286,7 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
 
   /* Setup hstat struct. */
   xzero (hstat);
+  hstat.ctx = ctx;
   hstat.referer = referer;
 
   if (opt.output_document)
@@ -3000,6 +3317,28 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
   /* Reset the document type. */
   *dt = 0;
 
+  /* Try to update an existing file by fetching only the blocks that
+     changed.  If that is not possible, fall back to retrieving the
+     whole file.  */
+  if (opt.delta_update && got_name && !opt.spider && !opt.output_document
+      && file_exists_p (hstat.local_file))
+    {
+      wgint downloaded;
+      if (zsync_retrieve (u, proxy, hstat.local_file, &downloaded) == RETROK)
+        {
+          ++numurls;
+          total_downloaded_bytes += downloaded;
+          *dt |= RETROKF;
+          if (has_html_suffix_p (hstat.local_file))
+            *dt |= TEXTHTML;
+          downloaded_file (FILE_DOWNLOADED_NORMALLY, hstat.local_file);
+          ret = RETROK;
+          goto exit;
+        }
+      logputs (LOG_VERBOSE,
+               _("Delta update not possible, retrieving the whole file.\n"));
+    }
+
   /* Skip preliminary HEAD request if we're not in spider mode.  */
   if (!opt.spider)
     send_head_first = false;
@@ -3059,9 +3398,19 @@ Spider mode enabled. Check if remote file exists.\n"));
          on or time-stamping is employed, HEAD_ONLY commands is
          encoded within *dt.  */
       if (send_head_first && !got_head)
-        *dt |= HEAD_ONLY;
+        {
+          /* A server that does not support HEAD gets a GET whose body
+             is not read.  */
+          if (opt.spider && !spider_head_supported_p (u))
+            {
+              *dt &= ~HEAD_ONLY;
+              *dt |= HEADERS_ONLY;
+            }
+          else
+            *dt |= HEAD_ONLY;
+        }
       else
-        *dt &= ~HEAD_ONLY;
+        *dt &= ~(HEAD_ONLY | HEADERS_ONLY);
 
       /* Decide whether or not to restart.  */
       if (force_full_retrieve)
@@ -3080,6 +3429,32 @@ Spider mode enabled. Check if remote file exists.\n"));
       else
         hstat.restval = 0;
 
+      /* Decide which validator, if any, to send in If-Range.  Prefer
+         the one the server gave us on the previous try; failing that,
+         use what a previous run of `wget -c' recorded.  */
+      xfree_null (hstat.if_range);
+      hstat.if_range = NULL;
+      if (hstat.restval > 0)
+        {
+          if (count > 1)
+            hstat.if_range = if_range_validator (hstat.etag,
+                                                 hstat.remote_time);
+          if (!hstat.if_range && opt.always_rest && got_name)
+            {
+              wgint length;
+              hstat.if_range = resume_info_load (hstat.local_file, &length);
+              if (hstat.if_range && length >= 0 && hstat.restval > length)
+                {
+                  /* The partial file is longer than the entity it is
+                     supposed to be part of; don't trust it.  */
+                  logprintf (LOG_VERBOSE, _("\
+Local file %s is larger than the remote file was, restarting.\n"),
+                             quote (hstat.local_file));
+                  hstat.restval = 0;
+                }
+            }
+        }
+
       /* Decide whether to send the no-cache directive.  We send it in
          two cases:
            a) we're using a proxy, and we're past our first retrieval.
@@ -3094,6 +3469,8 @@ Spider mode enabled. Check if remote file exists.\n"));
 
       /* Try fetching the document, or at least its head.  */
       err = gethttp (u, &hstat, dt, proxy, iri, count);
+      if (opt.spider)
+        spider_check_response (hstat.statcode, !!(*dt & HEAD_ONLY));
 
       /* Time?  */
       tms = datetime_str (time (NULL));
@@ -3163,6 +3540,8 @@ Spider mode enabled. Check if remote file exists.\n"));
           goto exit;
         case RETRUNNEEDED:
           /* The file was already fully retrieved. */
+          if (opt.always_rest && hstat.local_file)
+            resume_info_remove (hstat.local_file);
           ret = RETROK;
           goto exit;
         case RETRFINISHED:
@@ -3183,11 +3562,22 @@ Spider mode enabled. Check if remote file exists.\n"));
               logprintf (LOG_NONVERBOSE, "%s:\n", hurl);
             }
 
-          /* Fall back to GET if HEAD fails with a 500 or 501 error code. */
+          /* Fall back to GET if HEAD fails with a 405, 500 or 501
+             error code.  In spider mode, remember that the server does
+             not support HEAD, and check its links with GET from now
+             on.  */
           if (*dt & HEAD_ONLY
-              && (hstat.statcode == 500 || hstat.statcode == 501))
+              && (hstat.statcode == 405 || hstat.statcode == 500
+                  || hstat.statcode == 501))
             {
-              got_head = true;
+              if (opt.spider)
+                {
+                  spider_head_unsupported (u);
+                  count = 0;
+                }
+              else
+                got_head = true;
+              xfree_null (hurl);
               continue;
             }
           /* Maybe we should always keep track of broken links, not just in
@@ -3333,13 +3723,13 @@ Remote file exists.\n\n"));
                 }
 
               got_name = true;
-              *dt &= ~HEAD_ONLY;
+              *dt &= ~(HEAD_ONLY | HEADERS_ONLY);
               count = 0;          /* the retrieve count for HEAD is reset */
               continue;
             } /* send_head_first */
         } /* !got_head */
 
-      if (opt.useservertimestamps
+      if (opt.useservertimestamps && !hstat.in_memory
           && (tmr != (time_t) (-1))
           && ((hstat.len == hstat.contlen) ||
               ((hstat.res == 0) && (hstat.contlen == -1))))
@@ -3365,6 +3755,37 @@ Remote file exists.\n\n"));
       tmrate = retr_rate (hstat.rd_size, hstat.dltime);
       total_download_time += hstat.dltime;
 
+      /* Once the whole file has arrived, compare its digest to the
+         published one.  A mismatch is treated like a failed transfer:
+         the file is removed and retrieved again from scratch.  */
+      if (hstat.checksum && (*dt & RETROKF)
+          && (hstat.len == hstat.contlen
+              || (hstat.res == 0 && hstat.contlen == -1)))
+        {
+          if (!checksum_verify (hstat.checksum))
+            {
+              logprintf (LOG_NOTQUIET, _("%s (%s) - Checksum mismatch for %s. "),
+                         tms, tmrate, quote (hstat.local_file));
+              ret = CHECKSUMERR;
+              if (output_stream)
+                {
+                  /* Whatever was written can't be taken back.  */
+                  logputs (LOG_NOTQUIET, "\n");
+                  goto exit;
+                }
+              if (unlink (hstat.local_file) < 0)
+                logprintf (LOG_NOTQUIET, "%s: %s\n", hstat.local_file,
+                           strerror (errno));
+              if (opt.always_rest)
+                resume_info_remove (hstat.local_file);
+              hstat.len = 0;
+              printwhat (count, opt.ntry);
+              continue;
+            }
+          logprintf (LOG_VERBOSE, _("Checksum of %s verified.\n"),
+                     quote (hstat.local_file));
+        }
+
       if (hstat.len == hstat.contlen)
         {
           if (*dt & RETROKF)
@@ -3374,6 +3795,8 @@ Remote file exists.\n\n"));
               logprintf (LOG_VERBOSE,
                          write_to_stdout
                          ? _("%s (%s) - written to stdout %s[%s/%s]\n\n")
+                         : hstat.in_memory
+                         ? _("%s (%s) - %s held in memory [%s/%s]\n\n")
                          : _("%s (%s) - %s saved [%s/%s]\n\n"),
                          tms, tmrate,
                          write_to_stdout ? "" : quote (hstat.local_file),
@@ -3388,6 +3811,8 @@ Remote file exists.\n\n"));
             }
           ++numurls;
           total_downloaded_bytes += hstat.rd_size;
+          if (opt.always_rest && !output_stream)
+            resume_info_remove (hstat.local_file);
 
           /* Remember that we downloaded the file for later ".orig" code. */
           if (*dt & ADDED_HTML_EXTENSION)
@@ -3410,6 +3835,8 @@ Remote file exists.\n\n"));
                   logprintf (LOG_VERBOSE,
                              write_to_stdout
                              ? _("%s (%s) - written to stdout %s[%s]\n\n")
+                             : hstat.in_memory
+                             ? _("%s (%s) - %s held in memory [%s]\n\n")
                              : _("%s (%s) - %s saved [%s]\n\n"),
                              tms, tmrate,
                              write_to_stdout ? "" : quote (hstat.local_file),
@@ -3421,6 +3848,8 @@ Remote file exists.\n\n"));
                 }
               ++numurls;
               total_downloaded_bytes += hstat.rd_size;
+              if (opt.always_rest && !output_stream)
+                resume_info_remove (hstat.local_file);
 
               /* Remember that we downloaded the file for later ".orig" code. */
               if (*dt & ADDED_HTML_EXTENSION)
@@ -3488,6 +3917,104 @@ exit:
   return ret;
 }
 
+/* Fetch U into FILE for Wget's own use, without any of the
+   bookkeeping http_loop does for files the user asked for: no file
+   name selection, time-stamping, backups or statistics.  This is used
+   for auxiliary resources such as delta manifests, or selected byte
+   ranges of a file.
+
+   If RANGE is non-NULL, it is sent verbatim as the value of the Range
+   header.  The Content-Type and Content-Range headers of the response
+   are stored to CONTENT_TYPE and CONTENT_RANGE, or NULL if absent; the
+   caller is expected to free them.  The number of bytes received is
+   stored to RECEIVED.  If CHECKSUM is non-NULL, the body is digested
+   as it arrives and compared against it.
+
+   Returns RETROK if a successful response was received in its
+   entirety, WRONGCODE if the server responded with an error,
+   CHECKSUMERR if the body did not match CHECKSUM, or another error
+   code if the retrieval failed.  */
+uerr_t
+http_fetch (struct url *u, struct url *proxy, const char *range,
+            const char *file, struct checksum *checksum,
+            char **content_type, char **content_range, wgint *received)
+{
+  struct http_stat hstat;
+  struct transfer_context ctx;
+  struct iri *iri = iri_new ();
+  uerr_t err, ret = TRYLIMEXC;
+  int count = 0;
+  int dt;
+
+  transfer_context_init (&ctx);
+  ctx.host = u->host;
+  *content_type = *content_range = NULL;
+  *received = 0;
+
+  if (opt.cookies)
+    load_cookies ();
+
+  xzero (hstat);
+  hstat.local_file = xstrdup (file);
+  hstat.existence_checked = true;
+  hstat.timestamp_checked = true;
+  hstat.range = range;
+  hstat.auxiliary = true;
+  hstat.checksum = checksum;
+  hstat.ctx = &ctx;
+
+  do
+    {
+      ++count;
+      sleep_between_retrievals (count);
+      dt = 0;
+      if (!opt.allow_cache)
+        dt |= SEND_NOCACHE;
+
+      err = gethttp (u, &hstat, &dt, proxy, iri, count);
+      *received += hstat.rd_size;
+
+      switch (err)
+        {
+        case HERR: case HEOF: case CONSOCKERR: case CONCLOSED:
+        case CONERROR: case READERR: case WRITEFAILED:
+          printwhat (count, opt.ntry);
+          continue;
+        case RETRFINISHED:
+          break;
+        default:
+          ret = err;
+          goto exit;
+        }
+
+      if (!(dt & RETROKF))
+        {
+          ret = WRONGCODE;
+          goto exit;
+        }
+      if (hstat.len == hstat.contlen
+          || (hstat.res == 0 && hstat.contlen == -1))
+        {
+          *content_type = hstat.content_type;
+          *content_range = hstat.content_range;
+          hstat.content_type = hstat.content_range = NULL;
+          if (hstat.checksum && !checksum_verify (hstat.checksum))
+            ret = CHECKSUMERR;
+          else
+            ret = RETROK;
+          goto exit;
+        }
+      /* Short read; start over.  */
+      printwhat (count, opt.ntry);
+    }
+  while (!opt.ntry || (count < opt.ntry));
+
+exit:
+  free_hstat (&hstat);
+  iri_free (iri);
+  return ret;
+}
+
 /* Check whether the result of strptime() indicates success.
    strptime() returns the pointer to how far it got to in the string.
    The processing has been successful if the string is at `GMT' or
@@ -3880,20 +4407,23 @@ create_authorization_line (const char *au, const char *user,
 static void
 load_cookies (void)
 {
-  if (!wget_cookie_jar)
-    wget_cookie_jar = cookie_jar_new ();
   if (opt.cookies_input && !cookies_loaded_p)
     {
+      double stats_start = startup_stats_clock ();
+      if (!wget_cookie_jar)
+        wget_cookie_jar = cookie_jar_new ();
       cookie_jar_load (wget_cookie_jar, opt.cookies_input);
       cookies_loaded_p = true;
+      startup_stats_add ("cookies", stats_start, true);
     }
 }
 
 void
 save_cookies (void)
 {
-  if (wget_cookie_jar)
-    cookie_jar_save (wget_cookie_jar, opt.cookies_output);
+  if (!wget_cookie_jar)
+    wget_cookie_jar = cookie_jar_new ();
+  cookie_jar_save (wget_cookie_jar, opt.cookies_output);
 }
 
 void
@@ -32,10 +32,18 @@ as that of the covered work.  */
 #define HTTP_H
 
 struct url;
+struct checksum;
+struct transfer_context;
 
 uerr_t http_loop (struct url *, struct url *, char **, char **, const char *,
-                  int *, struct url *, struct iri *);
+                  int *, struct url *, struct iri *,
+                  struct transfer_context *);
+uerr_t http_fetch (struct url *, struct url *, const char *, const char *,
+                   struct checksum *, char **, char **, wgint *);
+bool parse_content_range (const char *, wgint *, wgint *, wgint *);
 void save_cookies (void);
+void http_close_persistent (void);
+void http_connection_stats (int *, int *);
 void http_cleanup (void);
 time_t http_atotm (const char *);
 
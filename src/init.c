@@ -68,6 +68,12 @@ as that of the covered work.  */
 #include "http.h"               /* for http_cleanup */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
+#include "checksum.h"           /* for checksum_cleanup */
+#include "preconnect.h"         /* for preconnect_cleanup */
+#include "spider.h"             /* for link_report_close */
+#include "trap.h"               /* for trap_cleanup */
+#include "ratelimit.h"          /* for rate_limit_cleanup */
+#include "connect.h"            /* for bind_sources_cleanup */
 
 #ifdef TESTING
 #include "test.h"
@@ -97,6 +103,14 @@ CMD_DECLARE (cmd_spec_header);
 CMD_DECLARE (cmd_spec_warc_header);
 CMD_DECLARE (cmd_spec_htmlify);
 CMD_DECLARE (cmd_spec_mirror);
+CMD_DECLARE (cmd_spec_checksum);
+CMD_DECLARE (cmd_spec_bind_address);
+CMD_DECLARE (cmd_spec_bind_policy);
+CMD_DECLARE (cmd_spec_convert_sync);
+CMD_DECLARE (cmd_spec_canonicalize);
+CMD_DECLARE (cmd_spec_limit_rate_host);
+CMD_DECLARE (cmd_spec_limit_rate_schedule);
+CMD_DECLARE (cmd_spec_link_report_format);
 CMD_DECLARE (cmd_spec_prefer_family);
 CMD_DECLARE (cmd_spec_progress);
 CMD_DECLARE (cmd_spec_recursive);
@@ -106,6 +120,9 @@ CMD_DECLARE (cmd_spec_report_speed);
 #ifdef HAVE_SSL
 CMD_DECLARE (cmd_spec_secure_protocol);
 #endif
+CMD_DECLARE (cmd_spec_shard);
+CMD_DECLARE (cmd_spec_socket_buffer);
+CMD_DECLARE (cmd_spec_srcset);
 CMD_DECLARE (cmd_spec_timeout);
 CMD_DECLARE (cmd_spec_useragent);
 CMD_DECLARE (cmd_spec_verbose);
@@ -126,6 +143,7 @@ static const struct {
   { "accept",           &opt.accepts,           cmd_vector },
   { "acceptregex",      &opt.acceptregex_s,     cmd_string },
   { "addhostdir",       &opt.add_hostdir,       cmd_boolean },
+  { "addressstats",     &opt.address_stats,     cmd_file },
   { "adjustextension",  &opt.adjust_extension,  cmd_boolean },
   { "alwaysrest",       &opt.always_rest,       cmd_boolean }, /* deprecated */
   { "askpassword",      &opt.ask_passwd,        cmd_boolean },
@@ -135,30 +153,41 @@ static const struct {
   { "backupconverted",  &opt.backup_converted,  cmd_boolean },
   { "backups",          &opt.backups,           cmd_number },
   { "base",             &opt.base_href,         cmd_string },
-  { "bindaddress",      &opt.bind_address,      cmd_string },
+  { "bindaddress",      NULL,                   cmd_spec_bind_address },
+  { "bindpolicy",       NULL,                   cmd_spec_bind_policy },
 #ifdef HAVE_SSL
   { "cacertificate",    &opt.ca_cert,           cmd_file },
 #endif
   { "cache",            &opt.allow_cache,       cmd_boolean },
 #ifdef HAVE_SSL
   { "cadirectory",      &opt.ca_directory,      cmd_directory },
+#endif
+  { "canonicalize",     NULL,                   cmd_spec_canonicalize },
+#ifdef HAVE_SSL
   { "certificate",      &opt.cert_file,         cmd_file },
   { "certificatetype",  &opt.cert_type,         cmd_cert_type },
   { "checkcertificate", &opt.check_cert,        cmd_boolean },
 #endif
+  { "checksum",         NULL,                   cmd_spec_checksum },
+  { "checksumfile",     &opt.checksum_file,     cmd_file },
   { "chooseconfig",     &opt.choose_config,	cmd_file },
   { "connecttimeout",   &opt.connect_timeout,   cmd_time },
   { "contentdisposition", &opt.content_disposition, cmd_boolean },
   { "contentonerror",   &opt.content_on_error,  cmd_boolean },
   { "continue",         &opt.always_rest,       cmd_boolean },
   { "convertlinks",     &opt.convert_links,     cmd_boolean },
+  { "convertsync",      NULL,                   cmd_spec_convert_sync },
   { "cookies",          &opt.cookies,           cmd_boolean },
   { "cutdirs",          &opt.cut_dirs,          cmd_number },
+  { "daemon",           &opt.daemon_socket,     cmd_file },
+  { "daemonjobs",       &opt.daemon_jobs,       cmd_number },
 #ifdef ENABLE_DEBUG
   { "debug",            &opt.debug,             cmd_boolean },
 #endif
   { "defaultpage", 	&opt.default_page,      cmd_string},
   { "deleteafter",      &opt.delete_after,      cmd_boolean },
+  { "deltaupdate",      &opt.delta_update,      cmd_boolean },
+  { "dirbudget",        &opt.dir_budget,        cmd_number },
   { "dirprefix",        &opt.dir_prefix,        cmd_directory },
   { "dirstruct",        NULL,                   cmd_spec_dirstruct },
   { "dnscache",         &opt.dns_cache,         cmd_boolean },
@@ -174,6 +203,7 @@ static const struct {
   { "excludedirectories", &opt.excludes,        cmd_directory_vector },
   { "excludedomains",   &opt.exclude_domains,   cmd_vector },
   { "followftp",        &opt.follow_ftp,        cmd_boolean },
+  { "followinput",      &opt.follow_input,      cmd_boolean },
   { "followtags",       &opt.follow_tags,       cmd_vector },
   { "forcehtml",        &opt.force_html,        cmd_boolean },
   { "ftppasswd",        &opt.ftp_passwd,        cmd_string }, /* deprecated */
@@ -184,6 +214,7 @@ static const struct {
 #endif /* def __VMS */
   { "ftpuser",          &opt.ftp_user,          cmd_string },
   { "glob",             &opt.ftp_glob,          cmd_boolean },
+  { "groupbyhost",      &opt.group_by_host,     cmd_boolean },
   { "header",           NULL,                   cmd_spec_header },
   { "htmlextension",    &opt.adjust_extension,  cmd_boolean }, /* deprecated */
   { "htmlify",          NULL,                   cmd_spec_htmlify },
@@ -201,15 +232,27 @@ static const struct {
   { "inet4only",        &opt.ipv4_only,         cmd_boolean },
   { "inet6only",        &opt.ipv6_only,         cmd_boolean },
 #endif
+  { "inmemorylimit",    &opt.in_memory_limit,   cmd_bytes },
   { "input",            &opt.input_filename,    cmd_file },
   { "iri",              &opt.enable_iri,        cmd_boolean },
   { "keepsessioncookies", &opt.keep_session_cookies, cmd_boolean },
+  { "limitburst",       &opt.limit_burst,       cmd_bytes },
   { "limitrate",        &opt.limit_rate,        cmd_bytes },
+  { "limitratehost",    NULL,                   cmd_spec_limit_rate_host },
+  { "limitrateschedule", NULL,                  cmd_spec_limit_rate_schedule },
+  { "limitratetotal",   &opt.limit_rate_total,  cmd_bytes },
+  { "linkreport",       &opt.link_report,       cmd_file },
+  { "linkreportformat", NULL,                   cmd_spec_link_report_format },
   { "loadcookies",      &opt.cookies_input,     cmd_file },
   { "localencoding",    &opt.locale,            cmd_string },
   { "logfile",          &opt.lfilename,         cmd_file },
   { "login",            &opt.ftp_user,          cmd_string },/* deprecated*/
+  { "maxpathdepth",     &opt.max_path_depth,    cmd_number },
   { "maxredirect",      &opt.max_redirect,      cmd_number },
+  { "maxsegmentrepeat", &opt.max_segment_repeat, cmd_number },
+  { "maxurllength",     &opt.max_url_length,    cmd_number },
+  { "metalink",         &opt.metalink_file,     cmd_file },
+  { "metalinkjobs",     &opt.metalink_jobs,     cmd_number },
   { "mirror",           NULL,                   cmd_spec_mirror },
   { "netrc",            &opt.netrc,             cmd_boolean },
   { "noclobber",        &opt.noclobber,         cmd_boolean },
@@ -223,6 +266,7 @@ static const struct {
   { "password",         &opt.passwd,            cmd_string },
   { "postdata",         &opt.post_data,         cmd_string },
   { "postfile",         &opt.post_file_name,    cmd_file },
+  { "preconnect",       &opt.preconnect,        cmd_number },
   { "preferfamily",     NULL,                   cmd_spec_prefer_family },
   { "preservepermissions", &opt.preserve_perm,  cmd_boolean },
 #ifdef HAVE_SSL
@@ -234,6 +278,7 @@ static const struct {
   { "proxypasswd",      &opt.proxy_passwd,      cmd_string }, /* deprecated */
   { "proxypassword",    &opt.proxy_passwd,      cmd_string },
   { "proxyuser",        &opt.proxy_user,        cmd_string },
+  { "querybudget",      &opt.query_budget,      cmd_number },
   { "quiet",            &opt.quiet,             cmd_boolean },
   { "quota",            &opt.quota,             cmd_bytes_sum },
 #ifdef HAVE_SSL
@@ -261,10 +306,19 @@ static const struct {
   { "secureprotocol",   &opt.secure_protocol,   cmd_spec_secure_protocol },
 #endif
   { "serverresponse",   &opt.server_response,   cmd_boolean },
+  { "shard",            NULL,                   cmd_spec_shard },
+  { "sharddir",         &opt.shard_dir,         cmd_directory },
   { "showalldnsentries", &opt.show_all_dns_entries, cmd_boolean },
+  { "skipsimilar",      &opt.skip_similar,      cmd_boolean },
+  { "socketbuffer",     NULL,                   cmd_spec_socket_buffer },
   { "spanhosts",        &opt.spanhost,          cmd_boolean },
   { "spider",           &opt.spider,            cmd_boolean },
+  { "spiderjobs",       &opt.spider_jobs,       cmd_number },
+  { "srcset",           NULL,                   cmd_spec_srcset },
+  { "startupstats",     &opt.startup_stats,     cmd_boolean },
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
+  { "stripparams",      &opt.strip_params,      cmd_vector },
+  { "submit",           &opt.submit_socket,     cmd_file },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
   { "tries",            &opt.ntry,              cmd_number_inf },
@@ -334,6 +388,9 @@ defaults (void)
   opt.verbose = -1;
   opt.ntry = 20;
   opt.reclevel = 5;
+  opt.in_memory_limit = 10 * 1024 * 1024;
+  opt.spider_jobs = 1;
+  opt.srcset_policy = srcset_largest;
   opt.add_hostdir = true;
   opt.netrc = true;
   opt.ftp_glob = true;
@@ -376,6 +433,10 @@ defaults (void)
 
   opt.max_redirect = 20;
 
+  opt.metalink_jobs = 4;
+
+  opt.daemon_jobs = 4;
+
   opt.waitretry = 10;
 
 #ifdef ENABLE_IRI
@@ -1303,6 +1364,23 @@ cmd_spec_htmlify (const char *com, const char *val, void *place_ignored)
   return flag;
 }
 
+/* Validate --checksum and set it.  */
+
+static bool
+cmd_spec_checksum (const char *com, const char *val, void *place_ignored)
+{
+  if (!checksum_spec_valid_p (val))
+    {
+      fprintf (stderr, _("%s: %s: Invalid checksum %s; \
+use ALGORITHM:HEXDIGITS, with md5, sha1 or sha256.\n"),
+               exec_name, com, quote (val));
+      return false;
+    }
+  xfree_null (opt.checksum);
+  opt.checksum = xstrdup (val);
+  return true;
+}
+
 /* Set the "mirror" mode.  It means: recursive download, timestamping,
    no limit on max. recursion depth, and don't remove listings.  */
 
@@ -1325,6 +1403,231 @@ cmd_spec_mirror (const char *com, const char *val, void *place_ignored)
   return true;
 }
 
+/* Parse ITEM, a rate limit of the form HOST=RATE if HOST_P is true,
+   or HH:MM-HH:MM=RATE otherwise, into RULE.  */
+
+static bool
+parse_rate_limit (const char *item, bool host_p, struct rate_limit *rule)
+{
+  const char *eq = strrchr (item, '=');
+  double rate;
+  int h1, m1, h2, m2;
+  char c;
+
+  xzero (*rule);
+  if (!eq || eq == item || !parse_bytes_helper (eq + 1, &rate))
+    return false;
+  rule->rate = rate;
+
+  if (host_p)
+    {
+      if (*item == '.')
+        ++item;
+      rule->host = strdupdelim (item, eq);
+      return *rule->host != '\0';
+    }
+
+  if (sscanf (item, "%d:%d-%d:%d%c", &h1, &m1, &h2, &m2, &c) != 5
+      || c != '='
+      || h1 < 0 || h1 > 23 || m1 < 0 || m1 > 59
+      || h2 < 0 || h2 > 23 || m2 < 0 || m2 > 59)
+    return false;
+  rule->from = h1 * 60 + m1;
+  rule->to = h2 * 60 + m2;
+  return true;
+}
+
+/* Free the COUNT rate limits in *RULES.  */
+
+static void
+free_rate_limits (struct rate_limit **rules, int *count)
+{
+  int i;
+  for (i = 0; i < *count; i++)
+    xfree_null ((*rules)[i].host);
+  xfree_null (*rules);
+  *rules = NULL;
+  *count = 0;
+}
+
+/* Engine for cmd_spec_limit_rate_host and cmd_spec_limit_rate_schedule:
+   add the comma-separated rate limits in VAL to the COUNT rules in
+   *RULES, or remove all the rules if VAL is empty.  */
+
+static bool
+add_rate_limits (const char *com, const char *val, bool host_p,
+                 struct rate_limit **rules, int *count)
+{
+  char **items, **t;
+  bool ok = true;
+
+  if (!*val)
+    {
+      free_rate_limits (rules, count);
+      return true;
+    }
+
+  items = sepstring (val);
+  for (t = items; *t; t++)
+    {
+      struct rate_limit rule;
+      if (!parse_rate_limit (*t, host_p, &rule))
+        {
+          xfree_null (rule.host);
+          fprintf (stderr, _("%s: %s: Invalid rate limit %s.\n"),
+                   exec_name, com, quote (*t));
+          ok = false;
+          break;
+        }
+      *rules = xrealloc (*rules, (*count + 1) * sizeof (**rules));
+      (*rules)[(*count)++] = rule;
+    }
+  free_vec (items);
+  return ok;
+}
+
+/* Add limits of the download rate from the hosts of particular
+   domains, such as "example.com=100k".  */
+
+static bool
+cmd_spec_limit_rate_host (const char *com, const char *val,
+                          void *place_ignored)
+{
+  return add_rate_limits (com, val, true, &opt.limit_rate_hosts,
+                          &opt.limit_rate_host_count);
+}
+
+/* Add limits of the total download rate at times of day, such as
+   "09:00-18:00=200k".  */
+
+static bool
+cmd_spec_limit_rate_schedule (const char *com, const char *val,
+                              void *place_ignored)
+{
+  return add_rate_limits (com, val, false, &opt.limit_rate_schedule,
+                          &opt.limit_rate_schedule_count);
+}
+
+/* Set the local addresses to bind to from the comma-separated list
+   VAL.  Unlike cmd_vector, this replaces the addresses set before, so
+   that --bind-address overrides the bind_address of a wgetrc as it
+   did when it took a single address.  Empty elements are ignored.  */
+
+static bool
+cmd_spec_bind_address (const char *com, const char *val, void *place_ignored)
+{
+  char **vec = sepstring (val);
+  int i, j;
+
+  free_vec (opt.bind_addresses);
+  opt.bind_addresses = NULL;
+  if (!vec)
+    return true;
+  for (i = j = 0; vec[i]; i++)
+    if (*vec[i])
+      vec[j++] = vec[i];
+    else
+      xfree (vec[i]);
+  vec[j] = NULL;
+  if (j)
+    opt.bind_addresses = vec;
+  else
+    xfree (vec);
+  return true;
+}
+
+/* Set how a local address is chosen among those given with
+   --bind-address.  */
+
+static bool
+cmd_spec_bind_policy (const char *com, const char *val, void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "round-robin", bind_round_robin },
+    { "hash", bind_hash },
+    { "least-loaded", bind_least_loaded },
+  };
+  int policy = bind_round_robin;
+  int ok = decode_string (val, choices, countof (choices), &policy);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  opt.bind_policy = policy;
+  return ok;
+}
+
+/* Set how far the files converted by -k are synced to disk.  */
+
+static bool
+cmd_spec_convert_sync (const char *com, const char *val, void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "none", convert_sync_none },
+    { "file", convert_sync_file },
+    { "dir", convert_sync_dir },
+  };
+  int sync = convert_sync_none;
+  int ok = decode_string (val, choices, countof (choices), &sync);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  opt.convert_sync = sync;
+  return ok;
+}
+
+/* Validate --link-report-format and set the choice.  */
+
+static bool
+cmd_spec_link_report_format (const char *com, const char *val,
+                             void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "json", link_report_json },
+    { "csv", link_report_csv },
+  };
+  int format = link_report_json;
+  int ok = decode_string (val, choices, countof (choices), &format);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  opt.link_report_format = format;
+  return ok;
+}
+
+/* Set which candidates of a srcset attribute are retrieved: "all",
+   "smallest", "largest", or the one best suited to a display of the
+   given width.  */
+
+static bool
+cmd_spec_srcset (const char *com, const char *val, void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "all", srcset_all },
+    { "smallest", srcset_smallest },
+    { "largest", srcset_largest },
+  };
+  int policy = srcset_largest;
+  int width;
+
+  if (c_isdigit (*val))
+    {
+      if (!simple_atoi (val, val + strlen (val), &width) || width <= 0)
+        {
+          fprintf (stderr, _("%s: %s: Invalid value %s.\n"),
+                   exec_name, com, quote (val));
+          return false;
+        }
+      opt.srcset_policy = srcset_width;
+      opt.srcset_width = width;
+      return true;
+    }
+  if (!decode_string (val, choices, countof (choices), &policy))
+    {
+      fprintf (stderr, _("%s: %s: Invalid value %s.\n"),
+               exec_name, com, quote (val));
+      return false;
+    }
+  opt.srcset_policy = policy;
+  return true;
+}
+
 /* Validate --prefer-family and set the choice.  Allowed values are
    "IPv4", "IPv6", and "none".  */
 
@@ -1454,6 +1757,62 @@ cmd_spec_restrict_file_names (const char *com, const char *val, void *place_igno
   return true;
 }
 
+/* Set the rules --canonicalize applies to the links found while
+   recursing, from a comma-separated list.  */
+
+static bool
+cmd_spec_canonicalize (const char *com, const char *val, void *place_ignored)
+{
+  bool canon_query = false;
+  bool canon_index = false;
+  bool canon_case = false;
+  bool canon_escapes = false;
+
+  const char *end;
+
+#define VAL_IS(string_literal) BOUNDED_EQUAL (val, end, string_literal)
+
+  do
+    {
+      end = strchr (val, ',');
+      if (!end)
+        end = val + strlen (val);
+
+      if (VAL_IS ("query"))
+        canon_query = true;
+      else if (VAL_IS ("index"))
+        canon_index = true;
+      else if (VAL_IS ("case"))
+        canon_case = true;
+      else if (VAL_IS ("escapes"))
+        canon_escapes = true;
+      else if (VAL_IS ("all"))
+        /* Not "case", which is only right for some servers.  */
+        canon_query = canon_index = canon_escapes = true;
+      else if (!VAL_IS ("none"))
+        {
+          fprintf (stderr, _("\
+%s: %s: Invalid canonicalization rule %s,\n\
+    use [query],[index],[case],[escapes], all or none.\n"),
+                   exec_name, com, quote (val));
+          return false;
+        }
+
+      if (*end)
+        val = end + 1;
+    }
+  while (*val && *end);
+
+#undef VAL_IS
+
+  opt.canonicalize_query = canon_query;
+  opt.canonicalize_index = canon_index;
+  opt.canonicalize_case = canon_case;
+  opt.canonicalize_escapes = canon_escapes;
+
+  return true;
+}
+
 static bool
 cmd_spec_report_speed (const char *com, const char *val, void *place_ignored)
 {
@@ -1480,6 +1839,44 @@ cmd_spec_secure_protocol (const char *com, const char *val, void *place)
 }
 #endif
 
+/* Set the size of the socket receive buffer: "auto", or a byte
+   value.  */
+
+static bool
+cmd_spec_socket_buffer (const char *com, const char *val,
+                        void *place_ignored)
+{
+  if (0 == strcasecmp (val, "auto"))
+    {
+      opt.socket_buffer = -1;
+      return true;
+    }
+  return cmd_bytes (com, val, &opt.socket_buffer);
+}
+
+/* Set the share of a sharded retrieval, given as K/N.  */
+
+static bool
+cmd_spec_shard (const char *com, const char *val, void *place_ignored)
+{
+  const char *slash = strchr (val, '/');
+  int index, count;
+
+  if (!slash
+      || !simple_atoi (val, slash, &index)
+      || !simple_atoi (slash + 1, val + strlen (val), &count)
+      || count < 1 || index < 1 || index > count)
+    {
+      fprintf (stderr, _("%s: %s: Invalid shard %s; use K/N, K being \
+between 1 and N.\n"),
+               exec_name, com, quote (val));
+      return false;
+    }
+  opt.shard_index = index - 1;
+  opt.shard_count = count;
+  return true;
+}
+
 /* Set all three timeout values. */
 
 static bool
@@ -1688,6 +2085,8 @@ cleanup (void)
     if (fclose (output_stream) == EOF)
       inform_exit_status (CLOSEFAILED);
 
+  link_report_close ();
+
   /* No need to check for error because Wget flushes its output (and
      checks for errors) after any data arrives.  */
 
@@ -1703,8 +2102,14 @@ cleanup (void)
   convert_cleanup ();
   res_cleanup ();
   http_cleanup ();
+  preconnect_cleanup ();
+  bind_sources_cleanup ();
+  receive_buffers_cleanup ();
+  trap_cleanup ();
+  rate_limit_cleanup ();
   cleanup_html_url ();
   spider_cleanup ();
+  checksum_cleanup ();
   host_cleanup ();
   log_cleanup ();
 
@@ -1720,6 +2125,7 @@ cleanup (void)
   xfree_null (opt.dir_prefix);
   xfree_null (opt.input_filename);
   xfree_null (opt.output_document);
+  xfree_null (opt.link_report);
   free_vec (opt.accepts);
   free_vec (opt.rejects);
   free_vec (opt.excludes);
@@ -1727,6 +2133,10 @@ cleanup (void)
   free_vec (opt.domains);
   free_vec (opt.follow_tags);
   free_vec (opt.ignore_tags);
+  free_vec (opt.strip_params);
+  free_rate_limits (&opt.limit_rate_hosts, &opt.limit_rate_host_count);
+  free_rate_limits (&opt.limit_rate_schedule,
+                    &opt.limit_rate_schedule_count);
   xfree_null (opt.progress_type);
   xfree_null (opt.ftp_user);
   xfree_null (opt.ftp_passwd);
@@ -1748,9 +2158,10 @@ cleanup (void)
   xfree_null (opt.random_file);
   xfree_null (opt.egd_file);
 # endif
-  xfree_null (opt.bind_address);
+  free_vec (opt.bind_addresses);
   xfree_null (opt.cookies_input);
   xfree_null (opt.cookies_output);
+  xfree_null (opt.address_stats);
   xfree_null (opt.user);
   xfree_null (opt.passwd);
   xfree_null (opt.base_href);
@@ -1825,5 +2236,76 @@ test_cmd_spec_restrict_file_names()
   return NULL;
 }
 
+const char *
+test_cmd_spec_bind_address()
+{
+  defaults();
+
+  cmd_spec_bind_address ("bindaddress", "192.0.2.1", NULL);
+  mu_assert ("test_cmd_spec_bind_address: single address",
+             opt.bind_addresses
+             && !strcmp (opt.bind_addresses[0], "192.0.2.1")
+             && !opt.bind_addresses[1]);
+
+  /* A new value replaces the old one rather than adding to it.  */
+  cmd_spec_bind_address ("bindaddress", "10.0.0.1, 10.0.0.2,,::1,", NULL);
+  mu_assert ("test_cmd_spec_bind_address: list",
+             opt.bind_addresses
+             && !strcmp (opt.bind_addresses[0], "10.0.0.1")
+             && !strcmp (opt.bind_addresses[1], "10.0.0.2")
+             && !strcmp (opt.bind_addresses[2], "::1")
+             && !opt.bind_addresses[3]);
+
+  cmd_spec_bind_address ("bindaddress", "", NULL);
+  mu_assert ("test_cmd_spec_bind_address: empty value",
+             opt.bind_addresses == NULL);
+
+  return NULL;
+}
+
+const char *
+test_parse_rate_limit()
+{
+  static const struct {
+    const char *item;
+    bool result;
+    int from, to;
+  } test_array[] = {
+    { "09:00-18:00=200k", true, 9 * 60, 18 * 60 },
+    { "22:30-06:15=1m", true, 22 * 60 + 30, 6 * 60 + 15 },
+    { "00:00-23:59=10k", true, 0, 23 * 60 + 59 },
+    { "24:30-06:00=1m", false, 0, 0 },
+    { "24:00-06:00=1m", false, 0, 0 },
+    { "18:00-24:00=1m", false, 0, 0 },
+    { "09:60-18:00=1m", false, 0, 0 },
+    { "09:00-18:75=1m", false, 0, 0 },
+    { "-1:00-18:00=1m", false, 0, 0 },
+    { "09:00-18:00", false, 0, 0 },
+    { "09:00-18:00=", false, 0, 0 },
+    { "09:00=1m", false, 0, 0 },
+  };
+  struct rate_limit rule;
+  int i;
+
+  for (i = 0; i < countof (test_array); ++i)
+    {
+      bool res = parse_rate_limit (test_array[i].item, false, &rule);
+      mu_assert ("test_parse_rate_limit: wrong result",
+                 res == test_array[i].result);
+      if (res)
+        mu_assert ("test_parse_rate_limit: wrong times",
+                   rule.from == test_array[i].from
+                   && rule.to == test_array[i].to);
+    }
+
+  mu_assert ("test_parse_rate_limit: host",
+             parse_rate_limit (".example.com=100k", true, &rule)
+             && !strcmp (rule.host, "example.com")
+             && rule.rate == 100 * 1024);
+  xfree (rule.host);
+
+  return NULL;
+}
+
 #endif /* TESTING */
 
@@ -878,7 +878,7 @@ redirect_output (void)
 }
 
 /* Check whether a signal handler requested the output to be
-   redirected. */
+   redirected, or the allocation report to be printed. */
 
 static void
 check_redirect_output (void)
@@ -888,6 +888,7 @@ check_redirect_output (void)
       redirect_request = RR_DONE;
       redirect_output ();
     }
+  alloc_stats_check_report ();
 }
 
 /* Request redirection at a convenient time.  This may be called from
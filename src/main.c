@@ -56,6 +56,11 @@ as that of the covered work.  */
 #include "http.h"               /* for save_cookies */
 #include "ptimer.h"
 #include "warc.h"
+#include "checksum.h"
+#include "metalink.h"
+#include "daemon.h"
+#include "shard.h"
+#include "connect.h"            /* for bind_sources_report */
 #include <getopt.h>
 #include <getpass.h>
 #include <quote.h>
@@ -158,6 +163,7 @@ static struct cmdline_option option_data[] =
   {
     { "accept", 'A', OPT_VALUE, "accept", -1 },
     { "accept-regex", 0, OPT_VALUE, "acceptregex", -1 },
+    { "address-stats", 0, OPT_VALUE, "addressstats", -1 },
     { "adjust-extension", 'E', OPT_BOOLEAN, "adjustextension", -1 },
     { "append-output", 'a', OPT__APPEND_OUTPUT, NULL, required_argument },
     { "ask-password", 0, OPT_BOOLEAN, "askpassword", -1 },
@@ -167,24 +173,33 @@ static struct cmdline_option option_data[] =
     { "backups", 0, OPT_BOOLEAN, "backups", -1 },
     { "base", 'B', OPT_VALUE, "base", -1 },
     { "bind-address", 0, OPT_VALUE, "bindaddress", -1 },
+    { "bind-policy", 0, OPT_VALUE, "bindpolicy", -1 },
     { IF_SSL ("ca-certificate"), 0, OPT_VALUE, "cacertificate", -1 },
     { IF_SSL ("ca-directory"), 0, OPT_VALUE, "cadirectory", -1 },
     { "cache", 0, OPT_BOOLEAN, "cache", -1 },
+    { "canonicalize", 0, OPT_VALUE, "canonicalize", -1 },
     { IF_SSL ("certificate"), 0, OPT_VALUE, "certificate", -1 },
     { IF_SSL ("certificate-type"), 0, OPT_VALUE, "certificatetype", -1 },
     { IF_SSL ("check-certificate"), 0, OPT_BOOLEAN, "checkcertificate", -1 },
+    { "checksum", 0, OPT_VALUE, "checksum", -1 },
+    { "checksum-file", 0, OPT_VALUE, "checksumfile", -1 },
     { "clobber", 0, OPT__CLOBBER, NULL, optional_argument },
     { "config", 0, OPT_VALUE, "chooseconfig", -1 },
     { "connect-timeout", 0, OPT_VALUE, "connecttimeout", -1 },
     { "continue", 'c', OPT_BOOLEAN, "continue", -1 },
     { "convert-links", 'k', OPT_BOOLEAN, "convertlinks", -1 },
+    { "convert-sync", 0, OPT_VALUE, "convertsync", -1 },
     { "content-disposition", 0, OPT_BOOLEAN, "contentdisposition", -1 },
     { "content-on-error", 0, OPT_BOOLEAN, "contentonerror", -1 },
     { "cookies", 0, OPT_BOOLEAN, "cookies", -1 },
     { "cut-dirs", 0, OPT_VALUE, "cutdirs", -1 },
+    { "daemon", 0, OPT_VALUE, "daemon", -1 },
+    { "daemon-jobs", 0, OPT_VALUE, "daemonjobs", -1 },
     { WHEN_DEBUG ("debug"), 'd', OPT_BOOLEAN, "debug", -1 },
     { "default-page", 0, OPT_VALUE, "defaultpage", -1 },
     { "delete-after", 0, OPT_BOOLEAN, "deleteafter", -1 },
+    { "delta-update", 0, OPT_BOOLEAN, "deltaupdate", -1 },
+    { "dir-budget", 0, OPT_VALUE, "dirbudget", -1 },
     { "directories", 0, OPT_BOOLEAN, "dirstruct", -1 },
     { "directory-prefix", 'P', OPT_VALUE, "dirprefix", -1 },
     { "dns-cache", 0, OPT_BOOLEAN, "dnscache", -1 },
@@ -197,6 +212,7 @@ static struct cmdline_option option_data[] =
     { "exclude-domains", 0, OPT_VALUE, "excludedomains", -1 },
     { "execute", 'e', OPT__EXECUTE, NULL, required_argument },
     { "follow-ftp", 0, OPT_BOOLEAN, "followftp", -1 },
+    { "follow-input", 0, OPT_BOOLEAN, "followinput", -1 },
     { "follow-tags", 0, OPT_VALUE, "followtags", -1 },
     { "force-directories", 'x', OPT_BOOLEAN, "dirstruct", -1 },
     { "force-html", 'F', OPT_BOOLEAN, "forcehtml", -1 },
@@ -206,6 +222,7 @@ static struct cmdline_option option_data[] =
 #endif /* def __VMS */
     { "ftp-user", 0, OPT_VALUE, "ftpuser", -1 },
     { "glob", 0, OPT_BOOLEAN, "glob", -1 },
+    { "group-by-host", 0, OPT_BOOLEAN, "groupbyhost", -1 },
     { "header", 0, OPT_VALUE, "header", -1 },
     { "help", 'h', OPT_FUNCALL, (void *)print_help, no_argument },
     { "host-directories", 0, OPT_BOOLEAN, "addhostdir", -1 },
@@ -218,6 +235,7 @@ static struct cmdline_option option_data[] =
     { "ignore-case", 0, OPT_BOOLEAN, "ignorecase", -1 },
     { "ignore-length", 0, OPT_BOOLEAN, "ignorelength", -1 },
     { "ignore-tags", 0, OPT_VALUE, "ignoretags", -1 },
+    { "in-memory-limit", 0, OPT_VALUE, "inmemorylimit", -1 },
     { "include-directories", 'I', OPT_VALUE, "includedirectories", -1 },
 #ifdef ENABLE_IPV6
     { "inet4-only", '4', OPT_BOOLEAN, "inet4only", -1 },
@@ -227,10 +245,21 @@ static struct cmdline_option option_data[] =
     { "iri", 0, OPT_BOOLEAN, "iri", -1 },
     { "keep-session-cookies", 0, OPT_BOOLEAN, "keepsessioncookies", -1 },
     { "level", 'l', OPT_VALUE, "reclevel", -1 },
+    { "limit-burst", 0, OPT_VALUE, "limitburst", -1 },
     { "limit-rate", 0, OPT_VALUE, "limitrate", -1 },
+    { "limit-rate-host", 0, OPT_VALUE, "limitratehost", -1 },
+    { "limit-rate-schedule", 0, OPT_VALUE, "limitrateschedule", -1 },
+    { "limit-rate-total", 0, OPT_VALUE, "limitratetotal", -1 },
+    { "link-report", 0, OPT_VALUE, "linkreport", -1 },
+    { "link-report-format", 0, OPT_VALUE, "linkreportformat", -1 },
     { "load-cookies", 0, OPT_VALUE, "loadcookies", -1 },
     { "local-encoding", 0, OPT_VALUE, "localencoding", -1 },
+    { "max-path-depth", 0, OPT_VALUE, "maxpathdepth", -1 },
     { "max-redirect", 0, OPT_VALUE, "maxredirect", -1 },
+    { "max-segment-repeat", 0, OPT_VALUE, "maxsegmentrepeat", -1 },
+    { "max-url-length", 0, OPT_VALUE, "maxurllength", -1 },
+    { "metalink", 0, OPT_VALUE, "metalink", -1 },
+    { "metalink-jobs", 0, OPT_VALUE, "metalinkjobs", -1 },
     { "mirror", 'm', OPT_BOOLEAN, "mirror", -1 },
     { "no", 'n', OPT__NO, NULL, required_argument },
     { "no-clobber", 0, OPT_BOOLEAN, "noclobber", -1 },
@@ -243,6 +272,7 @@ static struct cmdline_option option_data[] =
     { "password", 0, OPT_VALUE, "password", -1 },
     { "post-data", 0, OPT_VALUE, "postdata", -1 },
     { "post-file", 0, OPT_VALUE, "postfile", -1 },
+    { "preconnect", 0, OPT_VALUE, "preconnect", -1 },
     { "prefer-family", 0, OPT_VALUE, "preferfamily", -1 },
     { "preserve-permissions", 0, OPT_BOOLEAN, "preservepermissions", -1 },
     { IF_SSL ("private-key"), 0, OPT_VALUE, "privatekey", -1 },
@@ -254,6 +284,7 @@ static struct cmdline_option option_data[] =
     { "proxy-passwd", 0, OPT_VALUE, "proxypassword", -1 }, /* deprecated */
     { "proxy-password", 0, OPT_VALUE, "proxypassword", -1 },
     { "proxy-user", 0, OPT_VALUE, "proxyuser", -1 },
+    { "query-budget", 0, OPT_VALUE, "querybudget", -1 },
     { "quiet", 'q', OPT_BOOLEAN, "quiet", -1 },
     { "quota", 'Q', OPT_VALUE, "quota", -1 },
     { "random-file", 0, OPT_VALUE, "randomfile", -1 },
@@ -275,9 +306,18 @@ static struct cmdline_option option_data[] =
     { "save-headers", 0, OPT_BOOLEAN, "saveheaders", -1 },
     { IF_SSL ("secure-protocol"), 0, OPT_VALUE, "secureprotocol", -1 },
     { "server-response", 'S', OPT_BOOLEAN, "serverresponse", -1 },
+    { "shard", 0, OPT_VALUE, "shard", -1 },
+    { "shard-dir", 0, OPT_VALUE, "sharddir", -1 },
+    { "skip-similar", 0, OPT_BOOLEAN, "skipsimilar", -1 },
+    { "socket-buffer", 0, OPT_VALUE, "socketbuffer", -1 },
     { "span-hosts", 'H', OPT_BOOLEAN, "spanhosts", -1 },
     { "spider", 0, OPT_BOOLEAN, "spider", -1 },
+    { "spider-jobs", 0, OPT_VALUE, "spiderjobs", -1 },
+    { "srcset", 0, OPT_VALUE, "srcset", -1 },
+    { "startup-stats", 0, OPT_BOOLEAN, "startupstats", -1 },
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
+    { "strip-params", 0, OPT_VALUE, "stripparams", -1 },
+    { "submit", 0, OPT_VALUE, "submit", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
     { "tries", 't', OPT_VALUE, "tries", -1 },
@@ -317,7 +357,7 @@ static struct cmdline_option option_data[] =
 static char *
 no_prefix (const char *s)
 {
-  static char buffer[1024];
+  static char buffer[2048];
   static char *p = buffer;
 
   char *cp = p;
@@ -437,6 +477,12 @@ Startup:\n"),
   -b,  --background        go to background after startup.\n"),
     N_("\
   -e,  --execute=COMMAND   execute a `.wgetrc'-style command.\n"),
+    N_("\
+       --daemon=SOCKET     run the jobs submitted on the Unix SOCKET.\n"),
+    N_("\
+       --daemon-jobs=N     run up to N submitted jobs at once.\n"),
+    N_("\
+       --submit=SOCKET     have the daemon on SOCKET run this command.\n"),
     "\n",
 
     N_("\
@@ -461,8 +507,15 @@ Logging and input file:\n"),
   -nv, --no-verbose          turn off verboseness, without being quiet.\n"),
     N_("\
        --report-speed=TYPE   Output bandwidth as TYPE.  TYPE can be bits.\n"),
+    N_("\
+       --startup-stats       report the time spent initializing.\n"),
     N_("\
   -i,  --input-file=FILE     download URLs found in local or external FILE.\n"),
+    N_("\
+       --follow-input        keep reading the input file as it grows.\n"),
+    N_("\
+       --group-by-host       retrieve the URLs of the input file grouped\n\
+                             by host, reusing connections.\n"),
     N_("\
   -F,  --force-html          treat input file as HTML.\n"),
     N_("\
@@ -485,6 +538,9 @@ Download:\n"),
                                  existing files (overwriting them).\n"),
     N_("\
   -c,  --continue                resume getting a partially-downloaded file.\n"),
+    N_("\
+       --delta-update            update existing files by fetching only the\n\
+                                 changed parts, using zsync manifests.\n"),
     N_("\
        --progress=TYPE           select progress gauge type.\n"),
     N_("\
@@ -497,6 +553,24 @@ Download:\n"),
   -S,  --server-response         print server response.\n"),
     N_("\
        --spider                  don't download anything.\n"),
+    N_("\
+       --spider-jobs=N           check up to N links at once with --spider.\n"),
+    N_("\
+       --link-report=FILE        write the outcome of each --spider check\n\
+                                 to FILE.\n"),
+    N_("\
+       --link-report-format=FMT  write the link report as json or csv.\n"),
+    N_("\
+       --checksum=ALGO:HEX       verify the file against the given MD5, SHA1\n\
+                                 or SHA256 checksum.\n"),
+    N_("\
+       --checksum-file=FILE      verify files against the checksums listed\n\
+                                 in FILE (as written by sha256sum etc.).\n"),
+    N_("\
+       --metalink=FILE           download the files described by the Metalink\n\
+                                 FILE in pieces from multiple mirrors.\n"),
+    N_("\
+       --metalink-jobs=NUMBER    fetch up to NUMBER pieces at once.\n"),
     N_("\
   -T,  --timeout=SECONDS         set all timeout values to SECONDS.\n"),
     N_("\
@@ -505,6 +579,8 @@ Download:\n"),
        --connect-timeout=SECS    set the connect timeout to SECS.\n"),
     N_("\
        --read-timeout=SECS       set the read timeout to SECS.\n"),
+    N_("\
+       --preconnect=N            connect early to the hosts of the next N URLs.\n"),
     N_("\
   -w,  --wait=SECONDS            wait SECONDS between retrievals.\n"),
     N_("\
@@ -516,11 +592,33 @@ Download:\n"),
     N_("\
   -Q,  --quota=NUMBER            set retrieval quota to NUMBER.\n"),
     N_("\
-       --bind-address=ADDRESS    bind to ADDRESS (hostname or IP) on local host.\n"),
+       --bind-address=ADDRESS    bind to ADDRESS (hostname or IP) on local host.\n\
+                                 Several comma-separated addresses may be\n\
+                                 given.\n"),
+    N_("\
+       --bind-policy=POLICY      choose among the bind addresses for each\n\
+                                 connection by POLICY: round-robin, hash\n\
+                                 or least-loaded.\n"),
     N_("\
        --limit-rate=RATE         limit download rate to RATE.\n"),
+    N_("\
+       --limit-rate-total=RATE   limit the rate of all downloads together.\n"),
+    N_("\
+       --limit-rate-host=DOMAIN=RATE\n\
+                                 limit the rate of downloads from DOMAIN.\n"),
+    N_("\
+       --limit-rate-schedule=HH:MM-HH:MM=RATE\n\
+                                 limit the total rate between the given\n\
+                                 times of day.\n"),
+    N_("\
+       --limit-burst=SIZE        let downloads exceed their limits by SIZE.\n"),
+    N_("\
+       --socket-buffer=auto|SIZE set the size of the socket receive buffer.\n"),
     N_("\
        --no-dns-cache            disable caching DNS lookups.\n"),
+    N_("\
+       --address-stats=FILE      keep the connect times and failures of\n\
+                                 addresses in FILE across runs.\n"),
     N_("\
        --restrict-file-names=OS  restrict chars in file names to ones OS allows.\n"),
     N_("\
@@ -702,9 +800,17 @@ Recursive download:\n"),
   -l,  --level=NUMBER       maximum recursion depth (inf or 0 for infinite).\n"),
     N_("\
        --delete-after       delete files locally after downloading them.\n"),
+    N_("\
+       --in-memory-limit=SIZE\n\
+                            parse documents up to SIZE in memory instead of\n\
+                            saving them with --spider or --delete-after.\n"),
     N_("\
   -k,  --convert-links      make links in downloaded HTML or CSS point to\n\
                             local files.\n"),
+    N_("\
+       --convert-sync=POLICY\n\
+                            sync converted files to disk: none, file\n\
+                            or dir.\n"),
 #ifdef __VMS
     N_("\
   -K,  --backup-converted   before converting file X, back up as X_orig.\n"),
@@ -716,8 +822,15 @@ Recursive download:\n"),
   -m,  --mirror             shortcut for -N -r -l inf --no-remove-listing.\n"),
     N_("\
   -p,  --page-requisites    get all images, etc. needed to display HTML page.\n"),
+    N_("\
+       --srcset=POLICY      which images of a srcset to get: all, smallest,\n\
+                            largest, or the best for a display WIDTH wide.\n"),
     N_("\
        --strict-comments    turn on strict (SGML) handling of HTML comments.\n"),
+    N_("\
+       --shard=K/N          retrieve share K of N, by host, of the crawl.\n"),
+    N_("\
+       --shard-dir=DIR      exchange links with the other shards in DIR.\n"),
     "\n",
 
     N_("\
@@ -747,6 +860,28 @@ Recursive accept/reject:\n"),
        --follow-tags=LIST          comma-separated list of followed HTML tags.\n"),
     N_("\
        --ignore-tags=LIST          comma-separated list of ignored HTML tags.\n"),
+    N_("\
+       --canonicalize=RULES        compare links in a canonical form when\n\
+                                   deciding whether they were seen before\n\
+                                   (query|index|case|escapes|all).\n"),
+    N_("\
+       --strip-params=LIST         query parameters to ignore when comparing\n\
+                                   links.\n"),
+    N_("\
+       --max-path-depth=NUMBER     reject links more than NUMBER directories deep.\n"),
+    N_("\
+       --max-url-length=NUMBER     reject links longer than NUMBER characters.\n"),
+    N_("\
+       --max-segment-repeat=NUMBER reject links in which a directory occurs\n\
+                                   more than NUMBER times.\n"),
+    N_("\
+       --dir-budget=NUMBER         retrieve at most NUMBER URLs per directory.\n"),
+    N_("\
+       --query-budget=NUMBER       retrieve at most NUMBER URLs per path and\n\
+                                   set of query parameter names.\n"),
+    N_("\
+       --skip-similar              don't follow the links of pages nearly\n\
+                                   identical to ones seen before.\n"),
     N_("\
   -H,  --span-hosts                go to foreign hosts when recursive.\n"),
     N_("\
@@ -964,42 +1099,15 @@ There is NO WARRANTY, to the extent permitted by law.\n"), stdout) < 0)
 char *program_name; /* Needed by lib/error.c. */
 char *program_argstring; /* Needed by wget_warc.c. */
 
-int
-main (int argc, char **argv)
-{
-  char **url, **t;
-  int i, ret, longindex;
-  int nurl;
-  bool append_to_log = false;
-
-  total_downloaded_bytes = 0;
+/* Set program_argstring to the quoted arguments ARGV.  */
 
-  program_name = argv[0];
-
-  struct ptimer *timer = ptimer_new ();
-  double start_time = ptimer_measure (timer);
-
-  i18n_initialize ();
-
-  /* Construct the name of the executable, without the directory part.  */
-#ifdef __VMS
-  /* On VMS, lose the "dev:[dir]" prefix and the ".EXE;nnn" suffix. */
-  exec_name = vms_basename (argv[0]);
-#else /* def __VMS */
-  exec_name = strrchr (argv[0], PATH_SEPARATOR);
-  if (!exec_name)
-    exec_name = argv[0];
-  else
-    ++exec_name;
-#endif /* def __VMS [else] */
-
-#ifdef WINDOWS
-  /* Drop extension (typically .EXE) from executable filename. */
-  windows_main ((char **) &exec_name);
-#endif
-
-  /* Construct the arguments string. */
+static void
+set_program_argstring (int argc, char **argv)
+{
+  int i;
   int argstring_length = 1;
+
+  free (program_argstring);
   for (i = 1; i < argc; i++)
     argstring_length += strlen (argv[i]) + 2 + 1;
   char *p = program_argstring = malloc (argstring_length * sizeof (char));
@@ -1018,48 +1126,15 @@ main (int argc, char **argv)
       *p++ = ' ';
     }
   *p = '\0';
+}
 
-  /* Load the hard-coded defaults.  */
-  defaults ();
-
-  init_switches ();
-
-  /* This separate getopt_long is needed to find the user config file
-     option ("--config") and parse it before the other user options. */
-  longindex = -1;
-  int retconf;
-  bool use_userconfig = false;
-
-  while ((retconf = getopt_long (argc, argv,
-                                short_options, long_options, &longindex)) != -1)
-    {
-      int confval;
-      bool userrc_ret = true;
-      struct cmdline_option *config_opt;
-
-      /* There is no short option for "--config". */
-      if (longindex >= 0)
-        {
-          confval = long_options[longindex].val;
-          config_opt = &option_data[confval & ~BOOLEAN_NEG_MARKER];
-          if (strcmp (config_opt->long_name, "config") == 0)
-            {
-              userrc_ret &= run_wgetrc (optarg);
-              use_userconfig = true;
-            }
-          if (!userrc_ret)
-            {
-              fprintf (stderr, _("Exiting due to error in %s\n"), optarg);
-              exit (2);
-            }
-          else
-            break;
-        }
-    }
+/* Process the command-line options in ARGV.  APPEND_TO_LOG is set if
+   the log file is to be appended to.  */
 
-  /* If the user did not specify a config, read the system wgetrc and ~/.wgetrc. */
-  if (use_userconfig == false)
-    initialize ();
+static void
+parse_args (int argc, char **argv, bool *append_to_log)
+{
+  int ret, longindex;
 
   opterr = 0;
   optind = 0;
@@ -1116,7 +1191,7 @@ main (int argc, char **argv)
           break;
         case OPT__APPEND_OUTPUT:
           setoptval ("logfile", optarg, opt->long_name);
-          append_to_log = true;
+          *append_to_log = true;
           break;
         case OPT__EXECUTE:
           run_command (optarg);
@@ -1178,6 +1253,130 @@ main (int argc, char **argv)
 
       longindex = -1;
     }
+}
+
+int
+main (int argc, char **argv)
+{
+  char **url, **t, **orig_argv;
+  int i, longindex;
+  int nurl;
+  bool append_to_log = false;
+
+  total_downloaded_bytes = 0;
+
+  program_name = argv[0];
+
+  struct ptimer *timer = ptimer_new ();
+  double start_time = ptimer_measure (timer);
+  double stats_start;
+
+  stats_start = startup_stats_clock ();
+  i18n_initialize ();
+  startup_stats_add ("locale", stats_start, false);
+
+  /* Construct the name of the executable, without the directory part.  */
+#ifdef __VMS
+  /* On VMS, lose the "dev:[dir]" prefix and the ".EXE;nnn" suffix. */
+  exec_name = vms_basename (argv[0]);
+#else /* def __VMS */
+  exec_name = strrchr (argv[0], PATH_SEPARATOR);
+  if (!exec_name)
+    exec_name = argv[0];
+  else
+    ++exec_name;
+#endif /* def __VMS [else] */
+
+#ifdef WINDOWS
+  /* Drop extension (typically .EXE) from executable filename. */
+  windows_main ((char **) &exec_name);
+#endif
+
+  /* Construct the arguments string. */
+  set_program_argstring (argc, argv);
+
+  /* Keep the arguments in their original order, to hand them to a
+     daemon.  */
+  orig_argv = alloca_array (char *, argc + 1);
+  memcpy (orig_argv, argv, (argc + 1) * sizeof (char *));
+
+  /* Load the hard-coded defaults.  */
+  stats_start = startup_stats_clock ();
+  defaults ();
+
+  init_switches ();
+
+  /* This separate getopt_long is needed to find the user config file
+     option ("--config") and parse it before the other user options. */
+  longindex = -1;
+  int retconf;
+  bool use_userconfig = false;
+
+  while ((retconf = getopt_long (argc, argv,
+                                short_options, long_options, &longindex)) != -1)
+    {
+      int confval;
+      bool userrc_ret = true;
+      struct cmdline_option *config_opt;
+
+      /* There is no short option for "--config". */
+      if (longindex >= 0)
+        {
+          confval = long_options[longindex].val;
+          config_opt = &option_data[confval & ~BOOLEAN_NEG_MARKER];
+          if (strcmp (config_opt->long_name, "config") == 0)
+            {
+              userrc_ret &= run_wgetrc (optarg);
+              use_userconfig = true;
+            }
+          if (!userrc_ret)
+            {
+              fprintf (stderr, _("Exiting due to error in %s\n"), optarg);
+              exit (2);
+            }
+          else
+            break;
+        }
+    }
+
+  startup_stats_add ("defaults", stats_start, false);
+
+  /* If the user did not specify a config, read the system wgetrc and ~/.wgetrc. */
+  stats_start = startup_stats_clock ();
+  if (use_userconfig == false)
+    initialize ();
+  startup_stats_add ("wgetrc", stats_start, false);
+  stats_start = startup_stats_clock ();
+
+  parse_args (argc, argv, &append_to_log);
+
+  /* Hand the command line over to a daemon, if one is listening.  */
+  if (opt.submit_socket && !opt.daemon_socket)
+    {
+      int status = daemon_submit (opt.submit_socket, argc, orig_argv);
+      if (status >= 0)
+        exit (status);
+      if (!opt.quiet)
+        fprintf (stderr, _("Cannot submit to %s: %s; running directly.\n"),
+                 opt.submit_socket, strerror (errno));
+    }
+
+  if (opt.daemon_socket)
+    {
+      char *socket_name = opt.daemon_socket;
+      opt.daemon_socket = NULL;
+
+      /* This returns only in the processes forked to run the jobs, with
+         the job's arguments, which apply on top of the daemon's.  */
+      daemon_serve (socket_name, &argc, &argv);
+      xfree (socket_name);
+
+      start_time = ptimer_measure (timer);
+      set_program_argstring (argc, argv);
+      parse_args (argc, argv, &append_to_log);
+      if (!daemon_check_job ())
+        exit (2);
+    }
 
   nurl = argc - optind;
 
@@ -1218,6 +1417,56 @@ main (int argc, char **argv)
       print_usage (1);
       exit (1);
     }
+  if (opt.checksum && opt.checksum_file)
+    {
+      fprintf (stderr,
+               _("Cannot specify both --checksum and --checksum-file.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if (opt.checksum
+      && (nurl > 1 || opt.input_filename || opt.recursive
+          || opt.page_requisites))
+    {
+      fprintf (stderr, _("\
+--checksum applies to a single file; use --checksum-file to verify\n\
+multiple files, or in combination with -i, -r or -p.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if (opt.group_by_host && opt.follow_input)
+    {
+      fprintf (stderr, _("\
+--group-by-host needs the whole input file; it cannot be used\n\
+with --follow-input.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if (opt.shard_count > 1 && !opt.shard_dir)
+    {
+      fprintf (stderr, _("--shard requires --shard-dir.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if ((opt.link_report || opt.spider_jobs > 1) && !opt.spider)
+    {
+      fprintf (stderr,
+               _("--link-report and --spider-jobs require --spider.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if (opt.spider_jobs > 1 && opt.shard_count > 1)
+    {
+      fprintf (stderr, _("Cannot specify both --spider-jobs and --shard.\n"));
+      print_usage (1);
+      exit (1);
+    }
+  if (opt.metalink_file && opt.output_document)
+    {
+      fprintf (stderr, _("Cannot specify both --metalink and -O.\n"));
+      print_usage (1);
+      exit (1);
+    }
   if (opt.timestamping && opt.noclobber)
     {
       fprintf (stderr, _("\
@@ -1259,6 +1508,12 @@ WARNING: timestamping does nothing in combination with -O. See the manual\n\
 for details.\n\n"));
           opt.timestamping = false;
         }
+      if (opt.delta_update)
+        {
+          logprintf (LOG_NOTQUIET, "%s", _("\
+WARNING: --delta-update does nothing in combination with -O.\n\n"));
+          opt.delta_update = false;
+        }
       if (opt.noclobber && file_exists_p(opt.output_document))
            {
               /* Check if output file exists; if it does, exit. */
@@ -1298,6 +1553,13 @@ for details.\n\n"));
                      "--continue will be disabled.\n"));
           opt.always_rest = false;
         }
+      if (opt.delta_update)
+        {
+          fprintf (stderr,
+                   _("WARC output does not work with --delta-update, "
+                     "--delta-update will be disabled.\n"));
+          opt.delta_update = false;
+        }
       if (opt.warc_cdx_dedup_filename != 0 && !opt.warc_digests_enabled)
         {
           fprintf (stderr,
@@ -1318,7 +1580,7 @@ for details.\n\n"));
       exit (1);
     }
 
-  if (!nurl && !opt.input_filename)
+  if (!nurl && !opt.input_filename && !opt.metalink_file)
     {
       /* No URL specified.  */
       fprintf (stderr, _("%s: missing URL\n"), exec_name);
@@ -1330,7 +1592,10 @@ for details.\n\n"));
       exit (1);
     }
 
+  startup_stats_add ("command line", stats_start, false);
+
   /* Compile the regular expressions.  */
+  stats_start = startup_stats_clock ();
   switch (opt.regex_type)
     {
 #ifdef HAVE_LIBPCRE
@@ -1359,7 +1624,10 @@ for details.\n\n"));
         exit (1);
     }
 
+  startup_stats_add ("regular expressions", stats_start, false);
+
 #ifdef ENABLE_IRI
+  stats_start = startup_stats_clock ();
   if (opt.enable_iri)
     {
       if (opt.locale && !check_encoding_name (opt.locale))
@@ -1371,6 +1639,7 @@ for details.\n\n"));
       if (opt.encoding_remote && !check_encoding_name (opt.encoding_remote))
         opt.encoding_remote = NULL;
     }
+  startup_stats_add ("IRI locale", stats_start, false);
 #else
   memset (&dummy_iri, 0, sizeof (dummy_iri));
   if (opt.enable_iri || opt.locale || opt.encoding_remote)
@@ -1421,11 +1690,34 @@ for details.\n\n"));
   url[i] = NULL;
 
   /* Initialize logging.  */
+  stats_start = startup_stats_clock ();
   log_init (opt.lfilename, append_to_log);
+  startup_stats_add ("logging", stats_start, false);
 
   /* Open WARC file. */
   if (opt.warc_filename != 0)
-    warc_init ();
+    {
+      /* Each shard writes a WARC file of its own.  */
+      if (opt.shard_count > 1)
+        {
+          char *name = aprintf ("%s-shard%d", opt.warc_filename,
+                                opt.shard_index + 1);
+          xfree (opt.warc_filename);
+          opt.warc_filename = name;
+        }
+      stats_start = startup_stats_clock ();
+      warc_init ();
+      startup_stats_add ("WARC", stats_start, false);
+    }
+
+  /* Read the checksums to verify the downloads against.  */
+  if (opt.checksum_file)
+    {
+      stats_start = startup_stats_clock ();
+      if (!checksum_read_file (opt.checksum_file))
+        exit (1);
+      startup_stats_add ("checksum file", stats_start, false);
+    }
 
   DEBUGP (("DEBUG output created by Wget %s on %s.\n\n",
            version_string, OS_TYPE));
@@ -1483,6 +1775,9 @@ outputting to a regular file.\n"));
         }
     }
 
+  if (opt.link_report)
+    link_report_open ();
+
 #ifdef __VMS
   /* Set global ODS5 flag according to the specified destination (if
      any), otherwise according to the current default device.
@@ -1542,24 +1837,17 @@ outputting to a regular file.\n"));
         {
           if ((opt.recursive || opt.page_requisites)
               && (url_scheme (*t) != SCHEME_FTP || url_uses_proxy (url_parsed)))
-            {
-              int old_follow_ftp = opt.follow_ftp;
-
-              /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
-              if (url_scheme (*t) == SCHEME_FTP)
-                opt.follow_ftp = 1;
-
-              retrieve_tree (url_parsed, NULL);
-
-              opt.follow_ftp = old_follow_ftp;
-            }
+            retrieve_tree (url_parsed, NULL);
           else
           {
             retrieve_url (url_parsed, *t, &filename, &redirected_URL, NULL,
                           &dt, opt.recursive, iri, true);
           }
 
-          if (opt.delete_after && filename != NULL && file_exists_p (filename))
+          if (filename != NULL && memory_file_p (filename))
+            memory_file_forget (filename);
+          else if (opt.delete_after && filename != NULL
+                   && file_exists_p (filename))
             {
               DEBUGP (("Removing file due to --delete-after in main():\n"));
               logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
@@ -1585,6 +1873,18 @@ outputting to a regular file.\n"));
                    opt.input_filename);
     }
 
+  /* And the files described by the Metalink file.  */
+  if (opt.metalink_file)
+    {
+      int count;
+      int status;
+      status = retrieve_from_metalink (opt.metalink_file, &count);
+      inform_exit_status (status);
+      if (!count)
+        logprintf (LOG_NOTQUIET, _("No files found in %s.\n"),
+                   opt.metalink_file);
+    }
+
   /* Print broken links. */
   if (opt.recursive && opt.spider)
     print_broken_links ();
@@ -1592,7 +1892,8 @@ outputting to a regular file.\n"));
   /* Print the downloaded sum.  */
   if ((opt.recursive || opt.page_requisites
        || nurl > 1
-       || (opt.input_filename && total_downloaded_bytes != 0))
+       || ((opt.input_filename || opt.metalink_file)
+           && total_downloaded_bytes != 0))
       &&
       total_downloaded_bytes != 0)
     {
@@ -1620,11 +1921,25 @@ outputting to a regular file.\n"));
                    human_readable (opt.quota));
     }
 
+  bind_sources_report ();
+
   if (opt.cookies_output)
     save_cookies ();
 
+  address_stats_save ();
+
   if (opt.convert_links && !opt.delete_after)
-    convert_all_links ();
+    {
+      /* Convert the links to the files the other shards downloaded
+         as well.  */
+      if (opt.shard_count > 1)
+        shard_merge_maps ();
+      convert_all_links ();
+    }
+
+  if (opt.startup_stats)
+    startup_stats_print ();
+  alloc_stats_report ();
 
   cleanup ();
 
@@ -1644,7 +1959,8 @@ outputting to a regular file.\n"));
 
 /* Hangup signal handler.  When wget receives SIGHUP or SIGUSR1, it
    will proceed operation as usual, trying to write into a log file.
-   If that is impossible, the output will be turned off.  */
+   If that is impossible, the output will be turned off.  SIGUSR1 also
+   prints the allocation report of --enable-alloc-stats builds.  */
 
 static void
 redirect_output_signal (int sig)
@@ -1654,6 +1970,8 @@ redirect_output_signal (int sig)
                               "WTF?!"));
   log_request_redirect_output (signal_name);
   progress_schedule_redirect ();
+  if (sig == SIGUSR1)
+    alloc_stats_request_report ();
   signal (sig, redirect_output_signal);
 }
 #endif
@@ -0,0 +1,1071 @@
+/* Segmented downloads from multiple mirrors described by Metalink files.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* A Metalink document (RFC 5854) describes files that are available
+   from several mirrors, optionally along with the digests of the
+   whole file and of consecutive fixed-size pieces of it.  Each file
+   is split into pieces that are fetched concurrently with HTTP range
+   requests, one connection per mirror.  Mirrors that deliver faster
+   are handed more pieces; a mirror that keeps failing, or that serves
+   a piece not matching its digest, is dropped.  When no pieces remain
+   to be handed out, an idle mirror expected to finish a straggling
+   piece sooner than the one working on it fetches the same piece, and
+   the copy that completes first is used.  The pieces are then joined,
+   verified and renamed into place.
+
+   Instead of a Metalink document, the file may list, one file per
+   line, whitespace-separated alternative URLs of the same file.
+
+   The pieces are fetched by child processes, each of which performs
+   a single request using http_fetch and writes the piece to a file of
+   its own.  Where fork is not available, the pieces are fetched one
+   at a time.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <signal.h>
+# include <sys/wait.h>
+# define USE_FORK
+#endif
+
+#include "utils.h"
+#include "url.h"
+#include "retr.h"
+#include "http.h"
+#include "ptimer.h"
+#include "convert.h"
+#include "html-parse.h"
+#include "checksum.h"
+#include "exits.h"
+#include "metalink.h"
+
+#ifndef MIN
+# define MIN(x, y) ((x) > (y) ? (y) : (x))
+#endif
+#ifndef MAX
+# define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+extern int numurls;
+
+/* Size of the pieces of files whose Metalink description doesn't
+   specify one, unless that would split the file into more than
+   PIECES_PER_JOB pieces per concurrent connection.  */
+#define MIN_PIECE_SIZE (256 * 1024)
+#define MAX_PIECE_SIZE (16 * 1024 * 1024)
+#define PIECES_PER_JOB 4
+
+/* Number of failed pieces after which a mirror is no longer used.  */
+#define MAX_MIRROR_FAILURES 3
+
+struct mirror {
+  struct url *url;
+  struct url *proxy;            /* proxy to use for URL, or NULL */
+  int priority;                 /* lower values are preferred */
+  int order;                    /* position in the Metalink file */
+  int failures;                 /* consecutive failed pieces */
+  bool disabled;                /* whether the mirror was given up */
+  bool busy;                    /* whether a piece is being fetched */
+  int pieces;                   /* pieces fetched from the mirror, */
+  wgint bytes;                  /* their total size, */
+  double secs;                  /* and the time it took */
+};
+
+/* A file described by the Metalink file.  */
+struct ml_file {
+  char *name;                   /* local file name */
+  wgint size;                   /* size, or -1 if unknown */
+  bool has_hash;
+  struct checksum hash;         /* digest of the whole file */
+  wgint piece_length;           /* size of PIECE_HASHES' pieces */
+  struct checksum *piece_hashes;
+  int npiece_hashes, piece_hashes_size;
+  bool bad_piece_hashes;        /* whether any failed to parse */
+  struct mirror *mirrors;
+  int nmirrors, mirrors_size;
+};
+
+enum piece_state {
+  PIECE_PENDING,                /* not being fetched yet */
+  PIECE_ACTIVE,                 /* being fetched by one or more workers */
+  PIECE_DONE                    /* stored in FILE */
+};
+
+struct piece {
+  wgint start, end;             /* byte range, END being exclusive */
+  struct checksum *hash;        /* expected digest, or NULL */
+  enum piece_state state;
+  int workers;                  /* number of workers fetching it */
+  char *file;                   /* where the piece is stored, if done */
+};
+
+/* Exit statuses of workers.  */
+enum {
+  WORKER_OK,                    /* the piece was fetched */
+  WORKER_FAILED,                /* the fetch failed */
+  WORKER_CORRUPT,               /* the mirror sent the wrong data */
+  WORKER_CANCELLED              /* another worker fetched it first */
+};
+
+struct worker {
+  int piece, mirror;            /* indices of what it's working on */
+  char *file;                   /* file it is writing the piece to */
+  double started;               /* when it was started */
+  bool cancelled;               /* whether it was asked to stop */
+#ifdef USE_FORK
+  pid_t pid;                    /* process fetching the piece, or 0 */
+#endif
+  int status;                   /* exit status, if pid is 0 */
+};
+
+/* The state of the download of one file.  */
+struct ml_job {
+  struct ml_file *file;
+  struct piece *pieces;
+  int npieces;
+  struct worker *workers;       /* active workers, one per mirror */
+  int nworkers;
+  int serial;                   /* for naming the workers' files */
+  struct ptimer *timer;
+};
+
+static void
+add_mirror (struct ml_file *f, const char *url_text, int priority)
+{
+  struct mirror *m;
+  struct url *u, *proxy_url = NULL;
+  char *proxy;
+  int error;
+
+  u = url_parse (url_text, &error, NULL, false);
+  if (!u)
+    {
+      char *msg = url_error (url_text, error);
+      logprintf (LOG_NOTQUIET, _("Skipping mirror %s: %s.\n"),
+                 quote (url_text), msg);
+      xfree (msg);
+      return;
+    }
+  if (u->scheme != SCHEME_HTTP
+#ifdef HAVE_SSL
+      && u->scheme != SCHEME_HTTPS
+#endif
+      )
+    {
+      logprintf (LOG_VERBOSE, _("Skipping mirror %s: not an HTTP URL.\n"),
+                 quote (url_text));
+      url_free (u);
+      return;
+    }
+  proxy = getproxy (u);
+  if (proxy)
+    {
+      proxy_url = url_parse (proxy, &error, NULL, true);
+      if (!proxy_url || proxy_url->scheme != SCHEME_HTTP)
+        {
+          logprintf (LOG_NOTQUIET, _("Error in proxy URL %s: Must be HTTP.\n"),
+                     proxy);
+          if (proxy_url)
+            url_free (proxy_url);
+          url_free (u);
+          return;
+        }
+    }
+
+  DO_REALLOC (f->mirrors, f->mirrors_size, f->nmirrors + 1, struct mirror);
+  m = &f->mirrors[f->nmirrors];
+  xzero (*m);
+  m->url = u;
+  m->proxy = proxy_url;
+  m->priority = priority;
+  m->order = f->nmirrors++;
+}
+
+static void
+free_ml_file (struct ml_file *f)
+{
+  int i;
+  for (i = 0; i < f->nmirrors; i++)
+    {
+      url_free (f->mirrors[i].url);
+      if (f->mirrors[i].proxy)
+        url_free (f->mirrors[i].proxy);
+    }
+  xfree_null (f->mirrors);
+  xfree_null (f->piece_hashes);
+  xfree_null (f->name);
+}
+
+/* Metalink parsing.  */
+
+struct ml_parse {
+  struct ml_file *files;
+  int nfiles, files_size;
+  struct ml_file *cur;          /* file whose element is open, or NULL */
+  bool in_pieces;               /* whether inside <pieces> */
+  char *hash_type;              /* type of the open <hash> */
+  char *pieces_type;            /* type of the hashes of <pieces> */
+  int priority;                 /* priority of the open <url> */
+};
+
+static const char *
+find_attr (const struct taginfo *tag, const char *name)
+{
+  int i;
+  for (i = 0; i < tag->nattrs; i++)
+    if (!strcasecmp (tag->attrs[i].name, name))
+      return tag->attrs[i].value;
+  return NULL;
+}
+
+/* Return the text content of TAG, which must be an end tag, with the
+   surrounding white space removed and the predefined XML entities
+   decoded.  */
+
+static char *
+element_text (const struct taginfo *tag)
+{
+  static const struct {
+    const char *name;
+    char c;
+  } entities[] = {
+    { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' },
+    { "&quot;", '"' }, { "&apos;", '\'' },
+  };
+  const char *b = tag->contents_begin, *e = tag->contents_end;
+  char *text, *q;
+
+  while (b < e && c_isspace (*b))
+    ++b;
+  while (e > b && c_isspace (e[-1]))
+    --e;
+  text = q = xmalloc (e - b + 1);
+  while (b < e)
+    {
+      int i;
+      for (i = 0; i < countof (entities); i++)
+        {
+          size_t len = strlen (entities[i].name);
+          if (e - b >= len && !memcmp (b, entities[i].name, len))
+            break;
+        }
+      if (i < countof (entities))
+        {
+          *q++ = entities[i].c;
+          b += strlen (entities[i].name);
+        }
+      else
+        *q++ = *b++;
+    }
+  *q = '\0';
+  return text;
+}
+
+/* Sanitize NAME, the name given to a file by the Metalink file, and
+   return the local file name to use for it, or NULL if it is
+   unsafe.  */
+
+static char *
+local_name (const char *name)
+{
+  const char *p;
+
+  if (!*name || *name == '/' || strchr (name, '\\'))
+    return NULL;
+  for (p = name; p; p = strchr (p, '/'))
+    {
+      if (*p == '/')
+        ++p;
+      if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+        return NULL;
+    }
+  if (opt.dir_prefix && strcmp (opt.dir_prefix, "."))
+    return aprintf ("%s/%s", opt.dir_prefix, name);
+  return xstrdup (name);
+}
+
+static void
+metalink_tag (struct taginfo *tag, void *arg)
+{
+  struct ml_parse *ctx = arg;
+  struct ml_file *f = ctx->cur;
+  const char *type;
+  char *text;
+
+  if (!tag->end_tag_p)
+    {
+      if (!strcasecmp (tag->name, "file"))
+        {
+          const char *name = find_attr (tag, "name");
+          DO_REALLOC (ctx->files, ctx->files_size, ctx->nfiles + 1,
+                      struct ml_file);
+          f = ctx->cur = &ctx->files[ctx->nfiles++];
+          xzero (*f);
+          f->size = -1;
+          if (name)
+            f->name = local_name (name);
+          if (!f->name)
+            logprintf (LOG_NOTQUIET,
+                       _("Ignoring file with missing or unsafe name %s.\n"),
+                       quote (name ? name : ""));
+        }
+      else if (!f)
+        return;
+      else if (!strcasecmp (tag->name, "pieces"))
+        {
+          const char *length = find_attr (tag, "length");
+          ctx->in_pieces = true;
+          f->piece_length = length ? str_to_wgint (length, NULL, 10) : 0;
+          xfree_null (ctx->pieces_type);
+          type = find_attr (tag, "type");
+          ctx->pieces_type = type ? xstrdup (type) : NULL;
+        }
+      else if (!strcasecmp (tag->name, "hash"))
+        {
+          xfree_null (ctx->hash_type);
+          type = find_attr (tag, "type");
+          ctx->hash_type = type ? xstrdup (type) : NULL;
+        }
+      else if (!strcasecmp (tag->name, "url"))
+        {
+          const char *priority = find_attr (tag, "priority");
+          ctx->priority = priority ? atoi (priority) : INT_MAX;
+        }
+      return;
+    }
+
+  if (!f)
+    return;
+  if (!strcasecmp (tag->name, "file"))
+    {
+      ctx->cur = NULL;
+      return;
+    }
+  if (!strcasecmp (tag->name, "pieces"))
+    {
+      ctx->in_pieces = false;
+      return;
+    }
+  if (!tag->contents_begin)
+    return;
+
+  text = element_text (tag);
+  if (!strcasecmp (tag->name, "size"))
+    f->size = str_to_wgint (text, NULL, 10);
+  else if (!strcasecmp (tag->name, "hash") && ctx->in_pieces)
+    {
+      DO_REALLOC (f->piece_hashes, f->piece_hashes_size,
+                  f->npiece_hashes + 1, struct checksum);
+      if (ctx->pieces_type
+          && checksum_parse (&f->piece_hashes[f->npiece_hashes],
+                             ctx->pieces_type, text))
+        ++f->npiece_hashes;
+      else
+        f->bad_piece_hashes = true;
+    }
+  else if (!strcasecmp (tag->name, "hash") && ctx->hash_type)
+    {
+      /* Use the strongest of the digests given.  */
+      struct checksum cs;
+      if (checksum_parse (&cs, ctx->hash_type, text)
+          && (!f->has_hash || cs.type > f->hash.type))
+        {
+          f->hash = cs;
+          f->has_hash = true;
+        }
+    }
+  else if (!strcasecmp (tag->name, "url"))
+    add_mirror (f, text, ctx->priority);
+  xfree (text);
+}
+
+/* Parse the plain list of alternative URLs in FM, one file per line,
+   into CTX.  */
+
+static void
+parse_url_list (const struct file_memory *fm, struct ml_parse *ctx)
+{
+  const char *p = fm->content, *end = fm->content + fm->length;
+
+  while (p < end)
+    {
+      const char *eol = memchr (p, '\n', end - p);
+      struct ml_file *f = NULL;
+      if (!eol)
+        eol = end;
+      while (p < eol)
+        {
+          const char *b;
+          char *url_text;
+
+          while (p < eol && c_isspace (*p))
+            ++p;
+          if (p == eol || (*p == '#' && !f))
+            break;
+          for (b = p; p < eol && !c_isspace (*p); p++)
+            ;
+          if (!f)
+            {
+              DO_REALLOC (ctx->files, ctx->files_size, ctx->nfiles + 1,
+                          struct ml_file);
+              f = &ctx->files[ctx->nfiles++];
+              xzero (*f);
+              f->size = -1;
+            }
+          url_text = strdupdelim (b, p);
+          add_mirror (f, url_text, 0);
+          xfree (url_text);
+          if (!f->name && f->nmirrors)
+            f->name = url_file_name (f->mirrors[0].url, NULL);
+        }
+      p = eol + 1;
+    }
+}
+
+/* Prefer mirrors with lower priority values, keeping the order of the
+   Metalink file among mirrors of the same priority.  */
+
+static int
+mirror_cmp (const void *a, const void *b)
+{
+  const struct mirror *m1 = a, *m2 = b;
+  if (m1->priority != m2->priority)
+    return m1->priority < m2->priority ? -1 : 1;
+  return m1->order - m2->order;
+}
+
+/* Scheduling.  */
+
+/* Return the rate in bytes per second at which M has been delivering
+   pieces, or 0 if it hasn't delivered any yet.  */
+
+static double
+mirror_rate (const struct mirror *m)
+{
+  if (!m->pieces)
+    return 0;
+  return m->bytes / (m->secs > 0.001 ? m->secs : 0.001);
+}
+
+/* Return the idle mirror that should fetch the next piece, or -1 if
+   none is available.  Mirrors that haven't been measured yet are
+   tried first, in the order of preference; the fastest one is chosen
+   otherwise.  */
+
+static int
+pick_mirror (const struct ml_file *f)
+{
+  int i, best = -1;
+  for (i = 0; i < f->nmirrors; i++)
+    {
+      const struct mirror *m = &f->mirrors[i];
+      if (m->disabled || m->busy)
+        continue;
+      if (!m->pieces)
+        return i;
+      if (best < 0 || mirror_rate (m) > mirror_rate (&f->mirrors[best]))
+        best = i;
+    }
+  return best;
+}
+
+/* Return a piece that MIRROR, which is idle, should fetch in parallel
+   with the worker currently fetching it, or -1 if there is none.  A
+   piece is chosen if MIRROR is expected to fetch it before the other
+   worker is done with it.  */
+
+static int
+pick_straggler (const struct ml_job *job, int mirror, double now)
+{
+  const struct ml_file *f = job->file;
+  double rate = mirror_rate (&f->mirrors[mirror]);
+  double best_remaining = 0;
+  int i, best = -1;
+
+  if (!rate)
+    return -1;
+  for (i = 0; i < job->nworkers; i++)
+    {
+      const struct worker *w = &job->workers[i];
+      const struct piece *p = &job->pieces[w->piece];
+      double other_rate = mirror_rate (&f->mirrors[w->mirror]);
+      double elapsed = now - w->started;
+      double remaining;
+
+      if (w->cancelled || p->workers != 1)
+        continue;
+      /* Without a measured rate, assume the other worker is halfway
+         through.  */
+      if (other_rate)
+        remaining = (p->end - p->start) / other_rate - elapsed;
+      else
+        remaining = elapsed;
+      if ((p->end - p->start) / rate < remaining && remaining > best_remaining)
+        {
+          best = w->piece;
+          best_remaining = remaining;
+        }
+    }
+  return best;
+}
+
+/* Fetch PIECE from M into FILE and return the worker exit status.  */
+
+static int
+fetch_piece (struct ml_job *job, struct mirror *m, struct piece *p,
+             const char *file)
+{
+  char range[64];
+  char *content_type, *content_range;
+  wgint received, first, last, length;
+  int ntry = opt.ntry;
+  uerr_t err;
+  int status;
+
+  snprintf (range, sizeof range, "bytes=%s-",
+            number_to_static_string (p->start));
+  snprintf (range + strlen (range), sizeof range - strlen (range), "%s",
+            number_to_static_string (p->end - 1));
+
+  /* Failures are retried with other mirrors.  */
+  opt.ntry = 1;
+  err = http_fetch (m->url, m->proxy, range, file, p->hash, &content_type,
+                    &content_range, &received);
+  opt.ntry = ntry;
+
+  if (err == CHECKSUMERR)
+    status = WORKER_CORRUPT;
+  else if (err != RETROK)
+    status = WORKER_FAILED;
+  else if (content_range
+           ? (!parse_content_range (content_range, &first, &last, &length)
+              || first != p->start || last != p->end - 1
+              || length != job->file->size)
+           : (p->start != 0 || p->end != job->file->size))
+    /* The server doesn't support ranges, or the file it has is not
+       the one described.  */
+    status = WORKER_CORRUPT;
+  else if (file_size (file) != p->end - p->start)
+    status = WORKER_FAILED;
+  else
+    status = WORKER_OK;
+
+  xfree_null (content_type);
+  xfree_null (content_range);
+  return status;
+}
+
+/* Start fetching piece PI from mirror MI.  */
+
+static void
+start_worker (struct ml_job *job, int pi, int mi)
+{
+  struct ml_file *f = job->file;
+  struct worker *w = &job->workers[job->nworkers++];
+  struct piece *p = &job->pieces[pi];
+  struct mirror *m = &f->mirrors[mi];
+
+  xzero (*w);
+  w->piece = pi;
+  w->mirror = mi;
+  w->file = aprintf ("%s.wget-piece-%d", f->name, ++job->serial);
+  w->started = ptimer_measure (job->timer);
+  p->state = PIECE_ACTIVE;
+  ++p->workers;
+  m->busy = true;
+  DEBUGP (("Fetching piece %d [%s, %s) from %s.\n", pi,
+           number_to_static_string (p->start),
+           number_to_static_string (p->end), m->url->url));
+
+#ifdef USE_FORK
+  logflush ();
+  w->pid = fork ();
+  if (w->pid == 0)
+    {
+      int status;
+      opt.verbose = false;
+      rate_limit_share (MAX (1, opt.metalink_jobs));
+      status = fetch_piece (job, m, p, w->file);
+      logflush ();
+      _exit (status);
+    }
+  if (w->pid > 0)
+    return;
+  DEBUGP (("fork: %s\n", strerror (errno)));
+  w->pid = 0;
+#endif
+  w->status = fetch_piece (job, m, p, w->file);
+}
+
+/* If worker W is done, store its exit status to STATUS and return
+   true.  */
+
+static bool
+reap_worker (struct worker *w, int *status)
+{
+#ifdef USE_FORK
+  if (w->pid)
+    {
+      int wstatus;
+      pid_t pid = waitpid (w->pid, &wstatus, WNOHANG);
+      if (pid == 0)
+        return false;
+      if (pid < 0)
+        *status = WORKER_FAILED;
+      else if (WIFEXITED (wstatus))
+        *status = WEXITSTATUS (wstatus);
+      else
+        *status = WORKER_CANCELLED;
+      if (w->cancelled)
+        *status = WORKER_CANCELLED;
+      return true;
+    }
+#endif
+  *status = w->status;
+  return true;
+}
+
+/* Ask the other workers fetching piece PI to stop.  */
+
+static void
+cancel_workers (struct ml_job *job, int pi)
+{
+  int i;
+  for (i = 0; i < job->nworkers; i++)
+    {
+      struct worker *w = &job->workers[i];
+      if (w->piece != pi || w->cancelled)
+        continue;
+      w->cancelled = true;
+#ifdef USE_FORK
+      if (w->pid)
+        kill (w->pid, SIGTERM);
+#endif
+    }
+}
+
+/* Account for the exit of worker I with STATUS, and remove it from
+   the active workers.  */
+
+static void
+finish_worker (struct ml_job *job, int i, int status, double now)
+{
+  struct worker *w = &job->workers[i];
+  struct piece *p = &job->pieces[w->piece];
+  struct mirror *m = &job->file->mirrors[w->mirror];
+
+  m->busy = false;
+  --p->workers;
+  switch (status)
+    {
+    case WORKER_OK:
+      m->failures = 0;
+      ++m->pieces;
+      m->bytes += p->end - p->start;
+      m->secs += now - w->started;
+      if (p->state != PIECE_DONE)
+        {
+          p->state = PIECE_DONE;
+          p->file = w->file;
+          w->file = NULL;
+          cancel_workers (job, w->piece);
+        }
+      break;
+    case WORKER_CANCELLED:
+      break;
+    case WORKER_CORRUPT:
+      logprintf (LOG_NOTQUIET, _("\
+Mirror %s sent data not matching the Metalink file; not using it.\n"),
+                 m->url->url);
+      m->disabled = true;
+      break;
+    default:
+      if (++m->failures >= MAX_MIRROR_FAILURES)
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("Mirror %s failed %d times; not using it.\n"),
+                     m->url->url, m->failures);
+          m->disabled = true;
+        }
+      break;
+    }
+  if (p->state == PIECE_ACTIVE && !p->workers)
+    p->state = PIECE_PENDING;
+  if (w->file)
+    {
+      unlink (w->file);
+      xfree (w->file);
+    }
+  job->workers[i] = job->workers[--job->nworkers];
+}
+
+/* Fetch all pieces of JOB.  Returns true if they were all fetched.  */
+
+static bool
+fetch_pieces (struct ml_job *job)
+{
+  struct ml_file *f = job->file;
+  int jobs = MAX (1, opt.metalink_jobs);
+  int i;
+
+  while (true)
+    {
+      double now = ptimer_measure (job->timer);
+      bool reaped = false;
+
+      /* Hand out pieces to idle mirrors.  */
+      while (job->nworkers < jobs)
+        {
+          int mi = pick_mirror (f), pi;
+          if (mi < 0)
+            break;
+          for (pi = 0; pi < job->npieces; pi++)
+            if (job->pieces[pi].state == PIECE_PENDING)
+              break;
+          if (pi == job->npieces)
+            pi = pick_straggler (job, mi, now);
+          if (pi < 0)
+            break;
+          start_worker (job, pi, mi);
+        }
+      if (!job->nworkers)
+        break;
+
+      /* Collect the workers that are done.  */
+      for (i = 0; i < job->nworkers; i++)
+        {
+          int status;
+          if (reap_worker (&job->workers[i], &status))
+            {
+              finish_worker (job, i, status, ptimer_measure (job->timer));
+              reaped = true;
+              --i;
+            }
+        }
+      if (!reaped)
+        xsleep (0.05);
+    }
+
+  for (i = 0; i < job->npieces; i++)
+    if (job->pieces[i].state != PIECE_DONE)
+      return false;
+  return true;
+}
+
+/* Find out the size of F by requesting its first byte from the
+   mirrors.  If a mirror sends the whole file instead, it is stored in
+   FILE and true is stored to WHOLE.  */
+
+static uerr_t
+probe_size (struct ml_file *f, const char *file, bool *whole)
+{
+  uerr_t err = URLERROR;
+  int i;
+
+  *whole = false;
+  for (i = 0; i < f->nmirrors; i++)
+    {
+      struct mirror *m = &f->mirrors[i];
+      char *content_type, *content_range;
+      wgint received, first, last;
+
+      err = http_fetch (m->url, m->proxy, "bytes=0-0", file, NULL,
+                        &content_type, &content_range, &received);
+      xfree_null (content_type);
+      if (err == RETROK && !content_range)
+        {
+          f->size = file_size (file);
+          *whole = true;
+        }
+      else if (err == RETROK
+               && (!parse_content_range (content_range, &first, &last,
+                                         &f->size)
+                   || f->size < 0))
+        err = RANGEERR;
+      xfree_null (content_range);
+      if (err == RETROK)
+        break;
+    }
+  if (err != RETROK)
+    unlink (file);
+  return err;
+}
+
+/* Join the pieces of JOB into FILE.  */
+
+static bool
+join_pieces (struct ml_job *job, const char *file)
+{
+  FILE *out = fopen (file, "wb");
+  char buf[8192];
+  int i;
+
+  if (!out)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return false;
+    }
+  for (i = 0; i < job->npieces; i++)
+    {
+      FILE *in = fopen (job->pieces[i].file, "rb");
+      size_t n;
+      if (!in)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", job->pieces[i].file,
+                     strerror (errno));
+          fclose (out);
+          return false;
+        }
+      while ((n = fread (buf, 1, sizeof buf, in)) > 0)
+        fwrite (buf, 1, n, out);
+      fclose (in);
+    }
+  if (fclose (out) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"), file,
+                 strerror (errno));
+      return false;
+    }
+  return true;
+}
+
+/* Download the file described by F.  */
+
+static uerr_t
+metalink_download (struct ml_file *f)
+{
+  struct ml_job job;
+  wgint piece_length;
+  char *temp_file;
+  bool whole = false;
+  uerr_t ret = RETROK;
+  double secs;
+  int i;
+
+  if (!f->nmirrors)
+    {
+      logprintf (LOG_NOTQUIET, _("No usable mirrors for %s.\n"),
+                 quote (f->name));
+      return URLERROR;
+    }
+  if (opt.noclobber && file_exists_p (f->name))
+    {
+      logprintf (LOG_VERBOSE, _("\
+File %s already there; not retrieving.\n\n"), quote (f->name));
+      return RETROK;
+    }
+  qsort (f->mirrors, f->nmirrors, sizeof *f->mirrors, mirror_cmp);
+
+  xzero (job);
+  job.file = f;
+  job.timer = ptimer_new ();
+  temp_file = aprintf ("%s.wget-metalink", f->name);
+
+  if (f->size < 0)
+    {
+      ret = probe_size (f, temp_file, &whole);
+      if (ret != RETROK)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot determine the size of %s.\n"),
+                     quote (f->name));
+          goto out;
+        }
+    }
+
+  if (f->bad_piece_hashes
+      || (f->npiece_hashes
+          && (f->piece_length <= 0
+              || f->npiece_hashes != (f->size + f->piece_length - 1)
+                                     / f->piece_length)))
+    {
+      logprintf (LOG_NOTQUIET, _("\
+Ignoring the piece digests of %s, which don't match its size.\n"),
+                 quote (f->name));
+      f->npiece_hashes = 0;
+    }
+  if (f->npiece_hashes)
+    piece_length = f->piece_length;
+  else
+    {
+      piece_length = f->size / (PIECES_PER_JOB * MAX (1, opt.metalink_jobs));
+      piece_length = MAX (piece_length, MIN_PIECE_SIZE);
+      piece_length = MIN (piece_length, MAX_PIECE_SIZE);
+    }
+
+  if (!whole)
+    {
+      /* Don't let the workers share the connection used for the
+         probe.  */
+      http_close_persistent ();
+      job.npieces = (f->size + piece_length - 1) / piece_length;
+      job.pieces = xnew0_array (struct piece, job.npieces);
+      job.workers = xnew_array (struct worker, f->nmirrors);
+      for (i = 0; i < job.npieces; i++)
+        {
+          struct piece *p = &job.pieces[i];
+          p->start = i * piece_length;
+          p->end = MIN (p->start + piece_length, f->size);
+          p->hash = f->npiece_hashes ? &f->piece_hashes[i] : NULL;
+        }
+      logprintf (LOG_VERBOSE, _("\
+Fetching %s (%s bytes) in %d pieces from %d mirrors.\n"),
+                 quote (f->name), number_to_static_string (f->size),
+                 job.npieces, f->nmirrors);
+
+      if (!fetch_pieces (&job))
+        {
+          logprintf (LOG_NOTQUIET, _("Could not fetch %s from any mirror.\n"),
+                     quote (f->name));
+          ret = TRYLIMEXC;
+          goto out;
+        }
+      if (!join_pieces (&job, temp_file))
+        {
+          ret = FWRITEERR;
+          goto out;
+        }
+    }
+
+  if (f->has_hash)
+    {
+      if (!checksum_prepare (&f->hash, temp_file, f->size)
+          || !checksum_verify (&f->hash))
+        {
+          logprintf (LOG_NOTQUIET, _("Checksum mismatch for %s.\n"),
+                     quote (f->name));
+          ret = CHECKSUMERR;
+          goto out;
+        }
+      logprintf (LOG_VERBOSE, _("Checksum of %s verified.\n"),
+                 quote (f->name));
+    }
+  if (rename (temp_file, f->name) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot rename %s to %s: %s\n"),
+                 quote_n (0, temp_file), quote_n (1, f->name),
+                 strerror (errno));
+      ret = FWRITEERR;
+      goto out;
+    }
+
+  secs = ptimer_measure (job.timer);
+  for (i = 0; i < f->nmirrors; i++)
+    if (f->mirrors[i].pieces)
+      logprintf (LOG_VERBOSE, _("  %d pieces from %s (%s)\n"),
+                 f->mirrors[i].pieces, f->mirrors[i].url->url,
+                 retr_rate (f->mirrors[i].bytes, f->mirrors[i].secs));
+  logprintf (LOG_VERBOSE, _("%s (%s) - %s saved [%s]\n\n"),
+             datetime_str (time (NULL)), retr_rate (f->size, secs),
+             quote (f->name), number_to_static_string (f->size));
+  logprintf (LOG_NONVERBOSE, "%s [%s] -> %s [1]\n",
+             datetime_str (time (NULL)), number_to_static_string (f->size),
+             quote (f->name));
+  ++numurls;
+  total_downloaded_bytes += f->size;
+  total_download_time += secs;
+  downloaded_file (FILE_DOWNLOADED_NORMALLY, f->name);
+
+ out:
+  for (i = 0; i < job.npieces; i++)
+    if (job.pieces[i].file)
+      {
+        unlink (job.pieces[i].file);
+        xfree (job.pieces[i].file);
+      }
+  if (ret != RETROK)
+    unlink (temp_file);
+  xfree_null (job.pieces);
+  xfree_null (job.workers);
+  ptimer_destroy (job.timer);
+  xfree (temp_file);
+  return ret;
+}
+
+/* Download the files described by the Metalink file FILE, or listed
+   in it as alternative URLs.  The number of files found is stored to
+   COUNT.  */
+
+uerr_t
+retrieve_from_metalink (const char *file, int *count)
+{
+  struct file_memory *fm;
+  struct ml_parse ctx;
+  const char *p;
+  uerr_t status = RETROK;
+  int i;
+
+  *count = 0;
+  fm = wget_read_file (file);
+  if (!fm)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return FILEBADFILE;
+    }
+
+  xzero (ctx);
+  for (p = fm->content; p < fm->content + fm->length && c_isspace (*p); p++)
+    ;
+  if (p < fm->content + fm->length && *p == '<')
+    map_html_tags (fm->content, fm->length, metalink_tag, &ctx,
+                   MHT_TRIM_VALUES, NULL, NULL, NULL);
+  else
+    parse_url_list (fm, &ctx);
+  wget_read_file_free (fm);
+  xfree_null (ctx.hash_type);
+  xfree_null (ctx.pieces_type);
+
+  *count = ctx.nfiles;
+  for (i = 0; i < ctx.nfiles; i++)
+    {
+      struct ml_file *f = &ctx.files[i];
+      uerr_t err;
+
+      if (opt.quota && total_downloaded_bytes > opt.quota)
+        {
+          status = QUOTEXC;
+          break;
+        }
+      err = f->name ? metalink_download (f) : URLERROR;
+      inform_exit_status (err);
+      if (err != RETROK)
+        status = err;
+    }
+
+  for (i = 0; i < ctx.nfiles; i++)
+    free_ml_file (&ctx.files[i]);
+  xfree_null (ctx.files);
+  return status;
+}
@@ -109,7 +109,7 @@ typedef __int64 wgint;
 const char *inet_ntop (int, const void *, char *, socklen_t);
 #endif
 
-/* ioctl needed by set_windows_fd_as_blocking_socket() */
+/* ioctl needed by set_socket_nonblocking() */
 #include <sys/ioctl.h>
 
 /* Public functions.  */
@@ -119,6 +119,5 @@ void ws_changetitle (const char *);
 void ws_percenttitle (double);
 char *ws_mypath (void);
 void windows_main (char **);
-void set_windows_fd_as_blocking_socket (int);
 
 #endif /* MSWINDOWS_H */
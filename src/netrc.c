@@ -95,7 +95,11 @@ search_netrc (const char *host, const char **acc, const char **passwd,
           xfree (home);
           err = stat (path, &buf);
           if (err == 0)
-            netrc_list = parse_netrc (path);
+            {
+              double stats_start = startup_stats_clock ();
+              netrc_list = parse_netrc (path);
+              startup_stats_add ("netrc", stats_start, true);
+            }
         }
 
 #endif /* def __VMS [else] */
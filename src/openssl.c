@@ -162,11 +162,14 @@ bool
 ssl_init (void)
 {
   SSL_METHOD const *meth;
+  double stats_start;
 
   if (ssl_ctx)
     /* The SSL has already been initialized. */
     return true;
 
+  stats_start = startup_stats_clock ();
+
   /* Init the PRNG.  If that fails, bail out.  */
   init_prng ();
   if (RAND_status () != 1)
@@ -242,6 +245,7 @@ ssl_init (void)
      tell it to do so.  */
   SSL_CTX_set_mode (ssl_ctx, SSL_MODE_AUTO_RETRY);
 
+  startup_stats_add ("TLS and CA certificates", stats_start, true);
   return true;
 
  error:
@@ -254,8 +258,40 @@ ssl_init (void)
 struct openssl_transport_context {
   SSL *conn;                    /* SSL connection handle */
   char *last_error;             /* last error printed with openssl_errstr */
+  int want;                     /* what the connection waits for after
+                                   an operation would have blocked */
 };
 
+/* Translate the result RET of an SSL operation to the conventions of
+   fd_read and fd_write: a connection that wants to read or write
+   before it can go on gives -1 with errno set to EAGAIN, and what it
+   wants is remembered for openssl_poll.  */
+
+static int
+openssl_result (struct openssl_transport_context *ctx, int ret)
+{
+  ctx->want = 0;
+  if (ret <= 0)
+    switch (SSL_get_error (ctx->conn, ret))
+      {
+      case SSL_ERROR_WANT_READ:
+        ctx->want = WAIT_FOR_READ;
+        errno = EAGAIN;
+        return -1;
+      case SSL_ERROR_WANT_WRITE:
+        ctx->want = WAIT_FOR_WRITE;
+        errno = EAGAIN;
+        return -1;
+      case SSL_ERROR_SYSCALL:
+        break;
+      default:
+        /* Don't let a stale errno pass for EAGAIN.  */
+        errno = 0;
+        break;
+      }
+  return ret;
+}
+
 static int
 openssl_read (int fd, char *buf, int bufsize, void *arg)
 {
@@ -268,7 +304,7 @@ openssl_read (int fd, char *buf, int bufsize, void *arg)
          && SSL_get_error (conn, ret) == SSL_ERROR_SYSCALL
          && errno == EINTR);
 
-  return ret;
+  return openssl_result (ctx, ret);
 }
 
 static int
@@ -282,7 +318,7 @@ openssl_write (int fd, char *buf, int bufsize, void *arg)
   while (ret == -1
          && SSL_get_error (conn, ret) == SSL_ERROR_SYSCALL
          && errno == EINTR);
-  return ret;
+  return openssl_result (ctx, ret);
 }
 
 static int
@@ -294,6 +330,10 @@ openssl_poll (int fd, double timeout, int wait_for, void *arg)
     return 1;
   if (timeout == 0)
     return 1;
+  /* A renegotiation may have to write while reading, or vice
+     versa.  */
+  if (ctx->want)
+    wait_for = ctx->want;
   return select_fd (fd, timeout, wait_for);
 }
 
@@ -303,14 +343,12 @@ openssl_peek (int fd, char *buf, int bufsize, void *arg)
   int ret;
   struct openssl_transport_context *ctx = arg;
   SSL *conn = ctx->conn;
-  if (! openssl_poll (fd, 0.0, WAIT_FOR_READ, arg))
-    return 0;
   do
     ret = SSL_peek (conn, buf, bufsize);
   while (ret == -1
          && SSL_get_error (conn, ret) == SSL_ERROR_SYSCALL
          && errno == EINTR);
-  return ret;
+  return openssl_result (ctx, ret);
 }
 
 static const char *
@@ -425,7 +463,30 @@ ssl_connect_wget (int fd, const char *hostname)
   if (!SSL_set_fd (conn, FD_TO_SOCKET (fd)))
     goto error;
   SSL_set_connect_state (conn);
-  if (SSL_connect (conn) <= 0 || conn->state != SSL_ST_OK)
+
+  /* The socket is in non-blocking mode, so wait for it whenever the
+     handshake has to, for no longer than the read timeout.  */
+  for (;;)
+    {
+      int ret = SSL_connect (conn), wait_for;
+      if (ret > 0)
+        break;
+      switch (SSL_get_error (conn, ret))
+        {
+        case SSL_ERROR_WANT_READ:
+          wait_for = WAIT_FOR_READ;
+          break;
+        case SSL_ERROR_WANT_WRITE:
+          wait_for = WAIT_FOR_WRITE;
+          break;
+        default:
+          goto error;
+        }
+      if (select_fd (fd, opt.read_timeout ? opt.read_timeout : -1,
+                     wait_for) <= 0)
+        goto error;
+    }
+  if (conn->state != SSL_ST_OK)
     goto error;
 
   ctx = xnew0 (struct openssl_transport_context);
@@ -29,6 +29,17 @@ Corresponding Source for a non-source form of such a combination
 shall include the source code for the parts of OpenSSL used as well
 as that of the covered work.  */
 
+/* A download rate limit given with --limit-rate-host, applying to the
+   hosts in the domain HOST, or with --limit-rate-schedule, applying to
+   the total rate between the times of day FROM and TO, in minutes
+   after midnight.  */
+struct rate_limit
+{
+  char *host;
+  int from, to;
+  wgint rate;
+};
+
 struct options
 {
   int verbose;			/* Are we verbose?  (First set to -1,
@@ -61,10 +72,24 @@ struct options
   char *input_filename;		/* Input filename */
   char *choose_config;		/* Specified config file */
   bool force_html;		/* Is the input file an HTML file? */
+  bool follow_input;		/* Wait for more URLs at the end of
+				   the input file? */
+  bool group_by_host;		/* Retrieve the URLs of the input
+				   file grouped by host? */
 
   char *default_page;           /* Alternative default page (index file) */
 
   bool spider;			/* Is Wget in spider mode? */
+  wgint in_memory_limit;	/* Keep bodies up to this size in memory
+				   when they are not to be saved. */
+  int spider_jobs;		/* Links checked at once in spider
+				   mode. */
+  char *link_report;		/* File the checked links are
+				   reported to. */
+  enum {
+    link_report_json,
+    link_report_csv
+  } link_report_format;		/* Format of the link report. */
 
   char **accepts;		/* List of patterns to accept. */
   char **rejects;		/* List of patterns to reject. */
@@ -90,10 +115,30 @@ struct options
   char **domains;		/* See host.c */
   char **exclude_domains;
   bool dns_cache;		/* whether we cache DNS lookups. */
+  char *address_stats;		/* File the connect times and failures
+				   of addresses are kept in. */
 
   char **follow_tags;           /* List of HTML tags to recursively follow. */
   char **ignore_tags;           /* List of HTML tags to ignore if recursing. */
 
+  bool canonicalize_query;	/* Sort the query parameters of links? */
+  bool canonicalize_index;	/* Drop index file names from links? */
+  bool canonicalize_case;	/* Lowercase the path of links? */
+  bool canonicalize_escapes;	/* Normalize the %-escapes of links? */
+  char **strip_params;		/* Query parameters to remove from links. */
+
+  int max_path_depth;		/* Maximum number of directories in the
+				   path of a link; 0 for no limit. */
+  int max_url_length;		/* Maximum length of a link's URL. */
+  int max_segment_repeat;	/* Maximum number of times a directory
+				   may occur in the path of a link. */
+  int dir_budget;		/* Maximum number of URLs retrieved per
+				   directory. */
+  int query_budget;		/* Maximum number of URLs retrieved per
+				   path and set of query parameters. */
+  bool skip_similar;		/* Don't follow the links of pages that
+				   are nearly identical to earlier ones? */
+
   bool follow_ftp;		/* Are FTP URL-s followed in recursive
 				   retrieving? */
   bool retr_symlinks;		/* Whether we retrieve symlinks in
@@ -115,6 +160,13 @@ struct options
   bool ask_passwd;              /* Ask for password? */
 
   bool always_rest;		/* Always use REST. */
+  bool delta_update;		/* Update existing files using zsync
+				   manifests. */
+  char *checksum;		/* Expected checksum, as "ALGO:HEX". */
+  char *checksum_file;		/* File listing expected checksums. */
+  char *metalink_file;		/* Metalink file to download from. */
+  int metalink_jobs;		/* Concurrent connections per Metalink
+				   file. */
   char *ftp_user;		/* FTP username */
   char *ftp_passwd;		/* FTP password */
   bool netrc;			/* Whether to read .netrc. */
@@ -138,6 +190,8 @@ struct options
   double read_timeout;		/* The read/write timeout. */
   double dns_timeout;		/* The DNS timeout. */
   double connect_timeout;	/* The connect timeout. */
+  int preconnect;		/* How many URLs ahead to open
+				   connections for. */
 
   bool random_wait;		/* vary from 0 .. wait secs by random()? */
   double wait;			/* The wait period between retrievals. */
@@ -146,6 +200,20 @@ struct options
 
   wgint limit_rate;		/* Limit the download rate to this
 				   many bps. */
+  wgint limit_rate_total;	/* Limit the rate of all the transfers
+				   together. */
+  struct rate_limit *limit_rate_hosts; /* Limits for particular
+				   domains. */
+  int limit_rate_host_count;
+  struct rate_limit *limit_rate_schedule; /* Limits of the total rate
+				   at times of day. */
+  int limit_rate_schedule_count;
+  wgint limit_burst;		/* How many bytes a transfer may get
+				   ahead of its limits. */
+  wgint socket_buffer;		/* Size of the receive buffer of
+				   the sockets; 0 leaves it to the
+				   system, -1 sizes it from the
+				   measured bandwidth and RTT. */
   SUM_SIZE_INT quota;		/* Maximum file size to download and
 				   store. */
 
@@ -163,6 +231,17 @@ struct options
   bool wdebug;                  /* Watt-32 tcp/ip debugging on/off */
 #endif
 
+  bool startup_stats;		/* Report the time spent initializing. */
+
+  int shard_index;		/* This process's share of the crawl, */
+  int shard_count;		/* out of this many shares. */
+  char *shard_dir;		/* Directory shared by the shards. */
+
+  char *daemon_socket;		/* Socket to serve jobs on. */
+  int daemon_jobs;		/* Jobs the daemon runs at once. */
+  char *submit_socket;		/* Socket of the daemon to hand the
+				   command line to. */
+
   bool timestamping;		/* Whether to use time-stamping. */
 
   bool backup_converted;	/* Do we save pre-converted files as *.orig? */
@@ -175,6 +254,12 @@ struct options
 				   NULL. */
   bool convert_links;		/* Will the links be converted
 				   locally? */
+  enum {
+    convert_sync_none,
+    convert_sync_file,
+    convert_sync_dir
+  } convert_sync;		/* How far the converted files are
+				   synced to disk. */
   bool remove_listing;		/* Do we remove .listing files
 				   generated by FTP? */
   bool htmlify;			/* Do we HTML-ify the OS-dependent
@@ -193,7 +278,22 @@ struct options
 
   bool page_requisites;		/* Whether we need to download all files
 				   necessary to display a page properly. */
-  char *bind_address;		/* What local IP address to bind to. */
+  enum {
+    srcset_all,
+    srcset_smallest,
+    srcset_largest,
+    srcset_width
+  } srcset_policy;		/* Which candidates of a srcset to
+				   retrieve. */
+  int srcset_width;		/* The display width srcset_width picks
+				   candidates for, in CSS pixels. */
+  char **bind_addresses;	/* What local IP addresses to bind to. */
+  enum {
+    bind_round_robin,
+    bind_hash,
+    bind_least_loaded
+  } bind_policy;		/* How one of bind_addresses is chosen
+				   for a connection. */
 
 #ifdef HAVE_SSL
   enum {
@@ -0,0 +1,265 @@
+/* Connections opened ahead of the requests that need them.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "url.h"
+#include "host.h"
+#include "connect.h"
+#include "retr.h"
+#include "ptimer.h"
+#include "preconnect.h"
+
+/* A connection that was not used within this many seconds is closed,
+   before the server gives up on it.  */
+#define PRECONNECT_IDLE 10
+
+/* A connection started before a request needed it.  */
+struct preconnection {
+  char *host;
+  int port;
+  int sock;                     /* -1 while the host is not resolved */
+  bool resolving;               /* whether its lookup was started */
+  double started;               /* when the connection was started,
+                                   as measured by pool_timer */
+};
+
+/* The connections waiting to be used.  There are at most
+   opt.preconnect of them.  */
+static struct preconnection *pool;
+static int pool_count;
+static struct ptimer *pool_timer;
+
+/* Close the connection at index I of the pool and remove it.  */
+
+static void
+pool_drop (int i)
+{
+  DEBUGP (("Dropping early connection to %s:%d.\n",
+           pool[i].host, pool[i].port));
+  if (pool[i].sock >= 0)
+    fd_close (pool[i].sock);
+  xfree (pool[i].host);
+  pool[i] = pool[--pool_count];
+}
+
+/* Drop the connections that have waited too long, or that the server
+   has closed.  */
+
+static void
+pool_expire (void)
+{
+  double now = ptimer_measure (pool_timer);
+  int i;
+
+  for (i = pool_count - 1; i >= 0; i--)
+    if (now - pool[i].started > PRECONNECT_IDLE
+        || (pool[i].sock >= 0 && !test_socket_open (pool[i].sock)))
+      pool_drop (i);
+}
+
+static int
+pool_find (const char *host, int port)
+{
+  int i;
+  for (i = 0; i < pool_count; i++)
+    if (pool[i].port == port && 0 == strcmp (pool[i].host, host))
+      return i;
+  return -1;
+}
+
+/* Start connecting to the first address of AL, in the order
+   lookup_host left them, that a connection can be started to.
+   Returns the socket, or -1.  */
+
+static int
+connect_first (struct address_list *al, int port)
+{
+  int start, end, i, sock = -1;
+
+  address_list_get_bounds (al, &start, &end);
+  for (i = start; i < end && sock < 0; i++)
+    sock = connect_start (address_list_address_at (al, i), port);
+  return sock;
+}
+
+/* Note that U will probably be retrieved after CURRENT, which is
+   being retrieved now.  If U is on another host, start connecting to
+   it, so that the connection is established by the time it is
+   needed.  CURRENT may be NULL.
+
+   Only a host whose addresses are already known is connected to
+   right away; the others are looked up in the background by
+   preconnect_resolve, once the current transfer is under way, so
+   that their lookups never delay it.  */
+
+void
+preconnect_hint (const struct url *u, const struct url *current)
+{
+  struct address_list *al;
+  int sock = -1;
+
+  if (!opt.preconnect)
+    return;
+  /* Only direct HTTP connections are opened early; a connection to
+     a proxy or an FTP server needs more than a host and a port.  */
+  if (!schemes_are_similar_p (u->scheme, SCHEME_HTTP)
+      || getproxy ((struct url *) u))
+    return;
+  if (current && current->port == u->port
+      && 0 == strcmp (current->host, u->host))
+    return;
+
+  if (!pool_timer)
+    {
+      pool_timer = ptimer_new ();
+      pool = xnew_array (struct preconnection, opt.preconnect);
+    }
+  pool_expire ();
+  if (pool_count >= opt.preconnect || pool_find (u->host, u->port) >= 0)
+    return;
+
+  al = lookup_host (u->host, LH_SILENT | LH_CACHED);
+  if (al)
+    {
+      sock = connect_first (al, u->port);
+      address_list_release (al);
+      if (sock < 0)
+        return;
+      DEBUGP (("Connecting early to %s:%d.\n", u->host, u->port));
+    }
+
+  pool[pool_count].host = xstrdup (u->host);
+  pool[pool_count].port = u->port;
+  pool[pool_count].sock = sock;
+  pool[pool_count].resolving = false;
+  pool[pool_count].started = ptimer_measure (pool_timer);
+  ++pool_count;
+}
+
+/* Start connecting to the hosts preconnect_hint could not connect
+   to right away whose addresses have been found since, and start
+   looking up the next of the others.  The lookups are left to the
+   resolver process (see lookup_host_async), one at a time, so this
+   never waits for DNS.  It is called before and after the body of
+   each response is read, so that the lookups overlap with its
+   transfer.  Where lookups cannot be left to another process, only
+   hosts that are already in the DNS cache are connected to early.  */
+
+void
+preconnect_resolve (void)
+{
+  int i;
+
+  for (i = pool_count - 1; i >= 0; i--)
+    {
+      struct address_list *al;
+
+      if (pool[i].sock >= 0)
+        continue;
+      al = lookup_host (pool[i].host, LH_SILENT | LH_CACHED);
+      if (!al)
+        continue;
+      pool[i].sock = connect_first (al, pool[i].port);
+      address_list_release (al);
+      if (pool[i].sock < 0)
+        {
+          pool_drop (i);
+          continue;
+        }
+      DEBUGP (("Connecting early to %s:%d.\n", pool[i].host, pool[i].port));
+      pool[i].started = ptimer_measure (pool_timer);
+    }
+
+  /* Look up the host hinted first among the others.  */
+  for (i = 0; i < pool_count; i++)
+    if (pool[i].sock < 0 && !pool[i].resolving)
+      {
+        pool[i].resolving = lookup_host_async (pool[i].host);
+        break;
+      }
+}
+
+/* Return a connection to HOST and PORT opened by preconnect_hint,
+   waiting for it to be established if needed, or -1 if there is no
+   usable one.  */
+
+int
+preconnect_take (const char *host, int port)
+{
+  int i, sock;
+
+  if (!pool_count)
+    return -1;
+  pool_expire ();
+  i = pool_find (host, port);
+  if (i < 0)
+    return -1;
+  if (pool[i].sock < 0)
+    {
+      /* Never resolved; connect the usual way.  */
+      pool_drop (i);
+      return -1;
+    }
+
+  sock = pool[i].sock;
+  xfree (pool[i].host);
+  pool[i] = pool[--pool_count];
+
+  if (connect_finish (sock, opt.connect_timeout) < 0)
+    {
+      DEBUGP (("Early connection to %s:%d failed: %s\n",
+               host, port, strerror (errno)));
+      fd_close (sock);
+      return -1;
+    }
+  logprintf (LOG_VERBOSE, _("Using the connection opened early to %s:%d.\n"),
+             quotearg_style (escape_quoting_style, host), port);
+  return sock;
+}
+
+/* Close the connections nobody used.  */
+
+void
+preconnect_cleanup (void)
+{
+  while (pool_count)
+    pool_drop (pool_count - 1);
+  xfree_null (pool);
+  pool = NULL;
+  if (pool_timer)
+    ptimer_destroy (pool_timer);
+  pool_timer = NULL;
+}
@@ -0,0 +1,283 @@
+/* Download rate limits.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* The download rate is limited by a hierarchy of token buckets: each
+   transfer has a bucket of its own (--limit-rate), the hosts of a
+   domain share one (--limit-rate-host), and all the transfers share
+   the total bucket (--limit-rate-total, which --limit-rate-schedule
+   can change with the time of day).  The bytes read are taken from
+   all the buckets of the transfer, and the transfer waits until the
+   emptiest one has been refilled.  A bucket holds up to --limit-burst
+   bytes, by which a transfer may exceed its rates after a pause.
+
+   The transfers of one Wget process take turns, so a transfer whose
+   bucket is empty only delays itself.  When several processes run
+   transfers at once, each of them gets its share of the host and
+   total rates through rate_limit_share.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "ptimer.h"
+#include "ratelimit.h"
+
+/* Sleeps shorter than this are deferred until more data has been
+   read, as they cannot be timed accurately.  */
+#define MIN_SLEEP 0.2
+
+/* The clock the buckets are refilled by.  */
+static struct ptimer *rate_clock;
+
+/* The bucket shared by all transfers, and the buckets of the domains
+   in opt.limit_rate_hosts.  */
+static struct rate_bucket total_bucket;
+static bool total_started;
+static struct rate_bucket *host_buckets;
+
+/* The number of processes the host and total rates are shared by.  */
+static int share = 1;
+
+/* The total rate in effect, and when the schedule was last checked.  */
+static wgint scheduled_rate;
+static double schedule_checked = -1;
+
+static double
+rate_now (void)
+{
+  if (!rate_clock)
+    rate_clock = ptimer_new ();
+  return ptimer_measure (rate_clock);
+}
+
+static void
+bucket_start (struct rate_bucket *b, double rate, double now)
+{
+  b->rate = rate;
+  b->tokens = opt.limit_burst;
+  b->refilled = now;
+}
+
+/* Add the tokens earned since B was last refilled, up to the burst
+   allowance.  */
+
+static void
+bucket_refill (struct rate_bucket *b, double now)
+{
+  b->tokens += (now - b->refilled) * b->rate;
+  if (!b->rate || b->tokens > opt.limit_burst)
+    b->tokens = opt.limit_burst;
+  b->refilled = now;
+}
+
+/* Return the total rate in effect at this time of day according to
+   --limit-rate-schedule, or --limit-rate-total outside the scheduled
+   times.  The schedule is consulted at most once a second.  */
+
+static wgint
+total_rate (double now)
+{
+  int i, minute;
+  time_t t;
+  struct tm *tm;
+
+  if (!opt.limit_rate_schedule_count)
+    return opt.limit_rate_total;
+  if (schedule_checked >= 0 && now - schedule_checked < 1)
+    return scheduled_rate;
+  schedule_checked = now;
+
+  t = time (NULL);
+  tm = localtime (&t);
+  minute = tm->tm_hour * 60 + tm->tm_min;
+  scheduled_rate = opt.limit_rate_total;
+  for (i = 0; i < opt.limit_rate_schedule_count; i++)
+    {
+      const struct rate_limit *r = &opt.limit_rate_schedule[i];
+      if (r->from == r->to
+          || (r->from < r->to
+              ? minute >= r->from && minute < r->to
+              : minute >= r->from || minute < r->to))
+        {
+          scheduled_rate = r->rate;
+          break;
+        }
+    }
+  return scheduled_rate;
+}
+
+/* Return the bucket of the longest domain in opt.limit_rate_hosts that
+   HOST belongs to, or NULL if there is none.  */
+
+static struct rate_bucket *
+host_bucket (const char *host, double now)
+{
+  int i, best = -1;
+  size_t best_len = 0, hlen;
+
+  if (!host || !opt.limit_rate_host_count)
+    return NULL;
+
+  hlen = strlen (host);
+  for (i = 0; i < opt.limit_rate_host_count; i++)
+    {
+      const char *domain = opt.limit_rate_hosts[i].host;
+      size_t dlen = strlen (domain);
+      if (hlen < dlen || 0 != strcasecmp (host + hlen - dlen, domain))
+        continue;
+      if (hlen > dlen && host[hlen - dlen - 1] != '.')
+        continue;
+      if (best < 0 || dlen >= best_len)
+        best = i, best_len = dlen;
+    }
+  if (best < 0)
+    return NULL;
+
+  if (!host_buckets)
+    {
+      host_buckets = xnew_array (struct rate_bucket,
+                                 opt.limit_rate_host_count);
+      for (i = 0; i < opt.limit_rate_host_count; i++)
+        bucket_start (&host_buckets[i],
+                      (double) opt.limit_rate_hosts[i].rate / share, now);
+    }
+  return &host_buckets[best];
+}
+
+/* Set up L for a transfer from HOST, which may be NULL.  Returns true
+   if any limit applies to the transfer, in which case
+   rate_limit_consume must be called for the data read.  */
+
+bool
+rate_limit_begin (struct rate_limiter *l, const char *host)
+{
+  double now = rate_now ();
+
+  bucket_start (&l->transfer, opt.limit_rate, now);
+  l->host = host_bucket (host, now);
+  if (!total_started)
+    {
+      bucket_start (&total_bucket, (double) total_rate (now) / share, now);
+      total_started = true;
+    }
+  return (opt.limit_rate || l->host
+          || opt.limit_rate_total || opt.limit_rate_schedule_count);
+}
+
+/* Return the lowest of the rates that currently apply to the transfer
+   of L, or 0 if it is unlimited.  */
+
+wgint
+rate_limit_lowest (const struct rate_limiter *l)
+{
+  double rates[3];
+  double lowest = 0;
+  int i;
+
+  rates[0] = l->transfer.rate;
+  rates[1] = l->host ? l->host->rate : 0;
+  rates[2] = (double) total_rate (rate_now ()) / share;
+  for (i = 0; i < countof (rates); i++)
+    if (rates[i] && (!lowest || rates[i] < lowest))
+      lowest = rates[i];
+  return lowest;
+}
+
+/* Take BYTES, which the transfer of L has just read, from its buckets,
+   and pause the transfer until the emptiest of them has been
+   refilled.  */
+
+void
+rate_limit_consume (struct rate_limiter *l, wgint bytes)
+{
+  struct rate_bucket *buckets[3];
+  int count = 0, i;
+  double now = rate_now ();
+  double wait = 0;
+
+  buckets[count++] = &l->transfer;
+  if (l->host)
+    buckets[count++] = l->host;
+  buckets[count++] = &total_bucket;
+
+  for (i = 0; i < count; i++)
+    {
+      struct rate_bucket *b = buckets[i];
+      bucket_refill (b, now);
+      if (b == &total_bucket)
+        b->rate = (double) total_rate (now) / share;
+      if (!b->rate)
+        continue;
+      b->tokens -= bytes;
+      if (b->tokens < 0 && -b->tokens / b->rate > wait)
+        wait = -b->tokens / b->rate;
+    }
+
+  if (wait < MIN_SLEEP)
+    {
+      if (wait > 0)
+        DEBUGP (("deferring a %.2f ms sleep (%s).\n", wait * 1000,
+                 number_to_static_string (bytes)));
+      return;
+    }
+  DEBUGP (("\nsleeping %.2f ms for %s bytes\n", wait * 1000,
+           number_to_static_string (bytes)));
+  xsleep (wait);
+}
+
+/* Divide the host and total rates among N processes running transfers
+   at the same time.  This is called in each of the processes.  */
+
+void
+rate_limit_share (int n)
+{
+  int i;
+
+  share = n > 1 ? n : 1;
+  if (host_buckets)
+    for (i = 0; i < opt.limit_rate_host_count; i++)
+      host_buckets[i].rate = (double) opt.limit_rate_hosts[i].rate / share;
+  total_started = false;
+}
+
+void
+rate_limit_cleanup (void)
+{
+  if (rate_clock)
+    ptimer_destroy (rate_clock);
+  rate_clock = NULL;
+  xfree_null (host_buckets);
+  host_buckets = NULL;
+  total_started = false;
+  schedule_checked = -1;
+}
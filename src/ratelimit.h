@@ -0,0 +1,54 @@
+/* Declarations for ratelimit.c.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/* A token bucket: a transfer may read as many bytes as there are
+   tokens, and the tokens are replenished at RATE bytes per second.  */
+struct rate_bucket {
+  double rate;                  /* bytes per second, 0 if unlimited */
+  double tokens;                /* negative if more was read */
+  double refilled;              /* when tokens were last added */
+};
+
+/* The buckets a transfer draws from: its own, the one of the domain
+   of its host, and the one shared by all transfers.  */
+struct rate_limiter {
+  struct rate_bucket transfer;
+  struct rate_bucket *host;
+};
+
+bool rate_limit_begin (struct rate_limiter *, const char *);
+wgint rate_limit_lowest (const struct rate_limiter *);
+void rate_limit_consume (struct rate_limiter *, wgint);
+void rate_limit_share (int);
+void rate_limit_cleanup (void);
+
+#endif /* RATELIMIT_H */
@@ -50,6 +50,9 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "spider.h"
+#include "shard.h"
+#include "preconnect.h"
+#include "trap.h"
 
 /* Functions for maintaining the URL queue.  */
 
@@ -106,6 +109,11 @@ url_enqueue (struct url_queue *queue, struct iri *i,
   qel->css_allowed = css_allowed;
   qel->next = NULL;
 
+  /* The queue owns URL and REFERER; account them to it.  */
+  alloc_stats_retag (qel, "frontier");
+  alloc_stats_retag (url, "frontier");
+  alloc_stats_retag (referer, "frontier");
+
   ++queue->count;
   if (queue->count > queue->maxcount)
     queue->maxcount = queue->count;
@@ -159,11 +167,90 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   xfree (qel);
   return true;
 }
+
+/* Start connecting to the hosts of the next opt.preconnect URLs in
+   QUEUE, so that connections to hosts other than that of CURRENT are
+   set up while CURRENT is being retrieved.  */
+
+static void
+url_queue_preconnect (const struct url_queue *queue,
+                      const struct url *current)
+{
+  const struct queue_element *qel;
+  int i;
+
+  for (qel = queue->head, i = 0; qel && i < opt.preconnect;
+       qel = qel->next, i++)
+    {
+      struct url *u = url_parse (qel->url, NULL, NULL, false);
+      if (u)
+        {
+          preconnect_hint (u, current);
+          url_free (u);
+        }
+    }
+}
 
+/* Like url_dequeue, but keep the link checking processes of POOL busy
+   with the URLs of QUEUE, and take the next URL whose check is over.
+   CHECKED tells whether the URL was checked; if so, the outcome is
+   stored to RESULT.  URLs downloaded before, and URLs no process could
+   take, are returned unchecked.  */
+
+static bool
+url_dequeue_checked (struct spider_pool *pool, struct url_queue *queue,
+                     struct iri **i, const char **url, const char **referer,
+                     int *depth, bool *html_allowed, bool *css_allowed,
+                     struct spider_result *result, bool *checked)
+{
+  struct queue_element *qel;
+
+  *checked = false;
+  while (spider_pool_idle_p (pool))
+    {
+      qel = xnew (struct queue_element);
+      if (!url_dequeue (queue, &qel->iri, &qel->url, &qel->referer,
+                        &qel->depth, &qel->html_allowed, &qel->css_allowed))
+        {
+          xfree (qel);
+          break;
+        }
+      if ((dl_url_file_map && hash_table_contains (dl_url_file_map, qel->url))
+          || !spider_pool_submit (pool, qel->url, qel->referer, qel->iri, qel))
+        goto found;
+    }
+
+  qel = spider_pool_wait (pool, result);
+  if (!qel)
+    /* Nothing is being checked, either because the queue is empty or
+       because no process is left.  */
+    return url_dequeue (queue, i, url, referer, depth, html_allowed,
+                        css_allowed);
+  *checked = true;
+
+ found:
+  *i = qel->iri;
+  *url = qel->url;
+  *referer = qel->referer;
+  *depth = qel->depth;
+  *html_allowed = qel->html_allowed;
+  *css_allowed = qel->css_allowed;
+  xfree (qel);
+  return true;
+}
+
 static bool download_child_p (const struct urlpos *, struct url *, int,
                               struct url *, struct hash_table *, struct iri *);
+static bool robots_allow_p (struct url *, struct iri *);
 static bool descend_redirect_p (const char *, struct url *, int,
                                 struct url *, struct hash_table *, struct iri *);
+static char *canonical_child (const struct urlpos *);
+
+/* The number of links --canonicalize and --strip-params gave a
+   canonical form other than their own, and how many of them turned
+   out to be variants of a URL already seen.  */
+static int canonical_rewrites;
+static int canonical_duplicates;
 
 
 /* Retrieve a part of the web beginning with START_URL.  This used to
@@ -199,7 +286,11 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
      the queue, but haven't been downloaded yet.  */
   struct hash_table *blacklist;
 
+  /* The processes checking links with --spider-jobs.  */
+  struct spider_pool *pool = NULL;
+
   struct iri *i = iri_new ();
+  const char *scope;
 
 #define COPYSTR(x)  (x) ? xstrdup(x) : NULL;
   /* Duplicate pi struct if not NULL */
@@ -214,13 +305,37 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 #undef COPYSTR
 
   queue = url_queue_new ();
+  /* Tell the blacklist apart from the rest of recur.c in the
+     allocation report of --enable-alloc-stats builds.  */
+  scope = alloc_stats_enter ("blacklist");
   blacklist = make_string_hash_table (0);
+  alloc_stats_leave (scope);
+  canonical_rewrites = canonical_duplicates = 0;
+
+  if (opt.shard_count > 1)
+    shard_begin ();
+  if (opt.spider && opt.spider_jobs > 1)
+    pool = spider_pool_new (opt.spider_jobs);
 
   /* Enqueue the starting URL.  Use start_url_parsed->url rather than
-     just URL so we enqueue the canonical form of the URL.  */
-  url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
-               false);
+     just URL so we enqueue the canonical form of the URL.  When the
+     retrieval is sharded, the shard owning its host starts with it
+     and the others wait for links to their hosts.  */
+  if (!shard_foreign_p (start_url_parsed))
+    url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
+                 false);
+  else
+    iri_free (i);
   string_set_add (blacklist, start_url_parsed->url);
+  {
+    char *canonical = url_canonicalize (start_url_parsed);
+    if (canonical)
+      {
+        string_set_add (blacklist, canonical);
+        xfree (canonical);
+      }
+  }
+  spider_note_link (start_url_parsed->url, NULL, true);
 
   while (1)
     {
@@ -230,6 +345,8 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
       bool html_allowed, css_allowed;
       bool is_css = false;
       bool dash_p_leaf_HTML = false;
+      struct spider_result checked_result;
+      bool checked = false;
 
       if (opt.quota && total_downloaded_bytes > opt.quota)
         break;
@@ -238,10 +355,65 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
       /* Get the next URL from the queue... */
 
-      if (!url_dequeue (queue, (struct iri **) &i,
-                        (const char **)&url, (const char **)&referer,
-                        &depth, &html_allowed, &css_allowed))
-        break;
+      if (pool
+          ? !url_dequeue_checked (pool, queue, (struct iri **) &i,
+                                  (const char **)&url,
+                                  (const char **)&referer, &depth,
+                                  &html_allowed, &css_allowed,
+                                  &checked_result, &checked)
+          : !url_dequeue (queue, (struct iri **) &i,
+                          (const char **)&url, (const char **)&referer,
+                          &depth, &html_allowed, &css_allowed))
+        {
+          struct shard_link *links, *link;
+
+          /* Continue with the links other shards found to our hosts,
+             until all shards run out of work.  */
+          if (opt.shard_count <= 1 || !(links = shard_receive ()))
+            break;
+          for (link = links; link; link = link->next)
+            {
+              struct url *u;
+              struct iri *ci;
+              char *canonical = NULL;
+
+              if (string_set_contains (blacklist, link->url))
+                continue;
+              string_set_add (blacklist, link->url);
+              ci = iri_new ();
+              set_uri_encoding (ci, opt.locale, true);
+              u = url_parse (link->url, NULL, ci, true);
+              /* Other shards may have found other variants of it.  */
+              if (u && (canonical = url_canonicalize (u)) != NULL)
+                {
+                  bool seen = string_set_contains (blacklist, canonical);
+                  if (!seen)
+                    string_set_add (blacklist, canonical);
+                  xfree (canonical);
+                  if (seen)
+                    {
+                      url_free (u);
+                      iri_free (ci);
+                      continue;
+                    }
+                }
+              if (!u || (opt.use_robots
+                         && schemes_are_similar_p (u->scheme, SCHEME_HTTP)
+                         && !robots_allow_p (u, ci)))
+                {
+                  if (u)
+                    url_free (u);
+                  iri_free (ci);
+                  continue;
+                }
+              url_free (u);
+              url_enqueue (queue, ci, xstrdup (link->url),
+                           link->referer ? xstrdup (link->referer) : NULL,
+                           link->depth, link->html_allowed, link->css_allowed);
+            }
+          shard_free_links (links);
+          continue;
+        }
 
       /* ...and download it.  Note that this download is in most cases
          unconditional, as download_child_p already makes sure a file
@@ -251,7 +423,8 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
          and again under URL2, but at a different (possibly smaller)
          depth, we want the URL's children to be taken into account
          the second time.  */
-      if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
+      if (!checked
+          && dl_url_file_map && hash_table_contains (dl_url_file_map, url))
         {
 	  bool is_css_bool;
 
@@ -277,8 +450,22 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
           char *redirected = NULL;
           struct url *url_parsed = url_parse (url, &url_err, i, true);
 
-          status = retrieve_url (url_parsed, url, &file, &redirected, referer,
-                                 &dt, false, i, true);
+          if (checked)
+            {
+              /* One of the link checking processes retrieved it.  */
+              status = checked_result.status;
+              dt = checked_result.dt;
+              file = checked_result.file;
+              redirected = checked_result.redirected;
+            }
+          else
+            {
+              if (opt.preconnect && url_parsed)
+                url_queue_preconnect (queue, url_parsed);
+
+              status = retrieve_url (url_parsed, url, &file, &redirected,
+                                     referer, &dt, false, i, true);
+            }
 
           if (html_allowed && file && status == RETROK
               && (dt & RETROKF) && (dt & TEXTHTML))
@@ -356,6 +543,12 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
             }
         }
 
+      /* A page nearly identical to one seen before, such as another
+         page of an endless calendar, most likely has the same links.  */
+      if (descend && !is_css && opt.skip_similar
+          && trap_similar_page_p (file, url))
+        descend = false;
+
       /* If the downloaded document was HTML or CSS, parse it and enqueue the
          links it contains. */
 
@@ -388,24 +581,53 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
               for (; child; child = child->next)
                 {
+                  char *canonical;
+
                   if (child->ignore_when_downloading)
                     continue;
                   if (dash_p_leaf_HTML && !child->link_inline_p)
                     continue;
+                  canonical = canonical_child (child);
+                  if (canonical
+                      && !string_set_contains (blacklist, child->url->url)
+                      && string_set_contains (blacklist, canonical))
+                    {
+                      /* A variant of a URL already seen.  */
+                      ++canonical_duplicates;
+                      spider_note_link (child->url->url, referer_url, false);
+                      xfree (canonical);
+                      continue;
+                    }
                   if (download_child_p (child, url_parsed, depth, start_url_parsed,
                                         blacklist, i))
                     {
-                      ci = iri_new ();
-                      set_uri_encoding (ci, i->content_encoding, false);
-                      url_enqueue (queue, ci, xstrdup (child->url->url),
-                                   xstrdup (referer_url), depth + 1,
-                                   child->link_expect_html,
-                                   child->link_expect_css);
+                      if (shard_foreign_p (child->url))
+                        shard_forward (child->url, referer_url, depth + 1,
+                                       child->link_expect_html,
+                                       child->link_expect_css);
+                      else
+                        {
+                          ci = iri_new ();
+                          set_uri_encoding (ci, i->content_encoding, false);
+                          url_enqueue (queue, ci, xstrdup (child->url->url),
+                                       xstrdup (referer_url), depth + 1,
+                                       child->link_expect_html,
+                                       child->link_expect_css);
+                          spider_note_link (child->url->url, referer_url,
+                                            true);
+                        }
                       /* We blacklist the URL we have enqueued, because we
                          don't want to enqueue (and hence download) the
                          same URL twice.  */
                       string_set_add (blacklist, child->url->url);
+                      if (canonical)
+                        string_set_add (blacklist, canonical);
                     }
+                  else
+                    /* Note that this page, too, links to the URL, if
+                       it is to be checked.  */
+                    spider_note_link (child->url->url, referer_url, false);
+                  xfree_null (canonical);
                 }
 
               if (strip_auth)
@@ -415,10 +637,13 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
             }
         }
 
-      if (file
-          && (opt.delete_after
-              || opt.spider /* opt.recursive is implicitely true */
-              || !acceptable (file)))
+      if (file && memory_file_p (file))
+        /* The document was only kept in memory; let it go.  */
+        memory_file_forget (file);
+      else if (file
+               && (opt.delete_after
+                   || opt.spider /* opt.recursive is implicitely true */
+                   || !acceptable (file)))
         {
           /* Either --delete-after was specified, or we loaded this
              (otherwise unneeded because of --spider or rejected by -R)
@@ -445,6 +670,11 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
       iri_free (i);
     }
 
+  if (pool)
+    spider_pool_delete (pool);
+  if (opt.shard_count > 1)
+    shard_end ();
+
   /* If anything is left of the queue due to a premature exit, free it
      now.  */
   {
@@ -464,6 +694,13 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
   string_set_free (blacklist);
 
+  if (canonical_rewrites)
+    logprintf (LOG_VERBOSE,
+               ngettext ("Canonicalized %d link, skipping %d duplicates.\n",
+                         "Canonicalized %d links, skipping %d duplicates.\n",
+                         canonical_rewrites),
+               canonical_rewrites, canonical_duplicates);
+
   if (opt.quota && total_downloaded_bytes > opt.quota)
     return QUOTEXC;
   else if (status == FWRITEERR)
@@ -472,6 +709,26 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
     return RETROK;
 }
 
+/* Return the canonical form of the URL of UPOS under --canonicalize
+   and --strip-params, or NULL if the rules leave it unchanged.  The
+   canonical form only serves to recognize the variants of a URL in
+   the blacklist: the URL is retrieved as it was written, since the
+   server need not know the canonical form -- think of the "case" rule
+   and a server that tells case apart.  */
+
+static char *
+canonical_child (const struct urlpos *upos)
+{
+  char *canonical = url_canonicalize (upos->url);
+
+  if (!canonical)
+    return NULL;
+  DEBUGP (("Canonical form of %s is %s.\n",
+           quote_n (0, upos->url->url), quote_n (1, canonical)));
+  ++canonical_rewrites;
+  return canonical;
+}
+
 /* Based on the context provided by retrieve_tree, decide whether a
    URL is to be descended to.  This is only ever called from
    retrieve_tree, but is in a separate function for clarity.
@@ -514,6 +771,7 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
      7. check for same host (if spanhost is unset), with possible
      gethostbyname baggage
      8. check for robots.txt
+     9. check for crawler traps (--max-path-depth, --dir-budget etc.)
 
      Addendum: If the URL is FTP, and it is to be loaded, only the
      domain and suffix settings are "stronger".
@@ -528,8 +786,12 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
   /* Determine whether URL under consideration has a HTTP-like scheme. */
   u_scheme_like_http = schemes_are_similar_p (u->scheme, SCHEME_HTTP);
 
-  /* 1. Schemes other than HTTP are normally not recursed into. */
-  if (!u_scheme_like_http && !(u->scheme == SCHEME_FTP && opt.follow_ftp))
+  /* 1. Schemes other than HTTP are normally not recursed into.  FTP
+     links are followed with --follow-ftp, and always when the
+     recursion itself started at an FTP URL (through a proxy).  */
+  if (!u_scheme_like_http
+      && !(u->scheme == SCHEME_FTP
+           && (opt.follow_ftp || start_url_parsed->scheme == SCHEME_FTP)))
     {
       DEBUGP (("Not following non-HTTP schemes.\n"));
       goto out;
@@ -623,47 +885,22 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
         goto out;
       }
 
-  /* 8. */
-  if (opt.use_robots && u_scheme_like_http)
-    {
-      struct robot_specs *specs = res_get_specs (u->host, u->port);
-      if (!specs)
-        {
-          char *rfile;
-          if (res_retrieve_file (url, &rfile, iri))
-            {
-              specs = res_parse_from_file (rfile);
-
-              /* Delete the robots.txt file if we chose to either delete the
-                 files after downloading or we're just running a spider. */
-              if (opt.delete_after || opt.spider)
-                {
-                  logprintf (LOG_VERBOSE, _("Removing %s.\n"), rfile);
-                  if (unlink (rfile))
-                      logprintf (LOG_NOTQUIET, "unlink: %s\n",
-                                 strerror (errno));
-                }
-
-              xfree (rfile);
-            }
-          else
-            {
-              /* If we cannot get real specs, at least produce
-                 dummy ones so that we can register them and stop
-                 trying to retrieve them.  */
-              specs = res_parse ("", 0);
-            }
-          res_register_specs (u->host, u->port, specs);
-        }
+  /* 8.  The robots.txt of hosts belonging to another shard is
+     checked by that shard.  */
+  if (opt.use_robots && u_scheme_like_http && !shard_foreign_p (u))
+    if (!robots_allow_p (u, iri))
+      {
+        string_set_add (blacklist, url);
+        goto out;
+      }
 
-      /* Now that we have (or don't have) robots.txt specs, we can
-         check what they say.  */
-      if (!res_match_path (specs, u->path))
-        {
-          DEBUGP (("Not following %s because robots.txt forbids it.\n", url));
-          string_set_add (blacklist, url);
-          goto out;
-        }
+  /* 9.  This comes last, as a URL that passes is counted against the
+     budgets of its directory and query pattern.  A rejected URL is
+     blacklisted so that the rejection is logged only once.  */
+  if (!trap_check (u))
+    {
+      string_set_add (blacklist, url);
+      goto out;
     }
 
   /* The URL has passed all the tests.  It can be placed in the
@@ -678,6 +915,52 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
   return false;
 }
 
+/* Return true if the robots.txt of the host of U, which is retrieved
+   unless it is already known, allows U to be retrieved.  */
+
+static bool
+robots_allow_p (struct url *u, struct iri *iri)
+{
+  struct robot_specs *specs = res_get_specs (u->host, u->port);
+  if (!specs)
+    {
+      char *rfile;
+      if (res_retrieve_file (u->url, &rfile, iri))
+        {
+          specs = res_parse_from_file (rfile);
+
+          /* Delete the robots.txt file if we chose to either delete the
+             files after downloading or we're just running a spider. */
+          if (opt.delete_after || opt.spider)
+            {
+              logprintf (LOG_VERBOSE, _("Removing %s.\n"), rfile);
+              if (unlink (rfile))
+                  logprintf (LOG_NOTQUIET, "unlink: %s\n",
+                             strerror (errno));
+            }
+
+          xfree (rfile);
+        }
+      else
+        {
+          /* If we cannot get real specs, at least produce
+             dummy ones so that we can register them and stop
+             trying to retrieve them.  */
+          specs = res_parse ("", 0);
+        }
+      res_register_specs (u->host, u->port, specs);
+    }
+
+  /* Now that we have (or don't have) robots.txt specs, we can
+     check what they say.  */
+  if (!res_match_path (specs, u->path))
+    {
+      DEBUGP (("Not following %s because robots.txt forbids it.\n", u->url));
+      return false;
+    }
+  return true;
+}
+
 /* This function determines whether we will consider downloading the
    children of a URL whose download resulted in a redirection,
    possibly to another host, etc.  It is needed very rarely, and thus
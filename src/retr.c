@@ -49,10 +49,14 @@ as that of the covered work.  */
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "arena.h"
 #include "convert.h"
 #include "ptimer.h"
 #include "html-url.h"
 #include "iri.h"
+#include "checksum.h"
+#include "preconnect.h"
+#include "spider.h"
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 SUM_SIZE_INT total_downloaded_bytes;
@@ -68,87 +72,80 @@ FILE *output_stream;
    i.e. not `-' or a device file. */
 bool output_stream_regular;
 
-static struct {
-  wgint chunk_bytes;
-  double chunk_start;
-  double sleep_adjust;
-} limit_data;
-
-static void
-limit_bandwidth_reset (void)
+/* Initialize CTX for a new transfer of the URL given on the command
+   line or in the input file.  */
+
+void
+transfer_context_init (struct transfer_context *ctx)
 {
-  xzero (limit_data);
+  xzero (*ctx);
+  ctx->post_data = opt.post_data;
+  ctx->post_file_name = opt.post_file_name;
 }
 
-/* Limit the bandwidth by pausing the download for an amount of time.
-   BYTES is the number of bytes received from the network, and TIMER
-   is the timer that started at the beginning of download.  */
+#ifndef MIN
+# define MIN(i, j) ((i) <= (j) ? (i) : (j))
+#endif
 
-static void
-limit_bandwidth (wgint bytes, struct ptimer *timer)
-{
-  double delta_t = ptimer_read (timer) - limit_data.chunk_start;
-  double expected;
+/* Add BUFSIZE bytes from BUF to the body collected in MEM.  If the
+   body outgrows MEM->limit, write what was collected to MEM->file and
+   continue there.  Returns false on error writing the file.  */
 
-  limit_data.chunk_bytes += bytes;
+static bool
+write_memory (struct body_memory *mem, const char *buf, int bufsize)
+{
+  if (mem->discard)
+    return true;
 
-  /* Calculate the amount of time we expect downloading the chunk
-     should take.  If in reality it took less time, sleep to
-     compensate for the difference.  */
-  expected = (double) limit_data.chunk_bytes / opt.limit_rate;
+  if (!mem->spill && mem->length + bufsize > mem->limit)
+    {
+      DEBUGP (("Body exceeds %s, writing it to %s.\n",
+               number_to_static_string (mem->limit), mem->file));
+      mkalldirs (mem->file);
+      mem->spill = fopen (mem->file, "wb");
+      if (!mem->spill)
+        return false;
+      fwrite (mem->content, 1, mem->length, mem->spill);
+      xfree_null (mem->content);
+      mem->content = NULL;
+      mem->size = 0;
+    }
 
-  if (expected > delta_t)
+  if (mem->spill)
     {
-      double slp = expected - delta_t + limit_data.sleep_adjust;
-      double t0, t1;
-      if (slp < 0.2)
-        {
-          DEBUGP (("deferring a %.2f ms sleep (%s/%.2f).\n",
-                   slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-                   delta_t));
-          return;
-        }
-      DEBUGP (("\nsleeping %.2f ms for %s bytes, adjust %.2f ms\n",
-               slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-               limit_data.sleep_adjust));
-
-      t0 = ptimer_read (timer);
-      xsleep (slp);
-      t1 = ptimer_measure (timer);
-
-      /* Due to scheduling, we probably slept slightly longer (or
-         shorter) than desired.  Calculate the difference between the
-         desired and the actual sleep, and adjust the next sleep by
-         that amount.  */
-      limit_data.sleep_adjust = slp - (t1 - t0);
-      /* If sleep_adjust is very large, it's likely due to suspension
-         and not clock inaccuracy.  Don't enforce those.  */
-      if (limit_data.sleep_adjust > 0.5)
-        limit_data.sleep_adjust = 0.5;
-      else if (limit_data.sleep_adjust < -0.5)
-        limit_data.sleep_adjust = -0.5;
+      fwrite (buf, 1, bufsize, mem->spill);
+      mem->length += bufsize;
+      return !ferror (mem->spill);
     }
 
-  limit_data.chunk_bytes = 0;
-  limit_data.chunk_start = ptimer_read (timer);
+  if (mem->length + bufsize > mem->size)
+    {
+      wgint size = mem->size ? mem->size : 16384;
+      while (size < mem->length + bufsize)
+        size <<= 1;
+      mem->content = xrealloc (mem->content, size);
+      mem->size = size;
+    }
+  memcpy (mem->content + mem->length, buf, bufsize);
+  mem->length += bufsize;
+  return true;
 }
 
-#ifndef MIN
-# define MIN(i, j) ((i) <= (j) ? (i) : (j))
-#endif
-
 /* Write data in BUF to OUT.  However, if *SKIP is non-zero, skip that
    amount of data and decrease SKIP.  Increment *TOTAL by the amount
    of data written.  If OUT2 is not NULL, also write BUF to OUT2.
-   In case of error writing to OUT, -1 is returned.  In case of error
-   writing to OUT2, -2 is returned.  In case of any other error,
-   1 is returned.  */
+   If CHECKSUM is not NULL, add the data written to OUT to its digest.
+   If MEM is not NULL, collect the data there instead of writing it
+   to OUT.  In case of error writing to OUT or MEM, -1 is returned.
+   In case of error writing to OUT2, -2 is returned.  In case of any
+   other error, 1 is returned.  */
 
 static int
 write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
-            wgint *skip, wgint *written)
+            wgint *skip, wgint *written, struct checksum *checksum,
+            struct body_memory *mem)
 {
-  if (out == NULL && out2 == NULL)
+  if (out == NULL && out2 == NULL && mem == NULL)
     return 1;
   if (*skip > bufsize)
     {
@@ -164,10 +161,14 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
         return 1;
     }
 
+  if (mem != NULL && !write_memory (mem, buf, bufsize))
+    return -1;
   if (out != NULL)
     fwrite (buf, 1, bufsize, out);
   if (out2 != NULL)
     fwrite (buf, 1, bufsize, out2);
+  if (checksum != NULL)
+    checksum_update (checksum, buf, bufsize);
   *written += bufsize;
 
   /* Immediately flush the downloaded data.  This should not hinder
@@ -197,10 +198,18 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
     return 0;
 }
 
+/* The largest buffer fd_read_body grows its buffer to, and the number
+   of reads in a row that must fill the buffer before it is grown.  */
+#define MAX_DLBUFSIZE (1024 * 1024)
+#define FULL_READS_TO_GROW 2
+
 /* Read the contents of file descriptor FD until it the connection
    terminates or a read error occurs.  The data is read in portions of
-   up to 16K and written to OUT as it arrives.  If opt.verbose is set,
-   the progress is shown.
+   8K, or more as long as the data keeps arriving faster than it is
+   read, up to MAX_DLBUFSIZE, and written to OUT as it arrives.  With
+   --socket-buffer=auto the socket receive buffer is grown along with
+   it to fit the measured bandwidth-delay product.  If opt.verbose is
+   set, the progress is shown.
 
    TOREAD is the amount of data expected to arrive, normally only used
    by the progress gauge.
@@ -217,6 +226,16 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
    response, everything -- including the chunk headers -- is written
    to OUT2.  (OUT will only get the unchunked response.)
 
+   If CHECKSUM is non-NULL, the data written to OUT is added to its
+   digest as it arrives, which saves reading the file back in order to
+   verify it.
+
+   If MEM is non-NULL, the data is collected there instead of being
+   written to OUT, which should then be NULL.
+
+   CTX is the context of the transfer, which keeps the state of the
+   rate limits.
+
    The function exits and returns the amount of data read.  In case of
    error while reading data, -1 is returned.  In case of error while
    writing data to OUT, -2 is returned.  In case of error while writing
@@ -225,7 +244,8 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
 int
 fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
               wgint *qtyread, wgint *qtywritten, double *elapsed, int flags,
-              FILE *out2)
+              FILE *out2, struct checksum *checksum,
+              struct body_memory *mem, struct transfer_context *ctx)
 {
   int ret = 0;
 #undef max
@@ -233,6 +253,15 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
   int dlbufsize = max (BUFSIZ, 8 * 1024);
   char *dlbuf = xmalloc (dlbufsize);
 
+  /* The largest the buffer may grow to: one second's worth of data
+     when rate-limited, MAX_DLBUFSIZE otherwise.  */
+  int dlbufmax = MAX_DLBUFSIZE;
+
+  /* Number of reads, and how many of them in a row filled the
+     buffer.  */
+  wgint reads = 0;
+  int full_reads = 0;
+
   struct ptimer *timer = NULL;
   double last_successful_read_tm = 0;
 
@@ -247,6 +276,9 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
 
   bool exact = !!(flags & rb_read_exactly);
 
+  /* Whether any rate limit applies to this transfer.  */
+  bool limited;
+
   /* Used only by HTTP/HTTPS chunked transfer encoding.  */
   bool chunked = flags & rb_chunked_transfer_encoding;
   wgint skip = 0;
@@ -269,24 +301,26 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
       progress_interactive = progress_interactive_p (progress);
     }
 
-  if (opt.limit_rate)
-    limit_bandwidth_reset ();
+  limited = rate_limit_begin (&ctx->limit, ctx->host);
 
-  /* A timer is needed for tracking progress, for throttling, and for
-     tracking elapsed time.  If either of these are requested, start
-     the timer.  */
-  if (progress || opt.limit_rate || elapsed)
-    {
-      timer = ptimer_new ();
-      last_successful_read_tm = 0;
-    }
+  /* A timer is needed for tracking progress, for throttling, for
+     tracking elapsed time, and for measuring the throughput that the
+     socket buffer is sized by.  */
+  timer = ptimer_new ();
+  last_successful_read_tm = 0;
 
   /* Use a smaller buffer for low requested bandwidths.  For example,
      with --limit-rate=2k, it doesn't make sense to slurp in 16K of
      data and then sleep for 8s.  With buffer size equal to the limit,
      we never have to sleep for more than one second.  */
-  if (opt.limit_rate && opt.limit_rate < dlbufsize)
-    dlbufsize = opt.limit_rate;
+  if (limited)
+    {
+      wgint lowest = rate_limit_lowest (&ctx->limit);
+      if (lowest && lowest < dlbufmax)
+        dlbufmax = lowest;
+      if (dlbufmax < dlbufsize)
+        dlbufsize = dlbufmax;
+    }
 
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
@@ -365,17 +399,16 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
       else if (ret <= 0)
         break;                  /* EOF or read error */
 
-      if (progress || opt.limit_rate || elapsed)
-        {
-          ptimer_measure (timer);
-          if (ret > 0)
-            last_successful_read_tm = ptimer_read (timer);
-        }
+      ptimer_measure (timer);
+      if (ret > 0)
+        last_successful_read_tm = ptimer_read (timer);
 
       if (ret > 0)
         {
+          ++reads;
           sum_read += ret;
-          int write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written);
+          int write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written,
+                                      checksum, mem);
           if (write_res != 0)
             {
               ret = (write_res == -3) ? -3 : -2;
@@ -402,8 +435,24 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
             }
         }
 
-      if (opt.limit_rate)
-        limit_bandwidth (ret, timer);
+      if (limited)
+        rate_limit_consume (&ctx->limit, ret);
+
+      /* A read that fills the whole buffer means that more data was
+         waiting in the socket: double the buffer so that a fast
+         transfer takes fewer reads.  On a slow link the reads come
+         back short and the buffer stays small.  */
+      if (ret > 0 && ret == dlbufsize)
+        {
+          if (++full_reads >= FULL_READS_TO_GROW && dlbufsize < dlbufmax)
+            {
+              dlbufsize = MIN (2 * (wgint) dlbufsize, dlbufmax);
+              dlbuf = xrealloc (dlbuf, dlbufsize);
+              full_reads = 0;
+            }
+        }
+      else if (ret > 0)
+        full_reads = 0;
 
       if (progress)
         progress_update (progress, ret, ptimer_read (timer));
@@ -422,8 +471,13 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
 
   if (elapsed)
     *elapsed = ptimer_read (timer);
-  if (timer)
-    ptimer_destroy (timer);
+  if (opt.socket_buffer < 0)
+    socket_note_throughput (fd, sum_read, last_successful_read_tm);
+  if (sum_read)
+    DEBUGP (("Read %s bytes in %s reads (%.1f per MB) with a buffer of up to %d bytes.\n",
+             number_to_static_string (sum_read), number_to_static_string (reads),
+             reads * 1048576.0 / sum_read, dlbufsize));
+  ptimer_destroy (timer);
 
   if (qtyread)
     *qtyread += sum_read;
@@ -677,25 +731,6 @@ calc_rate (wgint bytes, double secs, int *units)
 }
 
 
-#define SUSPEND_POST_DATA do {                  \
-  post_data_suspended = true;                   \
-  saved_post_data = opt.post_data;              \
-  saved_post_file_name = opt.post_file_name;    \
-  opt.post_data = NULL;                         \
-  opt.post_file_name = NULL;                    \
-} while (0)
-
-#define RESTORE_POST_DATA do {                          \
-  if (post_data_suspended)                              \
-    {                                                   \
-      opt.post_data = saved_post_data;                  \
-      opt.post_file_name = saved_post_file_name;        \
-      post_data_suspended = false;                      \
-    }                                                   \
-} while (0)
-
-static char *getproxy (struct url *);
-
 /* Retrieve the given URL.  Decides which loop to call -- HTTP, FTP,
    FTP, proxy, etc.  */
 
@@ -717,10 +752,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   int up_error_code;            /* url parse error code */
   char *local_file;
   int redirection_count = 0;
+  struct transfer_context ctx;
 
-  bool post_data_suspended = false;
-  char *saved_post_data = NULL;
-  char *saved_post_file_name = NULL;
+  transfer_context_init (&ctx);
 
   /* If dt is NULL, use local storage.  */
   if (!dt)
@@ -737,6 +771,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   if (!refurl)
     refurl = opt.referer;
 
+  if (opt.spider)
+    spider_check_start (origurl);
+
  redirected:
   /* (also for IRI fallbacking) */
 
@@ -745,6 +782,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
   local_file = NULL;
   proxy_url = NULL;
 
+  ctx.host = u->host;
   proxy = getproxy (u);
   if (proxy)
     {
@@ -761,7 +799,6 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
                      proxy, error);
           xfree (url);
           xfree (error);
-          RESTORE_POST_DATA;
           result = PROXERR;
           goto bail;
         }
@@ -770,7 +807,6 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           logprintf (LOG_NOTQUIET, _("Error in proxy URL %s: Must be HTTP.\n"), proxy);
           url_free (proxy_url);
           xfree (url);
-          RESTORE_POST_DATA;
           result = PROXERR;
           goto bail;
         }
@@ -783,7 +819,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
       || (proxy_url && proxy_url->scheme == SCHEME_HTTP))
     {
       result = http_loop (u, orig_parsed, &mynewloc, &local_file, refurl, dt,
-                          proxy_url, iri);
+                          proxy_url, iri, &ctx);
     }
   else if (u->scheme == SCHEME_FTP)
     {
@@ -794,7 +830,8 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
       if (redirection_count)
         oldrec = glob = false;
 
-      result = ftp_loop (u, &local_file, dt, proxy_url, recursive, glob);
+      result = ftp_loop (u, &local_file, dt, proxy_url, recursive, glob,
+                         &ctx);
       recursive = oldrec;
 
       /* There is a possibility of having HTTP being redirected to
@@ -853,7 +890,6 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           xfree (url);
           xfree (mynewloc);
           xfree (error);
-          RESTORE_POST_DATA;
           goto bail;
         }
 
@@ -862,6 +898,8 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
          don't want that propagating as url.  */
       xfree (mynewloc);
       mynewloc = xstrdup (newloc_parsed->url);
+      if (opt.spider)
+        spider_check_redirect (mynewloc);
 
       /* Check for max. number of redirections.  */
       if (++redirection_count > opt.max_redirect)
@@ -875,7 +913,6 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
             }
           xfree (url);
           xfree (mynewloc);
-          RESTORE_POST_DATA;
           result = WRONGCODE;
           goto bail;
         }
@@ -891,15 +928,15 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
       /* If we're being redirected from POST, and we received a
          redirect code different than 307, we don't want to POST
          again.  Many requests answer POST with a redirection to an
-         index page; that redirection is clearly a GET.  We "suspend"
-         POST data for the duration of the redirections, and restore
-         it when we're done.
+         index page; that redirection is clearly a GET, so the POST
+         data is dropped from the context for the remaining
+         redirections.
 	 
 	 RFC2616 HTTP/1.1 introduces code 307 Temporary Redirect
 	 specifically to preserve the method of the request.
 	 */
-      if (result != NEWLOCATION_KEEP_POST && !post_data_suspended)
-        SUSPEND_POST_DATA;
+      if (result != NEWLOCATION_KEEP_POST)
+        ctx.post_data = ctx.post_file_name = NULL;
 
       goto redirected;
     }
@@ -928,6 +965,18 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
     {
       register_download (u->url, local_file);
 
+      /* Let -k convert the links to the other variants of the URL
+         under --canonicalize, which are looked up under its canonical
+         form, to the same file.  */
+      {
+        char *canonical = url_canonicalize (u);
+        if (canonical)
+          {
+            register_redirection (canonical, u->url);
+            xfree (canonical);
+          }
+      }
+
       if (!opt.spider && redirection_count && 0 != strcmp (origurl, u->url))
         register_redirection (origurl, u->url);
 
@@ -962,14 +1011,213 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
       xfree (url);
     }
 
-  RESTORE_POST_DATA;
-
 bail:
+  if (opt.spider)
+    spider_check_finish (origurl, result);
   if (register_status)
     inform_exit_status (result);
   return result;
 }
 
+/* Retrieve the URL in CUR_URL on behalf of retrieve_from_file.  If
+   FILE is non-NULL, store the name of the file the URL was saved to,
+   or NULL if none was kept.  */
+
+static uerr_t
+retrieve_list_entry (struct urlpos *cur_url, struct iri *iri, char **file)
+{
+  uerr_t status;
+  char *filename = NULL, *new_file = NULL;
+  int dt = 0;
+  struct iri *tmpiri = iri_dup (iri);
+  struct url *parsed_url = url_parse (cur_url->url->url, NULL, tmpiri, true);
+
+  /* The FTP code changes the URL it is given, which an entry in an
+     arena cannot have done to it.  */
+  if (!parsed_url && cur_url->arena)
+    parsed_url = url_parse (cur_url->url->url, NULL, NULL, false);
+
+  if ((opt.recursive || opt.page_requisites)
+      && (cur_url->url->scheme != SCHEME_FTP || getproxy (cur_url->url)))
+    status = retrieve_tree (parsed_url ? parsed_url : cur_url->url, tmpiri);
+  else
+    status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
+                           cur_url->url->url, &filename,
+                           &new_file, NULL, &dt, opt.recursive, tmpiri,
+                           true);
+
+  if (parsed_url)
+      url_free (parsed_url);
+
+  if (filename && memory_file_p (filename))
+    {
+      memory_file_forget (filename);
+      xfree (filename);
+      filename = NULL;
+    }
+  else if (filename && opt.delete_after && file_exists_p (filename))
+    {
+      DEBUGP (("\
+Removing file due to --delete-after in retrieve_from_file():\n"));
+      logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
+      if (unlink (filename))
+        logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+      dt &= ~RETROKF;
+      xfree (filename);
+      filename = NULL;
+    }
+
+  xfree_null (new_file);
+  if (file)
+    *file = filename;
+  else
+    xfree_null (filename);
+  iri_free (tmpiri);
+  return status;
+}
+
+/* An entry of an input file retrieved with --group-by-host.  */
+
+struct grouped_url {
+  struct urlpos *pos;
+  int index;                    /* position in the input file */
+  int group;                    /* rank of the first appearance of the
+                                   scheme, host and port of the URL */
+  bool done;                    /* whether it was retrieved */
+  uerr_t status;
+  char *file;                   /* where it was saved, if anywhere */
+};
+
+static int
+grouped_url_cmp (const void *a, const void *b)
+{
+  const struct grouped_url *ga = *(const struct grouped_url **) a;
+  const struct grouped_url *gb = *(const struct grouped_url **) b;
+
+  if (ga->group != gb->group)
+    return ga->group < gb->group ? -1 : 1;
+  return ga->index < gb->index ? -1 : ga->index > gb->index;
+}
+
+/* Retrieve the URLs in LIST so that the URLs sharing a scheme, host
+   and port are retrieved one after another, letting them reuse one
+   persistent connection.  The groups are taken in the order of their
+   first appearance in LIST, and the URLs of a group in input order.
+
+   The results are reported in input order afterwards, and the status
+   returned is that of the last URL of the input, as though the URLs
+   had been retrieved in order.  */
+
+static uerr_t
+retrieve_grouped_by_host (struct urlpos *list, struct iri *iri, int *count)
+{
+  uerr_t status = RETROK;
+  struct hash_table *groups;
+  hash_table_iterator iter;
+  struct grouped_url *entries, **order;
+  struct urlpos *cur;
+  int n = 0, ngroups = 0, i, j;
+  int connects, reuses, old_connects, old_reuses;
+
+  for (cur = list; cur; cur = cur->next)
+    if (!cur->ignore_when_downloading)
+      ++n;
+  if (!n)
+    return RETROK;
+
+  entries = xnew0_array (struct grouped_url, n);
+  order = xnew_array (struct grouped_url *, n);
+  groups = make_string_hash_table (0);
+
+  for (cur = list, i = 0; cur; cur = cur->next)
+    {
+      struct url *u = cur->url;
+      char *key;
+      void *rank;
+
+      if (cur->ignore_when_downloading)
+        continue;
+
+      key = aprintf ("%d:%s:%d", (int) u->scheme, u->host, u->port);
+      rank = hash_table_get (groups, key);
+      if (!rank)
+        {
+          rank = (void *) (intptr_t) ++ngroups;
+          hash_table_put (groups, key, rank);
+        }
+      else
+        xfree (key);
+
+      entries[i].pos = cur;
+      entries[i].index = i;
+      entries[i].group = (intptr_t) rank;
+      order[i] = &entries[i];
+      ++i;
+    }
+
+  qsort (order, n, sizeof (order[0]), grouped_url_cmp);
+  DEBUGP (("Retrieving %d URLs from %d hosts.\n", n, ngroups));
+
+  http_connection_stats (&old_connects, &old_reuses);
+  for (i = 0; i < n; i++)
+    {
+      if (opt.quota && total_downloaded_bytes > opt.quota)
+        {
+          status = QUOTEXC;
+          break;
+        }
+      for (j = i + 1; j < n && j <= i + opt.preconnect; j++)
+        preconnect_hint (order[j]->pos->url, order[i]->pos->url);
+      order[i]->status = retrieve_list_entry (order[i]->pos, iri,
+                                              &order[i]->file);
+      order[i]->done = true;
+    }
+  http_connection_stats (&connects, &reuses);
+  connects -= old_connects;
+  reuses -= old_reuses;
+
+  /* Report the results in the order of the input.  */
+  if (n > 1)
+    logputs (LOG_VERBOSE, _("Results in input order:\n"));
+  for (i = 0; i < n; i++)
+    {
+      struct grouped_url *e = &entries[i];
+
+      if (n > 1)
+        {
+          if (!e->done)
+            logprintf (LOG_VERBOSE, _("  %s: not retrieved\n"),
+                       e->pos->url->url);
+          else if (e->status != RETROK)
+            logprintf (LOG_VERBOSE, _("  %s: failed\n"), e->pos->url->url);
+          else if (e->file)
+            logprintf (LOG_VERBOSE, "  %s -> %s\n",
+                       e->pos->url->url, quote (e->file));
+          else
+            logprintf (LOG_VERBOSE, _("  %s: done\n"), e->pos->url->url);
+        }
+
+      if (e->done && status != QUOTEXC)
+        status = e->status;
+      if (e->done)
+        ++*count;
+      xfree_null (e->file);
+    }
+
+  if (connects + reuses)
+    logprintf (LOG_NOTQUIET,
+               _("Reused connections: %d of %d HTTP requests (%d%%).\n"),
+               reuses, connects + reuses,
+               (int) (100.0 * reuses / (connects + reuses) + 0.5));
+
+  for (hash_table_iterate (groups, &iter); hash_table_iter_next (&iter); )
+    xfree (iter.key);
+  hash_table_destroy (groups);
+  xfree (order);
+  xfree (entries);
+  return status;
+}
+
 /* Find the URLs in the file and call retrieve_url() for each of them.
    If HTML is true, treat the file as HTML, and construct the URLs
    accordingly.
@@ -980,7 +1228,8 @@ uerr_t
 retrieve_from_file (const char *file, bool html, int *count)
 {
   uerr_t status;
-  struct urlpos *url_list, *cur_url;
+  struct urlpos *url_list = NULL, *cur_url;
+  struct urls_file *reader = NULL;
   struct iri *iri = iri_new();
 
   char *input_file, *url_file = NULL;
@@ -1034,69 +1283,62 @@ retrieve_from_file (const char *file, bool html, int *count)
   else
     input_file = (char *) file;
 
-  url_list = (html ? get_urls_html (input_file, NULL, NULL, iri)
-              : get_urls_file (input_file));
+  /* HTML is parsed as a whole; a list of URLs is read line by line as
+     the URLs are retrieved.  */
+  if (html)
+    url_list = get_urls_html (input_file, NULL, NULL, iri);
+  else
+    {
+      /* A file downloaded from a URL is complete; never follow it.  */
+      reader = urls_file_open (input_file, opt.follow_input && !url_file);
+    }
 
   xfree_null (url_file);
 
-  for (cur_url = url_list; cur_url; cur_url = cur_url->next, ++*count)
+  /* Grouping needs the whole list before the first URL is
+     retrieved.  */
+  if (opt.group_by_host && reader)
     {
-      char *filename = NULL, *new_file = NULL;
-      int dt;
-      struct iri *tmpiri = iri_dup (iri);
-      struct url *parsed_url = NULL;
-
-      if (cur_url->ignore_when_downloading)
-        continue;
-
-      if (opt.quota && total_downloaded_bytes > opt.quota)
-        {
-          status = QUOTEXC;
-          break;
-        }
-
-      parsed_url = url_parse (cur_url->url->url, NULL, tmpiri, true);
-
-      if ((opt.recursive || opt.page_requisites)
-          && (cur_url->url->scheme != SCHEME_FTP || getproxy (cur_url->url)))
-        {
-          int old_follow_ftp = opt.follow_ftp;
-
-          /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
-          if (cur_url->url->scheme == SCHEME_FTP)
-            opt.follow_ftp = 1;
-
-          status = retrieve_tree (parsed_url ? parsed_url : cur_url->url,
-                                  tmpiri);
-
-          opt.follow_ftp = old_follow_ftp;
-        }
-      else
-        status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
-                               cur_url->url->url, &filename,
-                               &new_file, NULL, &dt, opt.recursive, tmpiri,
-                               true);
-
-      if (parsed_url)
-          url_free (parsed_url);
-
-      if (filename && opt.delete_after && file_exists_p (filename))
-        {
-          DEBUGP (("\
-Removing file due to --delete-after in retrieve_from_file():\n"));
-          logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
-          if (unlink (filename))
-            logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
-          dt &= ~RETROKF;
-        }
-
-      xfree_null (new_file);
-      xfree_null (filename);
-      iri_free (tmpiri);
+      url_list = urls_file_read_all (reader);
+      urls_file_close (reader);
+      reader = NULL;
     }
 
+  if (opt.group_by_host)
+    status = retrieve_grouped_by_host (url_list, iri, count);
+  else
+    for (cur_url = reader ? urls_file_next (reader) : url_list;
+         cur_url;
+         cur_url = reader ? urls_file_next (reader) : cur_url->next, ++*count)
+      {
+        if (cur_url->ignore_when_downloading)
+          continue;
+
+        if (opt.quota && total_downloaded_bytes > opt.quota)
+          {
+            status = QUOTEXC;
+            break;
+          }
+
+        /* Only a list read as a whole can be looked ahead in.  */
+        if (opt.preconnect && !reader)
+          {
+            struct urlpos *next;
+            int i;
+            for (next = cur_url->next, i = 0;
+                 next && i < opt.preconnect;
+                 next = next->next, i++)
+              preconnect_hint (next->url, cur_url->url);
+          }
+
+        status = retrieve_list_entry (cur_url, iri, NULL);
+      }
+
   /* Free the linked list of URL-s.  */
-  free_urlpos (url_list);
+  if (reader)
+    urls_file_close (reader);
+  else
+    free_urlpos (url_list);
 
   iri_free (iri);
 
@@ -1158,10 +1400,16 @@ sleep_between_retrievals (int count)
     }
 }
 
-/* Free the linked list of urlpos.  */
+/* Free the linked list of urlpos.  A list allocated in an arena goes
+   away with it at once.  */
 void
 free_urlpos (struct urlpos *l)
 {
+  if (l && l->arena)
+    {
+      arena_free (l->arena);
+      return;
+    }
   while (l)
     {
       struct urlpos *next = l->next;
@@ -1202,7 +1450,7 @@ static bool no_proxy_match (const char *, const char **);
 
 /* Return the URL of the proxy appropriate for url U.  */
 
-static char *
+char *
 getproxy (struct url *u)
 {
   char *proxy = NULL;
@@ -33,6 +33,7 @@ as that of the covered work.  */
 #define RETR_H
 
 #include "url.h"
+#include "ratelimit.h"
 
 /* These global vars should be made static to retr.c and exported via
    functions! */
@@ -50,7 +51,57 @@ enum {
   rb_chunked_transfer_encoding = 4
 };
 
-int fd_read_body (int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
+struct checksum;
+
+/* A response body collected in memory by fd_read_body instead of
+   being written to a file.  */
+struct body_memory {
+  char *content;                /* the body, unless DISCARD */
+  wgint length;                 /* how much of it has arrived */
+  wgint size;                   /* allocated size of CONTENT */
+  bool discard;                 /* if true, the body is only counted */
+
+  /* Once the body grows beyond LIMIT bytes, it is written to FILE
+     after all, through SPILL.  */
+  wgint limit;
+  const char *file;
+  FILE *spill;
+};
+
+/* The state of one transfer started by retrieve_url, which used to be
+   kept in static variables or written into OPT while the transfer was
+   in progress.  It is passed down to http_loop and ftp_loop, and from
+   them to fd_read_body, so that OPT stays read-only during a retrieval
+   and two transfers don't share anything they both modify.
+
+   Not everything a transfer touches is in the context.  The caches
+   that are meant to be shared between transfers -- the persistent
+   HTTP connection (pconn in http.c), the cookie jar, the host name
+   cache and the WARC file (warc_current_file in warc.c) -- remain
+   global, and nothing serializes access to them: Wget runs one
+   transfer at a time, and has no thread support to lock them with.
+   They would have to be locked, or moved into the context, before
+   transfers could run in parallel.  The strings that end up in
+   requests and cache keys are built in buffers of their own rather
+   than with number_to_static_string or print_address.  */
+struct transfer_context {
+  /* The data to POST, or NULL.  These start out as opt.post_data and
+     opt.post_file_name, and are cleared when a redirection turns the
+     request into a GET.  */
+  char *post_data;
+  char *post_file_name;
+
+  /* The host data is being retrieved from, and the rate limits that
+     apply to the body being read.  */
+  const char *host;
+  struct rate_limiter limit;
+};
+
+void transfer_context_init (struct transfer_context *);
+
+int fd_read_body (int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *,
+                  struct checksum *, struct body_memory *,
+                  struct transfer_context *);
 
 typedef const char *(*hunk_terminator_t) (const char *, const char *, int);
 
@@ -69,6 +120,7 @@ void sleep_between_retrievals (int);
 
 void rotate_backups (const char *);
 
+char *getproxy (struct url *);
 bool url_uses_proxy (struct url *);
 
 void set_local_file (const char **, const char *);
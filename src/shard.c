@@ -0,0 +1,515 @@
+/* Sharing a recursive retrieval among several processes.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --shard=K/N, this Wget is shard K of a crawl divided among N
+   processes, possibly running on different machines, that share the
+   directory opt.shard_dir.  Hosts are partitioned among the shards by
+   a hash of their name.  All shards are given the same command line;
+   each one retrieves only the URLs on its own hosts, and forwards the
+   links it finds to other shards' hosts to their owner.
+
+   The shard directory contains, for each shard K:
+
+     inbox-K/   batches of links forwarded to shard K.  A batch is
+                written under a temporary name starting with a dot and
+                renamed into place, so that it is only seen complete.
+                Each line holds the depth, whether the link may be
+                treated as HTML and as CSS, the URL and the referer,
+                or "-" if there is none.
+
+     state-K    the number of the retrieve_tree call the shard is in,
+                whether it has run out of work, and the number of links
+                it has sent and received in total.
+
+     map-K      once the retrieval is over, the URLs the shard
+                downloaded and the files it saved them to, for -k.
+
+   A shard that runs out of work keeps looking for forwarded links
+   until all shards are idle and every link sent has been received,
+   as observed twice in a row.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "utils.h"
+#include "url.h"
+#include "hash.h"
+#include "convert.h"
+#include "http.h"
+#include "ptimer.h"
+#include "exits.h"
+#include "shard.h"
+
+/* The number of links forwarded to a shard at once.  */
+#define SHARD_BATCH 100
+
+/* How long to wait before looking for forwarded links again.  */
+#define SHARD_POLL_INTERVAL 0.2
+
+/* How long to wait for the other shards to publish their downloads
+   once the retrieval is over, in seconds.  By then every shard has
+   been seen idle, so one that takes longer has died.  */
+#define SHARD_MAP_TIMEOUT 60
+
+/* Links waiting to be forwarded to a shard.  */
+struct shard_outbox {
+  char *data;
+  size_t len, size;
+  int count;
+};
+
+static struct shard_outbox *outboxes;
+
+/* The number of the current retrieve_tree call.  */
+static int shard_round;
+
+/* Links sent to and received from other shards, in total.  */
+static long shard_sent, shard_received;
+
+/* The number of batches written by this shard, used to name them.  */
+static long shard_batches;
+
+/* The counters of all shards at the previous termination check.  */
+static long last_sent_sum = -1, last_received_sum = -1;
+
+/* Remove the newline at the end of LINE.  */
+
+static void
+chomp (char *line)
+{
+  size_t len = strlen (line);
+  if (len && line[len - 1] == '\n')
+    line[len - 1] = '\0';
+}
+
+static char *
+shard_file (const char *name, int shard)
+{
+  return aprintf ("%s/%s-%d", opt.shard_dir, name, shard + 1);
+}
+
+/* Return the shard that owns HOST.  The hash does not depend on the
+   machine, so that all shards agree.  */
+
+static int
+shard_of_host (const char *host)
+{
+  unsigned int h = 0;
+  const char *p;
+
+  for (p = host; *p; p++)
+    h = (h * 31 + c_tolower (*p)) & 0xffffffff;
+  return h % opt.shard_count;
+}
+
+/* Return true if the URL U is retrieved by another shard.  */
+
+bool
+shard_foreign_p (const struct url *u)
+{
+  return opt.shard_count > 1 && shard_of_host (u->host) != opt.shard_index;
+}
+
+/* Record the state of this shard, IDLE being true if it has no work
+   left.  */
+
+static void
+write_state (bool idle)
+{
+  char *file = shard_file ("state", opt.shard_index);
+  char *tmp = aprintf ("%s.tmp", file);
+  FILE *fp = fopen (tmp, "w");
+
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", tmp, strerror (errno));
+      exit (1);
+    }
+  fprintf (fp, "%d %d %ld %ld\n", shard_round, idle, shard_sent,
+           shard_received);
+  if (fclose (fp) != 0 || rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      exit (1);
+    }
+  xfree (tmp);
+  xfree (file);
+}
+
+/* Begin a retrieve_tree call.  The first call sets up the shard
+   directory.  */
+
+void
+shard_begin (void)
+{
+  if (!outboxes)
+    {
+      char *file = shard_file ("state", opt.shard_index);
+      char *inbox = shard_file ("inbox", opt.shard_index);
+
+      if (file_exists_p (file))
+        {
+          logprintf (LOG_NOTQUIET, _("\
+%s already exists; use a new shard directory for every retrieval.\n"),
+                     file);
+          exit (1);
+        }
+      if ((mkdir (opt.shard_dir, 0777) < 0 && errno != EEXIST)
+          || (mkdir (inbox, 0777) < 0 && errno != EEXIST))
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", inbox, strerror (errno));
+          exit (1);
+        }
+      xfree (inbox);
+      xfree (file);
+      outboxes = xnew0_array (struct shard_outbox, opt.shard_count);
+    }
+
+  ++shard_round;
+  last_sent_sum = last_received_sum = -1;
+  write_state (false);
+}
+
+/* Write the links waiting to be forwarded to SHARD.  */
+
+static void
+flush_outbox (int shard)
+{
+  struct shard_outbox *box = &outboxes[shard];
+  char *inbox, *tmp, *file;
+  FILE *fp;
+
+  if (!box->count)
+    return;
+
+  inbox = shard_file ("inbox", shard);
+  if (mkdir (inbox, 0777) < 0 && errno != EEXIST)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", inbox, strerror (errno));
+      exit (1);
+    }
+  ++shard_batches;
+  tmp = aprintf ("%s/.%d-%ld", inbox, opt.shard_index + 1, shard_batches);
+  file = aprintf ("%s/%d-%ld", inbox, opt.shard_index + 1, shard_batches);
+  fp = fopen (tmp, "w");
+  if (!fp
+      || fwrite (box->data, 1, box->len, fp) != box->len
+      || fclose (fp) != 0
+      || rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      exit (1);
+    }
+  DEBUGP (("Forwarded %d links to shard %d.\n", box->count, shard + 1));
+
+  shard_sent += box->count;
+  box->len = 0;
+  box->count = 0;
+  xfree (tmp);
+  xfree (file);
+  xfree (inbox);
+}
+
+/* Forward the link to URL found in REFERER, at DEPTH, to the shard
+   that owns its host.  */
+
+void
+shard_forward (const struct url *u, const char *referer, int depth,
+               bool html_allowed, bool css_allowed)
+{
+  int shard = shard_of_host (u->host);
+  struct shard_outbox *box = &outboxes[shard];
+  char *line = aprintf ("%d %d %d %s %s\n", depth, html_allowed, css_allowed,
+                        u->url, referer ? referer : "-");
+  size_t len = strlen (line);
+
+  if (box->len + len > box->size)
+    {
+      box->size = box->size * 2 > box->len + len
+                  ? box->size * 2 : box->len + len;
+      box->data = xrealloc (box->data, box->size);
+    }
+  memcpy (box->data + box->len, line, len);
+  box->len += len;
+  xfree (line);
+
+  if (++box->count >= SHARD_BATCH)
+    flush_outbox (shard);
+}
+
+/* Read the batches of links forwarded to this shard.  */
+
+static struct shard_link *
+read_inbox (void)
+{
+  char *inbox = shard_file ("inbox", opt.shard_index);
+  struct shard_link *links = NULL, *tail = NULL;
+  struct dirent *ent;
+  DIR *dir;
+
+  dir = opendir (inbox);
+  if (!dir)
+    {
+      xfree (inbox);
+      return NULL;
+    }
+  while ((ent = readdir (dir)) != NULL)
+    {
+      char *file, *line;
+      FILE *fp;
+
+      if (ent->d_name[0] == '.')
+        continue;
+      file = aprintf ("%s/%s", inbox, ent->d_name);
+      fp = fopen (file, "r");
+      if (!fp)
+        {
+          xfree (file);
+          continue;
+        }
+      while ((line = read_whole_line (fp)) != NULL)
+        {
+          char *url, *referer;
+          int depth, html_allowed, css_allowed, pos = 0;
+          struct shard_link *link;
+
+          ++shard_received;
+          chomp (line);
+          if (sscanf (line, "%d %d %d %n", &depth, &html_allowed,
+                      &css_allowed, &pos) != 3 || !pos
+              || !(referer = strchr (line + pos, ' ')))
+            {
+              xfree (line);
+              continue;
+            }
+          url = line + pos;
+          *referer++ = '\0';
+          link = xnew0 (struct shard_link);
+          link->url = xstrdup (url);
+          link->referer = strcmp (referer, "-") ? xstrdup (referer) : NULL;
+          link->depth = depth;
+          link->html_allowed = html_allowed;
+          link->css_allowed = css_allowed;
+          if (tail)
+            tail->next = link;
+          else
+            links = link;
+          tail = link;
+          xfree (line);
+        }
+      fclose (fp);
+      unlink (file);
+      xfree (file);
+    }
+  closedir (dir);
+  xfree (inbox);
+  return links;
+}
+
+/* Return true if every shard has finished the current retrieve_tree
+   call.  */
+
+static bool
+all_shards_done (void)
+{
+  long sent_sum = 0, received_sum = 0;
+  bool done = true;
+  int i;
+
+  for (i = 0; i < opt.shard_count; i++)
+    {
+      char *file = shard_file ("state", i);
+      FILE *fp = fopen (file, "r");
+      int round = 0, idle = 0;
+      long sent = 0, received = 0;
+
+      xfree (file);
+      if (!fp)
+        return false;
+      if (fscanf (fp, "%d %d %ld %ld", &round, &idle, &sent, &received) != 4)
+        done = false;
+      fclose (fp);
+
+      /* A shard that has moved on to the next call is done with this
+         one.  */
+      if (round < shard_round || (round == shard_round && !idle))
+        done = false;
+      sent_sum += sent;
+      received_sum += received;
+    }
+
+  if (!done || sent_sum != received_sum)
+    {
+      last_sent_sum = last_received_sum = -1;
+      return false;
+    }
+  if (sent_sum != last_sent_sum || received_sum != last_received_sum)
+    {
+      /* Look once more, in case a shard has been busy in between.  */
+      last_sent_sum = sent_sum;
+      last_received_sum = received_sum;
+      return false;
+    }
+  return true;
+}
+
+/* Return the links forwarded to this shard, waiting for them if there
+   are none.  Returns NULL when all shards have run out of work.  */
+
+struct shard_link *
+shard_receive (void)
+{
+  int i;
+
+  for (i = 0; i < opt.shard_count; i++)
+    flush_outbox (i);
+
+  /* Don't hold on to a server while waiting.  */
+  http_close_persistent ();
+
+  while (true)
+    {
+      struct shard_link *links = read_inbox ();
+      if (links)
+        {
+          last_sent_sum = last_received_sum = -1;
+          write_state (false);
+          return links;
+        }
+      write_state (true);
+      if (all_shards_done ())
+        return NULL;
+      xsleep (SHARD_POLL_INTERVAL);
+    }
+}
+
+/* Free the list of links returned by shard_receive.  */
+
+void
+shard_free_links (struct shard_link *links)
+{
+  while (links)
+    {
+      struct shard_link *next = links->next;
+      xfree (links->url);
+      xfree_null (links->referer);
+      xfree (links);
+      links = next;
+    }
+}
+
+/* End a retrieve_tree call, possibly cut short, so that the other
+   shards do not wait for this one.  */
+
+void
+shard_end (void)
+{
+  int i;
+
+  for (i = 0; i < opt.shard_count; i++)
+    flush_outbox (i);
+  write_state (true);
+}
+
+/* Publish the URLs downloaded by this shard and the files they were
+   saved to, wait for the other shards to do the same, and register
+   the downloads of the other shards, so that -k converts the links to
+   them.  A shard that has not published its downloads within
+   SHARD_MAP_TIMEOUT seconds is reported and given up on.  */
+
+void
+shard_merge_maps (void)
+{
+  char *file = shard_file ("map", opt.shard_index);
+  char *tmp = aprintf ("%s.tmp", file);
+  FILE *fp = fopen (tmp, "w");
+  struct ptimer *timer;
+  int i;
+
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", tmp, strerror (errno));
+      return;
+    }
+  if (dl_url_file_map)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (dl_url_file_map, &iter);
+           hash_table_iter_next (&iter); )
+        fprintf (fp, "%s\t%s\n", (char *) iter.key, (char *) iter.value);
+    }
+  if (fclose (fp) != 0 || rename (tmp, file) != 0)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+  xfree (tmp);
+  xfree (file);
+
+  timer = ptimer_new ();
+  for (i = 0; i < opt.shard_count; i++)
+    {
+      char *line;
+
+      if (i == opt.shard_index)
+        continue;
+      file = shard_file ("map", i);
+      while (!(fp = fopen (file, "r"))
+             && ptimer_measure (timer) < SHARD_MAP_TIMEOUT)
+        xsleep (SHARD_POLL_INTERVAL);
+      if (!fp)
+        {
+          logprintf (LOG_NOTQUIET, _("\
+Shard %d did not publish its downloads in %s; links to them are not \
+converted.\n"), i + 1, quote (opt.shard_dir));
+          inform_exit_status (FOPENERR);
+          xfree (file);
+          continue;
+        }
+      while ((line = read_whole_line (fp)) != NULL)
+        {
+          char *tab;
+
+          chomp (line);
+          tab = strchr (line, '\t');
+          if (tab)
+            {
+              *tab = '\0';
+              register_download (line, tab + 1);
+            }
+          xfree (line);
+        }
+      fclose (fp);
+      xfree (file);
+    }
+  ptimer_destroy (timer);
+}
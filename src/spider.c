@@ -28,21 +28,108 @@ Corresponding Source for a non-source form of such a combination
 shall include the source code for the parts of OpenSSL used as well
 as that of the covered work.  */
 
+/* In spider mode, Wget checks the links instead of downloading them.
+   The broken links are listed at the end, along with the pages that
+   refer to them.
+
+   With --link-report, the outcome of every check is also written to
+   a file as soon as it is known, one record per URL, in JSON or CSV.
+   A link to an already checked URL found afterwards is written as a
+   record of its own, carrying only the URL and the new referrer.
+
+   With --spider-jobs=N, a recursive check hands the URLs to N worker
+   processes, so that N links are checked at once.  Each worker keeps
+   its persistent connection between URLs and is given the URLs of the
+   host it checked last whenever possible.  A worker sends the outcome
+   back to the main process, along with the page if it is to be
+   parsed; the main process parses the pages and enqueues their links
+   as usual.  Where fork is not available, links are checked one at a
+   time.  */
+
 #include "wget.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <signal.h>
+# include <sys/wait.h>
+# define USE_FORK
+#endif
 
 #include "spider.h"
 #include "url.h"
 #include "utils.h"
 #include "hash.h"
 #include "res.h"
+#include "retr.h"
+#include "http.h"
+#include "iri.h"
+#include "ptimer.h"
+#include "convert.h"
+#include "exits.h"
 
+extern int numurls;
 
 static struct hash_table *nonexisting_urls_set;
 
+/* What is known about a URL to be checked.  */
+struct link_info {
+  const char **referrers;       /* the pages linking to it, interned
+                                   in referrer_names */
+  int count, size;
+  bool checked;                 /* whether its check was reported */
+  bool broken;                  /* whether it was found broken */
+};
+
+/* The URLs enqueued for checking, mapped to their link_info.  */
+static struct hash_table *links;
+static struct hash_table *referrer_names;
+
+/* A check of a URL, which may include several requests.  */
+struct link_check {
+  char *url;
+  int statcode;                 /* status of the last response, or 0 */
+  bool head;                    /* whether it was a response to HEAD */
+  char **redirects;             /* the locations redirected to */
+  int redirect_count;
+  char *broken;                 /* the URL found broken, if any */
+  double started;               /* when the check started */
+  double time;                  /* how long it took */
+  uerr_t status;
+};
+
+/* The check being made by this process.  */
+static struct link_check *current_check;
+static struct ptimer *check_timer;
+
+/* The file the checks are reported to.  */
+static FILE *link_report;
+
+/* The servers that do not support HEAD, as "HOST:PORT".  */
+static struct hash_table *headless_hosts;
+
+#ifdef USE_FORK
+/* In a link checking process, the check it last finished.  */
+static struct link_check *finished_check;
+static bool worker_p;
+#endif
+
+static void
+check_free (struct link_check *check)
+{
+  int i;
+  for (i = 0; i < check->redirect_count; i++)
+    xfree (check->redirects[i]);
+  xfree_null (check->redirects);
+  xfree_null (check->broken);
+  xfree (check->url);
+  xfree (check);
+}
+
 /* Cleanup the data structures associated with this file.  */
 
 void
@@ -50,8 +137,26 @@ spider_cleanup (void)
 {
   if (nonexisting_urls_set)
     string_set_free (nonexisting_urls_set);
+  if (links)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (links, &iter); hash_table_iter_next (&iter); )
+        {
+          struct link_info *info = iter.value;
+          xfree (iter.key);
+          xfree_null (info->referrers);
+          xfree (info);
+        }
+      hash_table_destroy (links);
+    }
+  if (referrer_names)
+    string_set_free (referrer_names);
+  if (headless_hosts)
+    string_set_free (headless_hosts);
+  if (check_timer)
+    ptimer_destroy (check_timer);
 }
-
+
 /* Remembers broken links.  */
 void
 nonexisting_url (const char *url)
@@ -62,6 +167,8 @@ nonexisting_url (const char *url)
   if (!nonexisting_urls_set)
     nonexisting_urls_set = make_string_hash_table (0);
   string_set_add (nonexisting_urls_set, url);
+  if (current_check && !current_check->broken)
+    current_check->broken = xstrdup (url);
 }
 
 void
@@ -88,13 +195,811 @@ print_broken_links (void)
     {
       /* Struct url_list *list; */
       const char *url = (const char *) iter.key;
+      struct link_info *info = links ? hash_table_get (links, url) : NULL;
+      int i;
 
       logprintf (LOG_NOTQUIET, _("%s\n"), url);
+      for (i = 0; info && i < info->count; i++)
+        logprintf (LOG_NOTQUIET, _("    linked from %s\n"),
+                   info->referrers[i]);
     }
   logputs (LOG_NOTQUIET, "\n");
 }
 
+/* Open the file named by --link-report, exiting if that fails.  */
+
+void
+link_report_open (void)
+{
+  link_report = fopen (opt.link_report, "w");
+  if (!link_report)
+    {
+      perror (opt.link_report);
+      exit (1);
+    }
+  if (opt.link_report_format == link_report_csv)
+    fputs ("url,result,code,method,time_ms,redirects,referrers\n",
+           link_report);
+  fflush (link_report);
+}
+
+void
+link_report_close (void)
+{
+  if (link_report)
+    fclose (link_report);
+  link_report = NULL;
+}
+
+/* Write S to the report as a JSON string.  */
+
+static void
+report_json_string (const char *s)
+{
+  putc ('"', link_report);
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        fprintf (link_report, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (link_report, "\\u%04x", c);
+      else
+        putc (c, link_report);
+    }
+  putc ('"', link_report);
+}
+
+/* Write the N strings of LIST to the report, as a JSON array or as a
+   quoted CSV field holding them separated by spaces.  */
+
+static void
+report_list (const char *const *list, int n)
+{
+  int i;
+  const char *p;
+
+  if (opt.link_report_format == link_report_json)
+    {
+      putc ('[', link_report);
+      for (i = 0; i < n; i++)
+        {
+          if (i)
+            putc (',', link_report);
+          report_json_string (list[i]);
+        }
+      putc (']', link_report);
+      return;
+    }
+
+  putc ('"', link_report);
+  for (i = 0; i < n; i++)
+    {
+      if (i)
+        putc (' ', link_report);
+      for (p = list[i]; *p; p++)
+        {
+          if (*p == '"')
+            putc ('"', link_report);
+          putc (*p, link_report);
+        }
+    }
+  putc ('"', link_report);
+}
+
+/* Write the record of CHECK to the report, along with the pages known
+   to refer to the URL so far.  */
+
+static void
+report_check (struct link_check *check)
+{
+  struct link_info *info = links ? hash_table_get (links, check->url) : NULL;
+  const char *result, *method;
+  long msecs = (long) (check->time * 1000 + 0.5);
+
+  if (check->broken)
+    result = "broken";
+  else if (check->status == RETROK)
+    result = "ok";
+  else
+    result = "error";
+  method = !check->statcode ? "" : check->head ? "HEAD" : "GET";
+
+  if (link_report)
+    {
+      if (opt.link_report_format == link_report_json)
+        {
+          fputs ("{\"url\":", link_report);
+          report_json_string (check->url);
+          fprintf (link_report, ",\"result\":\"%s\",\"code\":", result);
+          if (check->statcode)
+            fprintf (link_report, "%d", check->statcode);
+          else
+            fputs ("null", link_report);
+          fprintf (link_report, ",\"method\":\"%s\",\"time_ms\":%ld",
+                   method, msecs);
+          fputs (",\"redirects\":", link_report);
+        }
+      else
+        {
+          report_list ((const char *const *) &check->url, 1);
+          fprintf (link_report, ",%s,", result);
+          if (check->statcode)
+            fprintf (link_report, "%d", check->statcode);
+          fprintf (link_report, ",%s,%ld,", method, msecs);
+        }
+      report_list ((const char *const *) check->redirects,
+                   check->redirect_count);
+      fputs (opt.link_report_format == link_report_json
+             ? ",\"referrers\":" : ",", link_report);
+      report_list (info ? info->referrers : NULL, info ? info->count : 0);
+      fputs (opt.link_report_format == link_report_json ? "}\n" : "\n",
+             link_report);
+      fflush (link_report);
+    }
+
+  if (info)
+    {
+      info->checked = true;
+      info->broken = check->broken != NULL;
+      /* Only the referrers of broken links are listed at the end.  */
+      if (!info->broken)
+        {
+          xfree_null (info->referrers);
+          info->referrers = NULL;
+          info->count = info->size = 0;
+        }
+    }
+}
+
+/* Write a record of the link from REFERRER to the already checked
+   URL.  */
+
+static void
+report_referrer (const char *url, const char *referrer)
+{
+  if (!link_report)
+    return;
+  if (opt.link_report_format == link_report_json)
+    {
+      fputs ("{\"url\":", link_report);
+      report_json_string (url);
+      fputs (",\"referrer\":", link_report);
+      report_json_string (referrer);
+      fputs ("}\n", link_report);
+    }
+  else
+    {
+      report_list (&url, 1);
+      fputs (",,,,,,", link_report);
+      report_list (&referrer, 1);
+      putc ('\n', link_report);
+    }
+  fflush (link_report);
+}
+
+/* Note that the page REFERRER, which may be NULL, links to URL.
+   ENQUEUED tells whether URL has just been enqueued for checking;
+   links to other URLs are only noted if those are enqueued too.  */
+
+void
+spider_note_link (const char *url, const char *referrer, bool enqueued)
+{
+  struct link_info *info;
+  const char *name;
+
+  if (!opt.spider)
+    return;
+  if (!links)
+    links = make_string_hash_table (0);
+  info = hash_table_get (links, url);
+  if (!info)
+    {
+      if (!enqueued)
+        return;
+      info = xnew0 (struct link_info);
+      hash_table_put (links, xstrdup (url), info);
+    }
+  if (!referrer)
+    return;
+
+  if (!referrer_names)
+    referrer_names = make_string_hash_table (0);
+  string_set_add (referrer_names, referrer);
+  hash_table_get_pair (referrer_names, referrer, &name, NULL);
+  /* A page linking to URL several times is noted once.  */
+  if (info->count && info->referrers[info->count - 1] == name)
+    return;
+
+  if (info->checked)
+    {
+      report_referrer (url, name);
+      if (!info->broken)
+        return;
+    }
+  DO_REALLOC (info->referrers, info->size, info->count + 1, const char *);
+  info->referrers[info->count++] = name;
+}
+
+/* Start keeping track of the check of URL.  */
+
+void
+spider_check_start (const char *url)
+{
+  if (current_check || is_robots_txt_url (url))
+    return;
+  if (!check_timer)
+    check_timer = ptimer_new ();
+  current_check = xnew0 (struct link_check);
+  current_check->url = xstrdup (url);
+  current_check->started = ptimer_measure (check_timer);
+}
+
+/* Note that the server answered the current check with STATCODE.
+   HEAD tells whether the request was HEAD rather than GET.  */
+
+void
+spider_check_response (int statcode, bool head)
+{
+  if (!current_check || !statcode)
+    return;
+  current_check->statcode = statcode;
+  current_check->head = head;
+}
+
+/* Note that the current check was redirected to URL.  */
+
+void
+spider_check_redirect (const char *url)
+{
+  struct link_check *check = current_check;
+  if (!check)
+    return;
+  check->redirects = xrealloc (check->redirects, (check->redirect_count + 1)
+                               * sizeof (char *));
+  check->redirects[check->redirect_count++] = xstrdup (url);
+}
+
+/* Finish the check of URL, which ended with STATUS, and report it.  */
+
+void
+spider_check_finish (const char *url, uerr_t status)
+{
+  struct link_check *check = current_check;
+
+  if (!check || strcmp (check->url, url))
+    return;
+  current_check = NULL;
+  check->time = ptimer_measure (check_timer) - check->started;
+  check->status = status;
+#ifdef USE_FORK
+  if (worker_p)
+    {
+      /* worker_run sends it to the main process.  */
+      if (finished_check)
+        check_free (finished_check);
+      finished_check = check;
+      return;
+    }
+#endif
+  report_check (check);
+  check_free (check);
+}
+
+static char *
+host_key (const struct url *u)
+{
+  return aprintf ("%s:%d", u->host, u->port);
+}
+
+static void
+add_headless_host (const char *key)
+{
+  if (!headless_hosts)
+    headless_hosts = make_string_hash_table (0);
+  string_set_add (headless_hosts, key);
+}
+
+/* Note that the server of U failed a HEAD request, so that its links
+   are to be checked with GET.  */
+
+void
+spider_head_unsupported (const struct url *u)
+{
+  char *key = host_key (u);
+  if (!headless_hosts || !string_set_contains (headless_hosts, key))
+    logprintf (LOG_VERBOSE, _("\
+%s does not support HEAD; checking its links with GET.\n"),
+               quotearg_style (escape_quoting_style, u->host));
+  add_headless_host (key);
+  xfree (key);
+}
+
+/* Whether links on the server of U may be checked with HEAD.  */
+
+bool
+spider_head_supported_p (const struct url *u)
+{
+  char *key;
+  bool supported;
+
+  if (!headless_hosts)
+    return true;
+  key = host_key (u);
+  supported = !string_set_contains (headless_hosts, key);
+  xfree (key);
+  return supported;
+}
+
+#ifdef USE_FORK
+
+/* A process checking links for the main process.  */
+struct spider_worker {
+  pid_t pid;
+  FILE *jobs;                   /* where it reads the URLs from */
+  FILE *results;                /* where it writes the outcome to */
+  char *host;                   /* host and port of its last URL */
+  char *url;                    /* the URL being checked, or NULL */
+  void *data;                   /* the caller's data for that URL */
+};
+
+struct spider_pool {
+  struct spider_worker *workers;
+  int count;
+};
+
+/* Read a line from FP and strip the newline.  Returns NULL at the end
+   of the input.  */
+
+static char *
+read_field (FILE *fp)
+{
+  char *line = read_whole_line (fp);
+  if (line)
+    {
+      size_t len = strlen (line);
+      if (len && line[len - 1] == '\n')
+        line[len - 1] = '\0';
+    }
+  return line;
+}
+
+/* Check the URLs read from JOBS, writing the outcomes to RESULTS.
+
+   A job consists of the lines URL, referrer, URI encoding, content
+   encoding and flags: `u' if the URL is encoded in UTF-8, `g' if the
+   server does not support HEAD.  The outcome is a line of numbers
+   (status, document type, whether the server supports HEAD, number of
+   files and bytes retrieved, status code, whether it answered HEAD,
+   time in microseconds, number of redirections and length of the page
+   or -1) followed by the lines local file, new location and broken
+   URL, the redirections, and the page, if any.  Empty lines stand for
+   missing values.  */
+
+static void
+worker_run (FILE *jobs, FILE *results)
+{
+  char *url;
+
+  worker_p = true;
+  while ((url = read_field (jobs)) != NULL)
+    {
+      char *referer = read_field (jobs);
+      char *uri_encoding = read_field (jobs);
+      char *content_encoding = read_field (jobs);
+      char *flags = read_field (jobs);
+      struct iri *i;
+      struct url *u;
+      struct link_check *check;
+      struct file_memory *fm = NULL;
+      char *file = NULL, *redirected = NULL;
+      int dt = 0, url_err, files = numurls, n;
+      SUM_SIZE_INT bytes = total_downloaded_bytes;
+      uerr_t status = URLERROR;
+      bool headless = false;
+
+      if (!flags)
+        break;
+
+      i = iri_new ();
+      set_uri_encoding (i, *uri_encoding ? uri_encoding : NULL, true);
+      set_content_encoding (i, *content_encoding ? content_encoding : NULL);
+      i->utf8_encode = strchr (flags, 'u') != NULL;
+      u = url_parse (url, &url_err, i, true);
+      if (u)
+        {
+          char *key = host_key (u);
+          if (strchr (flags, 'g'))
+            add_headless_host (key);
+          xfree (key);
+          status = retrieve_url (u, url, &file, &redirected,
+                                 *referer ? referer : NULL, &dt, false, i,
+                                 false);
+          headless = !spider_head_supported_p (u);
+          url_free (u);
+        }
+      iri_free (i);
+
+      check = finished_check;
+      finished_check = NULL;
+      if (file && memory_file_p (file))
+        {
+          fm = wget_read_file (file);
+          memory_file_forget (file);
+        }
+
+      fprintf (results, "%d %d %d %d %s %d %d %ld %d %s\n",
+               (int) status, dt, headless, numurls - files,
+               number_to_static_string (total_downloaded_bytes - bytes),
+               check ? check->statcode : 0, check ? check->head : 0,
+               check ? (long) (check->time * 1000000) : 0L,
+               check ? check->redirect_count : 0,
+               number_to_static_string (fm ? fm->length : -1));
+      fprintf (results, "%s\n%s\n%s\n", file ? file : "",
+               redirected ? redirected : "",
+               check && check->broken ? check->broken : "");
+      for (n = 0; check && n < check->redirect_count; n++)
+        fprintf (results, "%s\n", check->redirects[n]);
+      if (fm)
+        {
+          fwrite (fm->content, 1, fm->length, results);
+          wget_read_file_free (fm);
+        }
+      fflush (results);
+      logflush ();
+
+      if (check)
+        check_free (check);
+      xfree_null (file);
+      xfree_null (redirected);
+      xfree (url);
+      xfree (referer);
+      xfree_null (uri_encoding);
+      xfree_null (content_encoding);
+      xfree (flags);
+    }
+}
+
+/* Read the outcome of the check worker W was busy with into RESULT,
+   and account for it as retrieve_url would have.  Returns false if the
+   worker is gone.  */
+
+static bool
+worker_read_result (struct spider_worker *w, struct spider_result *result)
+{
+  char *line = read_field (w->results);
+  struct link_check *check;
+  int status, headless, files, head, n;
+  long usecs;
+  char bytes[32], length[32];
+  wgint body_length;
+
+  xzero (*result);
+  if (!line)
+    return false;
+  check = xnew0 (struct link_check);
+  n = sscanf (line, "%d %d %d %d %31s %d %d %ld %d %31s", &status,
+              &result->dt, &headless, &files, bytes, &check->statcode,
+              &head, &usecs, &check->redirect_count, length);
+  xfree (line);
+  if (n != 10)
+    {
+      xfree (check);
+      return false;
+    }
+  result->status = status;
+  check->url = xstrdup (w->url);
+  check->head = head;
+  check->time = usecs / 1000000.0;
+  check->status = status;
+
+  result->file = read_field (w->results);
+  result->redirected = read_field (w->results);
+  check->broken = read_field (w->results);
+  check->redirects = xnew_array (char *, check->redirect_count + 1);
+  for (n = 0; n < check->redirect_count; n++)
+    if (!(check->redirects[n] = read_field (w->results)))
+      break;
+  check->redirect_count = n;
+
+#define EMPTY_TO_NULL(s) do {                   \
+  if ((s) && !*(s))                             \
+    {                                           \
+      xfree (s);                                \
+      (s) = NULL;                               \
+    }                                           \
+} while (0)
+  EMPTY_TO_NULL (result->file);
+  EMPTY_TO_NULL (result->redirected);
+  EMPTY_TO_NULL (check->broken);
+#undef EMPTY_TO_NULL
+
+  body_length = str_to_wgint (length, NULL, 10);
+  if (body_length >= 0)
+    {
+      char *body = xmalloc (body_length + 1);
+      if (fread (body, 1, body_length, w->results) != (size_t) body_length)
+        {
+          xfree (body);
+          xfree_null (result->file);
+          xfree_null (result->redirected);
+          xzero (*result);
+          check_free (check);
+          return false;
+        }
+      if (result->file)
+        memory_file_store (result->file, body, body_length);
+      else
+        xfree (body);
+    }
+
+  numurls += files;
+  total_downloaded_bytes += str_to_wgint (bytes, NULL, 10);
+  if (headless)
+    add_headless_host (w->host);
+  if (check->broken)
+    nonexisting_url (check->broken);
+  report_check (check);
+  check_free (check);
+
+  if (result->file && (result->dt & RETROKF))
+    {
+      register_download (result->redirected ? result->redirected : w->url,
+                         result->file);
+      if (result->dt & TEXTHTML)
+        register_html (result->file);
+      if (result->dt & TEXTCSS)
+        register_css (result->file);
+    }
+  inform_exit_status (result->status);
+  return true;
+}
+
+/* Stop worker I of POOL and remove it.  */
+
+static void
+worker_remove (struct spider_pool *pool, int i)
+{
+  struct spider_worker *w = &pool->workers[i];
+
+  if (w->url)
+    kill (w->pid, SIGTERM);
+  fclose (w->jobs);
+  fclose (w->results);
+  waitpid (w->pid, NULL, 0);
+  xfree_null (w->host);
+  xfree_null (w->url);
+  pool->workers[i] = pool->workers[--pool->count];
+}
+
+#endif /* USE_FORK */
+
+/* Start COUNT link checking processes.  Returns NULL if none could be
+   started, in which case the links are to be checked by this
+   process.  */
+
+struct spider_pool *
+spider_pool_new (int count)
+{
+#ifdef USE_FORK
+  struct spider_pool *pool = xnew0 (struct spider_pool);
+
+  /* The workers must not share the persistent connection, nor write
+     out what is buffered here.  */
+  http_close_persistent ();
+  logflush ();
+  if (link_report)
+    fflush (link_report);
+
+  pool->workers = xnew_array (struct spider_worker, count);
+  while (pool->count < count)
+    {
+      struct spider_worker *w = &pool->workers[pool->count];
+      int to_worker[2], from_worker[2];
+      pid_t pid;
+
+      if (pipe (to_worker) < 0)
+        break;
+      if (pipe (from_worker) < 0)
+        {
+          close (to_worker[0]);
+          close (to_worker[1]);
+          break;
+        }
+      pid = fork ();
+      if (pid == 0)
+        {
+          int i;
+          for (i = 0; i < pool->count; i++)
+            {
+              close (fileno (pool->workers[i].jobs));
+              close (fileno (pool->workers[i].results));
+            }
+          close (to_worker[1]);
+          close (from_worker[0]);
+          rate_limit_share (count);
+          worker_run (fdopen (to_worker[0], "r"), fdopen (from_worker[1], "w"));
+          logflush ();
+          _exit (0);
+        }
+      close (to_worker[0]);
+      close (from_worker[1]);
+      if (pid < 0)
+        {
+          DEBUGP (("fork: %s\n", strerror (errno)));
+          close (to_worker[1]);
+          close (from_worker[0]);
+          break;
+        }
+      xzero (*w);
+      w->pid = pid;
+      w->jobs = fdopen (to_worker[1], "w");
+      w->results = fdopen (from_worker[0], "r");
+      ++pool->count;
+    }
+
+  if (!pool->count)
+    {
+      xfree (pool->workers);
+      xfree (pool);
+      return NULL;
+    }
+  DEBUGP (("Started %d link checking processes.\n", pool->count));
+  return pool;
+#else
+  return NULL;
+#endif
+}
+
+/* Whether a process of POOL is ready to check a URL.  */
+
+bool
+spider_pool_idle_p (const struct spider_pool *pool)
+{
+#ifdef USE_FORK
+  int i;
+  for (i = 0; i < pool->count; i++)
+    if (!pool->workers[i].url)
+      return true;
+#endif
+  return false;
+}
+
+/* Have an idle process of POOL check URL, found on the page REFERER,
+   preferably one that checked a URL on the same server last.  DATA is
+   returned by spider_pool_wait along with the outcome.  Returns false
+   if no process could take the URL.  */
+
+bool
+spider_pool_submit (struct spider_pool *pool, const char *url,
+                    const char *referer, const struct iri *iri, void *data)
+{
+#ifdef USE_FORK
+  struct spider_worker *w = NULL;
+  struct url *u = url_parse (url, NULL, NULL, false);
+  char *key;
+  int i;
+
+  if (!u)
+    return false;
+  key = host_key (u);
+  for (i = 0; i < pool->count; i++)
+    {
+      struct spider_worker *idle = &pool->workers[i];
+      if (idle->url)
+        continue;
+      if (!w)
+        w = idle;
+      if (idle->host && 0 == strcmp (idle->host, key))
+        {
+          w = idle;
+          break;
+        }
+    }
+  if (!w)
+    {
+      url_free (u);
+      xfree (key);
+      return false;
+    }
+
+  fprintf (w->jobs, "%s\n%s\n%s\n%s\n%s%s\n", url, referer ? referer : "",
+           iri->uri_encoding ? iri->uri_encoding : "",
+           iri->content_encoding ? iri->content_encoding : "",
+           iri->utf8_encode ? "u" : "",
+           spider_head_supported_p (u) ? "" : "g");
+  url_free (u);
+  if (fflush (w->jobs) == EOF)
+    {
+      logprintf (LOG_NOTQUIET, _("Link checking process %d is gone.\n"),
+                 (int) w->pid);
+      xfree (key);
+      worker_remove (pool, w - pool->workers);
+      return false;
+    }
+  xfree_null (w->host);
+  w->host = key;
+  w->url = xstrdup (url);
+  w->data = data;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Wait for a process of POOL to finish its check, and store the
+   outcome to RESULT.  Returns the data given to spider_pool_submit
+   along with the URL, or NULL if no URL is being checked.  */
+
+void *
+spider_pool_wait (struct spider_pool *pool, struct spider_result *result)
+{
+#ifdef USE_FORK
+  while (true)
+    {
+      fd_set fds;
+      int i, maxfd = -1;
+
+      FD_ZERO (&fds);
+      for (i = 0; i < pool->count; i++)
+        if (pool->workers[i].url)
+          {
+            int fd = fileno (pool->workers[i].results);
+            FD_SET (fd, &fds);
+            if (fd > maxfd)
+              maxfd = fd;
+          }
+      if (maxfd < 0)
+        return NULL;
+      if (select (maxfd + 1, &fds, NULL, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          logprintf (LOG_NOTQUIET, "select: %s\n", strerror (errno));
+          return NULL;
+        }
+
+      for (i = 0; i < pool->count; i++)
+        {
+          struct spider_worker *w = &pool->workers[i];
+          void *data = w->data;
+
+          if (!w->url || !FD_ISSET (fileno (w->results), &fds))
+            continue;
+          if (!worker_read_result (w, result))
+            {
+              logprintf (LOG_NOTQUIET,
+                         _("Link checking process %d is gone.\n"),
+                         (int) w->pid);
+              result->status = READERR;
+              inform_exit_status (result->status);
+              worker_remove (pool, i);
+              return data;
+            }
+          xfree (w->url);
+          w->url = NULL;
+          w->data = NULL;
+          return data;
+        }
+    }
+#else
+  return NULL;
+#endif
+}
+
+/* Stop the processes of POOL.  */
+
+void
+spider_pool_delete (struct spider_pool *pool)
+{
+#ifdef USE_FORK
+  while (pool->count)
+    worker_remove (pool, pool->count - 1);
+  xfree (pool->workers);
+  xfree (pool);
+#endif
+}
+
 /*
  * vim: et ts=2 sw=2
  */
-
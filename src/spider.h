@@ -31,8 +31,39 @@ as that of the covered work.  */
 #ifndef SPIDER_H
 #define SPIDER_H
 
+struct url;
+struct iri;
+struct spider_pool;
+
+/* The outcome of a check made by a link checking process, as
+   retrieve_url would have stored it.  */
+struct spider_result {
+  uerr_t status;
+  int dt;
+  char *file;
+  char *redirected;
+};
+
 #define visited_url(a,b)
 void nonexisting_url (const char *);
 void print_broken_links (void);
 
+void link_report_open (void);
+void link_report_close (void);
+void spider_note_link (const char *, const char *, bool);
+void spider_check_start (const char *);
+void spider_check_response (int, bool);
+void spider_check_redirect (const char *);
+void spider_check_finish (const char *, uerr_t);
+
+void spider_head_unsupported (const struct url *);
+bool spider_head_supported_p (const struct url *);
+
+struct spider_pool *spider_pool_new (int);
+bool spider_pool_idle_p (const struct spider_pool *);
+bool spider_pool_submit (struct spider_pool *, const char *, const char *,
+                         const struct iri *, void *);
+void *spider_pool_wait (struct spider_pool *, struct spider_result *);
+void spider_pool_delete (struct spider_pool *);
+
 #endif /* SPIDER_H */
@@ -41,9 +41,15 @@ const char *test_subdir_p();
 const char *test_dir_matches_p();
 const char *test_commands_sorted();
 const char *test_cmd_spec_restrict_file_names();
+const char *test_cmd_spec_bind_address();
+const char *test_parse_rate_limit();
+const char *test_choose_bind_source();
+const char *test_receive_buffer();
+const char *test_address_list_order();
 const char *test_path_simplify ();
 const char *test_append_uri_pathel();
 const char *test_are_urls_equal();
+const char *test_url_canonicalize();
 const char *test_is_robots_txt_url();
 
 const char *program_argstring = "TEST";
@@ -58,9 +64,15 @@ all_tests()
   mu_run_test (test_dir_matches_p);
   mu_run_test (test_commands_sorted);
   mu_run_test (test_cmd_spec_restrict_file_names);
+  mu_run_test (test_cmd_spec_bind_address);
+  mu_run_test (test_parse_rate_limit);
+  mu_run_test (test_choose_bind_source);
+  mu_run_test (test_receive_buffer);
+  mu_run_test (test_address_list_order);
   mu_run_test (test_path_simplify);
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
+  mu_run_test (test_url_canonicalize);
   mu_run_test (test_is_robots_txt_url);
 
   return NULL;
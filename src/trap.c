@@ -0,0 +1,404 @@
+/* Detection of crawler traps during recursive retrieval.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "url.h"
+#include "hash.h"
+#include "trap.h"
+
+/* The URLs already counted against each directory budget and each
+   query pattern budget, keyed by the directory or pattern.  */
+static struct hash_table *dir_counts;
+static struct hash_table *query_counts;
+
+/* Log that U is not retrieved, and why.  */
+
+static void
+trap_reject (const struct url *u, const char *reason)
+{
+  logprintf (LOG_VERBOSE, _("Rejecting %s: %s.\n"),
+             quote (u->url), reason);
+}
+
+/* Return the number of URLs counted under KEY in TABLE.  */
+
+static int
+budget_used (struct hash_table *table, const char *key)
+{
+  return table ? (intptr_t) hash_table_get (table, key) : 0;
+}
+
+/* Count one more URL under KEY in *TABLE.  */
+
+static void
+budget_take (struct hash_table **table, const char *key)
+{
+  char *orig_key;
+  void *count;
+
+  if (!*table)
+    *table = make_string_hash_table (0);
+  if (!hash_table_get_pair (*table, key, &orig_key, &count))
+    {
+      orig_key = xstrdup (key);
+      count = NULL;
+    }
+  hash_table_put (*table, orig_key, (void *) ((intptr_t) count + 1));
+}
+
+static int
+name_cmp (const void *a, const void *b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Return the query pattern of U: its host, port and path, followed by
+   the sorted names of its query parameters.  Links to a calendar or a
+   faceted search share the pattern while their values vary without
+   end.  */
+
+static char *
+query_pattern (const struct url *u)
+{
+  char *copy = xstrdup (u->query);
+  char **names = xnew_array (char *, strlen (copy) + 1);
+  char *p = copy, *pattern, *q;
+  int count = 0, i;
+
+  for (;;)
+    {
+      char *end = strchr (p, '&');
+      char *eq;
+      if (end)
+        *end = '\0';
+      eq = strchr (p, '=');
+      if (eq)
+        *eq = '\0';
+      if (*p)
+        names[count++] = p;
+      if (!end)
+        break;
+      p = end + 1;
+    }
+  qsort (names, count, sizeof (char *), name_cmp);
+
+  q = pattern = xmalloc (strlen (u->host) + numdigit (u->port)
+                         + strlen (u->path) + strlen (u->query) + 4);
+  q += sprintf (q, "%s:%d/%s?", u->host, u->port, u->path);
+  for (i = 0; i < count; i++)
+    q += sprintf (q, i ? "&%s" : "%s", names[i]);
+
+  xfree (names);
+  xfree (copy);
+  return pattern;
+}
+
+/* Check U against the crawler trap limits: the number of times a
+   directory name may repeat in its path, the depth of the path, the
+   length of the URL, and the number of URLs per directory and per
+   query pattern.  Returns true and counts U against the budgets if it
+   passes; otherwise logs the reason and returns false.  */
+
+bool
+trap_check (const struct url *u)
+{
+  char *reason = NULL, *pattern = NULL, *dir_key = NULL;
+  bool ok = true;
+
+  if (opt.max_url_length && strlen (u->url) > opt.max_url_length)
+    reason = aprintf (_("URL is longer than %d characters"),
+                      opt.max_url_length);
+
+  if (!reason && (opt.max_path_depth || opt.max_segment_repeat))
+    {
+      /* The directories of the path, as [begin, end) pairs.  */
+      const char *dir = u->dir;
+      int nsegs = 0, i, j;
+      const char **segs = xnew_array (const char *, 2 * (strlen (dir) + 1));
+
+      while (*dir)
+        {
+          const char *end = strchr (dir, '/');
+          if (!end)
+            end = dir + strlen (dir);
+          segs[2 * nsegs] = dir;
+          segs[2 * nsegs + 1] = end;
+          ++nsegs;
+          dir = *end ? end + 1 : end;
+        }
+
+      if (opt.max_path_depth && nsegs > opt.max_path_depth)
+        reason = aprintf (_("path is deeper than %d directories"),
+                          opt.max_path_depth);
+
+      for (i = 0; !reason && opt.max_segment_repeat && i < nsegs; i++)
+        {
+          int len = segs[2 * i + 1] - segs[2 * i];
+          int seen = 1;
+          for (j = i + 1; j < nsegs; j++)
+            if (segs[2 * j + 1] - segs[2 * j] == len
+                && 0 == memcmp (segs[2 * i], segs[2 * j], len))
+              ++seen;
+          if (seen > opt.max_segment_repeat)
+            {
+              char *name;
+              BOUNDED_TO_ALLOCA (segs[2 * i], segs[2 * i + 1], name);
+              reason = aprintf (_("directory %s occurs %d times in the path"),
+                                quote (name), seen);
+            }
+        }
+      xfree (segs);
+    }
+
+  if (reason)
+    {
+      trap_reject (u, reason);
+      xfree (reason);
+      return false;
+    }
+
+  /* The budgets come last, so that only the URLs that pass every
+     other check are counted.  */
+  if (opt.query_budget && u->query)
+    {
+      pattern = query_pattern (u);
+      if (budget_used (query_counts, pattern) >= opt.query_budget)
+        reason = aprintf (_("more than %d URLs match %s"),
+                          opt.query_budget, quote (pattern));
+    }
+  if (!reason && opt.dir_budget)
+    {
+      dir_key = aprintf ("%s:%d/%s", u->host, u->port, u->dir);
+      if (budget_used (dir_counts, dir_key) >= opt.dir_budget)
+        reason = aprintf (_("more than %d URLs in directory %s"),
+                          opt.dir_budget, quote (dir_key));
+    }
+
+  if (reason)
+    {
+      trap_reject (u, reason);
+      xfree (reason);
+      ok = false;
+    }
+  else
+    {
+      if (pattern)
+        budget_take (&query_counts, pattern);
+      if (dir_key)
+        budget_take (&dir_counts, dir_key);
+    }
+  xfree_null (pattern);
+  xfree_null (dir_key);
+  return ok;
+}
+
+/* A page whose fingerprint differs from that of an earlier one in no
+   more than this many bits is considered the same page.  */
+#define SIMILAR_BITS 3
+
+/* Pages with fewer words than this are not fingerprinted, as there is
+   too little text to tell them apart.  */
+#define MIN_WORDS 16
+
+/* The fingerprints are indexed by each of their 16-bit quarters.  Two
+   fingerprints within SIMILAR_BITS of each other share at least one
+   quarter, so only those filed under one of a page's quarters need be
+   compared with it.  */
+#define BANDS 4
+#define BAND_BITS 16
+
+#if SIMILAR_BITS >= BANDS
+# error "SIMILAR_BITS must be less than BANDS"
+#endif
+
+struct fingerprint {
+  uint64_t hash;
+  char *url;
+  int next[BANDS];              /* the previous fingerprint filed under
+                                   the same quarter, plus one, or 0 */
+};
+
+static struct fingerprint *fingerprints;
+static int fingerprint_count, fingerprint_size;
+
+/* Mapping between the band number and value of a quarter of the
+   fingerprints, and the last fingerprint with that quarter, as its
+   index plus one.  */
+static struct hash_table *fingerprint_bands;
+
+/* Compute the simhash of the text of the HTML document in DATA, of
+   SIZE bytes: each word, with markup left out and case folded, votes
+   on every bit of the result according to its own hash.  Near
+   duplicates, such as the pages of a calendar that differ only in the
+   date, get fingerprints that differ in few bits.  Stores the number
+   of words in *WORDS.  */
+
+static uint64_t
+simhash (const char *data, long size, int *words)
+{
+  int votes[64];
+  const char *p = data, *end = data + size;
+  uint64_t result = 0;
+  int i;
+
+  memset (votes, 0, sizeof (votes));
+  *words = 0;
+  while (p < end)
+    {
+      uint64_t h = 14695981039346656037ULL;     /* FNV-1a */
+      const char *word = p;
+
+      if (*p == '<')
+        {
+          p = memchr (p, '>', end - p);
+          if (!p)
+            break;
+          ++p;
+          continue;
+        }
+      while (p < end && (c_isalnum (*p) || (unsigned char) *p >= 0x80))
+        {
+          h = (h ^ (unsigned char) c_tolower (*p)) * 1099511628211ULL;
+          ++p;
+        }
+      if (p == word)
+        {
+          ++p;
+          continue;
+        }
+      ++*words;
+      for (i = 0; i < 64; i++)
+        votes[i] += (h >> i) & 1 ? 1 : -1;
+    }
+
+  for (i = 0; i < 64; i++)
+    if (votes[i] > 0)
+      result |= (uint64_t) 1 << i;
+  return result;
+}
+
+/* Return the key of quarter BAND of HASH in fingerprint_bands.  */
+
+static void *
+band_key (uint64_t hash, int band)
+{
+  int value = (hash >> (band * BAND_BITS)) & ((1 << BAND_BITS) - 1);
+  return (void *) (intptr_t) (band << BAND_BITS | value);
+}
+
+static int
+bit_distance (uint64_t a, uint64_t b)
+{
+  uint64_t x = a ^ b;
+  int bits = 0;
+  for (; x; x &= x - 1)
+    ++bits;
+  return bits;
+}
+
+/* Return true if the HTML document FILE, retrieved from URL, is nearly
+   identical to one retrieved before, in which case its links are
+   probably those of the earlier page and need not be followed.
+   Otherwise remember the document's fingerprint.  */
+
+bool
+trap_similar_page_p (const char *file, const char *url)
+{
+  struct file_memory *fm = wget_read_file (file);
+  struct fingerprint *fp;
+  uint64_t hash;
+  int words, band, i;
+
+  if (!fm)
+    return false;
+  hash = simhash (fm->content, fm->length, &words);
+  wget_read_file_free (fm);
+  if (words < MIN_WORDS)
+    return false;
+
+  if (!fingerprint_bands)
+    fingerprint_bands = hash_table_new (0, NULL, NULL);
+
+  for (band = 0; band < BANDS; band++)
+    for (i = (intptr_t) hash_table_get (fingerprint_bands,
+                                        band_key (hash, band));
+         i;
+         i = fingerprints[i - 1].next[band])
+      if (bit_distance (hash, fingerprints[i - 1].hash) <= SIMILAR_BITS)
+        {
+          logprintf (LOG_VERBOSE,
+                     _("Not following the links of %s: it is nearly identical to %s.\n"),
+                     quote_n (0, url), quote_n (1, fingerprints[i - 1].url));
+          return true;
+        }
+
+  if (fingerprint_count == fingerprint_size)
+    {
+      fingerprint_size = fingerprint_size ? 2 * fingerprint_size : 64;
+      fingerprints = xrealloc (fingerprints,
+                               fingerprint_size * sizeof (*fingerprints));
+    }
+  fp = &fingerprints[fingerprint_count++];
+  fp->hash = hash;
+  fp->url = xstrdup (url);
+  for (band = 0; band < BANDS; band++)
+    {
+      void *key = band_key (hash, band);
+      fp->next[band] = (intptr_t) hash_table_get (fingerprint_bands, key);
+      hash_table_put (fingerprint_bands, key,
+                      (void *) (intptr_t) fingerprint_count);
+    }
+  return false;
+}
+
+void
+trap_cleanup (void)
+{
+  int i;
+
+  if (dir_counts)
+    string_set_free (dir_counts);
+  if (query_counts)
+    string_set_free (query_counts);
+  dir_counts = query_counts = NULL;
+  for (i = 0; i < fingerprint_count; i++)
+    xfree (fingerprints[i].url);
+  xfree_null (fingerprints);
+  fingerprints = NULL;
+  fingerprint_count = fingerprint_size = 0;
+  if (fingerprint_bands)
+    hash_table_destroy (fingerprint_bands);
+  fingerprint_bands = NULL;
+}
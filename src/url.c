@@ -39,6 +39,7 @@ as that of the covered work.  */
 #include <assert.h>
 
 #include "utils.h"
+#include "arena.h"
 #include "url.h"
 #include "host.h"  /* for is_valid_ipv6_address */
 
@@ -586,7 +587,7 @@ rewrite_shorthand_url (const char *url)
   return ret;
 }
 
-static void split_path (const char *, char **, char **);
+static void split_path (struct arena *, const char *, char **, char **);
 
 /* Like strpbrk, with the exception that it returns the pointer to the
    terminating zero (end-of-string aka "eos") if no matching character
@@ -655,6 +656,30 @@ static const char *parse_errors[] = {
   N_("Invalid IPv6 numeric address")
 };
 
+/* Copy the string in [BEG, END) for a URL allocated in ARENA, or on
+   the heap if ARENA is NULL.  */
+
+static char *
+url_strdupdelim (struct arena *arena, const char *beg, const char *end)
+{
+  return arena ? arena_strdupdelim (arena, beg, end) : strdupdelim (beg, end);
+}
+
+static char *
+url_strdup (struct arena *arena, const char *s)
+{
+  return url_strdupdelim (arena, s, s + strlen (s));
+}
+
+/* Return the malloc'ed string S as a string of a URL allocated in
+   ARENA.  */
+
+static char *
+url_keep (struct arena *arena, char *s)
+{
+  return arena ? arena_adopt (arena, s) : s;
+}
+
 /* Parse a URL.
 
    Return a new struct url if successful, NULL on error.  In case of
@@ -662,6 +687,16 @@ static const char *parse_errors[] = {
    error code. */
 struct url *
 url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
+{
+  return url_parse_arena (url, error, iri, percent_encode, NULL);
+}
+
+/* Like url_parse, but allocate the URL and its strings in ARENA, if
+   it is not NULL.  Such a URL goes away with the arena; it must not
+   be passed to url_free, url_set_dir or url_set_file.  */
+struct url *
+url_parse_arena (const char *url, int *error, struct iri *iri,
+                 bool percent_encode, struct arena *arena)
 {
   struct url *u;
   const char *p;
@@ -863,16 +898,16 @@ url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
         }
     }
 
-  u = xnew0 (struct url);
+  u = arena ? arena_alloc0 (arena, sizeof (struct url)) : xnew0 (struct url);
   u->scheme = scheme;
-  u->host   = strdupdelim (host_b, host_e);
+  u->host   = url_strdupdelim (arena, host_b, host_e);
   u->port   = port;
-  u->user   = user;
-  u->passwd = passwd;
+  u->user   = user ? url_keep (arena, user) : NULL;
+  u->passwd = passwd ? url_keep (arena, passwd) : NULL;
 
-  u->path = strdupdelim (path_b, path_e);
+  u->path = url_strdupdelim (arena, path_b, path_e);
   path_modified = path_simplify (scheme, u->path);
-  split_path (u->path, &u->dir, &u->file);
+  split_path (arena, u->path, &u->dir, &u->file);
 
   host_modified = lowercase_str (u->host);
 
@@ -891,26 +926,27 @@ url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
           char *new = idn_encode (iri, u->host);
           if (new)
             {
-              xfree (u->host);
-              u->host = new;
+              if (!arena)
+                xfree (u->host);
+              u->host = url_keep (arena, new);
               host_modified = true;
             }
         }
     }
 
   if (params_b)
-    u->params = strdupdelim (params_b, params_e);
+    u->params = url_strdupdelim (arena, params_b, params_e);
   if (query_b)
-    u->query = strdupdelim (query_b, query_e);
+    u->query = url_strdupdelim (arena, query_b, query_e);
   if (fragment_b)
-    u->fragment = strdupdelim (fragment_b, fragment_e);
+    u->fragment = url_strdupdelim (arena, fragment_b, fragment_e);
 
   if (opt.enable_iri || path_modified || u->fragment || host_modified || path_b == path_e)
     {
       /* If we suspect that a transformation has rendered what
          url_string might return different from URL_ENCODED, rebuild
          u->url using url_string.  */
-      u->url = url_string (u, URL_AUTH_SHOW);
+      u->url = url_keep (arena, url_string (u, URL_AUTH_SHOW));
 
       if (url_encoded != url)
         xfree ((char *) url_encoded);
@@ -918,9 +954,9 @@ url_parse (const char *url, int *error, struct iri *iri, bool percent_encode)
   else
     {
       if (url_encoded == url)
-        u->url = xstrdup (url);
+        u->url = url_strdup (arena, url);
       else
-        u->url = (char *) url_encoded;
+        u->url = url_keep (arena, (char *) url_encoded);
     }
 
   return u;
@@ -978,21 +1014,21 @@ url_error (const char *url, int error_code)
    "foo"                ""            "foo"
    "foo/bar/baz%2fqux"  "foo/bar"     "baz/qux" (!)
 
-   DIR and FILE are freshly allocated.  */
+   DIR and FILE are freshly allocated, in ARENA if it is not NULL.  */
 
 static void
-split_path (const char *path, char **dir, char **file)
+split_path (struct arena *arena, const char *path, char **dir, char **file)
 {
   char *last_slash = strrchr (path, '/');
   if (!last_slash)
     {
-      *dir = xstrdup ("");
-      *file = xstrdup (path);
+      *dir = url_strdup (arena, "");
+      *file = url_strdup (arena, path);
     }
   else
     {
-      *dir = strdupdelim (path, last_slash);
-      *file = xstrdup (last_slash + 1);
+      *dir = url_strdupdelim (arena, path, last_slash);
+      *file = url_strdup (arena, last_slash + 1);
     }
   url_unescape (*dir);
   url_unescape (*file);
@@ -1650,11 +1686,13 @@ url_file_name (const struct url *u, char *replaced_filename)
      2) Retrieval with regetting.
      3) Timestamping is used.
      4) Hierarchy is built.
+     5) Delta updates are used.
 
      The exception is the case when file does exist and is a
      directory (see `mkalldirs' for explanation).  */
 
-  if ((opt.noclobber || opt.always_rest || opt.timestamping || opt.dirstruct)
+  if ((opt.noclobber || opt.always_rest || opt.timestamping || opt.dirstruct
+       || opt.delta_update)
       && !(file_exists_p (fname) && !file_non_directory_p (fname)))
     {
       unique = fname;
@@ -2097,6 +2135,185 @@ url_string (const struct url *url, enum url_auth_mode auth_mode)
   return result;
 }
 
+/* Decode the %-escapes in S that stand for unreserved characters
+   (RFC 3986, section 2.3), and write the hex digits of the remaining
+   ones in upper case, as "%7e" and "%7E" name the same thing as "~".
+   S is modified in place.  */
+
+static void
+normalize_escapes (char *s)
+{
+  const char *p = s;
+  char *q = s;
+
+  while (*p)
+    if (p[0] == '%' && c_isxdigit (p[1]) && c_isxdigit (p[2]))
+      {
+        char c = X2DIGITS_TO_NUM (p[1], p[2]);
+        if (c_isalnum (c) || (c && strchr ("-._~", c)))
+          *q++ = c;
+        else
+          {
+            *q++ = '%';
+            *q++ = c_toupper (p[1]);
+            *q++ = c_toupper (p[2]);
+          }
+        p += 3;
+      }
+    else
+      *q++ = *p++;
+  *q = '\0';
+}
+
+/* Remove the index file name from the end of PATH, so that "dir/" and
+   "dir/index.html" compare equal.  */
+
+static void
+strip_index_file (char *path)
+{
+  static const char *index_names[] = { "index.html", "index.htm" };
+  char *file = strrchr (path, '/');
+  int i;
+
+  file = file ? file + 1 : path;
+  for (i = 0; i < countof (index_names); i++)
+    if (0 == strcmp (file, index_names[i]))
+      {
+        *file = '\0';
+        return;
+      }
+  if (opt.default_page && 0 == strcmp (file, opt.default_page))
+    *file = '\0';
+}
+
+/* Return true if the query parameter PARAM ("name=value") matches one
+   of the names given with --strip-params.  */
+
+static bool
+param_stripped_p (const char *param)
+{
+  const char *end = strchr (param, '=');
+  char *name;
+  char **pattern;
+
+  if (!opt.strip_params)
+    return false;
+  if (!end)
+    end = param + strlen (param);
+  BOUNDED_TO_ALLOCA (param, end, name);
+  for (pattern = opt.strip_params; *pattern; pattern++)
+    if (fnmatch_nocase (*pattern, name, 0) == 0)
+      return true;
+  return false;
+}
+
+static int
+param_cmp (const void *a, const void *b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Return the canonical form of QUERY: the parameters named by
+   --strip-params are removed, along with empty ones, and the rest are
+   sorted if --canonicalize=query was given.  Returns NULL if no
+   parameters are left.  */
+
+static char *
+canonicalize_query (const char *query)
+{
+  char *copy = xstrdup (query);
+  char **params = xnew_array (char *, strlen (query) + 1);
+  char *p = copy, *result = NULL;
+  int count = 0, i;
+
+  for (;;)
+    {
+      char *end = strchr (p, '&');
+      if (end)
+        *end = '\0';
+      if (*p && !param_stripped_p (p))
+        params[count++] = p;
+      if (!end)
+        break;
+      p = end + 1;
+    }
+
+  if (opt.canonicalize_query)
+    qsort (params, count, sizeof (char *), param_cmp);
+
+  if (count)
+    {
+      p = result = xmalloc (strlen (query) + 1);
+      for (i = 0; i < count; i++)
+        {
+          if (i)
+            *p++ = '&';
+          APPEND (p, params[i]);
+        }
+      *p = '\0';
+    }
+
+  xfree (params);
+  xfree (copy);
+  return result;
+}
+
+/* Apply the rules of --canonicalize and --strip-params to U, so that
+   links that differ only in the parts these rules remove end up with
+   the same URL.  Returns the canonical URL as a new string, or NULL if
+   the rules do not change U.  */
+
+char *
+url_canonicalize (const struct url *u)
+{
+  struct url canon;
+  char *path, *query = NULL, *result;
+
+  if (!opt.canonicalize_query && !opt.canonicalize_index
+      && !opt.canonicalize_case && !opt.canonicalize_escapes
+      && !opt.strip_params)
+    return NULL;
+
+  path = xstrdup (u->path);
+  if (opt.canonicalize_case)
+    {
+      char *p;
+      for (p = path; *p; p++)
+        *p = c_tolower (*p);
+    }
+  if (opt.canonicalize_escapes)
+    normalize_escapes (path);
+  if (opt.canonicalize_index)
+    strip_index_file (path);
+
+  if (u->query)
+    {
+      query = xstrdup (u->query);
+      if (opt.canonicalize_escapes)
+        normalize_escapes (query);
+      if (opt.canonicalize_query || opt.strip_params)
+        {
+          char *canon_query = canonicalize_query (query);
+          xfree (query);
+          query = canon_query;
+        }
+    }
+
+  canon = *u;
+  canon.path = path;
+  canon.query = query;
+  result = url_string (&canon, URL_AUTH_SHOW);
+  xfree (path);
+  xfree_null (query);
+
+  if (0 == strcmp (result, u->url))
+    {
+      xfree (result);
+      return NULL;
+    }
+  return result;
+}
+
 /* Return true if scheme a is similar to scheme b.
 
    Schemes are similar if they are equal.  If SSL is supported, schemes
@@ -2325,6 +2542,50 @@ test_are_urls_equal()
   return NULL;
 }
 
+const char *
+test_url_canonicalize (void)
+{
+  int i;
+  static char *strip[] = { "utm_*", "sid", NULL };
+  struct {
+    char *url;
+    char *expected_result;      /* NULL if the URL is left alone */
+  } test_array[] = {
+    { "http://www.adomain.com/apath/",                 NULL },
+    { "http://www.adomain.com/a?b=2&a=1",              "http://www.adomain.com/a?a=1&b=2" },
+    { "http://www.adomain.com/a?a=1&utm_source=x",     "http://www.adomain.com/a?a=1" },
+    { "http://www.adomain.com/a?SID=3&utm_medium=y",   "http://www.adomain.com/a" },
+    { "http://www.adomain.com/Dir/Index.HTML",         "http://www.adomain.com/dir/" },
+    { "http://www.adomain.com/%7euser/%2fx%2F",        "http://www.adomain.com/~user/%2Fx%2F" },
+    { "http://www.adomain.com/a?q=%41&&b",             "http://www.adomain.com/a?b&q=A" },
+  };
+  struct options saved = opt;
+
+  opt.canonicalize_query = opt.canonicalize_index = true;
+  opt.canonicalize_case = opt.canonicalize_escapes = true;
+  opt.strip_params = strip;
+  opt.default_page = NULL;
+
+  for (i = 0; i < countof (test_array); ++i)
+    {
+      struct url *u = url_parse (test_array[i].url, NULL, NULL, false);
+      char *result = url_canonicalize (u);
+      bool ok = (test_array[i].expected_result
+                 ? result && 0 == strcmp (result, test_array[i].expected_result)
+                 : !result);
+      xfree_null (result);
+      url_free (u);
+      if (!ok)
+        {
+          opt = saved;
+          return "test_url_canonicalize: wrong result";
+        }
+    }
+
+  opt = saved;
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
@@ -93,10 +93,14 @@ struct url
 
 /* Function declarations */
 
+struct arena;
+
 char *url_escape (const char *);
 char *url_escape_unsafe_and_reserved (const char *);
 
 struct url *url_parse (const char *, int *, struct iri *iri, bool percent_encode);
+struct url *url_parse_arena (const char *, int *, struct iri *, bool,
+                             struct arena *);
 char *url_error (const char *, int);
 char *url_full_path (const struct url *);
 void url_set_dir (struct url *, const char *);
@@ -110,6 +114,7 @@ int scheme_default_port (enum url_scheme);
 void scheme_disable (enum url_scheme);
 
 char *url_string (const struct url *, enum url_auth_mode);
+char *url_canonicalize (const struct url *);
 char *url_file_name (const struct url *, char *);
 
 char *uri_merge (const char *, const char *);
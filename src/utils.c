@@ -69,28 +69,14 @@ as that of the covered work.  */
 # include <termios.h>
 #endif
 
-/* Needed for Unix version of run_with_timeout. */
-#include <signal.h>
-#include <setjmp.h>
-
 #include <regex.h>
 #ifdef HAVE_LIBPCRE
 # include <pcre.h>
 #endif
 
-#ifndef HAVE_SIGSETJMP
-/* If sigsetjmp is a macro, configure won't pick it up. */
-# ifdef sigsetjmp
-#  define HAVE_SIGSETJMP
-# endif
-#endif
-
-#if defined HAVE_SIGSETJMP || defined HAVE_SIGBLOCK
-# define USE_SIGNAL_TIMEOUT
-#endif
-
 #include "utils.h"
 #include "hash.h"
+#include "ptimer.h"
 
 #ifdef __VMS
 #include "vms.h"
@@ -1188,6 +1174,54 @@ read_whole_line (FILE *fp)
   return line;
 }
 
+/* Files whose contents were kept in memory instead of being written
+   to disk, mapping file names to struct file_memory.  wget_read_file
+   reads them as though they had been written.  */
+static struct hash_table *memory_files;
+
+/* Register CONTENT, LENGTH bytes long, as the contents of FILE, which
+   is not written to disk.  CONTENT now belongs to the registry.  */
+
+void
+memory_file_store (const char *file, char *content, long length)
+{
+  struct file_memory *fm = xnew (struct file_memory);
+
+  fm->content = content;
+  fm->length = length;
+  fm->mmap_p = 0;
+  memory_file_forget (file);
+  if (!memory_files)
+    memory_files = make_string_hash_table (0);
+  hash_table_put (memory_files, xstrdup (file), fm);
+}
+
+/* Return true if FILE was registered with memory_file_store.  */
+
+bool
+memory_file_p (const char *file)
+{
+  return memory_files && hash_table_contains (memory_files, file);
+}
+
+/* Free the contents of FILE, registered with memory_file_store.  */
+
+void
+memory_file_forget (const char *file)
+{
+  char *key;
+  struct file_memory *fm;
+
+  if (memory_files
+      && hash_table_get_pair (memory_files, file, &key, &fm))
+    {
+      hash_table_remove (memory_files, file);
+      xfree (key);
+      xfree_null (fm->content);
+      xfree (fm);
+    }
+}
+
 /* Read FILE into memory.  A pointer to `struct file_memory' are
    returned; use struct element `content' to access file contents, and
    the element `length' to know the file length.  `content' is *not*
@@ -1202,7 +1236,9 @@ read_whole_line (FILE *fp)
    reads the file into the core using read().
 
    If file is named "-", fileno(stdin) is used for reading instead.
-   If you want to read from a real file named "-", use "./-" instead.  */
+   If you want to read from a real file named "-", use "./-" instead.
+
+   A file registered with memory_file_store is read from memory.  */
 
 struct file_memory *
 wget_read_file (const char *file)
@@ -1212,6 +1248,18 @@ wget_read_file (const char *file)
   long size;
   bool inhibit_close = false;
 
+  if (memory_file_p (file))
+    {
+      struct file_memory *kept = hash_table_get (memory_files, file);
+      fm = xnew (struct file_memory);
+      fm->content = xmalloc (kept->length + 1);
+      if (kept->length)
+        memcpy (fm->content, kept->content, kept->length);
+      fm->length = kept->length;
+      fm->mmap_p = 0;
+      return fm;
+    }
+
   /* Some magic in the finest tradition of Perl and its kin: if FILE
      is "-", just use stdin.  */
   if (HYPHENP (file))
@@ -1407,6 +1455,8 @@ vec_append (char **vec, const char *str)
 void
 string_set_add (struct hash_table *ht, const char *s)
 {
+  char *copy;
+
   /* First check whether the set element already exists.  If it does,
      do nothing so that we don't have to free() the old element and
      then strdup() a new one.  */
@@ -1417,7 +1467,9 @@ string_set_add (struct hash_table *ht, const char *s)
      value, and it consumes no memory -- the pointers to the same
      string "1" will be shared by all the key-value pairs in all `set'
      hash tables.  */
-  hash_table_put (ht, xstrdup (s), "1");
+  copy = xstrdup (s);
+  alloc_stats_retag (copy, hash_table_alloc_category (ht));
+  hash_table_put (ht, copy, "1");
 }
 
 /* Synonym for hash_table_contains... */
@@ -1831,7 +1883,11 @@ number_to_string (char *buffer, wgint number)
    number_to_static_string (num2)) work as expected.  Three buffers
    are currently used, which means that "%s %s %s" will work, but "%s
    %s %s %s" won't.  If you need to print more than three wgints,
-   bump the RING_SIZE (or rethink your message.)  */
+   bump the RING_SIZE (or rethink your message.)
+
+   The ring is shared by the whole program, so this is only meant for
+   messages.  Numbers that go into requests, headers or keys are
+   formatted with number_to_string into a buffer of the caller.  */
 
 char *
 number_to_static_string (wgint number)
@@ -1954,155 +2010,11 @@ random_float (void)
 #endif /* not HAVE_DRAND48 */
 }
 
-/* Implementation of run_with_timeout, a generic timeout-forcing
-   routine for systems with Unix-like signal handling.  */
-
-#ifdef USE_SIGNAL_TIMEOUT
-# ifdef HAVE_SIGSETJMP
-#  define SETJMP(env) sigsetjmp (env, 1)
-
-static sigjmp_buf run_with_timeout_env;
-
-static void
-abort_run_with_timeout (int sig)
-{
-  assert (sig == SIGALRM);
-  siglongjmp (run_with_timeout_env, -1);
-}
-# else /* not HAVE_SIGSETJMP */
-#  define SETJMP(env) setjmp (env)
-
-static jmp_buf run_with_timeout_env;
-
-static void
-abort_run_with_timeout (int sig)
-{
-  assert (sig == SIGALRM);
-  /* We don't have siglongjmp to preserve the set of blocked signals;
-     if we longjumped out of the handler at this point, SIGALRM would
-     remain blocked.  We must unblock it manually. */
-  sigset_t set;
-  sigemptyset (&set);
-  sigaddset (&set, SIGALRM);
-  sigprocmask (SIG_BLOCK, &set, NULL);
-
-  /* Now it's safe to longjump. */
-  longjmp (run_with_timeout_env, -1);
-}
-# endif /* not HAVE_SIGSETJMP */
-
-/* Arrange for SIGALRM to be delivered in TIMEOUT seconds.  This uses
-   setitimer where available, alarm otherwise.
-
-   TIMEOUT should be non-zero.  If the timeout value is so small that
-   it would be rounded to zero, it is rounded to the least legal value
-   instead (1us for setitimer, 1s for alarm).  That ensures that
-   SIGALRM will be delivered in all cases.  */
-
-static void
-alarm_set (double timeout)
-{
-#ifdef ITIMER_REAL
-  /* Use the modern itimer interface. */
-  struct itimerval itv;
-  xzero (itv);
-  itv.it_value.tv_sec = (long) timeout;
-  itv.it_value.tv_usec = 1000000 * (timeout - (long)timeout);
-  if (itv.it_value.tv_sec == 0 && itv.it_value.tv_usec == 0)
-    /* Ensure that we wait for at least the minimum interval.
-       Specifying zero would mean "wait forever".  */
-    itv.it_value.tv_usec = 1;
-  setitimer (ITIMER_REAL, &itv, NULL);
-#else  /* not ITIMER_REAL */
-  /* Use the old alarm() interface. */
-  int secs = (int) timeout;
-  if (secs == 0)
-    /* Round TIMEOUTs smaller than 1 to 1, not to zero.  This is
-       because alarm(0) means "never deliver the alarm", i.e. "wait
-       forever", which is not what someone who specifies a 0.5s
-       timeout would expect.  */
-    secs = 1;
-  alarm (secs);
-#endif /* not ITIMER_REAL */
-}
-
-/* Cancel the alarm set with alarm_set. */
-
-static void
-alarm_cancel (void)
-{
-#ifdef ITIMER_REAL
-  struct itimerval disable;
-  xzero (disable);
-  setitimer (ITIMER_REAL, &disable, NULL);
-#else  /* not ITIMER_REAL */
-  alarm (0);
-#endif /* not ITIMER_REAL */
-}
-
-/* Call FUN(ARG), but don't allow it to run for more than TIMEOUT
-   seconds.  Returns true if the function was interrupted with a
-   timeout, false otherwise.
-
-   This works by setting up SIGALRM to be delivered in TIMEOUT seconds
-   using setitimer() or alarm().  The timeout is enforced by
-   longjumping out of the SIGALRM handler.  This has several
-   advantages compared to the traditional approach of relying on
-   signals causing system calls to exit with EINTR:
-
-     * The callback function is *forcibly* interrupted after the
-       timeout expires, (almost) regardless of what it was doing and
-       whether it was in a syscall.  For example, a calculation that
-       takes a long time is interrupted as reliably as an IO
-       operation.
-
-     * It works with both SYSV and BSD signals because it doesn't
-       depend on the default setting of SA_RESTART.
-
-     * It doesn't require special handler setup beyond a simple call
-       to signal().  (It does use sigsetjmp/siglongjmp, but they're
-       optional.)
-
-   The only downside is that, if FUN allocates internal resources that
-   are normally freed prior to exit from the functions, they will be
-   lost in case of timeout.  */
-
-bool
-run_with_timeout (double timeout, void (*fun) (void *), void *arg)
-{
-  int saved_errno;
-
-  if (timeout == 0)
-    {
-      fun (arg);
-      return false;
-    }
-
-  signal (SIGALRM, abort_run_with_timeout);
-  if (SETJMP (run_with_timeout_env) != 0)
-    {
-      /* Longjumped out of FUN with a timeout. */
-      signal (SIGALRM, SIG_DFL);
-      return true;
-    }
-  alarm_set (timeout);
-  fun (arg);
-
-  /* Preserve errno in case alarm() or signal() modifies it. */
-  saved_errno = errno;
-  alarm_cancel ();
-  signal (SIGALRM, SIG_DFL);
-  errno = saved_errno;
-
-  return false;
-}
-
-#else  /* not USE_SIGNAL_TIMEOUT */
-
 #ifndef WINDOWS
-/* A stub version of run_with_timeout that just calls FUN(ARG).  Don't
-   define it under Windows, because Windows has its own version of
-   run_with_timeout that uses threads.  */
+/* A stub version of run_with_timeout that just calls FUN(ARG), used
+   for DNS lookups on systems without fork, where the lookup cannot be
+   abandoned.  Don't define it under Windows, because Windows has its
+   own version of run_with_timeout that uses threads.  */
 
 bool
 run_with_timeout (double timeout, void (*fun) (void *), void *arg)
@@ -2111,7 +2023,6 @@ run_with_timeout (double timeout, void (*fun) (void *), void *arg)
   return false;
 }
 #endif /* not WINDOWS */
-#endif /* not USE_SIGNAL_TIMEOUT */
 
 #ifndef WINDOWS
 
@@ -2548,6 +2459,73 @@ get_max_length (const char *path, int length, int name)
   return ret;
 }
 
+/* The time spent initializing each subsystem, reported by
+   --startup-stats.  Subsystems initialized on first use rather than
+   at startup are marked as such.  */
+
+static struct {
+  const char *what;
+  double secs;
+  bool on_demand;
+} startup_stats[32];
+static int startup_stats_count;
+static struct ptimer *startup_timer;
+
+/* Return the time in seconds elapsed since the first call.  This is
+   meant to be passed as START to startup_stats_add.  */
+
+double
+startup_stats_clock (void)
+{
+  if (!startup_timer)
+    startup_timer = ptimer_new ();
+  return ptimer_measure (startup_timer);
+}
+
+/* Record that WHAT was initialized since START, a value previously
+   returned by startup_stats_clock.  */
+
+void
+startup_stats_add (const char *what, double start, bool on_demand)
+{
+  if (startup_stats_count == countof (startup_stats))
+    return;
+  startup_stats[startup_stats_count].what = what;
+  startup_stats[startup_stats_count].secs = startup_stats_clock () - start;
+  startup_stats[startup_stats_count].on_demand = on_demand;
+  ++startup_stats_count;
+}
+
+/* Print the recorded initialization times.  */
+
+void
+startup_stats_print (void)
+{
+  double total = 0;
+  int i, pass;
+
+  for (i = 0; i < startup_stats_count; i++)
+    if (!startup_stats[i].on_demand)
+      total += startup_stats[i].secs;
+  logprintf (LOG_ALWAYS, _("Startup took %.3f ms:\n"), total * 1000);
+  for (pass = 0; pass < 2; pass++)
+    {
+      bool header = false;
+      for (i = 0; i < startup_stats_count; i++)
+        {
+          if (startup_stats[i].on_demand != pass)
+            continue;
+          if (pass && !header)
+            {
+              logputs (LOG_ALWAYS, _("Initialized on first use:\n"));
+              header = true;
+            }
+          logprintf (LOG_ALWAYS, "  %-28s %9.3f ms\n",
+                     startup_stats[i].what, startup_stats[i].secs * 1000);
+        }
+    }
+}
+
 #ifdef TESTING
 
 const char *
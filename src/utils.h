@@ -47,7 +47,10 @@ as that of the covered work.  */
 
 #define alloca_array(type, size) ((type *) alloca ((size) * sizeof (type)))
 
-#define xfree free
+/* alloc-stats.h has its own xfree, which keeps the accounting.  */
+#ifndef ENABLE_ALLOC_STATS
+# define xfree free
+#endif
 /* Free P if it is non-NULL.  C requires free() to behaves this way by
    default, but Wget's code is historically careful not to pass NULL
    to free.  This allows us to assert p!=NULL in xfree to check
@@ -99,6 +102,9 @@ bool has_wildcards_p (const char *);
 bool has_html_suffix_p (const char *);
 
 char *read_whole_line (FILE *);
+void memory_file_store (const char *, char *, long);
+bool memory_file_p (const char *);
+void memory_file_forget (const char *);
 struct file_memory *wget_read_file (const char *);
 void wget_read_file_free (struct file_memory *);
 
@@ -157,6 +163,10 @@ const char *print_decimal (double);
 
 size_t get_max_length (const char *path, int length, int name);
 
+double startup_stats_clock (void);
+void startup_stats_add (const char *, double, bool);
+void startup_stats_print (void);
+
 extern unsigned char char_prop[];
 
 #endif /* UTILS_H */
@@ -394,8 +394,9 @@ warc_write_date_header (const char *timestamp)
 static bool
 warc_write_ip_header (ip_address *ip)
 {
+  char buf[ADDRESS_STRING_SIZE];
   if (ip != NULL)
-    return warc_write_header ("WARC-IP-Address", print_address (ip));
+    return warc_write_header ("WARC-IP-Address", address_to_string (buf, ip));
   else
     return warc_write_ok;
 }
@@ -965,6 +966,10 @@ _("CDX file does not list record ids. (Missing column 'u'.)\n"));
     }
   else
     {
+      /* The records are accounted as "CDX" by --enable-alloc-stats
+         builds.  */
+      const char *scope = alloc_stats_enter ("CDX");
+
       /* Initialize the table. */
       warc_cdx_dedup_table = hash_table_new (1000, warc_hash_sha1_digest,
                                              warc_cmp_sha1_digest);
@@ -980,6 +985,7 @@ _("CDX file does not list record ids. (Missing column 'u'.)\n"));
 
         }
       while (line_length != -1);
+      alloc_stats_leave (scope);
 
       /* Print results. */
       int nrecords = hash_table_count (warc_cdx_dedup_table);
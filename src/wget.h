@@ -215,6 +215,7 @@ typedef double SUM_SIZE_INT;
 /* Everything uses this, so include them here directly.  */
 #include <alloca.h>
 #include "xalloc.h"
+#include "alloc-stats.h"
 
 /* Likewise for logging functions.  */
 #include "log.h"
@@ -326,7 +327,9 @@ enum
   SEND_NOCACHE         = 0x0008,	/* send Pragma: no-cache directive */
   ACCEPTRANGES         = 0x0010,	/* Accept-ranges header was found */
   ADDED_HTML_EXTENSION = 0x0020,        /* added ".html" extension due to -E */
-  TEXTCSS              = 0x0040	        /* document is of type text/css */
+  TEXTCSS              = 0x0040,	        /* document is of type text/css */
+  HEADERS_ONLY         = 0x0080	        /* send GET, but read only the
+                                           headers of the response */
 };
 
 /* Universal error type -- used almost everywhere.  Error reporting of
@@ -355,7 +358,9 @@ typedef enum
   AUTHFAILED, QUOTEXC, WRITEFAILED, SSLINITFAILED, VERIFCERTERR,
   UNLINKERR, NEWLOCATION_KEEP_POST, CLOSEFAILED,
 
-  WARC_ERR, WARC_TMP_FOPENERR, WARC_TMP_FWRITEERR
+  WARC_ERR, WARC_TMP_FOPENERR, WARC_TMP_FWRITEERR,
+
+  CHECKSUMERR
 } uerr_t;
 
 /* 2005-02-19 SMS.
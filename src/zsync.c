@@ -0,0 +1,833 @@
+/* Delta updates of local files using zsync manifests.
+   Copyright (C) 2012 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* A zsync manifest (a ".zsync" file published next to the file it
+   describes) lists, for each fixed-size block of the file, a weak
+   rolling checksum and a truncated MD4 digest.  Given an older copy
+   of the file, the rolling checksum allows finding blocks that are
+   still present in it at any offset, so that only the remaining ones
+   need to be transferred, using HTTP range requests.  The result is
+   assembled in a temporary file, verified against the SHA-1 digest
+   of the whole file, and renamed over the old copy.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "sha1.h"
+#include "utils.h"
+#include "url.h"
+#include "http.h"
+#include "zsync.h"
+
+#ifndef MIN
+# define MIN(x, y) ((x) > (y) ? (y) : (x))
+#endif
+
+/* The manifest is looked for at the URL of the file with this suffix
+   appended, as is customary.  */
+#define MANIFEST_SFX ".zsync"
+
+/* Temporary files are created next to the local file, so that the
+   result can be renamed into place.  */
+#define MANIFEST_TMP_SFX ".wget-zsync"
+#define ASSEMBLY_TMP_SFX ".wget-delta"
+#define RANGES_TMP_SFX ".wget-delta-ranges"
+
+/* Maximum number of byte ranges requested at once.  Many servers
+   limit the length of request headers or the number of ranges they
+   are willing to serve in one response.  */
+#define MAX_RANGES_PER_REQUEST 20
+
+/* Marks in the block source table: block still needs to be fetched,
+   or block has been fetched.  Other values are offsets into the old
+   file where the block was found.  */
+#define BLOCK_MISSING -1
+#define BLOCK_FETCHED -2
+
+struct manifest {
+  int blocksize;
+  wgint length;                 /* length of the remote file */
+  time_t mtime;                 /* its modification time, or -1 */
+  int seq_matches;              /* consecutive blocks that must match */
+  int rsum_bytes;               /* stored bytes of the rolling sum */
+  int checksum_bytes;           /* stored bytes of the MD4 digest */
+  unsigned char sha1[SHA1_DIGEST_SIZE];
+  int nblocks;
+  const unsigned char *sums;    /* per block: rsum_bytes of rolling sum,
+                                   then checksum_bytes of MD4 */
+};
+
+/* Return the value of the hex digit C.  */
+#define XDIGIT_VALUE(c) (c_isdigit (c) ? (c) - '0' : c_tolower (c) - 'a' + 10)
+
+/* Parse the manifest in FM into MF.  The block checksums are not
+   copied, so FM must outlive MF.  */
+
+static bool
+manifest_parse (const struct file_memory *fm, struct manifest *mf)
+{
+  const char *p = fm->content;
+  const char *end = fm->content + fm->length;
+  bool have_version = false, have_sha1 = false, have_hash_lengths = false;
+
+  xzero (*mf);
+  mf->length = -1;
+  mf->mtime = -1;
+
+  while (true)
+    {
+      const char *eol, *colon, *val, *vend;
+      char *value;
+
+      eol = memchr (p, '\n', end - p);
+      if (!eol)
+        return false;
+      if (eol == p)
+        {
+          /* An empty line terminates the header; binary block data
+             follows.  */
+          p = eol + 1;
+          break;
+        }
+      colon = memchr (p, ':', eol - p);
+      if (!colon)
+        return false;
+      for (val = colon + 1; val < eol && c_isspace (*val); val++)
+        ;
+      for (vend = eol; vend > val && c_isspace (vend[-1]); vend--)
+        ;
+      value = strdupdelim (val, vend);
+
+#define HEADER_IS(name) (colon - p == sizeof (name) - 1 \
+                         && !strncasecmp (p, name, sizeof (name) - 1))
+      if (HEADER_IS ("zsync"))
+        have_version = true;
+      else if (HEADER_IS ("Blocksize"))
+        mf->blocksize = atoi (value);
+      else if (HEADER_IS ("Length"))
+        mf->length = str_to_wgint (value, NULL, 10);
+      else if (HEADER_IS ("MTime"))
+        mf->mtime = http_atotm (value);
+      else if (HEADER_IS ("Hash-Lengths"))
+        have_hash_lengths = sscanf (value, "%d,%d,%d", &mf->seq_matches,
+                                    &mf->rsum_bytes,
+                                    &mf->checksum_bytes) == 3;
+      else if (HEADER_IS ("SHA-1") && strlen (value) == 2 * SHA1_DIGEST_SIZE)
+        {
+          int i;
+          have_sha1 = true;
+          for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+            {
+              if (!c_isxdigit (value[2 * i]) || !c_isxdigit (value[2 * i + 1]))
+                have_sha1 = false;
+              else
+                mf->sha1[i] = (XDIGIT_VALUE (value[2 * i]) << 4)
+                  | XDIGIT_VALUE (value[2 * i + 1]);
+            }
+        }
+#undef HEADER_IS
+      xfree (value);
+      p = eol + 1;
+    }
+
+  if (!have_version || !have_sha1 || !have_hash_lengths)
+    return false;
+  /* The block size is a power of two in all manifests we know of;
+     insisting on it protects against nonsense values.  */
+  if (mf->blocksize < 16 || (mf->blocksize & (mf->blocksize - 1)) != 0)
+    return false;
+  if (mf->length < 0
+      || (mf->length + mf->blocksize - 1) / mf->blocksize > INT_MAX / 2)
+    return false;
+  if (mf->seq_matches < 1 || mf->seq_matches > 2
+      || mf->rsum_bytes < 1 || mf->rsum_bytes > 4
+      || mf->checksum_bytes < 3 || mf->checksum_bytes > MD4_DIGEST_SIZE)
+    return false;
+
+  mf->nblocks = (mf->length + mf->blocksize - 1) / mf->blocksize;
+  if (end - p != (wgint) mf->nblocks * (mf->rsum_bytes + mf->checksum_bytes))
+    return false;
+  mf->sums = (const unsigned char *) p;
+  return true;
+}
+
+/* The rolling checksum used by zsync.  For a window of LEN bytes
+   x[0]..x[LEN-1], A is the sum of the bytes and B the sum of
+   (LEN - i) * x[i], both modulo 2^16.  */
+
+struct rsum {
+  unsigned short a, b;
+};
+
+static void
+rsum_init (struct rsum *r, const unsigned char *data, int len)
+{
+  unsigned short a = 0, b = 0;
+  for (; len > 0; len--)
+    {
+      unsigned char c = *data++;
+      a += c;
+      b += len * c;
+    }
+  r->a = a;
+  r->b = b;
+}
+
+/* Slide the window of R one byte forward, dropping OUT and adding IN.  */
+
+static inline void
+rsum_roll (struct rsum *r, unsigned char out, unsigned char in, int len)
+{
+  r->a += in - out;
+  r->b += r->a - len * out;
+}
+
+/* The rolling checksum as stored in the manifest: the last RSUM_BYTES
+   bytes of A and B in network byte order.  */
+
+static inline unsigned int
+rsum_key (const struct rsum *r, int rsum_bytes)
+{
+  unsigned int key = ((unsigned int) r->a << 16) | r->b;
+  if (rsum_bytes < 4)
+    key &= (1U << (8 * rsum_bytes)) - 1;
+  return key;
+}
+
+static unsigned int
+block_key (const struct manifest *mf, int block)
+{
+  const unsigned char *s = mf->sums
+    + (wgint) block * (mf->rsum_bytes + mf->checksum_bytes);
+  unsigned int key = 0;
+  int i;
+  for (i = 0; i < mf->rsum_bytes; i++)
+    key = (key << 8) | s[i];
+  return key;
+}
+
+static const unsigned char *
+block_checksum (const struct manifest *mf, int block)
+{
+  return mf->sums + (wgint) block * (mf->rsum_bytes + mf->checksum_bytes)
+    + mf->rsum_bytes;
+}
+
+static inline unsigned int
+key_bucket (unsigned int key, unsigned int mask)
+{
+  return ((key ^ (key >> 15)) * 2654435761U) & mask;
+}
+
+/* Return true if the BLOCKSIZE bytes at DATA have the MD4 digest
+   recorded for BLOCK.  */
+
+static bool
+checksum_matches (const struct manifest *mf, int block,
+                  const unsigned char *data)
+{
+  unsigned char digest[MD4_DIGEST_SIZE];
+  md4_buffer ((const char *) data, mf->blocksize, digest);
+  return !memcmp (digest, block_checksum (mf, block), mf->checksum_bytes);
+}
+
+/* Scan the old file OLD for blocks of the remote file described by
+   MF.  For each block found, SOURCE receives its offset in OLD; the
+   other entries are left as BLOCK_MISSING.  Returns the number of
+   blocks found.  */
+
+static int
+find_known_blocks (const struct manifest *mf, const struct file_memory *old,
+                   wgint *source)
+{
+  const unsigned char *data = (const unsigned char *) old->content;
+  wgint len = old->length;
+  int bs = mf->blocksize;
+  bool seq = mf->seq_matches > 1;
+  unsigned int *keys, mask, nbuckets;
+  int *heads, *next;
+  int i, found = 0;
+  struct rsum r, r_next = { 0, 0 };
+  wgint off;
+
+  if (len < bs || mf->nblocks == 0)
+    return 0;
+
+  /* Index the blocks by their rolling checksum.  */
+  for (nbuckets = 16; nbuckets < 2 * (unsigned int) mf->nblocks; nbuckets <<= 1)
+    ;
+  mask = nbuckets - 1;
+  heads = xnew_array (int, nbuckets);
+  for (i = 0; i < (int) nbuckets; i++)
+    heads[i] = -1;
+  next = xnew_array (int, mf->nblocks);
+  keys = xnew_array (unsigned int, mf->nblocks);
+  for (i = mf->nblocks - 1; i >= 0; i--)
+    {
+      unsigned int b = key_bucket (keys[i] = block_key (mf, i), mask);
+      next[i] = heads[b];
+      heads[b] = i;
+    }
+
+  off = 0;
+  rsum_init (&r, data, bs);
+  if (seq && len >= 2 * bs)
+    rsum_init (&r_next, data + bs, bs);
+
+  while (found < mf->nblocks)
+    {
+      unsigned int key = rsum_key (&r, mf->rsum_bytes);
+      bool have_next = seq && off + 2 * bs <= len;
+      bool matched = false;
+      int j;
+
+      for (j = heads[key_bucket (key, mask)]; j != -1; j = next[j])
+        {
+          if (keys[j] != key || source[j] != BLOCK_MISSING)
+            continue;
+          if (seq && j + 1 < mf->nblocks)
+            {
+              /* With seq_matches=2 the stored checksums are too short
+                 to be trusted alone; require the following block to
+                 match as well.  */
+              if (!have_next
+                  || keys[j + 1] != rsum_key (&r_next, mf->rsum_bytes)
+                  || !checksum_matches (mf, j, data + off)
+                  || !checksum_matches (mf, j + 1, data + off + bs))
+                continue;
+              source[j] = off;
+              ++found;
+              if (source[j + 1] == BLOCK_MISSING)
+                {
+                  source[j + 1] = off + bs;
+                  ++found;
+                }
+            }
+          else
+            {
+              if (!checksum_matches (mf, j, data + off))
+                continue;
+              source[j] = off;
+              ++found;
+            }
+          matched = true;
+        }
+
+      if (matched)
+        {
+          /* Skip past the matched data, as it is unlikely to contain
+             other blocks.  */
+          off += bs;
+          if (off + bs > len)
+            break;
+          rsum_init (&r, data + off, bs);
+          if (seq && off + 2 * bs <= len)
+            rsum_init (&r_next, data + off + bs, bs);
+          continue;
+        }
+
+      if (off + bs >= len)
+        break;
+      rsum_roll (&r, data[off], data[off + bs], bs);
+      if (have_next && off + 2 * bs < len)
+        rsum_roll (&r_next, data[off + bs], data[off + 2 * bs], bs);
+      ++off;
+    }
+
+  xfree (heads);
+  xfree (next);
+  xfree (keys);
+  return found;
+}
+
+/* Return the number of bytes of BLOCK, which may be less than the
+   block size for the last block.  */
+
+static wgint
+block_length (const struct manifest *mf, int block)
+{
+  wgint start = (wgint) block * mf->blocksize;
+  return MIN (mf->blocksize, mf->length - start);
+}
+
+/* Write SIZE bytes at DATA to OUT at offset POS.  */
+
+static bool
+write_at (FILE *out, wgint pos, const char *data, wgint size)
+{
+  if (fseeko (out, pos, SEEK_SET) != 0)
+    return false;
+  return fwrite (data, 1, size, out) == (size_t) size;
+}
+
+/* Store the range FIRST-LAST of the remote file, whose contents are
+   at DATA, and mark the blocks it covers as fetched.  */
+
+static bool
+store_range (const struct manifest *mf, FILE *out, wgint *source,
+             wgint first, wgint last, const char *data)
+{
+  int i;
+
+  if (first < 0 || last < first || last >= mf->length)
+    return false;
+  if (!write_at (out, first, data, last - first + 1))
+    return false;
+  for (i = first / mf->blocksize; i < mf->nblocks; i++)
+    {
+      wgint start = (wgint) i * mf->blocksize;
+      if (start > last)
+        break;
+      if (start >= first && start + block_length (mf, i) - 1 <= last)
+        source[i] = BLOCK_FETCHED;
+    }
+  return true;
+}
+
+/* Find the delimiter "--BOUNDARY" in [P, END).  Returns a pointer to
+   the first character after it, or NULL.  */
+
+static const char *
+find_delimiter (const char *p, const char *end, const char *boundary)
+{
+  size_t blen = strlen (boundary);
+  for (; end - p >= (ptrdiff_t) (blen + 2); p++)
+    {
+      p = memchr (p, '-', end - p - blen - 1);
+      if (!p)
+        return NULL;
+      if (p[1] == '-' && !memcmp (p + 2, boundary, blen))
+        return p + 2 + blen;
+    }
+  return NULL;
+}
+
+/* Split a multipart/byteranges body of SIZE bytes at DATA, delimited
+   by BOUNDARY, and store each part.  */
+
+static bool
+store_multipart (const struct manifest *mf, FILE *out, wgint *source,
+                 const char *data, wgint size, const char *boundary)
+{
+  const char *p = data, *end = data + size;
+  int parts = 0;
+
+  while ((p = find_delimiter (p, end, boundary)) != NULL)
+    {
+      wgint first = -1, last = -1, total;
+
+      if (end - p >= 2 && p[0] == '-' && p[1] == '-')
+        /* Closing delimiter.  */
+        return parts > 0;
+
+      /* Skip the rest of the delimiter line, then read the part's
+         headers up to the empty line.  */
+      p = memchr (p, '\n', end - p);
+      if (!p)
+        return false;
+      ++p;
+      while (true)
+        {
+          const char *eol = memchr (p, '\n', end - p);
+          const char *line_end;
+          if (!eol)
+            return false;
+          line_end = eol;
+          if (line_end > p && line_end[-1] == '\r')
+            --line_end;
+          if (line_end == p)
+            {
+              p = eol + 1;
+              break;
+            }
+          if (line_end - p > 14 && !strncasecmp (p, "Content-Range:", 14))
+            {
+              char *hdr;
+              const char *b = p + 14;
+              while (b < line_end && c_isspace (*b))
+                ++b;
+              hdr = strdupdelim (b, line_end);
+              if (!parse_content_range (hdr, &first, &last, &total))
+                first = -1;
+              xfree (hdr);
+              if (first >= 0 && total != -1 && total != mf->length)
+                {
+                  logputs (LOG_VERBOSE, _("\
+The remote file does not match its zsync manifest.\n"));
+                  return false;
+                }
+            }
+          p = eol + 1;
+        }
+
+      if (first < 0 || last - first + 1 > end - p
+          || !store_range (mf, out, source, first, last, p))
+        return false;
+      p += last - first + 1;
+      ++parts;
+    }
+  return false;
+}
+
+/* Return the boundary parameter of the multipart/byteranges
+   CONTENT_TYPE, or NULL if it is not such a content type.  */
+
+static char *
+byteranges_boundary (const char *content_type)
+{
+  param_token name, value;
+  const char *p = content_type;
+
+  if (strncasecmp (content_type, "multipart/byteranges", 20) != 0)
+    return NULL;
+  p = strchr (content_type, ';');
+  if (!p)
+    return NULL;
+  ++p;
+  while (extract_param (&p, &name, &value, ';'))
+    if (name.e - name.b == 8 && !strncasecmp (name.b, "boundary", 8)
+        && value.b)
+      return strdupdelim (value.b, value.e);
+  return NULL;
+}
+
+/* Fetch the COUNT ranges FIRST[i]-LAST[i] of the remote file at U,
+   storing the result to OUT.  If the server ignores the Range header
+   and sends the whole file, it is left in RANGES_FILE and *WHOLE is
+   set to true.  */
+
+static bool
+fetch_ranges (const struct manifest *mf, struct url *u, struct url *proxy,
+              const wgint *first, const wgint *last, int count,
+              FILE *out, wgint *source, const char *ranges_file,
+              bool *whole, wgint *downloaded)
+{
+  char *range, *p;
+  char *content_type, *content_range;
+  struct file_memory *fm;
+  wgint received, range_first, range_last, total;
+  bool ok = false;
+  uerr_t err;
+  int i;
+
+  /* "bytes=" followed by at most COUNT pairs of numbers.  */
+  range = p = xmalloc (7 + count * (2 * (sizeof (wgint) * 3 + 1) + 2));
+  p += sprintf (p, "bytes=");
+  for (i = 0; i < count; i++)
+    {
+      if (i)
+        *p++ = ',';
+      p = number_to_string (p, first[i]);
+      *p++ = '-';
+      p = number_to_string (p, last[i]);
+    }
+
+  err = http_fetch (u, proxy, range, ranges_file, NULL, &content_type,
+                    &content_range, &received);
+  xfree (range);
+  *downloaded += received;
+  if (err != RETROK)
+    goto out;
+
+  if (!content_range && !(content_type && strncasecmp (content_type,
+                                                       "multipart/", 10) == 0))
+    {
+      /* The server ignored the Range header and sent the whole
+         file; it can serve as the result as well as anything.  */
+      *whole = true;
+      ok = true;
+      goto out;
+    }
+
+  fm = wget_read_file (ranges_file);
+  if (!fm)
+    goto out;
+  if (content_range)
+    {
+      if (parse_content_range (content_range, &range_first, &range_last, &total)
+          && (total == -1 || total == mf->length)
+          && range_last - range_first + 1 == fm->length)
+        ok = store_range (mf, out, source, range_first, range_last,
+                          fm->content);
+      else
+        logputs (LOG_VERBOSE, _("\
+The remote file does not match its zsync manifest.\n"));
+    }
+  else
+    {
+      char *boundary = byteranges_boundary (content_type);
+      if (boundary)
+        {
+          ok = store_multipart (mf, out, source, fm->content, fm->length,
+                                boundary);
+          xfree (boundary);
+        }
+    }
+  wget_read_file_free (fm);
+
+ out:
+  xfree_null (content_type);
+  xfree_null (content_range);
+  if (!*whole)
+    unlink (ranges_file);
+  return ok;
+}
+
+/* Return true if the SHA-1 digest of FILE is the one recorded in
+   MF.  */
+
+static bool
+verify_file (const struct manifest *mf, const char *file)
+{
+  unsigned char digest[SHA1_DIGEST_SIZE];
+  FILE *fp = fopen (file, "rb");
+  bool ok;
+
+  if (!fp)
+    return false;
+  ok = sha1_stream (fp, digest) == 0
+    && !memcmp (digest, mf->sha1, SHA1_DIGEST_SIZE);
+  fclose (fp);
+  return ok;
+}
+
+/* Try to bring LOCAL_FILE up to date with the remote file at U by
+   transferring only the parts that differ, as described by the zsync
+   manifest published along with it.  PROXY is the proxy to use, if
+   any.  The number of bytes transferred is stored to DOWNLOADED.
+
+   Returns RETROK if LOCAL_FILE is now identical to the remote file.
+   Any other value means LOCAL_FILE has been left untouched and the
+   caller should retrieve the file as usual.  */
+
+uerr_t
+zsync_retrieve (struct url *u, struct url *proxy, const char *local_file,
+                wgint *downloaded)
+{
+  char *manifest_url, *p;
+  char *manifest_file, *assembly_file, *ranges_file;
+  char *content_type, *content_range;
+  struct url *mu;
+  struct file_memory *mfm = NULL, *old = NULL;
+  struct manifest mf;
+  wgint *source = NULL;
+  wgint *first = NULL, *last = NULL;
+  wgint reused = 0, received;
+  FILE *out = NULL;
+  bool whole = false;
+  uerr_t ret = RETRFINISHED;
+  int found, nranges, i;
+  int url_err;
+
+  *downloaded = 0;
+
+  /* The manifest lives at the URL of the file with MANIFEST_SFX
+     appended to the path.  */
+  p = u->url + strcspn (u->url, "?#");
+  manifest_url = xmalloc (strlen (u->url) + sizeof (MANIFEST_SFX));
+  memcpy (manifest_url, u->url, p - u->url);
+  strcpy (manifest_url + (p - u->url), MANIFEST_SFX);
+  strcat (manifest_url, p);
+  mu = url_parse (manifest_url, &url_err, NULL, false);
+  xfree (manifest_url);
+  if (!mu)
+    return URLERROR;
+
+  manifest_file = concat_strings (local_file, MANIFEST_TMP_SFX, (char *) 0);
+  assembly_file = concat_strings (local_file, ASSEMBLY_TMP_SFX, (char *) 0);
+  ranges_file = concat_strings (local_file, RANGES_TMP_SFX, (char *) 0);
+
+  logprintf (LOG_VERBOSE, _("Looking for a zsync manifest at %s.\n"), mu->url);
+  ret = http_fetch (mu, proxy, NULL, manifest_file, NULL, &content_type,
+                    &content_range, &received);
+  url_free (mu);
+  xfree_null (content_type);
+  xfree_null (content_range);
+  *downloaded += received;
+  if (ret != RETROK)
+    goto out;
+  ret = RETRFINISHED;
+
+  mfm = wget_read_file (manifest_file);
+  if (!mfm || !manifest_parse (mfm, &mf))
+    {
+      logputs (LOG_VERBOSE, _("Invalid or unsupported zsync manifest.\n"));
+      goto out;
+    }
+
+  old = wget_read_file (local_file);
+  if (!old)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", local_file, strerror (errno));
+      goto out;
+    }
+
+  if (old->length == mf.length)
+    {
+      unsigned char digest[SHA1_DIGEST_SIZE];
+      sha1_buffer (old->content, old->length, digest);
+      if (!memcmp (digest, mf.sha1, SHA1_DIGEST_SIZE))
+        {
+          logprintf (LOG_VERBOSE, _("Local file %s is up to date.\n\n"),
+                     quote (local_file));
+          ret = RETROK;
+          goto out;
+        }
+    }
+
+  source = xnew_array (wgint, mf.nblocks ? mf.nblocks : 1);
+  for (i = 0; i < mf.nblocks; i++)
+    source[i] = BLOCK_MISSING;
+  found = find_known_blocks (&mf, old, source);
+
+  out = fopen (assembly_file, "wb");
+  if (!out)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", assembly_file, strerror (errno));
+      goto out;
+    }
+
+  /* Copy the blocks we already have, coalescing runs of blocks that
+     are consecutive in the old file as well.  Collect the runs of
+     missing blocks as ranges to fetch.  */
+  first = xnew_array (wgint, mf.nblocks ? mf.nblocks : 1);
+  last = xnew_array (wgint, mf.nblocks ? mf.nblocks : 1);
+  nranges = 0;
+  for (i = 0; i < mf.nblocks; )
+    {
+      int j = i + 1;
+      if (source[i] == BLOCK_MISSING)
+        {
+          while (j < mf.nblocks && source[j] == BLOCK_MISSING)
+            ++j;
+          first[nranges] = (wgint) i * mf.blocksize;
+          last[nranges] = (wgint) (j - 1) * mf.blocksize
+            + block_length (&mf, j - 1) - 1;
+          ++nranges;
+        }
+      else
+        {
+          wgint size;
+          while (j < mf.nblocks
+                 && source[j] == source[i] + (wgint) (j - i) * mf.blocksize)
+            ++j;
+          size = (wgint) (j - 1 - i) * mf.blocksize + block_length (&mf, j - 1);
+          if (!write_at (out, (wgint) i * mf.blocksize, old->content + source[i],
+                         size))
+            {
+              logprintf (LOG_NOTQUIET, "%s: %s\n", assembly_file,
+                         strerror (errno));
+              goto out;
+            }
+          reused += size;
+        }
+      i = j;
+    }
+  wget_read_file_free (old);
+  old = NULL;
+
+  logprintf (LOG_VERBOSE, _("Reusing %d of %d blocks (%s bytes) from %s.\n"),
+             found, mf.nblocks, number_to_static_string (reused),
+             quote (local_file));
+
+  for (i = 0; i < nranges && !whole; i += MAX_RANGES_PER_REQUEST)
+    if (!fetch_ranges (&mf, u, proxy, first + i, last + i,
+                       MIN (nranges - i, MAX_RANGES_PER_REQUEST),
+                       out, source, ranges_file, &whole, downloaded))
+      goto out;
+
+  if (fclose (out) != 0)
+    {
+      out = NULL;
+      logprintf (LOG_NOTQUIET, "%s: %s\n", assembly_file, strerror (errno));
+      goto out;
+    }
+  out = NULL;
+
+  if (whole)
+    {
+      /* The server sent the whole file instead; use that.  */
+      if (rename (ranges_file, assembly_file) != 0)
+        {
+          unlink (ranges_file);
+          goto out;
+        }
+    }
+  else
+    for (i = 0; i < mf.nblocks; i++)
+      if (source[i] == BLOCK_MISSING)
+        {
+          logputs (LOG_VERBOSE, _("Not all missing blocks were received.\n"));
+          goto out;
+        }
+
+  if (!verify_file (&mf, assembly_file))
+    {
+      logprintf (LOG_NOTQUIET, _("\
+Checksum mismatch in the file assembled from %s.\n"), quote (local_file));
+      goto out;
+    }
+  if (rename (assembly_file, local_file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot rename %s to %s: %s\n"),
+                 quote_n (0, assembly_file), quote_n (1, local_file),
+                 strerror (errno));
+      goto out;
+    }
+  if (opt.useservertimestamps && mf.mtime != (time_t) -1)
+    touch (local_file, mf.mtime);
+
+  logprintf (LOG_VERBOSE, _("%s updated, %s bytes transferred.\n\n"),
+             quote (local_file), number_to_static_string (*downloaded));
+  ret = RETROK;
+
+ out:
+  if (out)
+    fclose (out);
+  if (ret != RETROK)
+    unlink (assembly_file);
+  if (mfm)
+    wget_read_file_free (mfm);
+  if (old)
+    wget_read_file_free (old);
+  unlink (manifest_file);
+  xfree_null (source);
+  xfree_null (first);
+  xfree_null (last);
+  xfree (manifest_file);
+  xfree (assembly_file);
+  xfree (ranges_file);
+  return ret;
+}
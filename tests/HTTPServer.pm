@@ -68,6 +68,9 @@ sub send_response {
     if (exists $url_rec->{'auth_method'}) {
         ($send_content, $code, $msg, $headers) =
             $self->handle_auth($req, $url_rec);
+    } elsif ($url_rec->{'no_head'} && $req->method eq "HEAD") {
+        ($send_content, $code, $msg, $headers) =
+            ('', 405, 'Method Not Allowed', {});
     } elsif (!$self->verify_request_headers ($req, $url_rec)) {
         ($send_content, $code, $msg, $headers) =
             ('', 400, 'Mismatch on expected headers', {});
@@ -95,12 +98,13 @@ sub send_response {
             print $con $content;
             next;
         }
-        if ($req->header("Range") && !$url_rec->{'force_code'}) {
+        if ($req->header("Range") && !$url_rec->{'force_code'}
+            && $self->_if_range_matches ($req, $url_rec)) {
             $req->header("Range") =~ m/bytes=(\d*)-(\d*)/;
             my $content_len = length($content);
             my $start = $1 ? $1 : 0;
             my $end = $2 ? $2 : ($content_len - 1);
-            my $len = $2 ? ($2 - $start) : ($content_len - $start);
+            my $len = $2 ? ($2 - $start + 1) : ($content_len - $start);
             if ($len > 0) {
                 $resp->header("Accept-Ranges" => "bytes");
                 $resp->header("Content-Length" => $len);
@@ -230,6 +234,22 @@ sub verify_request_headers {
     return 1;
 }
 
+# A Range request carrying If-Range is only honored if the validator
+# matches the current ETag or Last-Modified of the resource; otherwise
+# the whole resource is sent.
+sub _if_range_matches {
+    my ($self, $req, $url_rec) = @_;
+
+    my $validator = $req->header ("If-Range");
+    return 1 unless defined $validator;
+    for my $hdrname ("ETag", "Last-Modified") {
+        my $value = $url_rec->{headers}{$hdrname};
+        return 1 if defined $value && $value eq $validator;
+    }
+
+    return undef;
+}
+
 sub _substitute_port {
     my $self = shift;
     my $ret = shift;